@@ -1,27 +1,124 @@
 #include <stdio.h>
-#include "bbb_ain.h" 
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <endian.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "bbb_ain.h"
 
-#define AINPATH "/sys/bus/iio/devices/iio:device0/in_voltage%d_raw" 
+/* can be overridden at build time, e.g. to point at a fake tree for testing */
+#ifndef BBB_AIN_IIO_DIR
+#define BBB_AIN_IIO_DIR "/sys/bus/iio/devices/iio:device0"
+#endif
 
+#ifndef BBB_AIN_IIO_DEV
+#define BBB_AIN_IIO_DEV "/dev/iio:device0"
+#endif
+
+#define AINPATH BBB_AIN_IIO_DIR "/in_voltage%d_raw"
+
+// how long to wait for a buffered scan before giving up
+#define BUFFERED_TIMEOUT_MS 100
+#define DEFAULT_BUFFER_LENGTH 64
+
+// scans read at once when averaging from the buffer (each is at most 4 bytes per channel)
+#define CHUNK_SCANS 64
+
+/* sysfs descriptors, opened on first use */
+static int raw_fd[BBB_AIN_NUM] = { -1, -1, -1, -1, -1, -1, -1 };
+
+/* buffered capture state. lock serializes reads of the buffer, and starting and stopping it */
+static struct
+{
+  pthread_mutex_t lock;
+  int fd;
+  unsigned mask;
+  int scan_bytes;
+  struct
+  {
+    int offset;    // within a scan
+    int bytes;     // storage size
+    int shift;
+    int bits;      // real bits
+    int big_endian;
+  } chan[BBB_AIN_NUM];
+} buffered = { .lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1 };
+
+
+static int sysfs_write(const char * name, const char * val)
+{
+  char path[sizeof(BBB_AIN_IIO_DIR) + 64];
+  int fd, ok;
+  snprintf(path, sizeof(path), "%s/%s", BBB_AIN_IIO_DIR, name);
+  fd = open(path, O_WRONLY);
+  if (fd < 0) return -1;
+  ok = write(fd, val, strlen(val)) == (ssize_t) strlen(val);
+  close(fd);
+  return ok ? 0 : -1;
+}
+
+static int sysfs_read(const char * name, char * buf, int len)
+{
+  char path[sizeof(BBB_AIN_IIO_DIR) + 64];
+  int fd, n;
+  snprintf(path, sizeof(path), "%s/%s", BBB_AIN_IIO_DIR, name);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+  n = read(fd, buf, len - 1);
+  close(fd);
+  if (n < 0) return -1;
+  buf[n] = 0;
+  return n;
+}
+
+
+static int read_sysfs_raw(int ain)
+{
+  char buf[16];
+  ssize_t n;
+
+  int fd = __atomic_load_n(&raw_fd[ain], __ATOMIC_ACQUIRE);
+
+  if (fd < 0)
+  {
+    // several threads may race to open it; the first one in keeps its descriptor
+    char path[sizeof(AINPATH) + 16];
+    int expected = -1;
+    sprintf(path, AINPATH, ain);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    if (!__atomic_compare_exchange_n(&raw_fd[ain], &expected, fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      close(fd);
+      fd = expected;
+    }
+  }
+
+  // sysfs attributes regenerate their value on every read from offset 0. pread doesn't move a shared
+  // offset, so concurrent readers of the same descriptor don't disturb each other.
+  n = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (n <= 0) return -1;
+  buf[n] = 0;
+  return atoi(buf);
+}
 
 
 int bbb_ain_raw(int ain)
 {
-  int val; 
-  FILE * f; 
-  char buf[2*sizeof(AINPATH)]; 
-  if (ain < 0 || ain > 6) return -1; 
-  sprintf(buf, AINPATH, ain); 
-  f = fopen(buf,"r"); 
-  fscanf(f,"%d", &val); 
-  fclose(f); 
-  return val; 
+  int raw[BBB_AIN_NUM];
+  if (ain < 0 || ain >= BBB_AIN_NUM) return -1;
+  if (bbb_ain_raw_many(BBB_AIN_BIT(ain), 1, raw)) return -1;
+  return raw[ain];
 }
 
 
 float bbb_ain_V(int ain)
 {
-  int raw = bbb_ain_raw(ain);  
+  int raw = bbb_ain_raw(ain);
   if (raw < 0) return -1;
 
   /* Eric's conversion factors for BEACON */
@@ -30,3 +127,230 @@ float bbb_ain_V(int ain)
   /* float temp = (adc - 1.8583)/-0.01167; */
   /* return 1.5*temp; */
 }
+
+
+/* decodes one channel of one scan */
+static int decode_sample(const unsigned char * scan, int ain)
+{
+  const unsigned char * p = scan + buffered.chan[ain].offset;
+  uint32_t v;
+
+  switch (buffered.chan[ain].bytes)
+  {
+    case 1: v = p[0]; break;
+    case 2: { uint16_t x; memcpy(&x, p, 2); v = buffered.chan[ain].big_endian ? be16toh(x) : le16toh(x); break; }
+    default: { uint32_t x; memcpy(&x, p, 4); v = buffered.chan[ain].big_endian ? be32toh(x) : le32toh(x); break; }
+  }
+  v >>= buffered.chan[ain].shift;
+  if (buffered.chan[ain].bits < 32) v &= (1u << buffered.chan[ain].bits) - 1;
+  return v;
+}
+
+/* Sums navg fresh scans of the buffered channels into sum, a chunk of scans at a time. Returns 0 on success. */
+static int read_buffered(int navg, long * sum)
+{
+  unsigned char scans[CHUNK_SCANS * BBB_AIN_NUM * 4];
+  unsigned char junk[1024];
+  int i, ain;
+
+  // throw away whatever queued up since the last call, so the samples are current
+  while (read(buffered.fd, junk, sizeof(junk)) > 0);
+
+  while (navg > 0)
+  {
+    int nscans = navg < CHUNK_SCANS ? navg : CHUNK_SCANS;
+    int want = nscans * buffered.scan_bytes, have = 0;
+
+    while (have < want)
+    {
+      struct pollfd pfd = { .fd = buffered.fd, .events = POLLIN };
+      ssize_t n;
+
+      if (poll(&pfd, 1, BUFFERED_TIMEOUT_MS) <= 0) return -1;
+      n = read(buffered.fd, scans + have, want - have);
+      if (n < 0 && errno != EAGAIN && errno != EINTR) return -1;
+      if (n == 0) return -1;
+      if (n > 0) have += n;
+    }
+
+    for (i = 0; i < nscans; i++)
+    {
+      for (ain = 0; ain < BBB_AIN_NUM; ain++)
+      {
+        if (buffered.mask & BBB_AIN_BIT(ain))
+          sum[ain] += decode_sample(scans + i * buffered.scan_bytes, ain);
+      }
+    }
+    navg -= nscans;
+  }
+  return 0;
+}
+
+
+int bbb_ain_raw_many(unsigned mask, int navg, int * raw)
+{
+  long sum[BBB_AIN_NUM] = {0};
+  unsigned from_buffer;
+  int i, ain;
+
+  if (navg < 1) navg = 1;
+  if (mask >> BBB_AIN_NUM) return -1;
+
+  pthread_mutex_lock(&buffered.lock);
+  from_buffer = buffered.fd >= 0 ? mask & buffered.mask : 0;
+  if (from_buffer && read_buffered(navg, sum))
+  {
+    pthread_mutex_unlock(&buffered.lock);
+    return -1;
+  }
+  pthread_mutex_unlock(&buffered.lock);
+
+  for (ain = 0; ain < BBB_AIN_NUM; ain++)
+  {
+    if (!(mask & BBB_AIN_BIT(ain)) || (from_buffer & BBB_AIN_BIT(ain))) continue;
+    for (i = 0; i < navg; i++)
+    {
+      int val = read_sysfs_raw(ain);
+      if (val < 0) return -1;
+      sum[ain] += val;
+    }
+  }
+
+  for (ain = 0; ain < BBB_AIN_NUM; ain++)
+  {
+    if (mask & BBB_AIN_BIT(ain)) raw[ain] = (sum[ain] + navg / 2) / navg;
+  }
+  return 0;
+}
+
+
+int bbb_ain_V_many(unsigned mask, int navg, float * V)
+{
+  int raw[BBB_AIN_NUM];
+  int ain;
+  if (bbb_ain_raw_many(mask, navg, raw)) return -1;
+  for (ain = 0; ain < BBB_AIN_NUM; ain++)
+  {
+    if (mask & BBB_AIN_BIT(ain)) V[ain] = 1.8*((float) raw[ain])/4096.0;
+  }
+  return 0;
+}
+
+
+static void buffered_stop(void)
+{
+  if (buffered.fd < 0) return;
+  sysfs_write("buffer/enable", "0");
+  close(buffered.fd);
+  buffered.fd = -1;
+  buffered.mask = 0;
+}
+
+/* must hold buffered.lock */
+static int buffered_start(unsigned mask, int buffer_length)
+{
+  int index[BBB_AIN_NUM];
+  char name[64], val[64];
+  int ain, offset = 0, done = 0;
+
+  buffered_stop();
+  if (buffer_length <= 0) buffer_length = DEFAULT_BUFFER_LENGTH;
+
+  // the layout below is only the voltages, so the timestamp mustn't be in the scan (it might not exist at all)
+  sysfs_write("scan_elements/in_timestamp_en", "0");
+  if (sysfs_read("scan_elements/in_timestamp_en", val, sizeof(val)) > 0 && atoi(val)) goto fail;
+
+  for (ain = 0; ain < BBB_AIN_NUM; ain++)
+  {
+    char endian;
+    int bits, storage, shift;
+
+    sprintf(name, "scan_elements/in_voltage%d_en", ain);
+    if (sysfs_write(name, mask & BBB_AIN_BIT(ain) ? "1" : "0")) goto fail;
+    if (!(mask & BBB_AIN_BIT(ain))) continue;
+
+    // e.g. "le:u12/16>>0"
+    sprintf(name, "scan_elements/in_voltage%d_type", ain);
+    if (sysfs_read(name, val, sizeof(val)) < 0) goto fail;
+    if (sscanf(val, "%ce:%*c%d/%d>>%d", &endian, &bits, &storage, &shift) != 4) goto fail;
+    if (storage != 8 && storage != 16 && storage != 32) goto fail;
+    buffered.chan[ain].bytes = storage / 8;
+    buffered.chan[ain].bits = bits;
+    buffered.chan[ain].shift = shift;
+    buffered.chan[ain].big_endian = endian == 'b';
+
+    sprintf(name, "scan_elements/in_voltage%d_index", ain);
+    if (sysfs_read(name, val, sizeof(val)) < 0) goto fail;
+    index[ain] = atoi(val);
+  }
+
+  // the scan holds the enabled channels in order of index, each aligned to its own size
+  while (done != (int) mask)
+  {
+    int next = -1;
+    for (ain = 0; ain < BBB_AIN_NUM; ain++)
+    {
+      if ((mask & BBB_AIN_BIT(ain)) && !(done & BBB_AIN_BIT(ain)) && (next < 0 || index[ain] < index[next])) next = ain;
+    }
+    offset = (offset + buffered.chan[next].bytes - 1) / buffered.chan[next].bytes * buffered.chan[next].bytes;
+    buffered.chan[next].offset = offset;
+    offset += buffered.chan[next].bytes;
+    done |= BBB_AIN_BIT(next);
+  }
+  buffered.scan_bytes = offset;
+
+  sprintf(val, "%d", buffer_length);
+  if (sysfs_write("buffer/length", val)) goto fail;
+  if (sysfs_write("buffer/enable", "1")) goto fail;
+
+  buffered.fd = open(BBB_AIN_IIO_DEV, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (buffered.fd < 0)
+  {
+    sysfs_write("buffer/enable", "0");
+    goto fail;
+  }
+  buffered.mask = mask;
+  return 0;
+
+fail:
+  // don't leave anything enabled
+  for (ain = 0; ain < BBB_AIN_NUM; ain++)
+  {
+    if (!(mask & BBB_AIN_BIT(ain))) continue;
+    sprintf(name, "scan_elements/in_voltage%d_en", ain);
+    sysfs_write(name, "0");
+  }
+  fprintf(stderr, "Could not set up buffered capture from %s\n", BBB_AIN_IIO_DIR);
+  return -1;
+}
+
+
+int bbb_ain_buffered_start(unsigned mask, int buffer_length)
+{
+  int ret;
+  if (!mask || mask >> BBB_AIN_NUM) return -1;
+  pthread_mutex_lock(&buffered.lock);
+  ret = buffered_start(mask, buffer_length);
+  pthread_mutex_unlock(&buffered.lock);
+  return ret;
+}
+
+
+void bbb_ain_buffered_stop(void)
+{
+  pthread_mutex_lock(&buffered.lock);
+  buffered_stop();
+  pthread_mutex_unlock(&buffered.lock);
+}
+
+
+void bbb_ain_close(void)
+{
+  int ain;
+  bbb_ain_buffered_stop();
+  for (ain = 0; ain < BBB_AIN_NUM; ain++)
+  {
+    int fd = __atomic_exchange_n(&raw_fd[ain], -1, __ATOMIC_ACQ_REL);
+    if (fd >= 0) close(fd);
+  }
+}
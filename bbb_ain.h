@@ -1,9 +1,48 @@
-#ifndef bbb_ain_h 
-#define bbb_ain_h 
+#ifndef bbb_ain_h
+#define bbb_ain_h
 
+/**
+ * \file bbb_ain.h
+ *
+ * Analog inputs (AIN0-6) on the BeagleBoneBlack, through the IIO driver.
+ *
+ * By default each channel is read from its sysfs file, which is opened once and then read with pread()
+ * (one syscall per sample). bbb_ain_buffered_start() switches to the IIO buffered interface instead, where
+ * the ADC scans all the enabled channels continuously into a buffer, and one read() gets a sample of
+ * each. Either way, bbb_ain_raw_many()/bbb_ain_V_many() read several channels in one call, optionally
+ * averaging several samples of each.
+ *
+ * The reads may be called from several threads at once (the buffer is read by one at a time). Don't call
+ * bbb_ain_close() while anything else might be reading.
+ */
 
-int bbb_ain_raw(int ain); 
-float bbb_ain_V (int ain); 
+/** number of analog inputs */
+#define BBB_AIN_NUM 7
 
+/** the bit for an input in a channel mask */
+#define BBB_AIN_BIT(ain) (1u << (ain))
 
-#endif 
+/** Read one input (raw ADC counts, 0-4095). Returns -1 on failure. */
+int bbb_ain_raw(int ain);
+
+/** Read one input in volts. Returns -1 on failure. */
+float bbb_ain_V (int ain);
+
+/** Read every input in mask, averaging navg samples of each (navg < 1 means 1), into raw[ain] (in ADC counts,
+ * rounded) or V[ain] (in volts). Entries not in the mask are left alone. Returns 0 on success. */
+int bbb_ain_raw_many(unsigned mask, int navg, int * raw);
+int bbb_ain_V_many(unsigned mask, int navg, float * V);
+
+/** Switch to the IIO buffered interface for the inputs in mask, with a kernel buffer of buffer_length scans
+ * (0 for a default). Reads of other inputs still go through sysfs. Returns 0 on success; on failure,
+ * everything keeps using sysfs. */
+int bbb_ain_buffered_start(unsigned mask, int buffer_length);
+
+/** Stop buffered capture and go back to sysfs reads */
+void bbb_ain_buffered_stop(void);
+
+/** Close every descriptor (they're reopened as needed). A sysfs descriptor that stops working is only
+ * reopened after this. */
+void bbb_ain_close(void);
+
+#endif
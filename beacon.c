@@ -1,4 +1,6 @@
 #include "beacon.h" 
+#include "beaconcodec.h" 
+#include "beaconcol.h" 
 #include <string.h>
 #include <inttypes.h>
 #include <stdlib.h>
@@ -6,54 +8,361 @@
 
 //these need to be incremented if the structs change incompatibly
 //and then generic_*_read must be updated to delegate appropriately. 
-#define BEACON_HEADER_VERSION 2
-#define BEACON_EVENT_VERSION 0 
-#define BEACON_STATUS_VERSION 2 
+#define BEACON_HEADER_VERSION 3
+#define BEACON_EVENT_VERSION 1 
+#define BEACON_STATUS_VERSION 3 
 #define BEACON_HK_VERSION 1 
 
+//the last versions that were just the struct dumped to disk 
+#define BEACON_HEADER_STRUCT_VERSION 2 
+#define BEACON_STATUS_STRUCT_VERSION 2 
+
 
 #define BEACON_HEADER_MAGIC 0xbe  
 #define BEACON_EVENT_MAGIC  0xac 
 #define BEACON_STATUS_MAGIC 0x04 
 #define BEACON_HK_MAGIC     0xcc 
 
+/* If this bit is set in the version byte, the packet checksum is a folded
+ * CRC32C instead of the original fletcher-ish thing. Older readers will reject
+ * these with BN_ERR_BAD_VERSION, which is what we want.  */ 
+#define BEACON_VERSION_CRC32C 0x80
 
-//TODO there are apparently much faster versions of these 
 
-static uint16_t stupid_fletcher16_append(int N, const void * vbuf, uint16_t append) 
+/* The original checksum. Note that this is not quite Fletcher-16: sum2 accumulates
+ * (sum1+sum2) % 255 without itself ever being reduced, so it wraps at 16 bits and
+ * only its low byte makes it into the result. All of our existing files depend on
+ * that, so it has to be reproduced exactly. 
+ *
+ * It can still be vectorized: write t = sum2 % 255. Then (as long as sum2 doesn't
+ * wrap) t_k = 2 t_{k-1} + sum1_k (mod 255), and since 2^8 == 1 (mod 255), over a
+ * group of 8 bytes everything is a prefix sum of the input plus a rotation of the
+ * carried-in state. So we do groups of 8 bytes in 16-bit lanes with the modulos 
+ * deferred (folding bytes, which is cheap mod 255) and fall back to the plain loop 
+ * for the (rare) groups where sum2 wraps. 
+ *
+ * See examples/bench_checksum.c for a comparison against the old version. 
+ */ 
 
+static uint16_t fletcher16_scalar(size_t N, const uint8_t * buf, uint32_t * sum1, uint32_t * sum2) 
 {
-  int i; 
-  uint16_t sum1 = append  & 0xff; 
-  uint16_t sum2 = append >> 8;; 
-  uint8_t * buf = (uint8_t*) vbuf; 
-
+  size_t i; 
+  uint32_t s1 = *sum1; 
+  uint32_t s2 = *sum2; 
   for (i = 0; i < N; i++)
   {
-    sum1 =  (sum1 +buf[i]) % 255; 
-    sum2 += (sum1 + sum2) % 255;;
+    s1 = (s1 + buf[i]) % 255; 
+    s2 = (s2 + (s1 + s2) % 255) & 0xffff; 
+  }
+  *sum1 = s1; 
+  *sum2 = s2; 
+  return s1 | (s2 << 8); 
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_VECTOR_FLETCHER 
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) 
+#include <arm_neon.h> 
+#endif
+
+typedef uint16_t v8u16 __attribute__((vector_size(16))); 
+typedef int16_t v8i16 __attribute__((vector_size(16))); 
+
+// load 8 bytes into 16-bit lanes 
+static inline v8u16 load_widen(const uint8_t * buf) 
+{
+#ifdef __SSE2__
+  return (v8u16) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) buf), _mm_setzero_si128()); 
+#elif defined(__ARM_NEON) 
+  return (v8u16) vmovl_u8(vld1_u8(buf)); 
+#else
+  v8u16 v = { buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], buf[6], buf[7] }; 
+  return v; 
+#endif
+}
+
+// lanes < 510 to [0,254] 
+static inline v8u16 sub255(v8u16 v) 
+{
+  return v - ((v8u16) ((v8i16) v > 254) & 255); 
+}
+
+// lanes < 65280 to [0,254] 
+static inline v8u16 fold255(v8u16 v) 
+{
+  v = (v & 255) + (v >> 8); 
+  v = (v & 255) + (v >> 8); 
+  return sub255(v); 
+}
+
+static inline v8u16 lane_shift(v8u16 v, int n) 
+{
+  const v8u16 zero = {0}; 
+  switch (n) 
+  {
+    case 1: return __builtin_shuffle(v, zero, (v8u16) {8,0,1,2,3,4,5,6}); 
+    case 2: return __builtin_shuffle(v, zero, (v8u16) {8,8,0,1,2,3,4,5}); 
+    default: return __builtin_shuffle(v, zero, (v8u16) {8,8,8,8,0,1,2,3}); 
+  }
+}
+
+static inline v8u16 last_lane(v8u16 v) 
+{
+  return __builtin_shuffle(v, (v8u16) {7,7,7,7,7,7,7,7}); 
+}
+
+/* Does ngroups groups of 8 bytes, assuming sum2 doesn't wrap. Returns what gets added to sum2 */ 
+static uint32_t fletcher16_groups(size_t ngroups, const uint8_t * buf, uint32_t * sum1, uint32_t * mod2) 
+{
+  const v8u16 pow2 = {1,2,4,8,16,32,64,128}; 
+  v8u16 s1 = (v8u16) {0} + (uint16_t) *sum1; 
+  v8u16 t = (v8u16) {0} + (uint16_t) *mod2; 
+  v8u16 racc = {0}; 
+
+  while (ngroups--) 
+  {
+    v8u16 B = load_widen(buf); 
+    v8u16 Y; 
+
+    // B_k = sum of the first k bytes 
+    B += lane_shift(B,1); 
+    B += lane_shift(B,2); 
+    B += lane_shift(B,4); 
+    B = sub255((B & 255) + (B >> 8)); // B < 2048 
+
+    // Y_k = sum_j 2^(k-j) B_j, the part of t_k that doesn't depend on the carried-in state
+    Y = B + (lane_shift(B,1) << 1); 
+    Y += lane_shift(Y,2) << 2; 
+    Y += lane_shift(Y,4) << 4; 
+    Y = fold255(Y); 
+
+    // r_k = (sum1_k + t_{k-1}) % 255 is what's added to sum2 each step 
+    racc += fold255(sub255(s1 + t) * pow2 + lane_shift(Y,1) + B); 
+
+    s1 = sub255(s1 + last_lane(B)); 
+    t = sub255(t + last_lane(Y)); 
+    buf += 8; 
+  }
+
+  racc += __builtin_shuffle(racc, (v8u16) {4,5,6,7,0,1,2,3}); 
+  racc += __builtin_shuffle(racc, (v8u16) {2,3,0,1,2,3,0,1}); 
+  *sum1 = s1[0]; 
+  *mod2 = t[0]; 
+  return racc[0] + racc[1]; 
+}
+
+static uint16_t fletcher16_vector(size_t N, const uint8_t * buf, uint32_t s1, uint32_t s2) 
+{
+  uint32_t t = s2 % 255; 
+
+  while (N >= 8) 
+  {
+    //each group can add at most 8*254 to sum2, so this many can't wrap it 
+    size_t ngroups = (0xffff - s2) / (8*254); 
+    if (ngroups > N/8) ngroups = N/8; 
+
+    if (ngroups) 
+    {
+      s2 += fletcher16_groups(ngroups, buf, &s1, &t); 
+      buf += 8 * ngroups; 
+      N -= 8 * ngroups; 
+    }
+    else // close to wrapping, do a group the slow way 
+    {
+      fletcher16_scalar(8, buf, &s1, &s2); 
+      t = s2 % 255; 
+      buf += 8; 
+      N -= 8; 
+    }
   }
 
-  return sum1 | (sum2 << 8) ; 
+  return fletcher16_scalar(N, buf, &s1, &s2); 
 }
+#endif
 
-static uint16_t stupid_fletcher16(int N, const void * buf) 
+uint16_t beacon_fletcher16(size_t N, const void * buf, uint16_t append) 
 {
-  return stupid_fletcher16_append(N, buf, 0); 
+  uint32_t sum1 = append & 0xff; 
+  uint32_t sum2 = append >> 8; 
+#ifdef HAVE_VECTOR_FLETCHER
+  return fletcher16_vector(N, buf, sum1 % 255, sum2); 
+#else
+  return fletcher16_scalar(N, buf, &sum1, &sum2); 
+#endif
 }
 
 
+/* CRC32C (Castagnoli). Uses the crc32 instruction if we have it, otherwise slicing-by-8. */ 
+
+#define CRC32C_POLY 0x82f63b78 
+
+static uint32_t crc32c_table[8][256]; 
+
+#if defined(__x86_64__) || defined(__i386__) 
+#include <nmmintrin.h> 
+static int have_hw_crc32c = 0; 
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t * buf, size_t N) 
+{
+#ifdef __x86_64__
+  while (N >= 8) 
+  {
+    uint64_t v; 
+    memcpy(&v, buf, 8); 
+    crc = _mm_crc32_u64(crc, v); 
+    buf += 8; 
+    N -= 8; 
+  }
+#endif
+  while (N--) crc = _mm_crc32_u8(crc, *buf++); 
+  return crc; 
+}
+#elif defined(__ARM_FEATURE_CRC32) 
+#include <arm_acle.h> 
+static const int have_hw_crc32c = 1; 
+
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t * buf, size_t N) 
+{
+  while (N >= 4) 
+  {
+    uint32_t v; 
+    memcpy(&v, buf, 4); 
+    crc = __crc32cw(crc, v); 
+    buf += 4; 
+    N -= 4; 
+  }
+  while (N--) crc = __crc32cb(crc, *buf++); 
+  return crc; 
+}
+#else
+static const int have_hw_crc32c = 0; 
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t * buf, size_t N) { (void) buf; (void) N; return crc; } 
+#endif
 
 
-/* we'll handle (gz|f)(read|write) the same 
+__attribute__((constructor))
+static void crc32c_init() 
+{
+  int i,j; 
+  for (i = 0; i < 256; i++) 
+  {
+    uint32_t crc = i; 
+    for (j = 0; j < 8; j++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1; 
+    crc32c_table[0][i] = crc; 
+  }
+
+  for (i = 0; i < 256; i++) 
+  {
+    for (j = 1; j < 8; j++) 
+    {
+      crc32c_table[j][i] = (crc32c_table[j-1][i] >> 8) ^ crc32c_table[0][crc32c_table[j-1][i] & 0xff]; 
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__) 
+  __builtin_cpu_init(); 
+  have_hw_crc32c = __builtin_cpu_supports("sse4.2"); 
+#endif
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t * buf, size_t N) 
+{
+  while (N >= 8) 
+  {
+    uint32_t lo,hi; 
+    memcpy(&lo, buf, 4); 
+    memcpy(&hi, buf+4, 4); 
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    lo = __builtin_bswap32(lo); 
+    hi = __builtin_bswap32(hi); 
+#endif
+    lo ^= crc; 
+    crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+          crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^ 
+          crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+          crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24]; 
+    buf += 8; 
+    N -= 8; 
+  }
+  while (N--) crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *buf++) & 0xff]; 
+  return crc; 
+}
+
+uint32_t beacon_crc32c(size_t N, const void * buf, uint32_t append) 
+{
+  uint32_t crc = ~append; 
+  crc = have_hw_crc32c ? crc32c_hw(crc, buf, N) : crc32c_sw(crc, buf, N); 
+  return ~crc; 
+}
+
+
+/* Running checksum of a packet, of whichever type the version byte says. */ 
+struct packet_cksum
+{
+  int crc; 
+  uint32_t val; 
+}; 
+
+static void packet_cksum_init(struct packet_cksum * c, uint8_t ver) 
+{
+  c->crc = (ver & BEACON_VERSION_CRC32C) != 0; 
+  c->val = 0; 
+}
+
+static void packet_cksum_append(struct packet_cksum * c, int N, const void * buf) 
+{
+  c->val = c->crc ? beacon_crc32c(N, buf, c->val) : beacon_fletcher16(N, buf, c->val); 
+}
+
+//the CRC is folded to 16 bits so it fits in the packet start 
+static uint16_t packet_cksum_value(const struct packet_cksum * c) 
+{
+  return c->crc ? (c->val ^ (c->val >> 16)) & 0xffff : c->val; 
+}
+
+static uint16_t packet_cksum(uint8_t ver, int N, const void * buf) 
+{
+  struct packet_cksum c; 
+  packet_cksum_init(&c, ver); 
+  packet_cksum_append(&c, N, buf); 
+  return packet_cksum_value(&c); 
+}
+
+static beacon_checksum_t write_checksum = BN_CKSUM_FLETCHER16; 
+
+void beacon_set_write_checksum(beacon_checksum_t type) 
+{
+  write_checksum = type; 
+}
+
+beacon_checksum_t beacon_get_write_checksum() 
+{
+  return write_checksum; 
+}
+
+// the version byte to write for a packet with the given format version 
+static uint8_t packet_version(uint8_t ver) 
+{
+  return write_checksum == BN_CKSUM_CRC32C ? ver | BEACON_VERSION_CRC32C : ver; 
+}
+
+
+
+
+/* we'll handle (gz|f|sink)(read|write) the same 
  * with a little silly trickery */ 
 struct generic_file
 {
-  enum { STDIO, ZLIB } type; 
+  enum { STDIO, ZLIB, SINK } type; 
   union 
   {
     FILE * f;
     gzFile gzf;
+    const beacon_sink_t * sink; 
   } handle; 
 }; 
 
@@ -80,6 +389,8 @@ static int generic_write(struct generic_file gf, int n, const void * buf)
       return fwrite(buf, 1,n,gf.handle.f); 
     case ZLIB: 
       return gzwrite(gf.handle.gzf,buf,n); 
+    case SINK: 
+      return gf.handle.sink->write(gf.handle.sink->ctx, buf, n) ? -1 : n; 
     default:
       return -1; 
   }
@@ -94,44 +405,91 @@ struct packet_start
   uint16_t cksum; 
 };
 
+static int packet_start_check(const struct packet_start * start, uint8_t expected_magic, uint8_t maximum_version)
+{
+  if (start->magic != expected_magic) return BN_ERR_WRONG_TYPE; 
+  if ((start->ver & ~BEACON_VERSION_CRC32C) > maximum_version) return BN_ERR_BAD_VERSION; 
+  return 0; 
+}
+
 // takes care of the odious task of reading in the packet start 
 static int packet_start_read( struct generic_file gf, struct packet_start * start, uint8_t expected_magic, uint8_t maximum_version)
 {
   int got; 
-  got = generic_read(gf, sizeof(start->magic), &start->magic); 
-  if (got != sizeof(start->magic)) return BN_ERR_NOT_ENOUGH_BYTES; 
-
-  if (start->magic != expected_magic)
+  got = generic_read(gf, sizeof(*start), start); 
+  if (got != sizeof(*start)) 
   {
-    fprintf(stderr,"Bad magic byte. Expected 0x%x, got 0x%x\n", expected_magic, start->magic); 
-    return BN_ERR_WRONG_TYPE; 
+    if (got > 0) fprintf(stderr,"Did not get enough start bytes\n"); 
+    return BN_ERR_NOT_ENOUGH_BYTES; 
   }
 
-
-  got = generic_read(gf, sizeof(start->ver), &start->ver); 
-  if (got != sizeof(start->ver)) 
+  got = packet_start_check(start, expected_magic, maximum_version); 
+  if (got == BN_ERR_WRONG_TYPE)
   {
-    fprintf(stderr,"Did not get enough start bytes\n"); 
-    return BN_ERR_NOT_ENOUGH_BYTES; 
+    fprintf(stderr,"Bad magic byte. Expected 0x%x, got 0x%x\n", expected_magic, start->magic); 
   }
-
-  if (start->ver > maximum_version) 
+  else if (got == BN_ERR_BAD_VERSION) 
   {
-    fprintf(stderr,"Version %d exceeds maximum %d\n", start->ver , maximum_version); 
-    return BN_ERR_BAD_VERSION; 
+    fprintf(stderr,"Version %d exceeds maximum %d\n", start->ver & ~BEACON_VERSION_CRC32C, maximum_version); 
   }
 
-  got = generic_read(gf,sizeof(start->cksum), &start->cksum); 
+  return got; 
+}
 
-  if (got != sizeof(start->cksum))
-  {
-    fprintf(stderr,"Did not get enough checksum bytes\n"); 
-    return BN_ERR_NOT_ENOUGH_BYTES; 
-  }
+// parses the packet start at the beginning of buf
+static int packet_start_parse(const void * buf, size_t len, struct packet_start * start, uint8_t expected_magic, uint8_t maximum_version)
+{
+  if (len < sizeof(*start)) return BN_ERR_NOT_ENOUGH_BYTES; 
+  memcpy(start, buf, sizeof(*start)); 
+  return packet_start_check(start, expected_magic, maximum_version); 
+}
 
-  return 0; 
+// packet_start followed by a body that is checksummed as one piece 
+static int packet_serialize(void * buf, size_t cap, uint8_t magic, uint8_t ver, int size, const void * body) 
+{
+  struct packet_start start; 
+  if (cap < sizeof(start) + size) return -BN_ERR_NOT_ENOUGH_BYTES; 
+  start.magic = magic; 
+  start.ver = packet_version(ver); 
+  start.cksum = packet_cksum(start.ver, size, body); 
+  memcpy(buf, &start, sizeof(start)); 
+  memcpy((uint8_t*) buf + sizeof(start), body, size); 
+  return sizeof(start) + size; 
+}
+
+/* Packed records: every field in order, little endian, no padding, so they mean the same 
+ * thing on every machine no matter what the compiler does to the struct. The field lists 
+ * (F(name, type, width, count)) generate the size and both directions. 
+ */ 
+
+static inline void put_le(uint8_t * p, int width, uint64_t v) 
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(p, &v, width); //the widths are constants, so this is just a store 
+#else
+  int i; 
+  for (i = 0; i < width; i++) p[i] = v >> (8 * i); 
+#endif
+}
+
+static inline uint64_t get_le(const uint8_t * p, int width) 
+{
+  uint64_t v = 0; 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(&v, p, width); 
+#else
+  int i; 
+  for (i = 0; i < width; i++) v |= (uint64_t) p[i] << (8 * i); 
+#endif
+  return v; 
 }
 
+#define PACKED_FIELD_SIZE(name, type, width, count) + (width) * (count) 
+#define PACK_FIELD(name, type, width, count) \
+  for (i = 0; i < (count); i++, p += (width)) put_le(p, (width), ((const type *) &x->name)[i]); 
+#define UNPACK_FIELD(name, type, width, count) \
+  for (i = 0; i < (count); i++, p += (width)) ((type *) &x->name)[i] = (type) get_le(p, (width)); 
+
 
 typedef struct beacon_header_v0
 {
@@ -191,167 +549,422 @@ typedef struct beacon_header_v1
 
 
 
-/* Offsets from start of structs for headers */ 
-const int beacon_header_sizes []=  { sizeof(beacon_header_v0_t), sizeof(beacon_header_v1_t), sizeof(beacon_header_t) }; 
+/* The packed header (version 3 on) is the fields of BN_HEADER_COLUMNS in order, little endian, each element 
+ * as wide as its type except for the enums, which are a byte. */ 
+#define HEADER_WIRE_WIDTH(name, type) \
+  (BN_HCOL_##name == BN_HCOL_trig_type || BN_HCOL_##name == BN_HCOL_trig_pol ? 1 : (int) sizeof(type)) 
 
+#define HEADER_SIZE_S(name, type) PACKED_FIELD_SIZE(name, type, HEADER_WIRE_WIDTH(name, type), 1) 
+#define HEADER_SIZE_A(name, type, count) PACKED_FIELD_SIZE(name, type, HEADER_WIRE_WIDTH(name, type), count) 
+#define HEADER_PACK_S(name, type) PACK_FIELD(name, type, HEADER_WIRE_WIDTH(name, type), 1) 
+#define HEADER_PACK_A(name, type, count) PACK_FIELD(name, type, HEADER_WIRE_WIDTH(name, type), count) 
+#define HEADER_UNPACK_S(name, type) UNPACK_FIELD(name, type, HEADER_WIRE_WIDTH(name, type), 1) 
+#define HEADER_UNPACK_A(name, type, count) UNPACK_FIELD(name, type, HEADER_WIRE_WIDTH(name, type), count) 
 
+#define HEADER_PACKED_SIZE (0 BN_HEADER_COLUMNS(HEADER_SIZE_S, HEADER_SIZE_A)) 
 
+static void header_pack(const beacon_header_t * x, uint8_t * p) 
+{
+  int i; 
+  BN_HEADER_COLUMNS(HEADER_PACK_S, HEADER_PACK_A) 
+}
 
+static void header_unpack(const uint8_t * p, beacon_header_t * x) 
+{
+  int i; 
+  memset(x, 0, sizeof(*x)); 
+  BN_HEADER_COLUMNS(HEADER_UNPACK_S, HEADER_UNPACK_A) 
+}
 
+/* Body sizes for each header version. Version 2 is beacon_header_t as it is now; if that ever changes, 
+ * it needs its own struct here like v0 and v1. */ 
+const int beacon_header_sizes []=  { sizeof(beacon_header_v0_t), sizeof(beacon_header_v1_t), sizeof(beacon_header_t), HEADER_PACKED_SIZE }; 
 
-/* The on-disk format is just packet_start followed by the newest version of the
- * the header struct.  Every time the version changes,if we have data we care about, 
- * we need to increment the version. 
- */
+static int header_body_size(uint8_t ver) 
+{
+  return beacon_header_sizes[ver & ~BEACON_VERSION_CRC32C]; 
+}
 
-static int beacon_header_generic_write(struct generic_file gf, const beacon_header_t *h)
+/* copies a header body of header_body_size(ver) bytes, filling in what older versions don't have */ 
+static void header_copy(uint8_t ver, const void * body, beacon_header_t * h) 
 {
-  struct packet_start start; 
-  int written; 
-  start.magic = BEACON_HEADER_MAGIC; 
-  start.ver = BEACON_HEADER_VERSION; 
-  start.cksum = stupid_fletcher16(sizeof(beacon_header_t), h); 
+  if ((ver & ~BEACON_VERSION_CRC32C) > BEACON_HEADER_STRUCT_VERSION) 
+  {
+    header_unpack(body, h); 
+    return; 
+  }
+
+  memcpy(h, body, header_body_size(ver)); 
 
-  written = generic_write(gf, sizeof(start), &start); 
-  if (written != sizeof(start)) 
+  switch(ver & ~BEACON_VERSION_CRC32C) 
   {
-    return BN_ERR_NOT_ENOUGH_BYTES; 
+    //add cases here if necessary 
+   case 0: 
+      h->pps_counter = 0; 
+      h->dynamic_beam_mask = 0; 
+      h->veto_deadtime_counter = 0; 
+      break; 
+   case 1: 
+      h->veto_deadtime_counter = 0; 
+      break; 
+   default: //version 2 is the whole struct 
+      break; 
   }
+}
 
-  written = generic_write(gf, sizeof(beacon_header_t), h); 
-  
-  if (written != sizeof(beacon_header_t))
+/* decodes a header body of header_body_size(start->ver) bytes */ 
+static int header_decode(const struct packet_start * start, const void * body, beacon_header_t * h) 
+{
+  if (packet_cksum(start->ver, header_body_size(start->ver), body) != start->cksum) 
   {
-    return BN_ERR_NOT_ENOUGH_BYTES; 
+    return BN_ERR_CHECKSUM_FAILED; 
   }
 
+  header_copy(start->ver, body, h); 
   return 0; 
 }
 
 
+/* The on-disk format is packet_start followed by the header. Up to version 2, that was just the struct 
+ * (padding, host endianness and all); since version 3 it's packed (see HEADER_WIRE_WIDTH). 
+ * Every time the version changes,if we have data we care about, we need to increment the version. 
+ */
+
+int beacon_header_serialize(void * buf, size_t cap, const beacon_header_t * h) 
+{
+  uint8_t body[HEADER_PACKED_SIZE]; 
+  header_pack(h, body); 
+  return packet_serialize(buf, cap, BEACON_HEADER_MAGIC, BEACON_HEADER_VERSION, sizeof(body), body); 
+}
+
+int beacon_header_deserialize(const void * buf, size_t len, beacon_header_t * h) 
+{
+  struct packet_start start; 
+  int size; 
+  int ret = packet_start_parse(buf, len, &start, BEACON_HEADER_MAGIC, BEACON_HEADER_VERSION); 
+  if (ret) return -ret; 
+
+  size = sizeof(start) + header_body_size(start.ver); 
+  if (len < (size_t) size) return -BN_ERR_NOT_ENOUGH_BYTES; 
+
+  ret = header_decode(&start, (const uint8_t*) buf + sizeof(start), h); 
+  return ret ? -ret : size; 
+}
+
+static int beacon_header_generic_write(struct generic_file gf, const beacon_header_t *h)
+{
+  uint8_t buf[BN_MAX_HEADER_BYTES]; 
+  int size = beacon_header_serialize(buf, sizeof(buf), h); 
+  if (size < 0) return -size; 
+
+  if (generic_write(gf, size, buf) != size) 
+  {
+    return BN_ERR_NOT_ENOUGH_BYTES; 
+  }
+
+  return 0; 
+}
 
 static int beacon_header_generic_read(struct generic_file gf, beacon_header_t *h) 
 {
   struct packet_start start; 
+  uint8_t body[sizeof(beacon_header_t)]; 
   int got; 
   int wanted; 
-  uint16_t cksum; 
 
   got = packet_start_read(gf, &start, BEACON_HEADER_MAGIC, BEACON_HEADER_VERSION); 
   if (got) return got; 
 
-  switch(start.ver) 
-  {
-    //add cases here if necessary 
-   case 0: 
-      wanted = sizeof(beacon_header_v0_t); 
-      got = generic_read(gf, wanted, h); 
-      cksum = stupid_fletcher16(wanted, h); 
-      h->pps_counter = 0; 
-      h->dynamic_beam_mask = 0; 
-      break; 
-   case 1: 
-      wanted = sizeof(beacon_header_v1_t); 
-      got = generic_read(gf, wanted, h); 
-      cksum = stupid_fletcher16(wanted, h); 
-      h->pps_counter = 0; 
-      h->dynamic_beam_mask = 0; 
-      h->veto_deadtime_counter = 0; 
-      break; 
- 
-   case BEACON_HEADER_VERSION: //this is the most recent header!
-      wanted = sizeof(beacon_header_t); 
-      got = generic_read(gf, wanted, h); 
-      cksum = stupid_fletcher16(wanted, h); 
-      break; 
-    default: 
-     fprintf(stderr,"unknown version %d\n", start.ver); 
-    return BN_ERR_BAD_VERSION; 
-  }
-
+  wanted = header_body_size(start.ver); 
+  got = generic_read(gf, wanted, body); 
   if (wanted!=got)
   {
     fprintf(stderr,"not enough bytes\n"); 
     return BN_ERR_NOT_ENOUGH_BYTES; 
   }
 
-  if (cksum != start.cksum) 
+  got = header_decode(&start, body, h); 
+  if (got == BN_ERR_CHECKSUM_FAILED) 
   {
     fprintf(stderr,"cksum problem\n"); 
-    return BN_ERR_CHECKSUM_FAILED; 
   }
 
-  return 0; 
+  return got; 
 }
 
 
-/* The on-disk format is just packet_start followed by the newest version of the
- * the event struct. Note that we only write (and compute the checksum for) buffer length bytes for each event. 
+/* The on-disk format is packet_start followed by the event struct. Note that we only write (and compute the checksum for) buffer length bytes for each event. 
  *
  * very time the version changes,if we have data we care about, 
  * we need to increment the version. 
+ *
+ * Version 0 stores the waveforms as is. Its checksum is computed piece by piece (number, length, board ids,
+ * then each channel), which is not the same as over the whole thing at once, because that's how it was always done. 
+ *
+ * Version 1 (BN_EVENT_CODEC_PACKED) has a uint32_t with the number of encoded waveform bytes after the board ids,
+ * followed by each channel encoded with beacon_wf_encode(). Its checksum is over the whole body at once. 
+ *
+ * Which one we write is chosen by beacon_set_write_event_codec(). 
  */
 
-static int beacon_event_generic_write(struct generic_file gf, const beacon_event_t *ev)
+#define EVENT_PREFIX_SIZE (sizeof(uint64_t) + sizeof(uint16_t) + BN_MAX_BOARDS) 
+#define EVENT_PACKED_PREFIX_SIZE (EVENT_PREFIX_SIZE + sizeof(uint32_t)) 
+
+static beacon_event_codec_t write_event_codec = BN_EVENT_CODEC_RAW; 
+
+void beacon_set_write_event_codec(beacon_event_codec_t codec) 
+{
+  write_event_codec = codec; 
+}
+
+beacon_event_codec_t beacon_get_write_event_codec() 
+{
+  return write_event_codec; 
+}
+
+static int event_body_size(uint16_t buffer_length, const uint8_t * board_id) 
+{
+  int ibd; 
+  int size = EVENT_PREFIX_SIZE; 
+  for (ibd = 0; ibd < BN_MAX_BOARDS; ibd++) 
+  {
+    if (board_id[ibd]) size += BN_NUM_CHAN * buffer_length; 
+  }
+  return size; 
+}
+
+/* The number of body bytes needed before event_prefix_check can tell the body size */ 
+static int event_prefix_size(uint8_t ver) 
+{
+  return (ver & ~BEACON_VERSION_CRC32C) == 0 ? EVENT_PREFIX_SIZE : EVENT_PACKED_PREFIX_SIZE; 
+}
+
+static int event_serialize_packed(void * buf, size_t cap, const beacon_event_t * ev) 
 {
   struct packet_start start; 
-  int written; 
+  uint8_t * body = (uint8_t*) buf + sizeof(start); 
+  uint8_t * p = body + EVENT_PACKED_PREFIX_SIZE; 
+  uint32_t encoded = 0; 
   int i,ibd; 
+  int nboards = 0; 
+
+  for (ibd = 0; ibd < BN_MAX_BOARDS; ibd++) nboards += !!ev->board_id[ibd]; 
+
+  //worst case, so we never have to check in the middle 
+  if (cap < sizeof(start) + EVENT_PACKED_PREFIX_SIZE + nboards * BN_NUM_CHAN * BN_CODEC_MAX_BYTES(ev->buffer_length)) 
+    return -BN_ERR_NOT_ENOUGH_BYTES; 
+
+  memcpy(body, &ev->event_number, sizeof(ev->event_number)); 
+  memcpy(body + sizeof(uint64_t), &ev->buffer_length, sizeof(ev->buffer_length)); 
+  memcpy(body + sizeof(uint64_t) + sizeof(uint16_t), &ev->board_id, sizeof(ev->board_id)); 
+
+  for (ibd = 0; ibd <BN_MAX_BOARDS ; ibd++)
+  {
+    if (!ev->board_id[ibd]) continue; 
+    for (i = 0; i < BN_NUM_CHAN; i++) 
+    {
+      int n = beacon_wf_encode(ev->data[ibd][i], ev->buffer_length, p); 
+      p += n; 
+      encoded += n; 
+    }
+  }
+  memcpy(body + EVENT_PREFIX_SIZE, &encoded, sizeof(encoded)); 
+
   start.magic = BEACON_EVENT_MAGIC; 
-  start.ver = BEACON_EVENT_VERSION; 
+  start.ver = packet_version(1); 
+  start.cksum = packet_cksum(start.ver, p - body, body); 
+  memcpy(buf, &start, sizeof(start)); 
+  return p - (uint8_t*) buf; 
+}
 
-  start.cksum = stupid_fletcher16(sizeof(ev->event_number), &ev->event_number); 
-  start.cksum = stupid_fletcher16_append(sizeof(ev->buffer_length), &ev->buffer_length,start.cksum); 
-  start.cksum = stupid_fletcher16_append(sizeof(ev->board_id), &ev->board_id, start.cksum); 
+int beacon_event_serialize(void * buf, size_t cap, const beacon_event_t * ev) 
+{
+  struct packet_start start; 
+  struct packet_cksum cksum; 
+  uint8_t * p = (uint8_t*) buf + sizeof(start); 
+  int i,ibd; 
+  int size; 
+
+  if (ev->buffer_length > BN_MAX_WAVEFORM_LENGTH) return -BN_ERR_BAD_LENGTH; 
+
+  if (write_event_codec == BN_EVENT_CODEC_PACKED) return event_serialize_packed(buf, cap, ev); 
+
+  size = sizeof(start) + event_body_size(ev->buffer_length, ev->board_id); 
+  if (cap < (size_t) size) return -BN_ERR_NOT_ENOUGH_BYTES; 
+
+  start.magic = BEACON_EVENT_MAGIC; 
+  start.ver = packet_version(0); 
+  packet_cksum_init(&cksum, start.ver); 
+
+  memcpy(p, &ev->event_number, sizeof(ev->event_number)); 
+  packet_cksum_append(&cksum, sizeof(ev->event_number), p); 
+  p += sizeof(ev->event_number); 
+
+  memcpy(p, &ev->buffer_length, sizeof(ev->buffer_length)); 
+  packet_cksum_append(&cksum, sizeof(ev->buffer_length), p); 
+  p += sizeof(ev->buffer_length); 
+
+  memcpy(p, &ev->board_id, sizeof(ev->board_id)); 
+  packet_cksum_append(&cksum, sizeof(ev->board_id), p); 
+  p += sizeof(ev->board_id); 
 
   for (ibd = 0; ibd <BN_MAX_BOARDS ; ibd++)
   {
     if (!ev->board_id[ibd]) continue; 
     for (i = 0; i < BN_NUM_CHAN; i++) 
     {
-     start.cksum = stupid_fletcher16_append(ev->buffer_length, ev->data[ibd][i], start.cksum); 
+      memcpy(p, ev->data[ibd][i], ev->buffer_length); 
+      packet_cksum_append(&cksum, ev->buffer_length, p); 
+      p += ev->buffer_length; 
     }
   }
 
+  start.cksum = packet_cksum_value(&cksum); 
+  memcpy(buf, &start, sizeof(start)); 
+  return size; 
+}
 
-  written = generic_write(gf, sizeof(start), &start); 
-  if (written != sizeof(start)) 
+/* Checks the prefix (event_prefix_size bytes) of an event body, and returns the full body size */ 
+static int event_prefix_check(uint8_t ver, const uint8_t * body) 
+{
+  uint16_t buffer_length; 
+  uint32_t encoded; 
+  int ibd, nboards = 0; 
+  memcpy(&buffer_length, body + sizeof(uint64_t), sizeof(buffer_length)); 
+  if (buffer_length > BN_MAX_WAVEFORM_LENGTH) return -BN_ERR_BAD_LENGTH; 
+  if ((ver & ~BEACON_VERSION_CRC32C) == 0) 
   {
-    return BN_ERR_NOT_ENOUGH_BYTES; 
+    return event_body_size(buffer_length, body + sizeof(uint64_t) + sizeof(uint16_t)); 
   }
 
-  written = generic_write(gf, sizeof(ev->event_number), &ev->event_number); 
+  for (ibd = 0; ibd < BN_MAX_BOARDS; ibd++) nboards += !!body[sizeof(uint64_t) + sizeof(uint16_t) + ibd]; 
+  memcpy(&encoded, body + EVENT_PREFIX_SIZE, sizeof(encoded)); 
+  if (encoded > (uint32_t) nboards * BN_NUM_CHAN * BN_CODEC_MAX_BYTES(buffer_length)) return -BN_ERR_BAD_LENGTH; 
+  return EVENT_PACKED_PREFIX_SIZE + encoded; 
+}
+
+/* decodes a complete version 1 event body of the given size, whose checksum is already verified */ 
+static int event_decode_packed(const uint8_t * body, int size, beacon_event_t * ev) 
+{
+  const uint8_t * p = body + EVENT_PACKED_PREFIX_SIZE; 
+  const uint8_t * end = body + size; 
+  int i, ibd; 
 
-  if (written != sizeof(ev->event_number))
+  for (ibd = 0; ibd <BN_MAX_BOARDS; ibd++)
   {
-    return BN_ERR_NOT_ENOUGH_BYTES; 
+    if (!ev->board_id[ibd]) 
+    {
+      memset(ev->data[ibd],0, sizeof(ev->data[ibd])); 
+      continue; 
+    }
+
+    for (i = 0; i < BN_NUM_CHAN; i++)
+    {
+      int n = beacon_wf_decode(p, end - p, ev->data[ibd][i], ev->buffer_length); 
+      if (n < 0) return BN_ERR_BAD_LENGTH; 
+      p += n; 
+
+      // zero out the rest of the memory 
+      memset(ev->data[ibd][i] + ev->buffer_length, 0, BN_MAX_WAVEFORM_LENGTH - ev->buffer_length); 
+    }
   }
 
+  return p == end ? 0 : BN_ERR_BAD_LENGTH; 
+}
 
-  written = generic_write(gf, sizeof(ev->buffer_length), &ev->buffer_length); 
-  if (written != sizeof(ev->buffer_length))
+/* decodes a complete event body of the given size */ 
+static int event_decode(const struct packet_start * start, const uint8_t * body, int size, beacon_event_t * ev) 
+{
+  struct packet_cksum cksum; 
+  int i, ibd; 
+  const uint8_t * p = body; 
+  uint8_t ver = start->ver & ~BEACON_VERSION_CRC32C; 
+
+  //add additional cases if necessary for compatibility
+  if (ver > BEACON_EVENT_VERSION) 
   {
-    return BN_ERR_NOT_ENOUGH_BYTES; 
+    return BN_ERR_BAD_VERSION; 
+  }
+
+  if (ver == 1) 
+  {
+    if (packet_cksum(start->ver, size, body) != start->cksum) 
+    {
+      return BN_ERR_CHECKSUM_FAILED; 
+    }
+    memcpy(&ev->event_number, p, sizeof(ev->event_number)); 
+    memcpy(&ev->buffer_length, p + sizeof(uint64_t), sizeof(ev->buffer_length)); 
+    memcpy(&ev->board_id, p + sizeof(uint64_t) + sizeof(uint16_t), sizeof(ev->board_id)); 
+    return event_decode_packed(body, size, ev); 
+  }
+
+  packet_cksum_init(&cksum, start->ver); 
+
+  memcpy(&ev->event_number, p, sizeof(ev->event_number)); 
+  packet_cksum_append(&cksum, sizeof(ev->event_number), p); 
+  p += sizeof(ev->event_number); 
+
+  memcpy(&ev->buffer_length, p, sizeof(ev->buffer_length)); 
+  packet_cksum_append(&cksum, sizeof(ev->buffer_length), p); 
+  p += sizeof(ev->buffer_length); 
+
+  memcpy(&ev->board_id, p, sizeof(ev->board_id)); 
+  packet_cksum_append(&cksum, sizeof(ev->board_id), p); 
+  p += sizeof(ev->board_id); 
+
+  for (ibd = 0; ibd <BN_MAX_BOARDS; ibd++)
+  {
+    if (!ev->board_id[ibd]) 
+    {
+      memset(ev->data[ibd],0, sizeof(ev->data[ibd])); 
+      continue; 
+    }
+
+    for (i = 0; i < BN_NUM_CHAN; i++)
+    {
+      memcpy(ev->data[ibd][i], p, ev->buffer_length); 
+      packet_cksum_append(&cksum, ev->buffer_length, p); 
+      p += ev->buffer_length; 
+
+      // zero out the rest of the memory 
+      memset(ev->data[ibd][i] + ev->buffer_length, 0, BN_MAX_WAVEFORM_LENGTH - ev->buffer_length); 
+    }
   }
 
-  written = generic_write(gf, sizeof(ev->board_id), &ev->board_id); 
+  if (packet_cksum_value(&cksum) != start->cksum) 
+  {
+    return BN_ERR_CHECKSUM_FAILED; 
+  }
+
+  return 0; 
+}
+
+int beacon_event_deserialize(const void * buf, size_t len, beacon_event_t * ev) 
+{
+  struct packet_start start; 
+  const uint8_t * body = (const uint8_t*) buf + sizeof(start); 
+  int size; 
+  int ret = packet_start_parse(buf, len, &start, BEACON_EVENT_MAGIC, BEACON_EVENT_VERSION); 
+  if (ret) return -ret; 
+
+  if (len < sizeof(start) + event_prefix_size(start.ver)) return -BN_ERR_NOT_ENOUGH_BYTES; 
+  size = event_prefix_check(start.ver, body); 
+  if (size < 0) return size; 
+  if (len < sizeof(start) + size) return -BN_ERR_NOT_ENOUGH_BYTES; 
+
+  ret = event_decode(&start, body, size, ev); 
+  return ret ? -ret : (int) sizeof(start) + size; 
+}
+
+static int beacon_event_generic_write(struct generic_file gf, const beacon_event_t *ev)
+{
+  uint8_t buf[BN_MAX_EVENT_BYTES]; 
+  int size = beacon_event_serialize(buf, sizeof(buf), ev); 
+  if (size < 0) return -size; 
 
-  if (written != sizeof(ev->board_id)) 
+  if (generic_write(gf, size, buf) != size) 
   {
-      return BN_ERR_NOT_ENOUGH_BYTES; 
-  }
- 
-  for (ibd = 0; ibd < BN_MAX_BOARDS; ibd++)
-  {
-    if (!ev->board_id[ibd]) continue; 
-    for (i = 0; i <BN_NUM_CHAN; i++)
-    {
-      written = generic_write(gf, ev->buffer_length, &ev->data[ibd][i][0]); 
-      if (written != ev->buffer_length) 
-      {
-        return BN_ERR_NOT_ENOUGH_BYTES; 
-      }
-    }
+    return BN_ERR_NOT_ENOUGH_BYTES; 
   }
 
   return 0; 
@@ -361,69 +974,25 @@ static int beacon_event_generic_write(struct generic_file gf, const beacon_event
 static int beacon_event_generic_read(struct generic_file gf, beacon_event_t *ev) 
 {
   struct packet_start start; 
+  uint8_t body[BN_MAX_EVENT_BYTES]; 
   int got; 
   int wanted; 
-  uint16_t cksum; 
-  int i; 
+  int prefix; 
 
   got = packet_start_read(gf, &start, BEACON_EVENT_MAGIC, BEACON_EVENT_VERSION); 
   if (got) return got; 
 
+  prefix = event_prefix_size(start.ver); 
+  got = generic_read(gf, prefix, body); 
+  if (got != prefix) return BN_ERR_NOT_ENOUGH_BYTES; 
 
-  //add additional cases if necessary for compatibility
-  //
-  if (start.ver == BEACON_EVENT_VERSION) 
-  {
-      wanted = sizeof(ev->event_number); 
-      got = generic_read(gf, wanted, &ev->event_number); 
-      if (wanted != got) return BN_ERR_NOT_ENOUGH_BYTES; 
-      cksum = stupid_fletcher16(wanted, &ev->event_number); 
-
-      wanted = sizeof(ev->buffer_length); 
-      got = generic_read(gf, wanted, &ev->buffer_length); 
-      if (wanted != got) return BN_ERR_NOT_ENOUGH_BYTES; 
-      cksum = stupid_fletcher16_append(wanted, &ev->buffer_length,cksum); 
-
-      wanted = sizeof(ev->board_id); 
-      got = generic_read(gf, wanted, &ev->board_id); 
-      if (wanted != got) return BN_ERR_NOT_ENOUGH_BYTES; 
-      cksum = stupid_fletcher16_append(wanted, &ev->board_id,cksum); 
-
-      int ibd; 
-      for (ibd = 0; ibd <BN_MAX_BOARDS; ibd++)
-      {
-        if (!ev->board_id[ibd]) 
-        {
-          memset(ev->data[ibd],0, sizeof(ev->data[ibd])); 
-          continue; 
-        }
-
-        for (i = 0; i < BN_NUM_CHAN; i++)
-        {
-          wanted = ev->buffer_length; 
-          got = generic_read(gf, wanted, ev->data[ibd][i]); 
-          if (wanted != got) return BN_ERR_NOT_ENOUGH_BYTES; 
-          cksum = stupid_fletcher16_append(wanted, ev->data[ibd][i], cksum); 
-
-          // zero out the rest of the memory 
-          memset(ev->data[ibd][i] + wanted, 0, BN_MAX_WAVEFORM_LENGTH - wanted); 
-        }
-      }
-
-  }
-  
-  else
-  {
-    fprintf(stderr,"Unimplemented version: %d\n", start.ver); 
-    return BN_ERR_BAD_VERSION; 
-  }
+  wanted = event_prefix_check(start.ver, body); 
+  if (wanted < 0) return -wanted; 
 
-  if (cksum != start.cksum) 
-  {
-    return BN_ERR_CHECKSUM_FAILED; 
-  }
+  got = generic_read(gf, wanted - prefix, body + prefix); 
+  if (wanted - prefix != got) return BN_ERR_NOT_ENOUGH_BYTES; 
 
-  return 0; 
+  return event_decode(&start, body, wanted, ev); 
 }
 
 typedef struct beacon_status_v0
@@ -452,31 +1021,115 @@ typedef struct beacon_status_v1
   uint32_t dynamic_beam_mask;                                    //!<  the dynamic beam mask 
 } beacon_status_v1_t; 
 
+#define STATUS_PACKED_FIELDS(F) \
+  F(global_scalers, uint16_t, 2, BN_NUM_SCALERS) \
+  F(beam_scalers, uint16_t, 2, BN_NUM_SCALERS * BN_NUM_BEAMS) \
+  F(deadtime, uint32_t, 4, 1) \
+  F(readout_time, uint32_t, 4, 1) \
+  F(readout_time_ns, uint32_t, 4, 1) \
+  F(trigger_thresholds, uint32_t, 4, BN_NUM_BEAMS) \
+  F(latched_pps_time, uint64_t, 8, 1) \
+  F(board_id, uint8_t, 1, 1) \
+  F(dynamic_beam_mask, uint32_t, 4, 1) \
+  F(veto_status, uint8_t, 1, 1) 
+
+#define STATUS_PACKED_SIZE (0 STATUS_PACKED_FIELDS(PACKED_FIELD_SIZE)) 
+
+static void status_pack(const beacon_status_t * x, uint8_t * p) 
+{
+  int i; 
+  STATUS_PACKED_FIELDS(PACK_FIELD) 
+}
+
+static void status_unpack(const uint8_t * p, beacon_status_t * x) 
+{
+  int i; 
+  memset(x, 0, sizeof(*x)); 
+  STATUS_PACKED_FIELDS(UNPACK_FIELD) 
+}
+
+/* Body sizes for each status version. Version 2 is beacon_status_t as it is now. */ 
+static const int beacon_status_sizes[] = { sizeof(beacon_status_v0_t), sizeof(beacon_status_v1_t), sizeof(beacon_status_t), STATUS_PACKED_SIZE }; 
+
+static int status_body_size(uint8_t ver) 
+{
+  return beacon_status_sizes[ver & ~BEACON_VERSION_CRC32C]; 
+}
+
+/* copies a status body of status_body_size(ver) bytes, filling in what older versions don't have */ 
+static void status_copy(uint8_t ver, const void * body, beacon_status_t * st) 
+{
+  if ((ver & ~BEACON_VERSION_CRC32C) > BEACON_STATUS_STRUCT_VERSION) 
+  {
+    status_unpack(body, st); 
+    return; 
+  }
+
+  memcpy(st, body, status_body_size(ver)); 
+
+  switch(ver & ~BEACON_VERSION_CRC32C) 
+  {
+    //add cases here if necessary 
+   case 0: 
+      st->board_id = 1; 
+      st->dynamic_beam_mask = 0; 
+      st->veto_status = 0; 
+      break; 
+   case 1: 
+      st->veto_status = 0;
+      break; 
+   default: //version 2 is the whole struct 
+      break; 
+  }
+}
+
+/* decodes a status body of status_body_size(start->ver) bytes */ 
+static int status_decode(const struct packet_start * start, const void * body, beacon_status_t * st) 
+{
+  if (packet_cksum(start->ver, status_body_size(start->ver), body) != start->cksum) 
+  {
+    return BN_ERR_CHECKSUM_FAILED; 
+  }
 
+  status_copy(start->ver, body, st); 
+  return 0; 
+}
 
 
-/** The on-disk format is packet_start followed by the newest version of the status struct. 
+/** The on-disk format is packet_start followed by the status: the struct itself up to version 2, 
+ * packed (see STATUS_PACKED_FIELDS) since version 3. 
  *
  * Note that the implementation of status and header are basically the same right now... but that might
  * change if one of the versions changes. 
  */
-static int beacon_status_generic_write(struct generic_file gf, const beacon_status_t *st) 
+int beacon_status_serialize(void * buf, size_t cap, const beacon_status_t * st) 
+{
+  uint8_t body[STATUS_PACKED_SIZE]; 
+  status_pack(st, body); 
+  return packet_serialize(buf, cap, BEACON_STATUS_MAGIC, BEACON_STATUS_VERSION, sizeof(body), body); 
+}
+
+int beacon_status_deserialize(const void * buf, size_t len, beacon_status_t * st) 
 {
   struct packet_start start; 
-  int written; 
-  start.magic = BEACON_STATUS_MAGIC; 
-  start.ver = BEACON_STATUS_VERSION; 
-  start.cksum = stupid_fletcher16(sizeof(beacon_status_t), st); 
+  int size; 
+  int ret = packet_start_parse(buf, len, &start, BEACON_STATUS_MAGIC, BEACON_STATUS_VERSION); 
+  if (ret) return -ret; 
 
-  written = generic_write(gf, sizeof(start), &start); 
-  if (written != sizeof(start)) 
-  {
-    return BN_ERR_NOT_ENOUGH_BYTES; 
-  }
+  size = sizeof(start) + status_body_size(start.ver); 
+  if (len < (size_t) size) return -BN_ERR_NOT_ENOUGH_BYTES; 
 
-  written = generic_write(gf, sizeof(beacon_status_t), st); 
-  
-  if (written != sizeof(beacon_status_t))
+  ret = status_decode(&start, (const uint8_t*) buf + sizeof(start), st); 
+  return ret ? -ret : size; 
+}
+
+static int beacon_status_generic_write(struct generic_file gf, const beacon_status_t *st) 
+{
+  uint8_t buf[BN_MAX_STATUS_BYTES]; 
+  int size = beacon_status_serialize(buf, sizeof(buf), st); 
+  if (size < 0) return -size; 
+
+  if (generic_write(gf, size, buf) != size) 
   {
     return BN_ERR_NOT_ENOUGH_BYTES; 
   }
@@ -487,53 +1140,22 @@ static int beacon_status_generic_write(struct generic_file gf, const beacon_stat
 static int beacon_status_generic_read(struct generic_file gf, beacon_status_t *st) 
 {
   struct packet_start start; 
+  uint8_t body[sizeof(beacon_status_t)]; 
   int got; 
   int wanted; 
-  uint16_t cksum; 
 
   got = packet_start_read(gf, &start, BEACON_STATUS_MAGIC, BEACON_STATUS_VERSION); 
   if (got) return got; 
 
-  switch(start.ver) 
-  {
-    //add cases here if necessary 
-   case 0: 
-      wanted = sizeof(beacon_status_v0_t); 
-      got = generic_read(gf, wanted, st); 
-      cksum = stupid_fletcher16(wanted, st); 
-      st->board_id = 1; 
-      st->dynamic_beam_mask = 0; 
-      st->veto_status = 0; 
-      break; 
-   case 1: 
-      wanted = sizeof(beacon_status_v1_t); 
-      got = generic_read(gf, wanted, st); 
-      cksum = stupid_fletcher16(wanted, st); 
-      st->veto_status = 0;
-      break; 
-   case BEACON_STATUS_VERSION: //this is the most recent status!
-      wanted = sizeof(beacon_status_t); 
-      got = generic_read(gf, wanted, st); 
-      cksum = stupid_fletcher16(wanted, st); 
-      break; 
-    default: 
-      fprintf(stderr,"unknown version %d\n", start.ver); 
-      return BN_ERR_BAD_VERSION; 
-  }
-
+  wanted = status_body_size(start.ver); 
+  got = generic_read(gf, wanted, body); 
   if (wanted!=got)
   {
     printf("Wanted %d, got %d\n", wanted,got); 
     return BN_ERR_NOT_ENOUGH_BYTES; 
   }
 
-  if (cksum != start.cksum) 
-  {
-    printf("Wanted %d, got %d\n", cksum,start.cksum); 
-    return BN_ERR_CHECKSUM_FAILED; 
-  }
-
-  return 0; 
+  return status_decode(&start, body, st); 
 }
 
 typedef struct beacon_hk_v0
@@ -552,26 +1174,72 @@ typedef struct beacon_hk_v0
   uint32_t free_mem_kB;  
 } beacon_hk_v0_t; 
 
+static const int beacon_hk_sizes[] = { sizeof(beacon_hk_v0_t), sizeof(beacon_hk_t) }; 
 
+static int hk_body_size(uint8_t ver) 
+{
+  return beacon_hk_sizes[ver & ~BEACON_VERSION_CRC32C]; 
+}
 
-
-static int beacon_hk_generic_write(struct generic_file gf, const beacon_hk_t *hk)
+/* copies a hk body of hk_body_size(ver) bytes, filling in what older versions don't have */ 
+static void hk_copy(uint8_t ver, const void * body, beacon_hk_t * hk) 
 {
-  struct packet_start start; 
-  int written; 
-  start.magic = BEACON_HK_MAGIC; 
-  start.ver = BEACON_HK_VERSION; 
-  start.cksum = stupid_fletcher16(sizeof(beacon_hk_t), hk); 
+  memcpy(hk, body, hk_body_size(ver)); 
 
-  written = generic_write(gf, sizeof(start), &start); 
-  if (written != sizeof(start)) 
+  switch(ver & ~BEACON_VERSION_CRC32C) 
   {
-    return BN_ERR_NOT_ENOUGH_BYTES; 
+    //add cases here if necessary 
+    case 0: 
+      //set the rest to zero 
+      hk->inv_batt_dV = 0;
+      hk->cc_batt_dV = 0;
+      hk->pv_dV = 0;
+      hk->cc_daily_Ah = 0;
+      hk->cc_daily_hWh = 0;
+      break; 
+    default: //this is the most recent hk!
+      break; 
   }
+}
 
-  written = generic_write(gf, sizeof(beacon_hk_t), hk); 
-  
-  if (written != sizeof(beacon_hk_t))
+/* decodes a hk body of hk_body_size(start->ver) bytes */ 
+static int hk_decode(const struct packet_start * start, const void * body, beacon_hk_t * hk) 
+{
+  if (packet_cksum(start->ver, hk_body_size(start->ver), body) != start->cksum) 
+  {
+    return BN_ERR_CHECKSUM_FAILED; 
+  }
+
+  hk_copy(start->ver, body, hk); 
+  return 0; 
+}
+
+int beacon_hk_serialize(void * buf, size_t cap, const beacon_hk_t * hk) 
+{
+  return packet_serialize(buf, cap, BEACON_HK_MAGIC, BEACON_HK_VERSION, sizeof(beacon_hk_t), hk); 
+}
+
+int beacon_hk_deserialize(const void * buf, size_t len, beacon_hk_t * hk) 
+{
+  struct packet_start start; 
+  int size; 
+  int ret = packet_start_parse(buf, len, &start, BEACON_HK_MAGIC, BEACON_HK_VERSION); 
+  if (ret) return -ret; 
+
+  size = sizeof(start) + hk_body_size(start.ver); 
+  if (len < (size_t) size) return -BN_ERR_NOT_ENOUGH_BYTES; 
+
+  ret = hk_decode(&start, (const uint8_t*) buf + sizeof(start), hk); 
+  return ret ? -ret : size; 
+}
+
+static int beacon_hk_generic_write(struct generic_file gf, const beacon_hk_t *hk)
+{
+  uint8_t buf[BN_MAX_HK_BYTES]; 
+  int size = beacon_hk_serialize(buf, sizeof(buf), hk); 
+  if (size < 0) return -size; 
+
+  if (generic_write(gf, size, buf) != size) 
   {
     return BN_ERR_NOT_ENOUGH_BYTES; 
   }
@@ -582,48 +1250,21 @@ static int beacon_hk_generic_write(struct generic_file gf, const beacon_hk_t *hk
 static int beacon_hk_generic_read(struct generic_file gf, beacon_hk_t *hk) 
 {
   struct packet_start start; 
+  uint8_t body[sizeof(beacon_hk_t)]; 
   int got; 
   int wanted; 
-  uint16_t cksum; 
 
   got = packet_start_read(gf, &start, BEACON_HK_MAGIC, BEACON_HK_VERSION); 
   if (got) return got; 
 
-  switch(start.ver) 
-  {
-    //add cases here if necessary 
-    case 0: 
-      wanted = sizeof(beacon_hk_v0_t); 
-      got = generic_read(gf,wanted,hk); 
-      cksum = stupid_fletcher16(wanted,hk); 
-      //set the rest to zero 
-      hk->inv_batt_dV = 0;
-      hk->cc_batt_dV = 0;
-      hk->pv_dV = 0;
-      hk->cc_daily_Ah = 0;
-      hk->cc_daily_hWh = 0;
-      break; 
-    
-    case BEACON_HK_VERSION: //this is the most recent hk!
-      wanted = sizeof(beacon_hk_t); 
-      got = generic_read(gf, wanted, hk); 
-      cksum = stupid_fletcher16(wanted, hk); 
-      break; 
-    default: 
-    return BN_ERR_BAD_VERSION; 
-  }
-
+  wanted = hk_body_size(start.ver); 
+  got = generic_read(gf, wanted, body); 
   if (wanted!=got)
   {
     return BN_ERR_NOT_ENOUGH_BYTES; 
   }
 
-  if (cksum != start.cksum) 
-  {
-    return BN_ERR_CHECKSUM_FAILED; 
-  }
-
-  return 0; 
+  return hk_decode(&start, body, hk); 
 }
 
 
@@ -728,7 +1369,253 @@ int beacon_hk_gzread(gzFile f, beacon_hk_t * h)
   return beacon_hk_generic_read(gf, h); 
 }
 
+int beacon_event_sinkwrite(const beacon_sink_t * sink, const beacon_event_t * ev) 
+{
+  struct generic_file gf=  { .type = SINK, .handle.sink = sink }; 
+  return beacon_event_generic_write(gf, ev); 
+}
+
+int beacon_status_sinkwrite(const beacon_sink_t * sink, const beacon_status_t * st) 
+{
+  struct generic_file gf=  { .type = SINK, .handle.sink = sink }; 
+  return beacon_status_generic_write(gf, st); 
+}
+
+int beacon_header_sinkwrite(const beacon_sink_t * sink, const beacon_header_t * h) 
+{
+  struct generic_file gf=  { .type = SINK, .handle.sink = sink }; 
+  return beacon_header_generic_write(gf, h); 
+}
+
+int beacon_hk_sinkwrite(const beacon_sink_t * sink, const beacon_hk_t * hk) 
+{
+  struct generic_file gf=  { .type = SINK, .handle.sink = sink }; 
+  return beacon_hk_generic_write(gf, hk); 
+}
+
+
+/* In place access to records (e.g. in a memory mapped file). beacon_record_check() does the framing and
+ * (optionally) the checksum, so the views don't have to. */
+
+/* checksum of a complete event body of the given size, done the same way as beacon_event_serialize() */
+static uint16_t event_cksum(uint8_t ver, const uint8_t * body, int size) 
+{
+  struct packet_cksum cksum; 
+  uint16_t buffer_length; 
+  const uint8_t * board_id = body + sizeof(uint64_t) + sizeof(uint16_t); 
+  const uint8_t * p = body + EVENT_PREFIX_SIZE; 
+  int i, ibd; 
+
+  if (ver & ~BEACON_VERSION_CRC32C) return packet_cksum(ver, size, body); 
+
+  memcpy(&buffer_length, body + sizeof(uint64_t), sizeof(buffer_length)); 
+  packet_cksum_init(&cksum, ver); 
+  packet_cksum_append(&cksum, sizeof(uint64_t), body); 
+  packet_cksum_append(&cksum, sizeof(uint16_t), body + sizeof(uint64_t)); 
+  packet_cksum_append(&cksum, BN_MAX_BOARDS, board_id); 
+
+  for (ibd = 0; ibd < BN_MAX_BOARDS; ibd++) 
+  {
+    if (!board_id[ibd]) continue; 
+    for (i = 0; i < BN_NUM_CHAN; i++) 
+    {
+      packet_cksum_append(&cksum, buffer_length, p); 
+      p += buffer_length; 
+    }
+  }
+
+  return packet_cksum_value(&cksum); 
+}
+
+int beacon_record_check(const void * buf, size_t len, beacon_record_type_t * type, int verify) 
+{
+  struct packet_start start; 
+  const uint8_t * body = (const uint8_t*) buf + sizeof(start); 
+  uint16_t cksum; 
+  int size = 0; 
+  int ret; 
+
+  if (len < sizeof(start)) return -BN_ERR_NOT_ENOUGH_BYTES; 
+  memcpy(&start, buf, sizeof(start)); 
+
+  switch (start.magic) 
+  {
+    case BEACON_HEADER_MAGIC:
+      ret = packet_start_check(&start, BEACON_HEADER_MAGIC, BEACON_HEADER_VERSION); 
+      if (!ret) size = header_body_size(start.ver); 
+      break; 
+    case BEACON_EVENT_MAGIC:
+      ret = packet_start_check(&start, BEACON_EVENT_MAGIC, BEACON_EVENT_VERSION); 
+      if (ret) break; 
+      if (len < sizeof(start) + event_prefix_size(start.ver)) return -BN_ERR_NOT_ENOUGH_BYTES; 
+      size = event_prefix_check(start.ver, body); 
+      if (size < 0) return size; 
+      break; 
+    case BEACON_STATUS_MAGIC:
+      ret = packet_start_check(&start, BEACON_STATUS_MAGIC, BEACON_STATUS_VERSION); 
+      if (!ret) size = status_body_size(start.ver); 
+      break; 
+    case BEACON_HK_MAGIC:
+      ret = packet_start_check(&start, BEACON_HK_MAGIC, BEACON_HK_VERSION); 
+      if (!ret) size = hk_body_size(start.ver); 
+      break; 
+    default:
+      return -BN_ERR_WRONG_TYPE; 
+  }
+
+  if (ret) return -ret; 
+  if (len < sizeof(start) + size) return -BN_ERR_NOT_ENOUGH_BYTES; 
+
+  if (verify) 
+  {
+    cksum = start.magic == BEACON_EVENT_MAGIC ? event_cksum(start.ver, body, size) : packet_cksum(start.ver, size, body); 
+    if (cksum != start.cksum) return -BN_ERR_CHECKSUM_FAILED; 
+  }
+
+  if (type) *type = (beacon_record_type_t) start.magic; 
+  return sizeof(start) + size; 
+}
+
+int64_t beacon_record_find(const void * buf, size_t len, beacon_record_type_t type, int partial) 
+{
+  const uint8_t * start = buf; 
+  const uint8_t * end = start + len; 
+  const uint8_t * p = start; 
+
+  //only places starting with the magic byte are worth a closer look 
+  while (p < end && (p = memchr(p, type, end - p))) 
+  {
+    beacon_record_type_t got; 
+    int size = beacon_record_check(p, end - p, &got, 1); 
+
+    if (size == -BN_ERR_NOT_ENOUGH_BYTES && partial) return p - start; 
+
+    if (size > 0) 
+    {
+      // a good checksum could be luck, so the next record has to look right too (unless there isn't one) 
+      const uint8_t * next = p + size; 
+      int next_size = beacon_record_check(next, end - next, &got, 0); 
+      if (next == end || (next_size > 0 && got == type) || (next_size == -BN_ERR_NOT_ENOUGH_BYTES && *next == type)) 
+      {
+        return p - start; 
+      }
+    }
+
+    p++; 
+  }
+
+  return -1; 
+}
+
+int beacon_event_view(const void * buf, size_t len, beacon_event_view_t * view, uint8_t * scratch) 
+{
+  struct packet_start start; 
+  const uint8_t * body = (const uint8_t*) buf + sizeof(start); 
+  const uint8_t * p; 
+  const uint8_t * end; 
+  int i, ibd; 
+  int size; 
+  int ret = packet_start_parse(buf, len, &start, BEACON_EVENT_MAGIC, BEACON_EVENT_VERSION); 
+  if (ret) return -ret; 
+
+  if (len < sizeof(start) + event_prefix_size(start.ver)) return -BN_ERR_NOT_ENOUGH_BYTES; 
+  size = event_prefix_check(start.ver, body); 
+  if (size < 0) return size; 
+  if (len < sizeof(start) + size) return -BN_ERR_NOT_ENOUGH_BYTES; 
+
+  memcpy(&view->event_number, body, sizeof(view->event_number)); 
+  memcpy(&view->buffer_length, body + sizeof(uint64_t), sizeof(view->buffer_length)); 
+  memcpy(&view->board_id, body + sizeof(uint64_t) + sizeof(uint16_t), sizeof(view->board_id)); 
+
+  p = body + event_prefix_size(start.ver); 
+  end = body + size; 
+
+  for (ibd = 0; ibd < BN_MAX_BOARDS; ibd++) 
+  {
+    for (i = 0; i < BN_NUM_CHAN; i++) 
+    {
+      if (!view->board_id[ibd]) 
+      {
+        view->data[ibd][i] = NULL; 
+      }
+      else if (start.ver & ~BEACON_VERSION_CRC32C) 
+      {
+        int n = beacon_wf_decode(p, end - p, scratch, view->buffer_length); 
+        if (n < 0) return -BN_ERR_BAD_LENGTH; 
+        view->data[ibd][i] = scratch; 
+        scratch += view->buffer_length; 
+        p += n; 
+      }
+      else
+      {
+        view->data[ibd][i] = p; 
+        p += view->buffer_length; 
+      }
+    }
+  }
+
+  return p == end ? (int) sizeof(start) + size : -BN_ERR_BAD_LENGTH; 
+}
+
+void beacon_event_view_copy(const beacon_event_view_t * view, beacon_event_t * ev) 
+{
+  int i, ibd; 
+  ev->event_number = view->event_number; 
+  ev->buffer_length = view->buffer_length; 
+  memcpy(ev->board_id, view->board_id, sizeof(ev->board_id)); 
+
+  for (ibd = 0; ibd < BN_MAX_BOARDS; ibd++) 
+  {
+    if (!view->board_id[ibd]) 
+    {
+      memset(ev->data[ibd], 0, sizeof(ev->data[ibd])); 
+      continue; 
+    }
+
+    for (i = 0; i < BN_NUM_CHAN; i++) 
+    {
+      memcpy(ev->data[ibd][i], view->data[ibd][i], view->buffer_length); 
+      memset(ev->data[ibd][i] + view->buffer_length, 0, BN_MAX_WAVEFORM_LENGTH - view->buffer_length); 
+    }
+  }
+}
+
+/* records of the struct versions are the struct itself, so can be used in place if they're aligned */
+#define RECORD_IN_PLACE(start, body, version, type) \
+  (((start).ver & ~BEACON_VERSION_CRC32C) == (version) && ((uintptr_t) (body)) % __alignof__(type) == 0) 
+
+const beacon_header_t * beacon_header_view(const void * buf, size_t len, beacon_header_t * scratch) 
+{
+  struct packet_start start; 
+  const uint8_t * body = (const uint8_t*) buf + sizeof(start); 
+  if (packet_start_parse(buf, len, &start, BEACON_HEADER_MAGIC, BEACON_HEADER_VERSION)) return NULL; 
+  if (len < sizeof(start) + header_body_size(start.ver)) return NULL; 
+  if (RECORD_IN_PLACE(start, body, BEACON_HEADER_STRUCT_VERSION, beacon_header_t)) return (const beacon_header_t*) body; 
+  header_copy(start.ver, body, scratch); 
+  return scratch; 
+}
+
+const beacon_status_t * beacon_status_view(const void * buf, size_t len, beacon_status_t * scratch) 
+{
+  struct packet_start start; 
+  const uint8_t * body = (const uint8_t*) buf + sizeof(start); 
+  if (packet_start_parse(buf, len, &start, BEACON_STATUS_MAGIC, BEACON_STATUS_VERSION)) return NULL; 
+  if (len < sizeof(start) + status_body_size(start.ver)) return NULL; 
+  if (RECORD_IN_PLACE(start, body, BEACON_STATUS_STRUCT_VERSION, beacon_status_t)) return (const beacon_status_t*) body; 
+  status_copy(start.ver, body, scratch); 
+  return scratch; 
+}
 
+const beacon_hk_t * beacon_hk_view(const void * buf, size_t len, beacon_hk_t * scratch) 
+{
+  struct packet_start start; 
+  const uint8_t * body = (const uint8_t*) buf + sizeof(start); 
+  if (packet_start_parse(buf, len, &start, BEACON_HK_MAGIC, BEACON_HK_VERSION)) return NULL; 
+  if (len < sizeof(start) + hk_body_size(start.ver)) return NULL; 
+  if (RECORD_IN_PLACE(start, body, BEACON_HK_VERSION, beacon_hk_t)) return (const beacon_hk_t*) body; 
+  hk_copy(start.ver, body, scratch); 
+  return scratch; 
+}
 
 
 /* pretty prints */ 
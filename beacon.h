@@ -68,9 +68,53 @@ typedef enum
 BN_ERR_CHECKSUM_FAILED  = 0xbadadd,  //!< checksum failed while reading
 BN_ERR_NOT_ENOUGH_BYTES = 0xbadf00d, //!< did not write or read enough bytes
 BN_ERR_WRONG_TYPE       = 0xc0fefe , //!< got nonsensical type
-BN_ERR_BAD_VERSION      = 0xbadbeef  //!< version number not understood
+BN_ERR_BAD_VERSION      = 0xbadbeef, //!< version number not understood
+BN_ERR_BAD_LENGTH       = 0xbad5123, //!< a length (e.g. buffer_length) that makes no sense 
+BN_ERR_NO_SUCH_EVENT    = 0xbad0e1   //!< asked to seek to an event that isn't there
 } beacon_io_error_t; 
 
+/** Checksum used for the packets we write. 
+ *
+ * BN_CKSUM_FLETCHER16 is what we've always used and is readable by every version of this library. 
+ * BN_CKSUM_CRC32C is much faster where there is hardware support (SSE4.2 or ARMv8 CRC), but files
+ * written with it can only be read by versions of this library that know about it. 
+ */ 
+typedef enum beacon_checksum
+{
+  BN_CKSUM_FLETCHER16 = 0, //!< the original (fletcher-like) checksum, the default
+  BN_CKSUM_CRC32C = 1      //!< CRC32C, folded to 16 bits 
+} beacon_checksum_t; 
+
+/** Set the checksum used by all subsequent writes (in this process). Reading handles both types automatically. */ 
+void beacon_set_write_checksum(beacon_checksum_t type); 
+
+/** Get the checksum used for writing */
+beacon_checksum_t beacon_get_write_checksum(); 
+
+/** How the waveforms of the events we write are stored. 
+ *
+ * BN_EVENT_CODEC_PACKED uses the lossless codec in beaconcodec.h, which typically makes events 
+ * a few times smaller, much faster than gzip does. Files written with it can only be read by versions
+ * of this library that know about it. 
+ */ 
+typedef enum beacon_event_codec
+{
+  BN_EVENT_CODEC_RAW = 0,    //!< samples stored as is (event version 0), the default
+  BN_EVENT_CODEC_PACKED = 1  //!< samples stored with beacon_wf_encode() (event version 1)
+} beacon_event_codec_t; 
+
+/** Set the waveform encoding used by all subsequent event writes (in this process). Reading handles both automatically. */ 
+void beacon_set_write_event_codec(beacon_event_codec_t codec); 
+
+/** Get the waveform encoding used for writing */ 
+beacon_event_codec_t beacon_get_write_event_codec(); 
+
+/** The checksum used for BN_CKSUM_FLETCHER16 packets. Pass 0 for append unless continuing a previous checksum. */ 
+uint16_t beacon_fletcher16(size_t N, const void * buf, uint16_t append); 
+
+/** CRC32C of the buffer (before folding). Pass 0 for append unless continuing a previous checksum. */ 
+uint32_t beacon_crc32c(size_t N, const void * buf, uint32_t append); 
+
 
  
 /**  Trigger types */ 
@@ -288,6 +332,127 @@ int beacon_hk_read(FILE * f, beacon_hk_t * h);
 /** read this hk from compressed file. The size will be different than sizeof(beacon_hk_t). Returns 0 on success. */ 
 int beacon_hk_gzread(gzFile  f, beacon_hk_t * h); 
 
+/** The maximum number of bytes beacon_header_serialize() will produce */ 
+#define BN_MAX_HEADER_BYTES (4 + sizeof(beacon_header_t))
+
+/** The maximum number of bytes beacon_event_serialize() will produce (a packed event may have one extra byte per channel, and the length) */ 
+#define BN_MAX_EVENT_BYTES (4 + 8 + 2 + BN_MAX_BOARDS + 4 + BN_MAX_BOARDS * BN_NUM_CHAN * (1 + BN_MAX_WAVEFORM_LENGTH))
+
+/** The maximum number of bytes beacon_status_serialize() will produce */ 
+#define BN_MAX_STATUS_BYTES (4 + sizeof(beacon_status_t))
+
+/** The maximum number of bytes beacon_hk_serialize() will produce */ 
+#define BN_MAX_HK_BYTES (4 + sizeof(beacon_hk_t))
+
+/** Serialize this header into buf (of capacity cap) exactly as it would be written to disk. 
+ * Returns the number of bytes used, or -BN_ERR_NOT_ENOUGH_BYTES if cap is too small. 
+ */ 
+int beacon_header_serialize(void * buf, size_t cap, const beacon_header_t * h); 
+
+/** Deserialize a header from the len bytes in buf. Returns the number of bytes consumed, or
+ * the negative of a beacon_io_error_t (-BN_ERR_NOT_ENOUGH_BYTES if buf does not hold a complete header). */
+int beacon_header_deserialize(const void * buf, size_t len, beacon_header_t * h); 
+
+/** Serialize this event into buf (of capacity cap) exactly as it would be written to disk. 
+ * Returns the number of bytes used, or the negative of a beacon_io_error_t. 
+ * BN_MAX_EVENT_BYTES is always enough. */ 
+int beacon_event_serialize(void * buf, size_t cap, const beacon_event_t * ev); 
+
+/** Deserialize an event from the len bytes in buf. Returns the number of bytes consumed, or
+ * the negative of a beacon_io_error_t (-BN_ERR_NOT_ENOUGH_BYTES if buf does not hold a complete event). */
+int beacon_event_deserialize(const void * buf, size_t len, beacon_event_t * ev); 
+
+/** Serialize this status into buf (of capacity cap) exactly as it would be written to disk. 
+ * Returns the number of bytes used, or -BN_ERR_NOT_ENOUGH_BYTES if cap is too small. 
+ */ 
+int beacon_status_serialize(void * buf, size_t cap, const beacon_status_t * st); 
+
+/** Deserialize a status from the len bytes in buf. Returns the number of bytes consumed, or
+ * the negative of a beacon_io_error_t (-BN_ERR_NOT_ENOUGH_BYTES if buf does not hold a complete status). */
+int beacon_status_deserialize(const void * buf, size_t len, beacon_status_t * st); 
+
+/** Serialize this hk into buf (of capacity cap) exactly as it would be written to disk. 
+ * Returns the number of bytes used, or -BN_ERR_NOT_ENOUGH_BYTES if cap is too small. 
+ */ 
+int beacon_hk_serialize(void * buf, size_t cap, const beacon_hk_t * hk); 
+
+/** Deserialize a hk from the len bytes in buf. Returns the number of bytes consumed, or
+ * the negative of a beacon_io_error_t (-BN_ERR_NOT_ENOUGH_BYTES if buf does not hold a complete hk). */
+int beacon_hk_deserialize(const void * buf, size_t len, beacon_hk_t * hk);
+
+
+/** The kinds of records in data files (these are the magic bytes they start with) */
+typedef enum beacon_record_type
+{
+  BN_RECORD_HEADER = 0xbe,
+  BN_RECORD_EVENT  = 0xac,
+  BN_RECORD_STATUS = 0x04,
+  BN_RECORD_HK     = 0xcc
+} beacon_record_type_t;
+
+/** Check the record at the start of the len bytes in buf without decoding it: the magic byte, the version and that
+ * all of it is there, plus the checksum if verify is nonzero. The type is stored in *type if it's not NULL.
+ * Returns the size of the record, or the negative of a beacon_io_error_t. */
+int beacon_record_check(const void * buf, size_t len, beacon_record_type_t * type, int verify);
+
+/** Find the first record of the given type in the len bytes at buf, i.e. get back in step after corruption (or after
+ * starting somewhere arbitrary). A record counts if its magic byte, version and checksum check out and the record after it
+ * (if there's anything after it) at least starts like one. If partial is nonzero, something that might be a record but runs
+ * off the end of buf also counts, so a streaming reader knows to get more before deciding.
+ * Returns the offset of the record, or -1 if there is none. */
+int64_t beacon_record_find(const void * buf, size_t len, beacon_record_type_t type, int partial);
+
+/** A read-only view of an event record in memory (e.g. a memory mapped file), filled by beacon_event_view(). */
+typedef struct beacon_event_view
+{
+  uint64_t event_number;                                 //!< same as in beacon_event_t
+  uint16_t buffer_length;                                //!< the number of samples behind each data pointer
+  uint8_t board_id[BN_MAX_BOARDS];                       //!< same as in beacon_event_t
+  const uint8_t * data[BN_MAX_BOARDS][BN_NUM_CHAN];      //!< buffer_length samples per channel, NULL for missing boards
+} beacon_event_view_t;
+
+/** How much scratch space beacon_event_view() may need to decode a packed event */
+#define BN_EVENT_VIEW_SCRATCH_BYTES (BN_MAX_BOARDS * BN_NUM_CHAN * BN_MAX_WAVEFORM_LENGTH)
+
+/** Fill in a view of the event record at the start of buf, without copying the waveforms: for raw events the data pointers
+ * point into buf. Packed events have to be decoded, into scratch (of BN_EVENT_VIEW_SCRATCH_BYTES), and the data pointers
+ * point there. The checksum is not verified (see beacon_record_check()).
+ * Returns the size of the record, or the negative of a beacon_io_error_t. */
+int beacon_event_view(const void * buf, size_t len, beacon_event_view_t * view, uint8_t * scratch);
+
+/** Copy an event view into an event (zeroing the samples past buffer_length, like beacon_event_read() does) */
+void beacon_event_view_copy(const beacon_event_view_t * view, beacon_event_t * ev);
+
+/** Get at the header record at the start of buf. If it's stored as the struct itself (as older versions were) and is
+ * suitably aligned, this points into buf, otherwise it's decoded into scratch. The checksum is not verified (see beacon_record_check()). Returns NULL on error. */
+const beacon_header_t * beacon_header_view(const void * buf, size_t len, beacon_header_t * scratch);
+
+/** Get at the status record at the start of buf, see beacon_header_view() */
+const beacon_status_t * beacon_status_view(const void * buf, size_t len, beacon_status_t * scratch);
+
+/** Get at the hk record at the start of buf, see beacon_header_view() */
+const beacon_hk_t * beacon_hk_view(const void * buf, size_t len, beacon_hk_t * scratch);
+
+
+/** A custom destination for records. write() gets each complete record in one call and should return 0 on success. */
+typedef struct beacon_sink 
+{
+  int (*write)(void * ctx, const void * buf, size_t n); 
+  void * ctx; 
+} beacon_sink_t; 
+
+/** Write the header to a custom sink. Returns 0 on success. */ 
+int beacon_header_sinkwrite(const beacon_sink_t * sink, const beacon_header_t * h); 
+
+/** Write the event to a custom sink. Returns 0 on success. */ 
+int beacon_event_sinkwrite(const beacon_sink_t * sink, const beacon_event_t * ev); 
+
+/** Write the status to a custom sink. Returns 0 on success. */ 
+int beacon_status_sinkwrite(const beacon_sink_t * sink, const beacon_status_t * st); 
+
+/** Write the hk to a custom sink. Returns 0 on success. */ 
+int beacon_hk_sinkwrite(const beacon_sink_t * sink, const beacon_hk_t * hk); 
+
 #undef ARRAY1D
 #undef ARRAY2D
 #undef ARRAY3D
@@ -0,0 +1,247 @@
+#include "beaconblock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <zlib.h>
+
+
+#define DEFAULT_BLOCK_BYTES (4 << 20)
+
+// O_DIRECT wants buffers, offsets and lengths aligned to the device's logical block size, which is at most this
+#define ALIGNMENT 4096
+
+
+struct beacon_blockfile
+{
+  beacon_blockfile_opts_t opts;
+  int fd;
+  int direct;
+  int err;
+
+  uint8_t * block;
+  size_t fill;              // bytes in the block
+  uint64_t offset;          // where the block goes in the file
+
+  int gz;
+  z_stream z;
+
+  beacon_sink_t sink;
+  beacon_blockfile_stats_t stats;
+};
+
+
+static double since(const struct timespec * t0)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec - t0->tv_sec + 1e-9 * (now.tv_nsec - t0->tv_nsec);
+}
+
+static int pwrite_all(int fd, const uint8_t * p, size_t n, uint64_t offset)
+{
+  while (n)
+  {
+    ssize_t wrote = pwrite(fd, p, n, offset);
+    if (wrote < 0 && errno == EINTR) continue;
+    if (wrote <= 0) return wrote < 0 ? -errno : -EIO;
+    p += wrote;
+    n -= wrote;
+    offset += wrote;
+  }
+  return 0;
+}
+
+/* writes the first len bytes of the block at its offset, padding them out if using O_DIRECT */
+static int write_block(beacon_blockfile_t * b, size_t len)
+{
+  struct timespec t0;
+  size_t padded = len;
+  int ret;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (b->direct)
+  {
+    padded = (len + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    memset(b->block + len, 0, padded - len);
+  }
+
+  ret = pwrite_all(b->fd, b->block, padded, b->offset);
+
+  // some filesystems accept O_DIRECT at open but not when writing; carry on without it
+  if (ret == -EINVAL && b->direct)
+  {
+    b->direct = 0;
+    if (fcntl(b->fd, F_SETFL, fcntl(b->fd, F_GETFL) & ~O_DIRECT)) return (b->err = 1);
+    padded = len;
+    ret = pwrite_all(b->fd, b->block, padded, b->offset);
+  }
+
+  if (ret) return (b->err = 1);
+
+  // a partial block was padded; the file ends at the real data
+  if (padded != len && ftruncate(b->fd, b->offset + len)) return (b->err = 1);
+
+  b->stats.blocks++;
+  b->stats.bytes_out += padded;
+  b->stats.write_time += since(&t0);
+  return 0;
+}
+
+static int emit_if_full(beacon_blockfile_t * b)
+{
+  if (b->fill < b->opts.block_bytes) return 0;
+  if (write_block(b, b->fill)) return 1;
+  b->offset += b->fill;
+  b->fill = 0;
+  return 0;
+}
+
+/* runs deflate with the given flush mode until it's done, writing out blocks as they fill */
+static int deflate_all(beacon_blockfile_t * b, int flush)
+{
+  while (1)
+  {
+    int ret;
+    b->z.next_out = b->block + b->fill;
+    b->z.avail_out = b->opts.block_bytes - b->fill;
+    ret = deflate(&b->z, flush);
+    b->fill = b->opts.block_bytes - b->z.avail_out;
+    if (ret == Z_STREAM_ERROR || emit_if_full(b)) return (b->err = 1);
+
+    if (flush == Z_FINISH ? ret == Z_STREAM_END : (!b->z.avail_in && b->z.avail_out)) return 0;
+  }
+}
+
+
+int beacon_blockfile_write(beacon_blockfile_t * b, const void * buf, size_t n)
+{
+  const uint8_t * p = buf;
+  size_t len = n;
+
+  if (b->err) return 1;
+
+  if (b->gz)
+  {
+    b->z.next_in = (Bytef *) p;
+    b->z.avail_in = n;
+    if (deflate_all(b, Z_NO_FLUSH)) return 1;
+  }
+  else
+  {
+    while (n)
+    {
+      size_t piece = b->opts.block_bytes - b->fill;
+      if (piece > n) piece = n;
+      memcpy(b->block + b->fill, p, piece);
+      b->fill += piece;
+      p += piece;
+      n -= piece;
+      if (emit_if_full(b)) return 1;
+    }
+  }
+
+  b->stats.records++;
+  b->stats.bytes_in += len;
+  return 0;
+}
+
+static int blockfile_sink_write(void * ctx, const void * buf, size_t n)
+{
+  return beacon_blockfile_write(ctx, buf, n);
+}
+
+const beacon_sink_t * beacon_blockfile_sink(beacon_blockfile_t * b)
+{
+  return &b->sink;
+}
+
+
+beacon_blockfile_t * beacon_blockfile_open(const char * path, const beacon_blockfile_opts_t * opts)
+{
+  beacon_blockfile_t * b = calloc(1, sizeof(beacon_blockfile_t));
+  if (!b) return NULL;
+
+  if (opts) b->opts = *opts;
+  if (!b->opts.block_bytes) b->opts.block_bytes = DEFAULT_BLOCK_BYTES;
+  b->opts.block_bytes = (b->opts.block_bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  if (b->opts.level > 9) b->opts.level = 0;
+  b->sink.write = blockfile_sink_write;
+  b->sink.ctx = b;
+  b->fd = -1;
+
+  if (posix_memalign((void **) &b->block, ALIGNMENT, b->opts.block_bytes))
+  {
+    free(b);
+    return NULL;
+  }
+
+  if (b->opts.level >= 0)
+  {
+    // windowBits 15 + 16 for a gzip wrapper
+    if (deflateInit2(&b->z, b->opts.level ? b->opts.level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      goto fail;
+    b->gz = 1;
+  }
+
+  if (!b->opts.buffered)
+  {
+    b->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    b->direct = b->fd >= 0;
+  }
+  // not supported by the filesystem, or not wanted
+  if (b->fd < 0) b->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (b->fd < 0) goto fail;
+
+  return b;
+
+fail:
+  if (b->gz) deflateEnd(&b->z);
+  free(b->block);
+  free(b);
+  return NULL;
+}
+
+int beacon_blockfile_flush(beacon_blockfile_t * b)
+{
+  if (b->err) return 1;
+  if (b->gz)
+  {
+    b->z.avail_in = 0;
+    if (deflate_all(b, Z_SYNC_FLUSH)) return 1;
+  }
+  return b->fill ? write_block(b, b->fill) : 0;
+}
+
+int beacon_blockfile_get_stats(const beacon_blockfile_t * b, beacon_blockfile_stats_t * stats)
+{
+  *stats = b->stats;
+  stats->direct = b->direct;
+  return 0;
+}
+
+int beacon_blockfile_close(beacon_blockfile_t * b)
+{
+  int ret;
+
+  if (b->gz)
+  {
+    if (!b->err)
+    {
+      b->z.avail_in = 0;
+      deflate_all(b, Z_FINISH);
+    }
+    deflateEnd(&b->z);
+  }
+
+  if (!b->err && b->fill) write_block(b, b->fill);
+  if (close(b->fd)) b->err = 1;
+
+  ret = b->err;
+  free(b->block);
+  free(b);
+  return ret;
+}
@@ -0,0 +1,74 @@
+#ifndef _beaconblock_h
+#define _beaconblock_h
+
+#include "beacon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file beaconblock.h
+ *
+ * Output in large aligned blocks, for flash storage.
+ *
+ * Writing records (or zlib's output) as they come produces lots of small writes, which SD cards and
+ * eMMC turn into partial-page writes and erase-block rewrites. A beacon_blockfile_t instead collects
+ * the serialized (and optionally gzipped) records in a page-aligned block of a few MB and writes out
+ * only whole blocks, with O_DIRECT where the filesystem supports it and ordinary writes where it
+ * doesn't. The last, partial block is padded for the write and the file truncated to its real size,
+ * so the result is an ordinary record (or gzip) file.
+ *
+ * Typical usage:
+ *
+ *    beacon_blockfile_t * b = beacon_blockfile_open("events.gz", NULL);
+ *    while (...)  beacon_event_sinkwrite(beacon_blockfile_sink(b), &ev);
+ *    beacon_blockfile_close(b);
+ */
+
+/** opaque handle */
+typedef struct beacon_blockfile beacon_blockfile_t;
+
+/** Options for beacon_blockfile_open(). Zero means default for any member. */
+typedef struct beacon_blockfile_opts
+{
+  size_t block_bytes;   //!< size of a block, rounded up to a multiple of 4 kB (default: 4 MB)
+  int level;            //!< gzip level 1-9, or -1 to write uncompressed (default: zlib default)
+  int buffered;         //!< don't try O_DIRECT
+} beacon_blockfile_opts_t;
+
+/** Statistics, see beacon_blockfile_get_stats() */
+typedef struct beacon_blockfile_stats
+{
+  uint64_t records;     //!< records written to the sink
+  uint64_t bytes_in;    //!< uncompressed bytes written to the sink
+  uint64_t bytes_out;   //!< bytes written to the file (including padding rewritten by flushes)
+  uint64_t blocks;      //!< block writes (including partial ones from flushes)
+  int direct;           //!< whether O_DIRECT is in use
+  double write_time;    //!< seconds spent in write calls
+} beacon_blockfile_stats_t;
+
+/** Create (or truncate) path for writing. opts may be NULL for defaults. Returns NULL on failure. */
+beacon_blockfile_t * beacon_blockfile_open(const char * path, const beacon_blockfile_opts_t * opts);
+
+/** Write one record (n bytes). Returns 0 on success. */
+int beacon_blockfile_write(beacon_blockfile_t * b, const void * buf, size_t n);
+
+/** Returns a sink that writes into this file, for use with beacon_*_sinkwrite() */
+const beacon_sink_t * beacon_blockfile_sink(beacon_blockfile_t * b);
+
+/** Write out the partial block (padded) so that everything so far is in the file, which then ends at a
+ * record boundary (for gzip, after a sync flush). The block stays in memory and is written again when it
+ * fills, so this costs a rewrite; use it sparingly on flash. Returns 0 on success. */
+int beacon_blockfile_flush(beacon_blockfile_t * b);
+
+/** Fill in the current statistics */
+int beacon_blockfile_get_stats(const beacon_blockfile_t * b, beacon_blockfile_stats_t * stats);
+
+/** Finish the file, write out the last block and close. Returns 0 if there have been no errors. */
+int beacon_blockfile_close(beacon_blockfile_t * b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,507 @@
+#include "beaconcodec.h"
+#include <string.h>
+
+
+/* Implementation notes:
+ *
+ * The residuals of a block are stored as bit planes: plane k holds bit k of every sample in the
+ * block, one bit per sample, 8 samples per byte. That is exactly as compact as packing w-bit
+ * fields one after the other (for a full block, 32 * w bits either way), but it maps directly
+ * onto movemask on the way in and onto a 256-entry byte-spreading table on the way out, so
+ * neither direction has a per-sample loop.
+ *
+ * Blocks where most residuals are much smaller than the largest one can instead be rice coded:
+ * the low k bits go in bit planes as above, and the rest of each value in unary, which is
+ * decoded a word at a time with count-trailing-zeros.
+ *
+ * The predictors are all cheap enough to just try each of them on every channel and keep
+ * whichever packs smallest. Baseline wins for white noise, the deltas for oversampled / band
+ * limited signals.
+ *
+ * The predictor / zigzag / prefix sum passes work on 16 samples at a time with GCC vector
+ * extensions (which turn into SSE2 or NEON); everything has a plain C fallback.
+ *
+ * See examples/bench_codec.c for a comparison against gzip.
+ */
+
+#define BLOCK BN_CODEC_BLOCK
+
+// block codes from here up are rice coded, with k = code - RICE_CODE
+#define RICE_CODE 9
+#define MAX_RICE_K 6
+#define MAX_UNARY_BYTES BLOCK
+
+static inline uint8_t zigzag(uint8_t r)
+{
+  return (uint8_t) (r << 1) ^ (uint8_t) -(r >> 7);
+}
+
+static inline uint8_t unzigzag(uint8_t z)
+{
+  return (z >> 1) ^ (uint8_t) -(z & 1);
+}
+
+static inline uint64_t load64le(const uint8_t * p)
+{
+  uint64_t u;
+  memcpy(&u, p, sizeof(u));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  u = __builtin_bswap64(u);
+#endif
+  return u;
+}
+
+static inline void store64le(uint8_t * p, uint64_t u)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  u = __builtin_bswap64(u);
+#endif
+  memcpy(p, &u, sizeof(u));
+}
+
+// spread[c] has bit j of c in the lowest bit of byte j
+static uint64_t spread[256];
+
+__attribute__((constructor))
+static void codec_init()
+{
+  int c;
+  for (c = 0; c < 256; c++)
+  {
+    uint64_t x = c;
+    x = (x | x << 28) & 0x0000000f0000000full;
+    x = (x | x << 14) & 0x0003000300030003ull;
+    x = (x | x << 7) & 0x0101010101010101ull;
+    spread[c] = x;
+  }
+}
+
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define HAVE_VECTOR_CODEC
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef uint8_t v16u8 __attribute__((vector_size(16)));
+typedef int8_t v16i8 __attribute__((vector_size(16)));
+
+static inline v16u8 load16(const uint8_t * p)
+{
+  v16u8 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void store16(uint8_t * p, v16u8 v)
+{
+  memcpy(p, &v, sizeof(v));
+}
+
+static inline v16u8 zigzag16(v16u8 r)
+{
+  return (r << 1) ^ (v16u8) ((v16i8) r >> 7);
+}
+
+static inline v16u8 unzigzag16(v16u8 z)
+{
+  return (z >> 1) ^ (v16u8) -(z & 1);
+}
+
+// inclusive prefix sum (mod 256) of the lanes
+static inline v16u8 prefix16(v16u8 v)
+{
+  const v16u8 zero = {0};
+  v += __builtin_shuffle(v, zero, (v16u8) {16,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14});
+  v += __builtin_shuffle(v, zero, (v16u8) {16,16,0,1,2,3,4,5,6,7,8,9,10,11,12,13});
+  v += __builtin_shuffle(v, zero, (v16u8) {16,16,16,16,0,1,2,3,4,5,6,7,8,9,10,11});
+  v += __builtin_shuffle(v, zero, (v16u8) {16,16,16,16,16,16,16,16,0,1,2,3,4,5,6,7});
+  return v;
+}
+
+static inline v16u8 last16(v16u8 v)
+{
+  return __builtin_shuffle(v, (v16u8) {15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15});
+}
+#endif
+
+
+/* zigzagged residuals with respect to ref (baseline), to the previous sample (delta) and
+ * to the extrapolation of the previous two (delta2), with x[-1] = x[-2] = ref */
+static void residuals(const uint8_t * x, int n, uint8_t ref, uint8_t * zb, uint8_t * zd, uint8_t * zd2)
+{
+  int i = 0;
+  if (n <= 0) return;
+  zb[0] = zigzag(x[0] - ref);
+  zd[0] = zb[0];
+  zd2[0] = zb[0];
+  if (n > 1)
+  {
+    zb[1] = zigzag(x[1] - ref);
+    zd[1] = zigzag(x[1] - x[0]);
+    zd2[1] = zigzag(x[1] - 2 * x[0] + ref);
+  }
+  i = 2;
+
+#ifdef HAVE_VECTOR_CODEC
+  {
+    const v16u8 vref = (v16u8) {0} + ref;
+    for (; i + 16 <= n; i += 16)
+    {
+      v16u8 cur = load16(x + i);
+      v16u8 prev = load16(x + i - 1);
+      store16(zb + i, zigzag16(cur - vref));
+      store16(zd + i, zigzag16(cur - prev));
+      store16(zd2 + i, zigzag16(cur - prev - prev + load16(x + i - 2)));
+    }
+  }
+#endif
+
+  for (; i < n; i++)
+  {
+    zb[i] = zigzag(x[i] - ref);
+    zd[i] = zigzag(x[i] - x[i-1]);
+    zd2[i] = zigzag(x[i] - 2 * x[i-1] + x[i-2]);
+  }
+}
+
+/* sum of z[i] >> k over a whole block */
+static inline int sum_shifted(const uint8_t * z, int k)
+{
+  const uint64_t lanes = 0x00ff00ff00ff00ffull;
+  uint64_t acc = 0;
+  int j;
+  for (j = 0; j < BLOCK; j += 8)
+  {
+    uint64_t u = load64le(z + j) >> k & (0x0101010101010101ull * (0xff >> k));
+    acc += (u & lanes) + (u >> 8 & lanes);
+  }
+  return (acc * 0x0001000100010001ull) >> 48;
+}
+
+/* Chooses how to store each block of z, returns the total encoded size.
+ *
+ * Block codes up to 8 are bit widths. Rice coding is tried for the few k just below the width, since
+ * it only pays off when most values are well under the maximum, and is chosen when strictly smaller.
+ * That also means a rice block's unary part is always shorter than MAX_UNARY_BYTES. */
+static int plan_blocks(const uint8_t * z, int n, uint8_t * codes, int try_rice)
+{
+  int b, i, k;
+  int nblocks = (n + BLOCK - 1) / BLOCK;
+  int size = 2 + (nblocks + 1) / 2;
+  for (b = 0; b < nblocks; b++)
+  {
+    const uint8_t * p = z + b * BLOCK;
+    int len = n - b * BLOCK < BLOCK ? n - b * BLOCK : BLOCK;
+    int nbytes = (len + 7) / 8;
+    uint32_t acc = 0;
+    int w, best;
+    if (len == BLOCK)
+    {
+      uint64_t u = load64le(p) | load64le(p + 8) | load64le(p + 16) | load64le(p + 24);
+      u |= u >> 32;
+      u |= u >> 16;
+      u |= u >> 8;
+      acc = u & 0xff;
+    }
+    else
+    {
+      for (i = 0; i < len; i++) acc |= p[i];
+    }
+    w = acc ? 32 - __builtin_clz(acc) : 0;
+    best = w * nbytes;
+    codes[b] = w;
+
+    for (k = w - 1 < MAX_RICE_K ? w - 1 : MAX_RICE_K; try_rice && k >= 0 && k >= w - 3; k--)
+    {
+      int bits = len;
+      int cost;
+      if (len == BLOCK) bits += sum_shifted(p, k);
+      else for (i = 0; i < len; i++) bits += p[i] >> k;
+      cost = k * nbytes + (bits + 7) / 8;
+      if (cost < best)
+      {
+        best = cost;
+        codes[b] = RICE_CODE + k;
+      }
+    }
+    size += best;
+  }
+  return size;
+}
+
+/* writes the w bit planes of len (<= BLOCK) values, returns bytes written */
+static int pack_block(const uint8_t * z, int len, int w, uint8_t * out)
+{
+  int k, j;
+  int nbytes = (len + 7) / 8;
+  uint8_t tmp[BLOCK] = {0};
+
+  if (!w) return 0;
+
+  if (len < BLOCK)
+  {
+    memcpy(tmp, z, len);
+    z = tmp;
+  }
+
+#ifdef __SSE2__
+  {
+    __m128i lo = _mm_loadu_si128((const __m128i*) z);
+    __m128i hi = _mm_loadu_si128((const __m128i*) (z + 16));
+    lo = _mm_slli_epi16(lo, 8 - w);
+    hi = _mm_slli_epi16(hi, 8 - w);
+    for (k = w - 1; k >= 0; k--)
+    {
+      uint32_t bits = _mm_movemask_epi8(lo) | ((uint32_t) _mm_movemask_epi8(hi) << 16);
+      for (j = 0; j < nbytes; j++) out[k * nbytes + j] = bits >> (8 * j);
+      lo = _mm_slli_epi16(lo, 1);
+      hi = _mm_slli_epi16(hi, 1);
+    }
+  }
+#else
+  for (j = 0; j < nbytes; j++)
+  {
+    uint64_t u = load64le(z + 8 * j);
+    for (k = 0; k < w; k++)
+    {
+      out[k * nbytes + j] = (((u >> k) & 0x0101010101010101ull) * 0x0102040810204080ull) >> 56;
+    }
+  }
+#endif
+
+  return w * nbytes;
+}
+
+/* inverse of pack_block, writes (at least) the first len values of z, rounded up to a multiple of 8 */
+static void unpack_block(const uint8_t * in, int len, int w, uint8_t * z)
+{
+  int k, j;
+  int nbytes = (len + 7) / 8;
+  for (j = 0; j < nbytes; j++)
+  {
+    uint64_t u = 0;
+    for (k = 0; k < w; k++) u |= spread[in[k * nbytes + j]] << k;
+    store64le(z + 8 * j, u);
+  }
+}
+
+/* low k bits as bit planes, then q = z >> k in unary (q zeros then a one), returns bytes written */
+static int rice_block(const uint8_t * z, int len, int k, uint8_t * out)
+{
+  uint64_t unary[MAX_UNARY_BYTES / 8 + 1] = {0};
+  int pos = 0;
+  int i;
+  int nplanes = pack_block(z, len, k, out);
+  for (i = 0; i < len; i++)
+  {
+    pos += z[i] >> k;
+    unary[pos >> 6] |= 1ull << (pos & 63);
+    pos++;
+  }
+  for (i = 0; i < (pos + 63) / 64; i++) store64le((uint8_t*) &unary[i], unary[i]);
+  memcpy(out + nplanes, unary, (pos + 7) / 8);
+  return nplanes + (pos + 7) / 8;
+}
+
+/* inverse of rice_block, given avail bytes. Writes a whole BLOCK to z. Returns bytes consumed or -1 */
+static int unrice_block(const uint8_t * in, int avail, int len, int k, uint8_t * z)
+{
+  uint8_t unary[MAX_UNARY_BYTES] = {0};
+  int nplanes = k * ((len + 7) / 8);
+  int nunary = avail - nplanes < MAX_UNARY_BYTES ? avail - nplanes : MAX_UNARY_BYTES;
+  int last = -1;
+  int i = 0;
+  int iw;
+
+  if (nunary < 0) return -1;
+  unpack_block(in, len, k, z);
+  memcpy(unary, in + nplanes, nunary);
+
+  // each one ends a value, so just walk through the set bits
+  for (iw = 0; iw < MAX_UNARY_BYTES / 8 && i < len; iw++)
+  {
+    uint64_t word = load64le(unary + 8 * iw);
+    while (word && i < len)
+    {
+      int bit = 64 * iw + __builtin_ctzll(word);
+      z[i++] += (bit - last - 1) << k;
+      last = bit;
+      word &= word - 1;
+    }
+  }
+
+  if (i < len) return -1;
+  return nplanes + (last + 8) / 8;
+}
+
+int beacon_wf_encode(const uint8_t * x, int n, uint8_t * out)
+{
+  int nblocks = (n + BLOCK - 1) / BLOCK;
+  uint8_t z[3][n + BLOCK];
+  uint8_t codes[3][nblocks + 1];
+  uint8_t * p = out;
+  uint32_t sum = 0;
+  int i, b, m, mode, size;
+
+  if (n <= 0)
+  {
+    out[0] = BN_CODEC_RAW;
+    return 1;
+  }
+
+  for (i = 0; i < n; i++) sum += x[i];
+  uint8_t ref = (sum + n / 2) / n;
+
+  residuals(x, n, ref, z[0], z[1], z[2]);
+
+  // pick whichever predictor packs smallest (z[m] is for mode m+1), then see where rice helps
+  mode = 0;
+  size = 1 << 30;
+  for (m = 0; m < 3; m++)
+  {
+    int msize = plan_blocks(z[m], n, codes[m], 0);
+    if (msize < size)
+    {
+      size = msize;
+      mode = m + 1;
+    }
+  }
+  size = plan_blocks(z[mode-1], n, codes[mode-1], 1);
+  if (size >= BN_CODEC_MAX_BYTES(n)) mode = BN_CODEC_RAW;
+
+  // saturated or otherwise incompressible
+  if (mode == BN_CODEC_RAW)
+  {
+    out[0] = BN_CODEC_RAW;
+    memcpy(out + 1, x, n);
+    return BN_CODEC_MAX_BYTES(n);
+  }
+
+  *p++ = mode;
+  *p++ = ref;
+  m = mode - 1;
+  for (b = 0; b < nblocks; b += 2)
+  {
+    *p++ = codes[m][b] | (b + 1 < nblocks ? codes[m][b+1] << 4 : 0);
+  }
+
+  for (b = 0; b < nblocks; b++)
+  {
+    int len = n - b * BLOCK < BLOCK ? n - b * BLOCK : BLOCK;
+    int code = codes[m][b];
+    if (code >= RICE_CODE) p += rice_block(z[m] + b * BLOCK, len, code - RICE_CODE, p);
+    else p += pack_block(z[m] + b * BLOCK, len, code, p);
+  }
+
+  return p - out;
+}
+
+int beacon_wf_decode(const uint8_t * buf, int len, uint8_t * x, int n)
+{
+  int nblocks = (n + BLOCK - 1) / BLOCK;
+  const uint8_t * p = buf;
+  const uint8_t * end = buf + len;
+  const uint8_t * codes;
+  uint8_t blk[BLOCK];
+  uint8_t ref;
+  int mode, b, i;
+
+  if (len < 1) return -1;
+  mode = *p++;
+
+  if (mode == BN_CODEC_RAW)
+  {
+    if (end - p < n) return -1;
+    memcpy(x, p, n);
+    return 1 + n;
+  }
+
+  if (mode != BN_CODEC_BASELINE && mode != BN_CODEC_DELTA && mode != BN_CODEC_DELTA2) return -1;
+  if (end - p < 1 + (nblocks + 1) / 2) return -1;
+
+  ref = *p++;
+  codes = p;
+  p += (nblocks + 1) / 2;
+
+  for (b = 0; b < nblocks; b++)
+  {
+    int blen = n - b * BLOCK < BLOCK ? n - b * BLOCK : BLOCK;
+    int code = (codes[b / 2] >> (4 * (b & 1))) & 0xf;
+    int used;
+
+    if (code >= RICE_CODE)
+    {
+      used = unrice_block(p, end - p, blen, code - RICE_CODE, blk);
+      if (used < 0) return -1;
+    }
+    else
+    {
+      used = code * ((blen + 7) / 8);
+      if (code > 8 || end - p < used) return -1;
+      unpack_block(p, blen, code, blk);
+    }
+
+    memcpy(x + b * BLOCK, blk, blen);
+    p += used;
+  }
+
+  i = 0;
+  if (mode == BN_CODEC_BASELINE)
+  {
+#ifdef HAVE_VECTOR_CODEC
+    const v16u8 vref = (v16u8) {0} + ref;
+    for (; i + 16 <= n; i += 16) store16(x + i, unzigzag16(load16(x + i)) + vref);
+#endif
+    for (; i < n; i++) x[i] = unzigzag(x[i]) + ref;
+  }
+  else if (mode == BN_CODEC_DELTA)
+  {
+#ifdef HAVE_VECTOR_CODEC
+    v16u8 carry = (v16u8) {0} + ref;
+    for (; i + 16 <= n; i += 16)
+    {
+      v16u8 v = prefix16(unzigzag16(load16(x + i))) + carry;
+      store16(x + i, v);
+      carry = last16(v);
+    }
+    if (i) ref = x[i-1];
+#endif
+    for (; i < n; i++)
+    {
+      ref += unzigzag(x[i]);
+      x[i] = ref;
+    }
+  }
+  else
+  {
+    // the residual is the change in slope, so this is two prefix sums
+    uint8_t slope = 0;
+#ifdef HAVE_VECTOR_CODEC
+    v16u8 carry = (v16u8) {0} + ref;
+    v16u8 dcarry = (v16u8) {0};
+    for (; i + 16 <= n; i += 16)
+    {
+      v16u8 d = prefix16(unzigzag16(load16(x + i))) + dcarry;
+      v16u8 v = prefix16(d) + carry;
+      store16(x + i, v);
+      dcarry = last16(d);
+      carry = last16(v);
+    }
+    if (i)
+    {
+      slope = dcarry[0];
+      ref = carry[0];
+    }
+#endif
+    for (; i < n; i++)
+    {
+      slope += unzigzag(x[i]);
+      ref += slope;
+      x[i] = ref;
+    }
+  }
+
+  return p - buf;
+}
@@ -0,0 +1,58 @@
+#ifndef _beaconcodec_h
+#define _beaconcodec_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file beaconcodec.h
+ *
+ * Lossless waveform codec used by the packed event format (see beacon_set_write_event_codec()).
+ *
+ * Our waveforms are 8-bit samples sitting around a baseline with small excursions, so each channel
+ * is stored as residuals with respect to a baseline (the mean), the previous sample, or the linear
+ * extrapolation of the previous two samples, whichever is smallest. The residuals are zigzag encoded and bit-packed in blocks of BN_CODEC_BLOCK samples, each
+ * with its own bit width. Channels that wouldn't get any smaller (e.g. saturated ones) are stored raw.
+ *
+ * Encoded channel layout:
+ *
+ *   mode (1 byte): a beacon_codec_mode_t
+ *   if raw: the n samples
+ *   otherwise:
+ *     reference (1 byte): the baseline, also used as the (two) samples before the first one for the deltas
+ *     block codes: one nibble per block (low nibble first), rounded up to a whole byte.
+ *       0-8 is the bit width w; 9-15 means rice coding with k = code - 9
+ *     for each block, the w (or k) bit planes of the zigzagged residuals: for each plane, one bit per
+ *       sample (LSB first), rounded up to a whole byte. For rice blocks, then the residuals >> k in
+ *       unary (that many zeros, then a one), LSB first, rounded up to a whole byte
+ *
+ * The residual arithmetic is modulo 256, so it always fits in 8 bits.
+ */
+
+/** samples per bit-packing block */
+#define BN_CODEC_BLOCK 32
+
+/** The maximum number of bytes beacon_wf_encode() can produce for n samples */
+#define BN_CODEC_MAX_BYTES(n) (1 + (n))
+
+typedef enum beacon_codec_mode
+{
+  BN_CODEC_RAW = 0,
+  BN_CODEC_BASELINE = 1,
+  BN_CODEC_DELTA = 2,
+  BN_CODEC_DELTA2 = 3
+} beacon_codec_mode_t;
+
+/** Encode n samples into out, which must have room for BN_CODEC_MAX_BYTES(n). Returns the number of bytes used. */
+int beacon_wf_encode(const uint8_t * samples, int n, uint8_t * out);
+
+/** Decode n samples from the len bytes in buf. Returns the number of bytes consumed, or -1 if buf is too short or bogus. */
+int beacon_wf_decode(const uint8_t * buf, int len, uint8_t * samples, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,436 @@
+#include "beaconcol.h"
+#include "beaconreader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#define COL_MAGIC "BNHC"
+#define COL_VERSION 1
+#define BLOCK_START_SIZE 16
+#define COLUMN_START_SIZE 12
+#define MAX_VARINT 10
+
+enum
+{
+  ENC_PLAIN = 0,     // width bytes per value, little endian
+  ENC_DELTA = 1,     // zigzag varint of the difference from the previous value (the first is relative to 0)
+  ENC_CONST = 2      // one varint, the same for every header
+};
+
+/* where each field lives in beacon_header_t and beacon_header_columns_t */
+struct field_desc
+{
+  size_t offset;
+  size_t cols_offset;
+  int width;
+  int count;
+};
+
+#define DESC_S(name, type) { offsetof(beacon_header_t, name), offsetof(beacon_header_columns_t, name), sizeof(type), 1 },
+#define DESC_A(name, type, count) { offsetof(beacon_header_t, name), offsetof(beacon_header_columns_t, name), sizeof(type), count },
+static const struct field_desc fields[BN_HCOL_NFIELDS] = { BN_HEADER_COLUMNS(DESC_S, DESC_A) };
+#undef DESC_S
+#undef DESC_A
+
+
+static uint64_t load(int width, const void * p)
+{
+  uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64;
+  switch (width)
+  {
+    case 1: memcpy(&u8, p, 1); return u8;
+    case 2: memcpy(&u16, p, 2); return u16;
+    case 4: memcpy(&u32, p, 4); return u32;
+    default: memcpy(&u64, p, 8); return u64;
+  }
+}
+
+static void store(int width, void * p, uint64_t v)
+{
+  uint8_t u8 = v; uint16_t u16 = v; uint32_t u32 = v;
+  switch (width)
+  {
+    case 1: memcpy(p, &u8, 1); break;
+    case 2: memcpy(p, &u16, 2); break;
+    case 4: memcpy(p, &u32, 4); break;
+    default: memcpy(p, &v, 8); break;
+  }
+}
+
+static void put_le(uint8_t * p, int width, uint64_t v)
+{
+  int i;
+  for (i = 0; i < width; i++) p[i] = v >> (8 * i);
+}
+
+static uint64_t get_le(const uint8_t * p, int width)
+{
+  uint64_t v = 0;
+  int i;
+  for (i = 0; i < width; i++) v |= (uint64_t) p[i] << (8 * i);
+  return v;
+}
+
+static int varint_size(uint64_t v)
+{
+  int n = 1;
+  while (v >= 0x80)
+  {
+    v >>= 7;
+    n++;
+  }
+  return n;
+}
+
+static int put_varint(uint8_t * p, uint64_t v)
+{
+  int n = 0;
+  while (v >= 0x80)
+  {
+    p[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+/* returns the number of bytes used, or 0 if it runs off the end (or is too long) */
+static int get_varint(const uint8_t * p, const uint8_t * end, uint64_t * v)
+{
+  int n = 0;
+  *v = 0;
+  while (p + n < end && n < MAX_VARINT)
+  {
+    *v |= (uint64_t) (p[n] & 0x7f) << (7 * n);
+    if (!(p[n++] & 0x80)) return n;
+  }
+  return 0;
+}
+
+static uint64_t zigzag(uint64_t d)
+{
+  return (d << 1) ^ (uint64_t) -(int64_t) (d >> 63);
+}
+
+static uint64_t unzigzag(uint64_t z)
+{
+  return (z >> 1) ^ (uint64_t) -(int64_t) (z & 1);
+}
+
+
+struct beacon_col_writer
+{
+  FILE * f;
+  int block_size;
+  int n;
+  beacon_header_t * headers;
+  uint64_t * vals;
+  uint8_t * buf;
+};
+
+beacon_col_writer_t * beacon_col_writer_open(const char * path, int block_size)
+{
+  beacon_col_writer_t * w;
+  int ncolumns = 0;
+  int i;
+  FILE * f = fopen(path, "w");
+  if (!f) return NULL;
+
+  for (i = 0; i < BN_HCOL_NFIELDS; i++) ncolumns += fields[i].count;
+  if (block_size <= 0) block_size = BN_COL_DEFAULT_BLOCK;
+  if (block_size > BN_COL_MAX_BLOCK) block_size = BN_COL_MAX_BLOCK;
+
+  w = calloc(1, sizeof(*w));
+  w->f = f;
+  w->block_size = block_size;
+  w->headers = malloc(block_size * sizeof(beacon_header_t));
+  w->vals = malloc(block_size * sizeof(uint64_t));
+  w->buf = malloc(BLOCK_START_SIZE + (size_t) ncolumns * (COLUMN_START_SIZE + (size_t) block_size * MAX_VARINT));
+  return w;
+}
+
+/* encodes w->vals into p, returns the number of bytes used */
+static int encode_column(const beacon_col_writer_t * w, int width, uint8_t * p, uint8_t * encoding)
+{
+  size_t plain_size = (size_t) w->n * width;
+  size_t delta_size = 0;
+  uint64_t prev = 0;
+  int constant = 1;
+  int i;
+  uint8_t * start = p;
+
+  for (i = 0; i < w->n; i++)
+  {
+    delta_size += varint_size(zigzag(w->vals[i] - prev));
+    constant = constant && w->vals[i] == w->vals[0];
+    prev = w->vals[i];
+  }
+
+  if (constant)
+  {
+    *encoding = ENC_CONST;
+    return put_varint(p, w->vals[0]);
+  }
+
+  if (delta_size < plain_size)
+  {
+    *encoding = ENC_DELTA;
+    for (i = 0, prev = 0; i < w->n; i++)
+    {
+      p += put_varint(p, zigzag(w->vals[i] - prev));
+      prev = w->vals[i];
+    }
+    return p - start;
+  }
+
+  *encoding = ENC_PLAIN;
+  for (i = 0; i < w->n; i++, p += width) put_le(p, width, w->vals[i]);
+  return p - start;
+}
+
+static int write_block(beacon_col_writer_t * w)
+{
+  uint8_t * p = w->buf + BLOCK_START_SIZE;
+  int ncolumns = 0;
+  int k, e, i;
+
+  if (!w->n) return 0;
+
+  for (k = 0; k < BN_HCOL_NFIELDS; k++)
+  {
+    for (e = 0; e < fields[k].count; e++)
+    {
+      uint8_t * col = p;
+      int nbytes;
+
+      for (i = 0; i < w->n; i++)
+      {
+        w->vals[i] = load(fields[k].width, (const uint8_t*) &w->headers[i] + fields[k].offset + e * fields[k].width);
+      }
+
+      nbytes = encode_column(w, fields[k].width, col + COLUMN_START_SIZE, &col[2]);
+      col[0] = k;
+      col[1] = e;
+      col[3] = fields[k].width;
+      put_le(col + 4, 4, nbytes);
+      put_le(col + 8, 4, beacon_crc32c(nbytes, col + COLUMN_START_SIZE, 0));
+      p += COLUMN_START_SIZE + nbytes;
+      ncolumns++;
+    }
+  }
+
+  memcpy(w->buf, COL_MAGIC, 4);
+  put_le(w->buf + 4, 4, COL_VERSION);
+  put_le(w->buf + 8, 4, w->n);
+  put_le(w->buf + 12, 4, ncolumns);
+  w->n = 0;
+
+  return fwrite(w->buf, p - w->buf, 1, w->f) == 1 ? 0 : BN_ERR_NOT_ENOUGH_BYTES;
+}
+
+int beacon_col_writer_add(beacon_col_writer_t * w, const beacon_header_t * h)
+{
+  w->headers[w->n++] = *h;
+  return w->n == w->block_size ? write_block(w) : 0;
+}
+
+int beacon_col_writer_close(beacon_col_writer_t * w)
+{
+  int ret = write_block(w);
+  if (fclose(w->f)) ret = BN_ERR_NOT_ENOUGH_BYTES;
+  free(w->headers);
+  free(w->vals);
+  free(w->buf);
+  free(w);
+  return ret;
+}
+
+
+struct beacon_col_reader
+{
+  FILE * f;
+  size_t cap[BN_HCOL_NFIELDS];
+  void * arrays[BN_HCOL_NFIELDS];
+  uint8_t * buf;
+  size_t buf_cap;
+};
+
+beacon_col_reader_t * beacon_col_reader_open(const char * path)
+{
+  beacon_col_reader_t * r;
+  FILE * f = fopen(path, "r");
+  if (!f) return NULL;
+  r = calloc(1, sizeof(*r));
+  r->f = f;
+  return r;
+}
+
+/* decodes a column of n values into element e of field k */
+static int decode_column(beacon_col_reader_t * r, int k, int e, int encoding, int width, uint32_t n, uint32_t nbytes)
+{
+  const uint8_t * p = r->buf;
+  const uint8_t * end = r->buf + nbytes;
+  int stride = fields[k].width * fields[k].count;
+  uint8_t * out = (uint8_t*) r->arrays[k] + e * fields[k].width;
+  uint64_t v = 0;
+  uint32_t i;
+  int used;
+
+  switch (encoding)
+  {
+    case ENC_PLAIN:
+      if (width < 1 || width > 8 || nbytes != (uint64_t) n * width) return BN_ERR_BAD_LENGTH;
+      for (i = 0; i < n; i++, p += width, out += stride) store(fields[k].width, out, get_le(p, width));
+      return 0;
+
+    case ENC_DELTA:
+      for (i = 0; i < n; i++, out += stride)
+      {
+        uint64_t z;
+        used = get_varint(p, end, &z);
+        if (!used) return BN_ERR_BAD_LENGTH;
+        p += used;
+        v += unzigzag(z);
+        store(fields[k].width, out, v);
+      }
+      return p == end ? 0 : BN_ERR_BAD_LENGTH;
+
+    case ENC_CONST:
+      used = get_varint(p, end, &v);
+      if (!used || p + used != end) return BN_ERR_BAD_LENGTH;
+      for (i = 0; i < n; i++, out += stride) store(fields[k].width, out, v);
+      return 0;
+
+    default:
+      return BN_ERR_BAD_VERSION;
+  }
+}
+
+int beacon_col_read_block(beacon_col_reader_t * r, uint64_t wanted, beacon_header_columns_t * cols)
+{
+  uint8_t start[BLOCK_START_SIZE];
+  uint32_t n, ncolumns, c;
+  size_t got;
+  int k;
+
+  got = fread(start, 1, sizeof(start), r->f);
+  if (got == 0) return 0;
+  if (got < sizeof(start)) return -BN_ERR_NOT_ENOUGH_BYTES;
+  if (memcmp(start, COL_MAGIC, 4)) return -BN_ERR_WRONG_TYPE;
+  if (get_le(start + 4, 4) > COL_VERSION) return -BN_ERR_BAD_VERSION;
+  n = get_le(start + 8, 4);
+  ncolumns = get_le(start + 12, 4);
+  if (n > BN_COL_MAX_BLOCK) return -BN_ERR_BAD_LENGTH;
+
+  memset(cols, 0, sizeof(*cols));
+  cols->n = n;
+  cols->fields = wanted & BN_HCOL_ALL;
+
+  for (k = 0; k < BN_HCOL_NFIELDS; k++)
+  {
+    size_t size = (size_t) n * fields[k].width * fields[k].count;
+    if (!(cols->fields & (1ull << k))) continue;
+
+    if (r->cap[k] < size)
+    {
+      void * mem = realloc(r->arrays[k], size);
+      if (!mem) return -BN_ERR_NOT_ENOUGH_BYTES;
+      r->arrays[k] = mem;
+      r->cap[k] = size;
+    }
+
+    // in case the file doesn't have it
+    memset(r->arrays[k], 0, size);
+    memcpy((uint8_t*) cols + fields[k].cols_offset, &r->arrays[k], sizeof(void*));
+  }
+
+  for (c = 0; c < ncolumns; c++)
+  {
+    uint8_t col[COLUMN_START_SIZE];
+    uint32_t nbytes;
+    int ret;
+
+    if (fread(col, sizeof(col), 1, r->f) != 1) return -BN_ERR_NOT_ENOUGH_BYTES;
+    nbytes = get_le(col + 4, 4);
+
+    // skip what we don't know or don't want
+    if (col[0] >= BN_HCOL_NFIELDS || col[1] >= fields[col[0]].count || !(cols->fields & (1ull << col[0])))
+    {
+      if (fseeko(r->f, nbytes, SEEK_CUR)) return -BN_ERR_NOT_ENOUGH_BYTES;
+      continue;
+    }
+
+    if (r->buf_cap < nbytes)
+    {
+      uint8_t * mem = realloc(r->buf, nbytes);
+      if (!mem) return -BN_ERR_NOT_ENOUGH_BYTES;
+      r->buf = mem;
+      r->buf_cap = nbytes;
+    }
+
+    if (fread(r->buf, 1, nbytes, r->f) != nbytes) return -BN_ERR_NOT_ENOUGH_BYTES;
+    if (beacon_crc32c(nbytes, r->buf, 0) != get_le(col + 8, 4)) return -BN_ERR_CHECKSUM_FAILED;
+
+    ret = decode_column(r, col[0], col[1], col[2], col[3], n, nbytes);
+    if (ret) return -ret;
+  }
+
+  return n;
+}
+
+void beacon_col_reader_close(beacon_col_reader_t * r)
+{
+  int k;
+  if (!r) return;
+  fclose(r->f);
+  for (k = 0; k < BN_HCOL_NFIELDS; k++) free(r->arrays[k]);
+  free(r->buf);
+  free(r);
+}
+
+void beacon_header_columns_get(const beacon_header_columns_t * cols, size_t i, beacon_header_t * h)
+{
+  int k;
+  memset(h, 0, sizeof(*h));
+
+  for (k = 0; k < BN_HCOL_NFIELDS; k++)
+  {
+    size_t size = fields[k].width * fields[k].count;
+    const uint8_t * array;
+    memcpy(&array, (const uint8_t*) cols + fields[k].cols_offset, sizeof(array));
+    if (array) memcpy((uint8_t*) h + fields[k].offset, array + i * size, size);
+  }
+}
+
+int beacon_col_convert(const char * header_path, const char * col_path, int block_size)
+{
+  beacon_header_t h;
+  beacon_col_writer_t * w;
+  beacon_reader_t * r = beacon_reader_open(header_path);
+  int ret = 0;
+  if (!r) return BN_ERR_NOT_ENOUGH_BYTES;
+
+  w = beacon_col_writer_open(col_path, block_size);
+  if (!w)
+  {
+    beacon_reader_close(r);
+    return BN_ERR_NOT_ENOUGH_BYTES;
+  }
+
+  while (!ret)
+  {
+    // stop cleanly only at the end of the file, not at a corrupt or truncated record
+    beacon_read_error_t err;
+    if (!beacon_header_read_many(r, &h, 1, &err))
+    {
+      ret = err.code;
+      break;
+    }
+    ret = beacon_col_writer_add(w, &h);
+  }
+
+  beacon_reader_close(r);
+  if (beacon_col_writer_close(w) && !ret) ret = BN_ERR_NOT_ENOUGH_BYTES;
+  return ret;
+}
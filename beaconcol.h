@@ -0,0 +1,143 @@
+#ifndef _beaconcol_h
+#define _beaconcol_h
+
+#include "beacon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file beaconcol.h
+ *
+ * A columnar format for headers, for analyses that only look at a few fields of a lot of events.
+ *
+ * Headers are stored in blocks, each holding one column per field (per board, for the per-board fields).
+ * A column is whichever is smallest of: fixed width little-endian values, zigzag varint deltas from the
+ * previous value (great for event_number, trig_number, trig_time...) or a single value if it's constant
+ * over the block. Every column has its own CRC32C and length, so a reader can skip straight past the
+ * columns it doesn't want.
+ *
+ * The fields are listed in BN_HEADER_COLUMNS, which generates everything else. A field's position in the
+ * list is its id on disk, so only ever add to the end. Unknown fields in a file are skipped, and fields a
+ * file doesn't have are read as zeros.
+ *
+ * The file is a series of blocks, each:
+ *
+ *    "BNHC", uint32_t version, uint32_t nheaders, uint32_t ncolumns
+ *    ncolumns x { uint8_t field, uint8_t element, uint8_t encoding, uint8_t width, uint32_t nbytes, uint32_t crc32c, nbytes of data }
+ *
+ * Typical usage:
+ *
+ *    beacon_col_reader_t * r = beacon_col_reader_open("headers.col");
+ *    beacon_header_columns_t cols;
+ *    while (beacon_col_read_block(r, BN_HCOL_BIT(trig_type) | BN_HCOL_BIT(trig_time), &cols) > 0)
+ *      for (i = 0; i < cols.n; i++) do_something(cols.trig_type[i], cols.trig_time[i][0]);
+ *    beacon_col_reader_close(r);
+ */
+
+/** The schema: S(name, type) for scalar fields, A(name, type, count) for arrays. Only ever append to this!
+ * It also defines the packed header record (see beacon.c), so appending a field means a new header version. */
+#define BN_HEADER_COLUMNS(S, A) \
+  S(event_number, uint64_t) \
+  S(trig_number, uint64_t) \
+  S(buffer_length, uint16_t) \
+  S(pretrigger_samples, uint16_t) \
+  A(readout_time, uint32_t, BN_MAX_BOARDS) \
+  A(readout_time_ns, uint32_t, BN_MAX_BOARDS) \
+  A(trig_time, uint64_t, BN_MAX_BOARDS) \
+  S(approx_trigger_time, uint32_t) \
+  S(approx_trigger_time_nsecs, uint32_t) \
+  S(triggered_beams, uint32_t) \
+  S(beam_mask, uint32_t) \
+  S(beam_power, uint32_t) \
+  A(deadtime, uint32_t, BN_MAX_BOARDS) \
+  S(buffer_number, uint8_t) \
+  S(channel_mask, uint8_t) \
+  A(channel_read_mask, uint8_t, BN_MAX_BOARDS) \
+  S(gate_flag, uint8_t) \
+  S(buffer_mask, uint8_t) \
+  A(board_id, uint8_t, BN_MAX_BOARDS) \
+  S(trig_type, beacon_trig_type_t) \
+  S(trig_pol, beacon_trigger_polarization_t) \
+  S(calpulser, uint8_t) \
+  S(sync_problem, uint8_t) \
+  S(pps_counter, uint32_t) \
+  S(dynamic_beam_mask, uint32_t) \
+  S(veto_deadtime_counter, uint32_t)
+
+#define BN_HCOL_ENUM_S(name, type) BN_HCOL_##name,
+#define BN_HCOL_ENUM_A(name, type, count) BN_HCOL_##name,
+/** Field ids */
+typedef enum beacon_header_column
+{
+  BN_HEADER_COLUMNS(BN_HCOL_ENUM_S, BN_HCOL_ENUM_A)
+  BN_HCOL_NFIELDS
+} beacon_header_column_t;
+#undef BN_HCOL_ENUM_S
+#undef BN_HCOL_ENUM_A
+
+/** The bit for a field (by name) in a field mask */
+#define BN_HCOL_BIT(name) (1ull << BN_HCOL_##name)
+
+/** A field mask with every field */
+#define BN_HCOL_ALL ((1ull << BN_HCOL_NFIELDS) - 1)
+
+#define BN_HCOL_POINTER_S(name, type) type * name;
+#define BN_HCOL_POINTER_A(name, type, count) type (*name)[count];
+/** A block of headers, one array per field: cols.trig_type[i], cols.trig_time[i][board]...
+ * Fields that weren't asked for are NULL. */
+typedef struct beacon_header_columns
+{
+  size_t n;                 //!< number of headers
+  uint64_t fields;          //!< the field mask of what's filled in
+  BN_HEADER_COLUMNS(BN_HCOL_POINTER_S, BN_HCOL_POINTER_A)
+} beacon_header_columns_t;
+#undef BN_HCOL_POINTER_S
+#undef BN_HCOL_POINTER_A
+
+/** Default number of headers in a block */
+#define BN_COL_DEFAULT_BLOCK 16384
+
+/** Most headers allowed in a block (so a corrupt count can't make us allocate the world) */
+#define BN_COL_MAX_BLOCK (1 << 20)
+
+
+/** Writes a columnar header file */
+typedef struct beacon_col_writer beacon_col_writer_t;
+
+/** Create (truncating) a columnar header file, with block_size headers per block (0 for BN_COL_DEFAULT_BLOCK, at most BN_COL_MAX_BLOCK). Returns NULL on failure. */
+beacon_col_writer_t * beacon_col_writer_open(const char * path, int block_size);
+
+/** Add a header. A block is written out whenever it's full. Returns 0 on success. */
+int beacon_col_writer_add(beacon_col_writer_t * w, const beacon_header_t * h);
+
+/** Write out the last (partial) block and close. Returns 0 on success. */
+int beacon_col_writer_close(beacon_col_writer_t * w);
+
+
+/** Reads a columnar header file */
+typedef struct beacon_col_reader beacon_col_reader_t;
+
+/** Open a columnar header file. Returns NULL on failure. */
+beacon_col_reader_t * beacon_col_reader_open(const char * path);
+
+/** Read the next block, decoding only the fields in the mask (e.g. BN_HCOL_BIT(trig_type) | BN_HCOL_BIT(trig_time), or BN_HCOL_ALL).
+ * The arrays belong to the reader and are good until the next call. Returns the number of headers, 0 at the end of the file
+ * or the negative of a beacon_io_error_t. */
+int beacon_col_read_block(beacon_col_reader_t * r, uint64_t fields, beacon_header_columns_t * cols);
+
+/** Close the file and free everything */
+void beacon_col_reader_close(beacon_col_reader_t * r);
+
+/** Put row i of a block back together as a header. Fields that weren't read are zero. */
+void beacon_header_columns_get(const beacon_header_columns_t * cols, size_t i, beacon_header_t * h);
+
+/** Convert a header file (compressed or not) into a columnar one. Returns 0 on success, or the beacon_io_error_t
+ * of a corrupt or truncated record (the headers before it are still converted). */
+int beacon_col_convert(const char * header_path, const char * col_path, int block_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
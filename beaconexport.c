@@ -0,0 +1,508 @@
+#include "beaconexport.h"
+#include "beaconcol.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+// output is collected until there's about this much, then written in one go
+#define OUT_BUFFER_SIZE (1 << 20)
+
+// enough for any header, status or hk row, including the row of column names
+#define SMALL_RECORD_MAX 16384
+
+// enough for any event, as CSV or JSON, including the row of column names
+#define EVENT_MAX (BN_MAX_BOARDS * BN_NUM_CHAN * (4 * BN_MAX_WAVEFORM_LENGTH + 64) + 16 * BN_MAX_WAVEFORM_LENGTH + 1024)
+
+// which kinds of record have had their row of column names
+#define NAMES_EVENT 1
+#define NAMES_HEADER 2
+#define NAMES_STATUS 4
+#define NAMES_HK 8
+
+
+/* "00" "01" ... "99", for formatting two digits at a time */
+static char digit_pairs[200];
+
+/* every sample value as text, padded to 4 bytes so that it can be copied without looking at the length */
+static char sample_text[256][4];
+static uint8_t sample_len[256];
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void init_tables(void)
+{
+  int i;
+  for (i = 0; i < 100; i++)
+  {
+    digit_pairs[2 * i] = '0' + i / 10;
+    digit_pairs[2 * i + 1] = '0' + i % 10;
+  }
+  for (i = 0; i < 256; i++)
+  {
+    sample_len[i] = snprintf(sample_text[i], sizeof(sample_text[i]), "%d", i);
+  }
+}
+
+
+struct beacon_exporter
+{
+  FILE * f;
+  beacon_export_format_t format;
+  char sep;
+  int json;
+  int err;
+  int names_done;
+
+  char * buf;
+  size_t fill;
+  size_t cap;
+
+  // state within a row
+  int names;                  // writing the column names rather than the values
+  int need_sep;
+  int depth;                  // of arrays
+  const char * array_name;
+  int idx[2];
+
+  // the last second formatted as a time
+  int64_t cached_sec;
+  char cached_time[32];
+};
+
+
+static char * put_u64(char * p, uint64_t v)
+{
+  char tmp[20];
+  char * end = tmp + sizeof(tmp);
+  char * q = end;
+  while (v >= 100)
+  {
+    q -= 2;
+    memcpy(q, digit_pairs + 2 * (v % 100), 2);
+    v /= 100;
+  }
+  if (v >= 10)
+  {
+    q -= 2;
+    memcpy(q, digit_pairs + 2 * v, 2);
+  }
+  else
+  {
+    *--q = '0' + v;
+  }
+  memcpy(p, q, end - q);
+  return p + (end - q);
+}
+
+static char * put_i64(char * p, int64_t v)
+{
+  if (v < 0)
+  {
+    *p++ = '-';
+    return put_u64(p, -(uint64_t) v);
+  }
+  return put_u64(p, v);
+}
+
+/* exactly ndigits digits, with leading zeros */
+static char * put_fixed(char * p, uint64_t v, int ndigits)
+{
+  int i;
+  for (i = ndigits - 1; i >= 0; i--)
+  {
+    p[i] = '0' + v % 10;
+    v /= 10;
+  }
+  return p + ndigits;
+}
+
+static void put_str(beacon_exporter_t * x, const char * s)
+{
+  size_t n = strlen(s);
+  memcpy(x->buf + x->fill, s, n);
+  x->fill += n;
+}
+
+
+static int write_out(beacon_exporter_t * x)
+{
+  if (x->fill && fwrite(x->buf, 1, x->fill, x->f) != x->fill) x->err = 1;
+  x->fill = 0;
+  return x->err;
+}
+
+/* makes sure there's room for a record of up to need bytes */
+static int reserve(beacon_exporter_t * x, size_t need)
+{
+  if (x->fill + need > x->cap) return write_out(x);
+  return x->err;
+}
+
+
+static void row_begin(beacon_exporter_t * x)
+{
+  x->need_sep = 0;
+  x->depth = 0;
+  if (x->json) x->buf[x->fill++] = '{';
+}
+
+static void row_end(beacon_exporter_t * x)
+{
+  if (x->json) x->buf[x->fill++] = '}';
+  x->buf[x->fill++] = '\n';
+}
+
+static void put_sep(beacon_exporter_t * x)
+{
+  if (x->need_sep) x->buf[x->fill++] = x->sep;
+  x->need_sep = 1;
+}
+
+/* everything before a value: the separator, and the name if there is one (JSON) or it's the names row */
+static void field_begin(beacon_exporter_t * x, const char * name)
+{
+  int i;
+  put_sep(x);
+  if (x->names)
+  {
+    put_str(x, x->depth ? x->array_name : name);
+    for (i = 0; i < x->depth; i++)
+    {
+      x->buf[x->fill++] = '_';
+      x->fill = put_u64(x->buf + x->fill, x->idx[i]) - x->buf;
+    }
+  }
+  else if (x->json && !x->depth)
+  {
+    x->buf[x->fill++] = '"';
+    put_str(x, name);
+    put_str(x, "\":");
+  }
+}
+
+static void field_end(beacon_exporter_t * x)
+{
+  if (x->depth) x->idx[x->depth - 1]++;
+}
+
+static void field_u(beacon_exporter_t * x, const char * name, uint64_t v)
+{
+  field_begin(x, name);
+  if (!x->names) x->fill = put_u64(x->buf + x->fill, v) - x->buf;
+  field_end(x);
+}
+
+static void field_i(beacon_exporter_t * x, const char * name, int64_t v)
+{
+  field_begin(x, name);
+  if (!x->names) x->fill = put_i64(x->buf + x->fill, v) - x->buf;
+  field_end(x);
+}
+
+/* sec.frac as "YYYY-MM-DD hh:mm:ss.fff", with ndigits digits of fraction */
+static void field_time(beacon_exporter_t * x, const char * name, uint32_t sec, uint32_t frac, int ndigits)
+{
+  field_begin(x, name);
+  if (!x->names)
+  {
+    char * p;
+    if (sec != x->cached_sec)
+    {
+      struct tm tim;
+      time_t t = sec;
+      gmtime_r(&t, &tim);
+      strftime(x->cached_time, sizeof(x->cached_time), "%Y-%m-%d %H:%M:%S.", &tim);
+      x->cached_sec = sec;
+    }
+    if (x->json) x->buf[x->fill++] = '"';
+    put_str(x, x->cached_time);
+    p = put_fixed(x->buf + x->fill, frac, ndigits);
+    x->fill = p - x->buf;
+    if (x->json) x->buf[x->fill++] = '"';
+  }
+  field_end(x);
+}
+
+/* name is only used for the outermost array */
+static void array_begin(beacon_exporter_t * x, const char * name)
+{
+  if (x->json)
+  {
+    put_sep(x);
+    if (!x->depth)
+    {
+      x->buf[x->fill++] = '"';
+      put_str(x, name);
+      put_str(x, "\":");
+    }
+    x->buf[x->fill++] = '[';
+    x->need_sep = 0;
+  }
+  if (!x->depth) x->array_name = name;
+  x->idx[x->depth++] = 0;
+}
+
+static void array_end(beacon_exporter_t * x)
+{
+  if (x->json)
+  {
+    x->buf[x->fill++] = ']';
+    x->need_sep = 1;
+  }
+  x->depth--;
+  if (x->depth) x->idx[x->depth - 1]++;
+}
+
+/* n samples, each preceded by a separator (CSV/TSV) or as a JSON array */
+static void put_samples(beacon_exporter_t * x, const uint8_t * data, int n)
+{
+  char * p;
+  int i = 0;
+
+  if (x->json)
+  {
+    put_sep(x);
+    x->buf[x->fill++] = '[';
+  }
+
+  p = x->buf + x->fill;
+  if (x->json && n)
+  {
+    memcpy(p, sample_text[data[0]], 4);
+    p += sample_len[data[0]];
+    i = 1;
+  }
+  for (; i < n; i++)
+  {
+    *p = x->sep;
+    memcpy(p + 1, sample_text[data[i]], 4);
+    p += 1 + sample_len[data[i]];
+  }
+
+  if (x->json) *p++ = ']';
+  x->fill = p - x->buf;
+}
+
+
+beacon_exporter_t * beacon_exporter_open(FILE * f, beacon_export_format_t format)
+{
+  beacon_exporter_t * x = calloc(1, sizeof(beacon_exporter_t));
+  if (!x) return NULL;
+
+  pthread_once(&tables_once, init_tables);
+
+  x->f = f;
+  x->format = format;
+  x->json = format == BN_EXPORT_JSONL;
+  x->sep = format == BN_EXPORT_TSV ? '\t' : ',';
+  x->cached_sec = -1;
+  x->cap = OUT_BUFFER_SIZE + EVENT_MAX;
+  x->buf = malloc(x->cap);
+  if (!x->buf)
+  {
+    free(x);
+    return NULL;
+  }
+  return x;
+}
+
+
+int beacon_export_event(beacon_exporter_t * x, const beacon_event_t * ev)
+{
+  int ibd, ichan, i;
+  int len = ev->buffer_length > BN_MAX_WAVEFORM_LENGTH ? BN_MAX_WAVEFORM_LENGTH : ev->buffer_length;
+
+  if (reserve(x, EVENT_MAX)) return 1;
+
+  if (x->json)
+  {
+    row_begin(x);
+    field_u(x, "event_number", ev->event_number);
+    field_u(x, "buffer_length", ev->buffer_length);
+    array_begin(x, "board_id");
+    for (ibd = 0; ibd < BN_MAX_BOARDS; ibd++)
+      if (ev->board_id[ibd]) field_u(x, NULL, ev->board_id[ibd]);
+    array_end(x);
+    array_begin(x, "data");
+    for (ibd = 0; ibd < BN_MAX_BOARDS; ibd++)
+    {
+      if (!ev->board_id[ibd]) continue;
+      array_begin(x, NULL);
+      for (ichan = 0; ichan < BN_NUM_CHAN; ichan++) put_samples(x, ev->data[ibd][ichan], len);
+      array_end(x);
+    }
+    array_end(x);
+    row_end(x);
+    return 0;
+  }
+
+  if (!(x->names_done & NAMES_EVENT))
+  {
+    x->names = 1;
+    row_begin(x);
+    field_u(x, "event_number", 0);
+    field_u(x, "board_id", 0);
+    field_u(x, "channel", 0);
+    array_begin(x, "sample");
+    for (i = 0; i < len; i++) field_u(x, NULL, 0);
+    array_end(x);
+    row_end(x);
+    x->names = 0;
+    x->names_done |= NAMES_EVENT;
+  }
+
+  for (ibd = 0; ibd < BN_MAX_BOARDS; ibd++)
+  {
+    if (!ev->board_id[ibd]) continue;
+    for (ichan = 0; ichan < BN_NUM_CHAN; ichan++)
+    {
+      row_begin(x);
+      field_u(x, "event_number", ev->event_number);
+      field_u(x, "board_id", ev->board_id[ibd]);
+      field_u(x, "channel", ichan);
+      put_samples(x, ev->data[ibd][ichan], len);
+      row_end(x);
+    }
+  }
+  return 0;
+}
+
+
+/* the UTC versions of the times, right after the fields they're made from */
+static void header_derived(beacon_exporter_t * x, const beacon_header_t * h, int field)
+{
+  int i;
+
+  if (field == BN_HCOL_readout_time_ns)
+  {
+    array_begin(x, "readout_time_utc");
+    for (i = 0; i < BN_MAX_BOARDS; i++) field_time(x, NULL, h->readout_time[i], h->readout_time_ns[i], 9);
+    array_end(x);
+  }
+  else if (field == BN_HCOL_approx_trigger_time_nsecs)
+  {
+    field_time(x, "approx_trigger_time_utc", h->approx_trigger_time, h->approx_trigger_time_nsecs, 9);
+  }
+}
+
+/* every field of the column schema, so nothing in beacon_header_t is left out */
+#define HEADER_FIELD_S(name, type) \
+  field_u(x, #name, h->name); \
+  header_derived(x, h, BN_HCOL_##name);
+#define HEADER_FIELD_A(name, type, count) \
+  array_begin(x, #name); \
+  for (i = 0; i < (count); i++) field_u(x, NULL, h->name[i]); \
+  array_end(x); \
+  header_derived(x, h, BN_HCOL_##name);
+
+static void header_fields(beacon_exporter_t * x, const beacon_header_t * h)
+{
+  int i;
+  BN_HEADER_COLUMNS(HEADER_FIELD_S, HEADER_FIELD_A)
+}
+
+#undef HEADER_FIELD_S
+#undef HEADER_FIELD_A
+
+static void status_fields(beacon_exporter_t * x, const beacon_status_t * st)
+{
+  int i, j;
+
+  array_begin(x, "global_scalers");
+  for (i = 0; i < BN_NUM_SCALERS; i++) field_u(x, NULL, st->global_scalers[i]);
+  array_end(x);
+  array_begin(x, "beam_scalers");
+  for (i = 0; i < BN_NUM_SCALERS; i++)
+  {
+    array_begin(x, NULL);
+    for (j = 0; j < BN_NUM_BEAMS; j++) field_u(x, NULL, st->beam_scalers[i][j]);
+    array_end(x);
+  }
+  array_end(x);
+  field_u(x, "deadtime", st->deadtime);
+  field_u(x, "readout_time", st->readout_time);
+  field_u(x, "readout_time_ns", st->readout_time_ns);
+  field_time(x, "readout_time_utc", st->readout_time, st->readout_time_ns, 9);
+  array_begin(x, "trigger_thresholds");
+  for (i = 0; i < BN_NUM_BEAMS; i++) field_u(x, NULL, st->trigger_thresholds[i]);
+  array_end(x);
+  field_u(x, "latched_pps_time", st->latched_pps_time);
+  field_u(x, "board_id", st->board_id);
+  field_u(x, "dynamic_beam_mask", st->dynamic_beam_mask);
+  field_u(x, "veto_status", st->veto_status);
+}
+
+static void hk_fields(beacon_exporter_t * x, const beacon_hk_t * hk)
+{
+  field_u(x, "unixTime", hk->unixTime);
+  field_u(x, "unixTimeMillisecs", hk->unixTimeMillisecs);
+  field_time(x, "time_utc", hk->unixTime, hk->unixTimeMillisecs, 3);
+  field_i(x, "temp_board", hk->temp_board);
+  field_i(x, "temp_adc", hk->temp_adc);
+  field_u(x, "frontend_current", hk->frontend_current);
+  field_u(x, "adc_current", hk->adc_current);
+  field_u(x, "aux_current", hk->aux_current);
+  field_u(x, "ant_current", hk->ant_current);
+  field_u(x, "gpio_state", hk->gpio_state);
+  field_u(x, "disk_space_kB", hk->disk_space_kB);
+  field_u(x, "free_mem_kB", hk->free_mem_kB);
+  field_u(x, "inv_batt_dV", hk->inv_batt_dV);
+  field_u(x, "cc_batt_dV", hk->cc_batt_dV);
+  field_u(x, "pv_dV", hk->pv_dV);
+  field_u(x, "cc_daily_Ah", hk->cc_daily_Ah);
+  field_u(x, "cc_daily_hWh", hk->cc_daily_hWh);
+}
+
+/* the row of column names the first time (for CSV/TSV), then the row */
+#define EXPORT_ROW(x, which, fields, rec) \
+  do { \
+    if (reserve(x, SMALL_RECORD_MAX)) return 1; \
+    if (!x->json && !(x->names_done & which)) \
+    { \
+      x->names = 1; \
+      row_begin(x); \
+      fields(x, rec); \
+      row_end(x); \
+      x->names = 0; \
+      x->names_done |= which; \
+    } \
+    row_begin(x); \
+    fields(x, rec); \
+    row_end(x); \
+  } while (0)
+
+int beacon_export_header(beacon_exporter_t * x, const beacon_header_t * h)
+{
+  EXPORT_ROW(x, NAMES_HEADER, header_fields, h);
+  return 0;
+}
+
+int beacon_export_status(beacon_exporter_t * x, const beacon_status_t * st)
+{
+  EXPORT_ROW(x, NAMES_STATUS, status_fields, st);
+  return 0;
+}
+
+int beacon_export_hk(beacon_exporter_t * x, const beacon_hk_t * hk)
+{
+  EXPORT_ROW(x, NAMES_HK, hk_fields, hk);
+  return 0;
+}
+
+
+int beacon_exporter_flush(beacon_exporter_t * x)
+{
+  write_out(x);
+  if (fflush(x->f)) x->err = 1;
+  return x->err;
+}
+
+int beacon_exporter_close(beacon_exporter_t * x)
+{
+  int ret = beacon_exporter_flush(x);
+  free(x->buf);
+  free(x);
+  return ret;
+}
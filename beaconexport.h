@@ -0,0 +1,59 @@
+#ifndef _beaconexport_h
+#define _beaconexport_h
+
+#include "beacon.h"
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file beaconexport.h
+ *
+ * Fast text export of records, as CSV, TSV or JSON Lines.
+ *
+ * The beacon_*_print() functions are meant for people, and are far too slow for converting whole runs
+ * (an fprintf() per sample). An exporter formats numbers itself, formats each timestamp's second only
+ * once, and collects its output in a large buffer that is written out in big pieces.
+ *
+ * CSV/TSV start with a row of column names (taken from the first record), and are meant to hold one
+ * kind of record. Events become one row per board and channel: event_number, board_id, channel,
+ * then the samples. Arrays in the other records are flattened to name_0, name_1, ... columns.
+ * In JSON Lines each record is an object on its own line, arrays stay arrays, and kinds of record
+ * can be mixed. Times are given both as the raw numbers and as a UTC string.
+ *
+ *    beacon_exporter_t * x = beacon_exporter_open(stdout, BN_EXPORT_CSV);
+ *    while (!beacon_reader_read_header(r, &h)) beacon_export_header(x, &h);
+ *    beacon_exporter_close(x);
+ */
+
+/** opaque handle */
+typedef struct beacon_exporter beacon_exporter_t;
+
+typedef enum beacon_export_format
+{
+  BN_EXPORT_CSV,
+  BN_EXPORT_TSV,
+  BN_EXPORT_JSONL
+} beacon_export_format_t;
+
+/** Start exporting to f (which stays yours to close). Returns NULL on failure. */
+beacon_exporter_t * beacon_exporter_open(FILE * f, beacon_export_format_t format);
+
+/** Export one record. These return 0 on success. */
+int beacon_export_event(beacon_exporter_t * x, const beacon_event_t * ev);
+int beacon_export_header(beacon_exporter_t * x, const beacon_header_t * h);
+int beacon_export_status(beacon_exporter_t * x, const beacon_status_t * st);
+int beacon_export_hk(beacon_exporter_t * x, const beacon_hk_t * hk);
+
+/** Write out everything buffered so far (and fflush f). Returns 0 on success. */
+int beacon_exporter_flush(beacon_exporter_t * x);
+
+/** Flush and free. Returns 0 if there have been no errors. */
+int beacon_exporter_close(beacon_exporter_t * x);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
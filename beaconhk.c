@@ -1,4 +1,5 @@
 #include "beaconhk.h"
+#include "beaconshm.h" 
 #include "bbb_ain.h" 
 #include "bbb_gpio.h" 
 
@@ -12,6 +13,7 @@
 #include <fcntl.h> 
 #include <sys/ioctl.h> 
 #include <curl/curl.h> 
+#include <pthread.h> 
 
 
 
@@ -24,39 +26,373 @@
 #define ANT_IMON_AIN 1 
 #define AUX_IMON_AIN 4 
 
+#define HK_AIN_MASK (BBB_AIN_BIT(BOARD_TEMP_AIN) | BBB_AIN_BIT(ADC_TEMP_0_AIN) | BBB_AIN_BIT(FRONTEND_IMON_AIN) | \
+                     BBB_AIN_BIT(ADC_IMON_AIN) | BBB_AIN_BIT(ANT_IMON_AIN) | BBB_AIN_BIT(AUX_IMON_AIN)) 
+
 #define MASTER_POWER_GPIO 46
 #define COMM_GPIO 60
 
 
-// Global HK settings 
-//---------------------------------------------
+//--------------------------------------
+//temperature probe conversion 
+//-------------------------------------
+static float V_to_C(float val_V)
+{
+  /* return (1858.3-2*val_mV)  * 0.08569; */
+  return (val_V - 1.8583)/-0.01167;
+}
+
+
+//--------------------------
+// current conversion 
+// ------------------------
+
+static float V_to_mA(float val_V)
+{
+  float imon_res = 6800.e-6; 
+  float imon_gain = 52.0 ; 
+  float imon_offset = 0.8; //*1000;
+
+  return 1000*((val_V /imon_res - imon_offset) / imon_gain);
+}
+
+
+static uint32_t get_free_kB()
+{
+  char bitbucket[256]; 
+  FILE * meminfo = fopen("/proc/meminfo","r"); 
+  uint32_t available = 0; 
+
+  //eat first line
+  fgets(bitbucket, 256, meminfo); 
+  //eat second line
+  fgets(bitbucket, 256, meminfo); 
+
+
+  fscanf(meminfo, "MemAvailable: %u kB", &available); 
+
+  fclose(meminfo); 
+
+  return available; 
+}
+
+
+
+static double mono_now() 
+{
+  struct timespec ts; 
+  clock_gettime(CLOCK_MONOTONIC, &ts); 
+  return ts.tv_sec + 1e-9 * ts.tv_nsec; 
+}
+
+
+//---------------------------------------------------
+// MATE3 parsing stuff. The Dev_status.cgi response is
+// scanned once, as it arrives, by a little JSON 
+// tokenizer that picks out the fields in mate3_fields
+// from each device object (identified by its "Dev") 
+//---------------------------------------------------
+
+
+
+static void set_inv_batt(beacon_hk_t * hk, float v) { hk->inv_batt_dV = v * 10; } 
+static void set_cc_batt(beacon_hk_t * hk, float v) { hk->cc_batt_dV = v * 10; } 
+static void set_pv(beacon_hk_t * hk, float v) { hk->pv_dV = v * 10; } 
+static void set_daily_Ah(beacon_hk_t * hk, float v) { hk->cc_daily_Ah = v > 255 ? 255 : v; } 
+static void set_daily_hWh(beacon_hk_t * hk, float v) { hk->cc_daily_hWh = v > 25.5 ? 255 : v * 10; } 
+
+/* What to take from which device. If there are several of a kind (e.g. inverters), the first one wins. 
+ * Fields that aren't in the response are set to 0. */ 
+static const struct mate3_field 
+{
+  const char * dev;   // the device's "Dev" 
+  const char * key; 
+  void (*set)(beacon_hk_t * hk, float v); 
+} mate3_fields[] = 
+{
+  { "FX", "Batt_V", set_inv_batt }, 
+  { "CC", "Batt_V", set_cc_batt }, 
+  { "CC", "Out_AH", set_daily_Ah }, 
+  { "CC", "Out_kWh", set_daily_hWh }, 
+  { "CC", "In_V", set_pv }, 
+}; 
+
+#define NUM_MATE3_FIELDS (sizeof(mate3_fields) / sizeof(*mate3_fields)) 
+
+// anything nested deeper than this is skipped over 
+#define JSON_MAX_DEPTH 16 
+
+typedef struct json_scan 
+{
+  int depth; 
+  char container[JSON_MAX_DEPTH];    // '{' or '[' 
+
+  // the fields found in each open object, and its "Dev", since it may come after them 
+  struct 
+  {
+    char dev[32]; 
+    uint32_t have; 
+    float vals[NUM_MATE3_FIELDS]; 
+  } obj[JSON_MAX_DEPTH]; 
+
+  int in_string; 
+  int escape; 
+  int string_is_key; 
+  int expect_value;                  // after a ':' 
+  char str[32];                      // the string being read (truncated) 
+  int str_len; 
+  char key[32];                      // the key of the value being read 
+  char num[32];                      // the number being read 
+  int num_len; 
+
+  uint32_t found;                    // which fields have been found 
+  float vals[NUM_MATE3_FIELDS]; 
+} json_scan_t; 
+
+
+static void json_reset(json_scan_t * j) 
+{
+  memset(j, 0, sizeof(*j)); 
+}
+
+/* we're in an object, and the value for j->key just ended */ 
+static void json_value(json_scan_t * j, const char * str, float num, int is_num) 
+{
+  unsigned i; 
+  if (j->depth < 1 || j->depth > JSON_MAX_DEPTH) return; 
+
+  if (!is_num && !strcmp(j->key, "Dev")) 
+  {
+    memcpy(j->obj[j->depth - 1].dev, str, strlen(str) + 1);  // both are at most 32 
+    return; 
+  }
+
+  for (i = 0; i < NUM_MATE3_FIELDS; i++) 
+  {
+    if (is_num && !strcmp(j->key, mate3_fields[i].key)) 
+    {
+      j->obj[j->depth - 1].have |= 1u << i; 
+      j->obj[j->depth - 1].vals[i] = num; 
+    }
+  }
+}
+
+static void json_end_number(json_scan_t * j) 
+{
+  if (!j->num_len) return; 
+  j->num[j->num_len] = 0; 
+  j->num_len = 0; 
+  if (j->depth >= 1 && j->depth <= JSON_MAX_DEPTH && j->container[j->depth - 1] == '{') 
+    json_value(j, NULL, strtof(j->num, NULL), 1); 
+  j->expect_value = 0; 
+}
+
+/* an object ended, so we know what device it was */ 
+static void json_end_object(json_scan_t * j) 
+{
+  unsigned i; 
+  if (j->depth < 1 || j->depth > JSON_MAX_DEPTH) return; 
+  for (i = 0; i < NUM_MATE3_FIELDS; i++) 
+  {
+    if ((j->obj[j->depth - 1].have & (1u << i)) && !(j->found & (1u << i)) && !strcmp(j->obj[j->depth - 1].dev, mate3_fields[i].dev)) 
+    {
+      j->found |= 1u << i; 
+      j->vals[i] = j->obj[j->depth - 1].vals[i]; 
+    }
+  }
+}
+
+static void json_feed(json_scan_t * j, const char * p, size_t n) 
+{
+  size_t i; 
+  for (i = 0; i < n; i++) 
+  {
+    char c = p[i]; 
+
+    if (j->in_string) 
+    {
+      if (j->escape) j->escape = 0; 
+      else if (c == '\\') 
+      {
+        j->escape = 1; 
+        continue; 
+      }
+      else if (c == '"') 
+      {
+        j->in_string = 0; 
+        j->str[j->str_len] = 0; 
+        if (j->string_is_key) memcpy(j->key, j->str, j->str_len + 1); 
+        else if (j->expect_value) 
+        {
+          json_value(j, j->str, 0, 0); 
+          j->expect_value = 0; 
+        }
+        continue; 
+      }
+      if (j->str_len < (int) sizeof(j->str) - 1) j->str[j->str_len++] = c; 
+      continue; 
+    }
+
+    switch (c) 
+    {
+      case '"': 
+        json_end_number(j); 
+        j->in_string = 1; 
+        j->str_len = 0; 
+        j->string_is_key = j->depth >= 1 && j->depth <= JSON_MAX_DEPTH && j->container[j->depth - 1] == '{' && !j->expect_value; 
+        break; 
+      case '{': 
+      case '[': 
+        if (j->depth < JSON_MAX_DEPTH) 
+        {
+          j->container[j->depth] = c; 
+          memset(&j->obj[j->depth], 0, sizeof(j->obj[0])); 
+        }
+        j->depth++; 
+        j->expect_value = 0; 
+        break; 
+      case '}': 
+      case ']': 
+        json_end_number(j); 
+        if (c == '}') json_end_object(j); 
+        if (j->depth > 0) j->depth--; 
+        j->expect_value = 0; 
+        break; 
+      case ':': 
+        j->expect_value = 1; 
+        break; 
+      case ',': 
+        json_end_number(j); 
+        j->expect_value = 0; 
+        break; 
+      default: 
+        if (j->expect_value && ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')) 
+        {
+          if (j->num_len < (int) sizeof(j->num) - 1) j->num[j->num_len++] = c; 
+        }
+        else json_end_number(j); 
+        break; 
+    }
+  }
+}
+
+
+//this is our cURL callback that feeds what arrives to the tokenizer 
+static size_t save_http(char * ptr, size_t size, size_t nmemb, void * user) 
+{
+  json_feed((json_scan_t *) user, ptr, size * nmemb); 
+  return size * nmemb;  //if we don't return the size given, cURL gets angry
+}
+
+
+/* fills in hk from what was found. Returns 1 if nothing was, i.e. it wasn't a MATE3 answering */ 
+static int parse_http(const json_scan_t * j, beacon_hk_t * hk) 
+{
+  unsigned i; 
+  for (i = 0; i < NUM_MATE3_FIELDS; i++) 
+  {
+    mate3_fields[i].set(hk, j->found & (1u << i) ? j->vals[i] : 0); 
+  }
+  return !j->found; 
+}
+
+
+#define MATE3_DEFAULT_INTERVAL 10 
+#define MATE3_MAX_BACKOFF 300 
+
+/* The published snapshot. It's copied a word at a time with relaxed atomics, and the sequence number is odd
+ * while it's being written, so readers retry if it changed under them (a seqlock). */ 
+#define SUMMARY_WORDS ((sizeof(beacon_hk_summary_t) + 3) / 4) 
+
+typedef union 
+{
+  beacon_hk_summary_t s; 
+  uint32_t w[SUMMARY_WORDS]; 
+} summary_words_t; 
+
+
+/* Everything hk needs. Each part has its own lock, since the background threads and the caller share it. */ 
+struct beacon_hk_ctx 
+{
+  //---------------------------------------------
+  //   device handles for the GPIO pins 
+  //---------------------------------------------
+  pthread_mutex_t gpio_lock;   // the sampler thread reads the gpio's while others may set them 
+  int gpios_are_setup; 
+  bbb_gpio_pin_t * master_fpga_ctl; 
+  bbb_gpio_pin_t * comm_ctl; 
+
+  /* The MATE3 is polled by a background thread, so beacon_hk never waits for it, and the last good values are 
+   * cached. lock protects everything here but curl and json; query_lock serializes the queries themselves 
+   * (curl and json), and is never held by anything that must not block. */ 
+  struct 
+  {
+    pthread_mutex_t lock; 
+    pthread_mutex_t query_lock; 
+    pthread_cond_t cv; 
+    pthread_t thread; 
+    int running; 
+    int stop; 
+    int poll_now;              // set when the address changes 
+    double interval; 
+    double next_poll;          // monotonic time of the next poll 
+    int port; 
+    char * addr;               // the whole url 
+
+    CURL * curl; 
+    json_scan_t json; 
+
+    beacon_hk_t cached;        // only the power system fields 
+    int have;                  // whether cached has anything in it 
+    double last_good;          // monotonic time of the last successful query 
+    int failures;              // consecutive failed queries 
+  } mate3; 
+
+  struct 
+  {
+    beacon_hk_sampler_opts_t opts; 
+    pthread_t fast_thread; 
+    pthread_t slow_thread; 
+    pthread_mutex_t control;     // serializes starting and stopping, which read and change running 
+    int running; 
+
+    pthread_mutex_t lock;        // protects everything below, and serializes publishing 
+    pthread_cond_t stop_cv; 
+    int stop; 
+    beacon_hk_summary_t state;   // the next thing to publish 
+    beacon_shm_t * shm;          // also published here, if not NULL 
+    double window_t0;            // monotonic time the current window started 
+  } sampler; 
+
+  struct 
+  {
+    uint32_t seq; 
+    summary_words_t u; 
+  } published; 
+}; 
 
-static int gpios_are_setup = 0;
 
 //---------------------------------------------
-//   device handles for the GPIO pins 
+//  GPIO's 
 //---------------------------------------------
-static bbb_gpio_pin_t * master_fpga_ctl = 0; 
-static bbb_gpio_pin_t * comm_ctl = 0; 
-
 
 /** GPIO Setup
  *
  *  This just exports them
  *  
  **/ 
-static int setup_gpio() 
+static int setup_gpio(beacon_hk_ctx_t * c) 
 {
   // take control of the gpio's 
   int ret = 0; 
 
-  master_fpga_ctl = bbb_gpio_open(MASTER_POWER_GPIO);
-  if (!master_fpga_ctl) ret+=1;  
+  c->master_fpga_ctl = bbb_gpio_open(MASTER_POWER_GPIO);
+  if (!c->master_fpga_ctl) ret+=1;  
 
-  comm_ctl = bbb_gpio_open(COMM_GPIO); 
-  if (!comm_ctl) ret+=4; 
+  c->comm_ctl = bbb_gpio_open(COMM_GPIO); 
+  if (!c->comm_ctl) ret+=4; 
 
-  gpios_are_setup = 1; 
+  c->gpios_are_setup = 1; 
   return ret;
 }
 
@@ -64,312 +400,766 @@ static int setup_gpio()
 //---------------------------------------------------
 // Read in the GPIO state
 // -------------------------------------------------
-static beacon_gpio_power_state_t query_gpio_state() 
+static beacon_gpio_power_state_t query_gpio_state(beacon_hk_ctx_t * c) 
 {
 
-  if (!gpios_are_setup) setup_gpio(); 
+  pthread_mutex_lock(&c->gpio_lock); 
+  if (!c->gpios_are_setup) setup_gpio(c); 
   beacon_gpio_power_state_t state = 0; 
 
   //master is on as an input, I think
-  if (!master_fpga_ctl || bbb_gpio_get(master_fpga_ctl) )
+  if (!c->master_fpga_ctl || bbb_gpio_get(c->master_fpga_ctl) )
   {
     state = state | BN_FPGA_POWER_MASTER; 
   }
   
   //active low 
-  if (comm_ctl && bbb_gpio_get(comm_ctl) == 0)
+  if (c->comm_ctl && bbb_gpio_get(c->comm_ctl) == 0)
   {
     state = state | BN_SPI_ENABLE; 
   }
 
+  pthread_mutex_unlock(&c->gpio_lock); 
 
   return state; 
 }
 
 
-//--------------------------------------
-//temperature probe conversion 
-//-------------------------------------
-static float V_to_C(float val_V)
+int beacon_hk_ctx_set_gpio_power_state (beacon_hk_ctx_t * c, beacon_gpio_power_state_t state, beacon_gpio_power_state_t mask) 
 {
-  /* return (1858.3-2*val_mV)  * 0.08569; */
-  return (val_V - 1.8583)/-0.01167;
-}
+  pthread_mutex_lock(&c->gpio_lock); 
+  if (! c->gpios_are_setup) setup_gpio(c); 
 
+  int ret = 0; 
 
-//--------------------------
-// current conversion 
-// ------------------------
+  if (mask & BN_FPGA_POWER_MASTER) 
+  {
+    ret += !c->master_fpga_ctl || bbb_gpio_set( c->master_fpga_ctl, (state & BN_FPGA_POWER_MASTER)); 
+  }
 
-static uint16_t V_to_mA(float val_V)
-{
-  float imon_res = 6800.e-6; 
-  float imon_gain = 52.0 ; 
-  float imon_offset = 0.8; //*1000;
+  if (mask & BN_SPI_ENABLE) 
+  {
+    //this one is active low
+    ret += !c->comm_ctl || bbb_gpio_set( c->comm_ctl, !(state & BN_SPI_ENABLE) ); 
+  }
 
-  return 1000*((val_V /imon_res - imon_offset) / imon_gain);
+  pthread_mutex_unlock(&c->gpio_lock); 
+  return ret; 
 }
 
 
-static uint32_t get_free_kB()
+/** Sleep that resumes when interrupted by a signal */ 
+static void smart_sleep(int amount) 
 {
-  char bitbucket[256]; 
-  FILE * meminfo = fopen("/proc/meminfo","r"); 
-  uint32_t available = 0; 
+  while(amount) amount = sleep(amount);
+}
 
-  //eat first line
-  fgets(bitbucket, 256, meminfo); 
-  //eat second line
-  fgets(bitbucket, 256, meminfo); 
+///////////////////////////////////////////
+////  FPGA reboot
+////////////////////////////////////////////
+int beacon_hk_ctx_reboot_fpga_power(beacon_hk_ctx_t * c, int sleep_after_off, int sleep_after_master_on)
+{
+  int ret = 0; 
 
+  pthread_mutex_lock(&c->gpio_lock); 
+  if (!c->gpios_are_setup) setup_gpio(c); 
+  ret+=bbb_gpio_set(c->master_fpga_ctl, 0); 
+  pthread_mutex_unlock(&c->gpio_lock); 
 
-  fscanf(meminfo, "MemAvailable: %u kB", &available); 
+  smart_sleep(sleep_after_off); 
 
-  fclose(meminfo); 
+  pthread_mutex_lock(&c->gpio_lock); 
+  ret+=bbb_gpio_set(c->master_fpga_ctl, 1); 
+  pthread_mutex_unlock(&c->gpio_lock); 
 
-  return available; 
+  smart_sleep(sleep_after_master_on); 
+  return ret; 
 }
 
 
+//---------------------------------------------
+//  MATE3 polling 
+//---------------------------------------------
 
-//---------------------------------------------------
-// MATE3 parsing stuff, this is very naive. A better
-// method might use a json parser or something like
-// that 
-//---------------------------------------------------
+static void mate3_poller_start(beacon_hk_ctx_t * c); 
 
-static int mate3_port = 8080; 
-static char * mate3_addr = 0;
-static CURL * curl = 0; 
-typedef struct http_buf
+void beacon_hk_ctx_set_mate3_address(beacon_hk_ctx_t * c, const char * addr, int port)
 {
-  char * buf; 
-  size_t pos; 
-  size_t size; 
-} http_buf_t; 
 
+  pthread_mutex_lock(&c->mate3.lock); 
+  if (port) c->mate3.port = port; 
+  if (c->mate3.addr) free(c->mate3.addr); 
+  c->mate3.addr = 0; 
+  if (asprintf(&c->mate3.addr, "http://%s:%d/Dev_status.cgi?Port=0", addr, c->mate3.port) < 0) c->mate3.addr = 0; 
 
-// if we ever wanted to make this nonreentrant, it's not so hard... 
-static http_buf_t http_buf; 
+  // forget about the old one, and poll the new one right away 
+  c->mate3.have = 0; 
+  c->mate3.failures = 0; 
+  c->mate3.poll_now = 1; 
+  pthread_cond_broadcast(&c->mate3.cv); 
+  pthread_mutex_unlock(&c->mate3.lock); 
 
-//this is our cURL callback that copies into our buffer
-static size_t save_http(char * ptr, size_t size, size_t nmemb, void * user) 
+  mate3_poller_start(c); 
+}
+
+
+/* Does the query, blocking for up to the timeout, and on success updates the cache. Only one at a time. */ 
+static int http_update(beacon_hk_ctx_t * c, beacon_hk_t *hk)
 {
-  http_buf_t * http_buf = (http_buf_t*) user; 
+  char * url = 0; 
+  int ret = 1; 
+
+  pthread_mutex_lock(&c->mate3.lock); 
+  if (c->mate3.addr) url = strdup(c->mate3.addr); 
+  pthread_mutex_unlock(&c->mate3.lock); 
+  if (!url) return 1; 
 
-  if (!http_buf->buf)  // we haven't allocated a buffer yet. let's do it. minimum of 16K or whatever cURL passes us, +1 for null byte
+  pthread_mutex_lock(&c->mate3.query_lock); 
+  if (!c->mate3.curl) c->mate3.curl = curl_easy_init(); 
+  if (c->mate3.curl) 
   {
-    http_buf->size = size*nmemb < 16 * 1024 ? 1+ 16 * 1024 : size*nmemb + 1; 
-    http_buf->buf = malloc(http_buf->size); 
-    if (!http_buf->buf) return 0; 
+    CURL * curl = c->mate3.curl; 
+    json_reset(&c->mate3.json); 
+
+    curl_easy_setopt(curl, CURLOPT_URL, url); 
+    curl_easy_setopt(curl, CURLOPT_HTTPGET,1); 
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT,1); 
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL,1); 
+    curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, save_http); 
+    curl_easy_setopt( curl, CURLOPT_WRITEDATA, &c->mate3.json); 
+    if (!curl_easy_perform(curl)) ret = parse_http(&c->mate3.json, hk); 
   }
+  pthread_mutex_unlock(&c->mate3.query_lock); 
 
-  // see if we need a bigger buffer. if we do, allocate twice more what cURL gave us 
-  else if (http_buf->size < http_buf->pos + size * nmemb + 1) 
+  pthread_mutex_lock(&c->mate3.lock); 
+  // don't cache an answer from an address that's since been replaced 
+  if (c->mate3.addr && !strcmp(url, c->mate3.addr)) 
   {
-    http_buf->size = http_buf->pos + size*nmemb *2 + 1; 
-    http_buf->buf = realloc( http_buf->buf, http_buf->size); 
-    if (!http_buf->buf) return 0; 
+    if (!ret) 
+    {
+      c->mate3.cached = *hk; 
+      c->mate3.have = 1; 
+      c->mate3.last_good = mono_now(); 
+      c->mate3.failures = 0; 
+    }
+    else 
+    {
+      c->mate3.failures++; 
+    }
   }
-  
+  pthread_mutex_unlock(&c->mate3.lock); 
 
-  //copy into our buffer
-//  printf("memcpy(%x, %x, %u)\n", http_buf + http_buf_pos, ptr, size*nmemb); 
-  memcpy (http_buf->buf + http_buf->pos, ptr, size*nmemb); 
-  http_buf->pos += size * nmemb; 
-  http_buf->buf[http_buf->pos] = 0; // set the null byte
-//  printf("save_http called, buf is :%s\n", http_buf); 
+  free(url); 
+  return ret; 
+}
 
-  return size * nmemb;  //if we don't return the size given, cURL gets angry
+
+/* copies the cached values into hk (zeros if there are none). Returns 0 if they're from the latest query. */ 
+static int mate3_fill(beacon_hk_ctx_t * c, beacon_hk_t * hk) 
+{
+  int ret, have; 
+  pthread_mutex_lock(&c->mate3.lock); 
+  have = c->mate3.have; 
+  hk->inv_batt_dV = have ? c->mate3.cached.inv_batt_dV : 0; 
+  hk->cc_batt_dV = have ? c->mate3.cached.cc_batt_dV : 0; 
+  hk->pv_dV = have ? c->mate3.cached.pv_dV : 0; 
+  hk->cc_daily_Ah = have ? c->mate3.cached.cc_daily_Ah : 0; 
+  hk->cc_daily_hWh = have ? c->mate3.cached.cc_daily_hWh : 0; 
+  ret = !have || c->mate3.failures; 
+  pthread_mutex_unlock(&c->mate3.lock); 
+  return ret; 
+}
+
+
+/* Waits on cv (with lock held) until the given monotonic time, or until signalled */ 
+static void wait_until(pthread_cond_t * cv, pthread_mutex_t * lock, double when) 
+{
+  double left = when - mono_now(); 
+  struct timespec until; 
+  if (left <= 0) return; 
+  clock_gettime(CLOCK_REALTIME, &until); 
+  until.tv_sec += (time_t) left; 
+  until.tv_nsec += (left - (time_t) left) * 1e9; 
+  if (until.tv_nsec >= 1000000000) 
+  {
+    until.tv_sec++; 
+    until.tv_nsec -= 1000000000; 
+  }
+  pthread_cond_timedwait(cv, lock, &until); 
+}
+
+
+/* polls every interval, backing off (doubling up to MATE3_MAX_BACKOFF) while it doesn't answer */ 
+static void * mate3_poll_loop(void * arg) 
+{
+  beacon_hk_ctx_t * c = arg; 
+  pthread_mutex_lock(&c->mate3.lock); 
+  while (!c->mate3.stop) 
+  {
+    beacon_hk_t hk; 
+    double delay; 
+    int i; 
+
+    if (!c->mate3.poll_now && c->mate3.next_poll > mono_now()) 
+    {
+      wait_until(&c->mate3.cv, &c->mate3.lock, c->mate3.next_poll); 
+      continue; 
+    }
+
+    c->mate3.poll_now = 0; 
+    pthread_mutex_unlock(&c->mate3.lock); 
+    memset(&hk, 0, sizeof(hk)); 
+    http_update(c, &hk); 
+    pthread_mutex_lock(&c->mate3.lock); 
+
+    delay = c->mate3.interval; 
+    for (i = 0; i < c->mate3.failures && delay < MATE3_MAX_BACKOFF; i++) delay *= 2; 
+    if (c->mate3.failures && delay > MATE3_MAX_BACKOFF) delay = MATE3_MAX_BACKOFF; 
+    c->mate3.next_poll = mono_now() + delay; 
+  }
+  pthread_mutex_unlock(&c->mate3.lock); 
+  return NULL; 
 }
 
+static void mate3_poller_start(beacon_hk_ctx_t * c) 
+{
+  pthread_mutex_lock(&c->mate3.lock); 
+  if (!c->mate3.running && !c->mate3.stop && !pthread_create(&c->mate3.thread, NULL, mate3_poll_loop, c)) c->mate3.running = 1; 
+  pthread_mutex_unlock(&c->mate3.lock); 
+}
+
+static void mate3_poller_stop(beacon_hk_ctx_t * c) 
+{
+  pthread_mutex_lock(&c->mate3.lock); 
+  int running = c->mate3.running; 
+  c->mate3.stop = 1; 
+  pthread_cond_broadcast(&c->mate3.cv); 
+  pthread_mutex_unlock(&c->mate3.lock); 
+  if (running) pthread_join(c->mate3.thread, NULL); 
+  c->mate3.running = 0; 
+}
+
+
+void beacon_hk_ctx_set_mate3_interval(beacon_hk_ctx_t * c, double seconds) 
+{
+  pthread_mutex_lock(&c->mate3.lock); 
+  c->mate3.interval = seconds > 0 ? seconds : MATE3_DEFAULT_INTERVAL; 
+  pthread_cond_broadcast(&c->mate3.cv); 
+  pthread_mutex_unlock(&c->mate3.lock); 
+}
+
+
+int beacon_hk_ctx_query_mate3(beacon_hk_ctx_t * c, beacon_hk_t * hk) 
+{
+  int ret = http_update(c, hk); 
+  if (ret) mate3_fill(c, hk); 
+  return ret; 
+}
 
 
-static float parse_json_number_like_an_idiot(const char * str, const char * key, const char * after)
+int beacon_hk_ctx_get_mate3_status(beacon_hk_ctx_t * c, beacon_mate3_status_t * st) 
 {
+  double now = mono_now(); 
+  pthread_mutex_lock(&c->mate3.lock); 
+  st->have_values = c->mate3.have; 
+  st->age = c->mate3.have ? now - c->mate3.last_good : -1; 
+  st->failures = c->mate3.failures; 
+  st->next_poll = c->mate3.running && c->mate3.next_poll > now ? c->mate3.next_poll - now : 0; 
+  pthread_mutex_unlock(&c->mate3.lock); 
+  return !st->have_values || st->failures; 
+}
 
-  if (!str) return 0; 
-  int offset = 0; 
 
-  if (after) 
+//----------------------------------------
+// Reading the individual sources 
+//----------------------------------------
+
+/* reads the temperatures and currents into hk, and into vals (in the order of beacon_hk_window_t) if not NULL */ 
+static int read_ain(beacon_hk_t * hk, int navg, float * vals) 
+{
+  float V[BBB_AIN_NUM]; 
+  float x[6]; 
+  int ain, ret = 0; 
+
+  /* all the analog inputs in one go (the descriptors stay open between calls) */ 
+  if (bbb_ain_V_many(HK_AIN_MASK, navg, V)) 
   {
-    char * found_after = strstr(str,after);
-    if (found_after) offset = found_after - str; 
+    for (ain = 0; ain < BBB_AIN_NUM; ain++) V[ain] = -1; 
+    ret = 1; 
   }
 
+  /* now, read in our temperatures*/ 
+  x[0] = V_to_C(1.5*V[BOARD_TEMP_AIN]); 
+  x[1] = V_to_C(1.5*V[ADC_TEMP_0_AIN]); 
+  /* hk->temp_adc_1 =  mV_to_C(1.5*bbb_ain_mV(ADC_TEMP_1_AIN)) ; */
+
+  /* and the currents */ 
+  x[2] = V_to_mA(V[FRONTEND_IMON_AIN]); 
+  x[3] = V_to_mA(V[ADC_IMON_AIN]); 
+  x[4] = V_to_mA(V[AUX_IMON_AIN]); 
+  x[5] = V_to_mA(V[ANT_IMON_AIN]); 
+
+  hk->temp_board = x[0]; 
+  hk->temp_adc = x[1]; 
+  hk->frontend_current = x[2]; 
+  hk->adc_current = x[3]; 
+  hk->aux_current = x[4]; 
+  hk->ant_current = x[5]; 
+
+  if (vals) memcpy(vals, x, sizeof(x)); 
+  return ret; 
+}
 
-  char real_key[128]; // no key can possibly be longer than this? 
-  snprintf(real_key, sizeof(real_key),"\"%s\": ", key); 
+/* figure out the disk space  and memory*/ 
+static void read_slow(beacon_hk_t * hk) 
+{
+  struct statvfs fs; 
+  statvfs("/", &fs); 
+  hk->disk_space_kB = fs.f_bsize * (fs.f_bavail >> 10) ; 
+  hk->free_mem_kB = get_free_kB(); 
+}
 
-  char * start = strstr(str+offset, real_key); 
-  if (!start) return 0; 
+static void set_time(beacon_hk_t * hk) 
+{
+  struct timespec now; 
+  clock_gettime(CLOCK_REALTIME_COARSE, &now); 
+  hk->unixTime = now.tv_sec; 
+  hk->unixTimeMillisecs = now.tv_nsec / (1000000); 
+}
 
-  char fmt[132]; 
-  fmt[0]= 0; 
-  strcat(fmt,real_key); 
-  strcat(fmt,"%f"); 
 
-  float f; 
-  int found = sscanf(start, fmt, &f); 
+//----------------------------------------
+// The sampler 
+//----------------------------------------
 
-  if (!found) return 0; 
-  return f; 
+static double unix_now() 
+{
+  struct timespec ts; 
+  clock_gettime(CLOCK_REALTIME, &ts); 
+  return ts.tv_sec + 1e-9 * ts.tv_nsec; 
 }
 
+/* must hold sampler.lock */ 
+static void publish(beacon_hk_ctx_t * c) 
+{
+  summary_words_t u; 
+  uint32_t seq = c->published.seq; 
+  size_t i; 
+
+  memset(&u, 0, sizeof(u)); 
+  c->sampler.state.updates++; 
+  c->sampler.state.current.length = mono_now() - c->sampler.window_t0; 
+  set_time(&c->sampler.state.latest); 
+  u.s = c->sampler.state; 
+
+  __atomic_store_n(&c->published.seq, seq + 1, __ATOMIC_RELAXED); 
+  __atomic_thread_fence(__ATOMIC_RELEASE); 
+  for (i = 0; i < SUMMARY_WORDS; i++) __atomic_store_n(&c->published.u.w[i], u.w[i], __ATOMIC_RELAXED); 
+  __atomic_store_n(&c->published.seq, seq + 2, __ATOMIC_RELEASE); 
+
+  if (c->sampler.shm) beacon_shm_publish_hk(c->sampler.shm, &u.s.latest); 
+}
 
+static void stat_add(beacon_hk_stat_t * st, float x) 
+{
+  if (!st->n || x < st->min) st->min = x; 
+  if (!st->n || x > st->max) st->max = x; 
+  st->n++; 
+  st->mean += (x - st->mean) / st->n; 
+}
 
-static int parse_http(http_buf_t * buf, beacon_hk_t * hk) 
+/* must hold sampler.lock */ 
+static void window_add(beacon_hk_ctx_t * c, const float * vals) 
 {
-  
-  if (!buf->size || !buf->buf) 
+  beacon_hk_window_t * w = &c->sampler.state.current; 
+  double now = mono_now(); 
+
+  if (now - c->sampler.window_t0 >= c->sampler.opts.window) 
   {
-    return 1; 
+    w->length = now - c->sampler.window_t0; 
+    c->sampler.state.last = *w; 
+    memset(w, 0, sizeof(*w)); 
+    w->start = unix_now(); 
+    c->sampler.window_t0 = now; 
   }
 
-  //once again, this does the dumbest possible things, and could be faster. but obviously don't matter
-  //look for the inverter battery voltage
-  //assume all inverters have "FX" in them
-  float inv_batt_v = parse_json_number_like_an_idiot(buf->buf, "Batt_V", "\"FX\""); 
-  ///assume the charge controller has "CC" in it
-  float cc_batt_v = parse_json_number_like_an_idiot(buf->buf, "Batt_V","\"CC\""); 
-  float ah = parse_json_number_like_an_idiot(buf->buf, "Out_AH","\"CC\""); 
-  float kwh = parse_json_number_like_an_idiot(buf->buf, "Out_kWh","\"CC\""); 
-  float pv = parse_json_number_like_an_idiot(buf->buf, "In_V","\"CC\""); 
-
-  hk->inv_batt_dV = inv_batt_v *10; 
-  hk->cc_batt_dV = cc_batt_v *10; 
-  hk->pv_dV = pv*10; 
-  hk->cc_daily_Ah = ah > 255 ? 255 : ah; 
-  hk->cc_daily_hWh = kwh > 25.5 ? 255: kwh * 10; 
-  return 0; 
+  stat_add(&w->temp_board, vals[0]); 
+  stat_add(&w->temp_adc, vals[1]); 
+  stat_add(&w->frontend_current, vals[2]); 
+  stat_add(&w->adc_current, vals[3]); 
+  stat_add(&w->aux_current, vals[4]); 
+  stat_add(&w->ant_current, vals[5]); 
 }
 
+/* Waits until the given monotonic time, or until stopped. Must hold sampler.lock. Returns nonzero when stopped. */ 
+static int sampler_wait(beacon_hk_ctx_t * c, double when) 
+{
+  while (!c->sampler.stop && when > mono_now()) wait_until(&c->sampler.stop_cv, &c->sampler.lock, when); 
+  return c->sampler.stop; 
+}
+
+/* the next time something with this interval is due, not letting it pile up if we fell behind */ 
+static double next_time(double last, double interval, double now) 
+{
+  return last + interval > now ? last + interval : now + interval; 
+}
+
+/* the analog inputs and gpio's */ 
+static void * fast_loop(void * arg) 
+{
+  beacon_hk_ctx_t * c = arg; 
+  double next_ain = 0, next_gpio = 0; 
 
+  pthread_mutex_lock(&c->sampler.lock); 
+  while (!sampler_wait(c, next_ain < next_gpio ? next_ain : next_gpio)) 
+  {
+    double now = mono_now(); 
+    int do_ain = now >= next_ain, do_gpio = now >= next_gpio; 
+    beacon_gpio_power_state_t gpio = 0; 
+    beacon_hk_t hk; 
+    float vals[6]; 
+
+    pthread_mutex_unlock(&c->sampler.lock); 
+    if (do_ain) read_ain(&hk, c->sampler.opts.ain_navg, vals); 
+    if (do_gpio) gpio = query_gpio_state(c); 
+    pthread_mutex_lock(&c->sampler.lock); 
+
+    if (do_ain) 
+    {
+      beacon_hk_t * latest = &c->sampler.state.latest; 
+      latest->temp_board = hk.temp_board; 
+      latest->temp_adc = hk.temp_adc; 
+      latest->frontend_current = hk.frontend_current; 
+      latest->adc_current = hk.adc_current; 
+      latest->aux_current = hk.aux_current; 
+      latest->ant_current = hk.ant_current; 
+      window_add(c, vals); 
+      next_ain = next_time(next_ain, c->sampler.opts.ain_interval, now); 
+    }
+    if (do_gpio) 
+    {
+      c->sampler.state.latest.gpio_state = gpio; 
+      next_gpio = next_time(next_gpio, c->sampler.opts.gpio_interval, now); 
+    }
+    publish(c); 
+  }
+  pthread_mutex_unlock(&c->sampler.lock); 
+  return NULL; 
+}
 
-void beacon_hk_set_mate3_address(const char * addr, int port)
+/* the disk, memory and MATE3, which may be slow */ 
+static void * slow_loop(void * arg) 
 {
+  beacon_hk_ctx_t * c = arg; 
+  double next_slow = 0, next_mate3 = 0; 
 
-  if (port) mate3_port = port; 
-  if (mate3_addr) free(mate3_addr); 
-  mate3_addr = 0; 
-  asprintf(&mate3_addr, "http://%s:%d/Dev_status.cgi?Port=0", addr, mate3_port); 
+  pthread_mutex_lock(&c->sampler.lock); 
+  while (!sampler_wait(c, next_slow < next_mate3 ? next_slow : next_mate3)) 
+  {
+    double now = mono_now(); 
+    int do_slow = now >= next_slow, do_mate3 = now >= next_mate3; 
+    int mate3_ok = 0; 
+    beacon_hk_t hk; 
+
+    pthread_mutex_unlock(&c->sampler.lock); 
+    if (do_slow) read_slow(&hk); 
+    if (do_mate3) mate3_ok = !mate3_fill(c, &hk); 
+    pthread_mutex_lock(&c->sampler.lock); 
+
+    if (do_slow) 
+    {
+      c->sampler.state.latest.disk_space_kB = hk.disk_space_kB; 
+      c->sampler.state.latest.free_mem_kB = hk.free_mem_kB; 
+      next_slow = next_time(next_slow, c->sampler.opts.slow_interval, now); 
+    }
+    if (do_mate3) 
+    {
+      beacon_hk_t * latest = &c->sampler.state.latest; 
+      latest->inv_batt_dV = hk.inv_batt_dV; 
+      latest->cc_batt_dV = hk.cc_batt_dV; 
+      latest->pv_dV = hk.pv_dV; 
+      latest->cc_daily_Ah = hk.cc_daily_Ah; 
+      latest->cc_daily_hWh = hk.cc_daily_hWh; 
+      c->sampler.state.mate3_ok = mate3_ok; 
+      next_mate3 = next_time(next_mate3, c->sampler.opts.mate3_interval, now); 
+    }
+    publish(c); 
+  }
+  pthread_mutex_unlock(&c->sampler.lock); 
+  return NULL; 
 }
 
 
-static int http_update(beacon_hk_t *hk)
+int beacon_hk_ctx_sampler_start(beacon_hk_ctx_t * c, const beacon_hk_sampler_opts_t * opts) 
 {
-  if (!mate3_addr) goto fail;
-  if (!curl) 
+  beacon_hk_sampler_opts_t o; 
+  float vals[6]; 
+
+  pthread_mutex_lock(&c->sampler.control); 
+  if (c->sampler.running) 
   {
-    curl = curl_easy_init(); 
-    if (!curl) goto fail;
+    pthread_mutex_unlock(&c->sampler.control); 
+    return 0; 
   }
 
-  http_buf.pos = 0; 
+  memset(&o, 0, sizeof(o)); 
+  if (opts) o = *opts; 
+  if (o.ain_interval <= 0) o.ain_interval = 0.1; 
+  if (o.ain_navg < 1) o.ain_navg = 1; 
+  if (o.gpio_interval <= 0) o.gpio_interval = 1; 
+  if (o.slow_interval <= 0) o.slow_interval = 10; 
+  if (o.mate3_interval > 0) beacon_hk_ctx_set_mate3_interval(c, o.mate3_interval); 
+  else o.mate3_interval = MATE3_DEFAULT_INTERVAL; 
+  if (o.window <= 0) o.window = 60; 
+
+  // start with everything but the MATE3, so there's something to read right away 
+  pthread_mutex_lock(&c->sampler.lock); 
+  c->sampler.opts = o; 
+  c->sampler.stop = 0; 
+  c->sampler.shm = o.shm_name ? beacon_shm_create(o.shm_name) : NULL; 
+  if (o.shm_name && !c->sampler.shm) fprintf(stderr, "Could not create shared memory segment %s\n", o.shm_name); 
+  memset(&c->sampler.state, 0, sizeof(c->sampler.state)); 
+  c->sampler.state.current.start = unix_now(); 
+  c->sampler.window_t0 = mono_now(); 
+  read_ain(&c->sampler.state.latest, o.ain_navg, vals); 
+  window_add(c, vals); 
+  read_slow(&c->sampler.state.latest); 
+  c->sampler.state.latest.gpio_state = query_gpio_state(c); 
+  publish(c); 
+  pthread_mutex_unlock(&c->sampler.lock); 
+
+  if (pthread_create(&c->sampler.fast_thread, NULL, fast_loop, c)) goto fail; 
+  if (pthread_create(&c->sampler.slow_thread, NULL, slow_loop, c)) 
+  {
+    pthread_mutex_lock(&c->sampler.lock); 
+    c->sampler.stop = 1; 
+    pthread_cond_broadcast(&c->sampler.stop_cv); 
+    pthread_mutex_unlock(&c->sampler.lock); 
+    pthread_join(c->sampler.fast_thread, NULL); 
+    goto fail; 
+  }
 
-  curl_easy_setopt(curl, CURLOPT_URL, mate3_addr); 
-  curl_easy_setopt(curl, CURLOPT_HTTPGET,1); 
-  curl_easy_setopt(curl, CURLOPT_TIMEOUT,1); 
-  curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, save_http); 
-  curl_easy_setopt( curl, CURLOPT_WRITEDATA, &http_buf); 
-  if (curl_easy_perform(curl)) goto fail; 
-  return parse_http(&http_buf, hk); 
+  __atomic_store_n(&c->sampler.running, 1, __ATOMIC_RELEASE); 
+  pthread_mutex_unlock(&c->sampler.control); 
+  return 0; 
 
 fail: 
-  hk->inv_batt_dV = 0; 
-  hk->cc_batt_dV = 0; 
-  hk->pv_dV = 0; 
-  hk->cc_daily_Ah = 0;
-  hk->cc_daily_hWh = 0;
+  beacon_shm_close(c->sampler.shm); 
+  c->sampler.shm = NULL; 
+  pthread_mutex_unlock(&c->sampler.control); 
   return 1; 
+}
+
 
+int beacon_hk_ctx_sampler_get(beacon_hk_ctx_t * c, beacon_hk_t * hk, beacon_hk_summary_t * summary) 
+{
+  summary_words_t u; 
+  uint32_t seq0, seq1; 
+  size_t i; 
+
+  if (!__atomic_load_n(&c->sampler.running, __ATOMIC_ACQUIRE)) return 1; 
+
+  do 
+  {
+    seq0 = __atomic_load_n(&c->published.seq, __ATOMIC_ACQUIRE); 
+    for (i = 0; i < SUMMARY_WORDS; i++) u.w[i] = __atomic_load_n(&c->published.u.w[i], __ATOMIC_RELAXED); 
+    __atomic_thread_fence(__ATOMIC_ACQUIRE); 
+    seq1 = __atomic_load_n(&c->published.seq, __ATOMIC_RELAXED); 
+  } while ((seq0 & 1) || seq0 != seq1); 
+
+  if (hk) *hk = u.s.latest; 
+  if (summary) *summary = u.s; 
+  return 0; 
+}
+
+
+void beacon_hk_ctx_sampler_stop(beacon_hk_ctx_t * c) 
+{
+  pthread_mutex_lock(&c->sampler.control); 
+  if (!c->sampler.running) 
+  {
+    pthread_mutex_unlock(&c->sampler.control); 
+    return; 
+  }
+  __atomic_store_n(&c->sampler.running, 0, __ATOMIC_RELEASE); 
+
+  pthread_mutex_lock(&c->sampler.lock); 
+  c->sampler.stop = 1; 
+  pthread_cond_broadcast(&c->sampler.stop_cv); 
+  pthread_mutex_unlock(&c->sampler.lock); 
+  pthread_join(c->sampler.fast_thread, NULL); 
+  pthread_join(c->sampler.slow_thread, NULL); 
+
+  // the segment stays, with the last values, for whoever is reading it 
+  beacon_shm_close(c->sampler.shm); 
+  c->sampler.shm = NULL; 
+  pthread_mutex_unlock(&c->sampler.control); 
 }
 
 
 //----------------------------------------
 //The main hk update method 
 //----------------------------------------
-int beacon_hk(beacon_hk_t * hk) 
+int beacon_hk_ctx_hk(beacon_hk_ctx_t * c, beacon_hk_t * hk) 
 {
+  beacon_hk_summary_t summary; 
+
+  /* if the sampler is running, it already has everything */ 
+  if (!beacon_hk_ctx_sampler_get(c, NULL, &summary)) 
+  {
+    *hk = summary.latest; 
+    return !summary.mate3_ok; 
+  }
 
   /* first the ASPS-DAQ bits, using the specified method. */
+  read_ain(hk, 1, NULL); 
+  read_slow(hk); 
 
-  struct timespec now; 
-  struct statvfs fs; 
+  /* check our gpio state */ 
+  hk->gpio_state = query_gpio_state(c)  ; 
 
-  /* now, read in our temperatures*/ 
-  hk->temp_board =  V_to_C(1.5*bbb_ain_V(BOARD_TEMP_AIN)) ;
-  hk->temp_adc =  V_to_C(1.5*bbb_ain_V(ADC_TEMP_0_AIN)) ;
-  /* hk->temp_adc_1 =  mV_to_C(1.5*bbb_ain_mV(ADC_TEMP_1_AIN)) ; */
+  //get the time
+  set_time(hk); 
 
+  //the power system values, as of the last time the MATE3 answered 
+  return mate3_fill(c, hk); 
 
-  /* and the currents */ 
-  hk->adc_current = V_to_mA(bbb_ain_V(ADC_IMON_AIN));
-  hk->ant_current = V_to_mA(bbb_ain_V(ANT_IMON_AIN));
-  hk->aux_current = V_to_mA(bbb_ain_V(AUX_IMON_AIN));
-  hk->frontend_current = V_to_mA(bbb_ain_V(FRONTEND_IMON_AIN));
+}
 
 
-  /* figure out the disk space  and memory*/ 
-  statvfs("/", &fs); 
-  hk->disk_space_kB = fs.f_bsize * (fs.f_bavail >> 10) ; 
-  hk->free_mem_kB = get_free_kB(); 
+//-----------------------------------------
+//    contexts 
+//-----------------------------------------
 
-  /* check our gpio state */ 
-  hk->gpio_state = query_gpio_state()  ; 
+static pthread_once_t curl_once = PTHREAD_ONCE_INIT; 
 
-  //get the time
-  clock_gettime(CLOCK_REALTIME_COARSE, &now); 
-  hk->unixTime = now.tv_sec; 
-  hk->unixTimeMillisecs = now.tv_nsec / (1000000); 
+// curl_global_init isn't thread-safe, so do it once here rather than letting curl_easy_init do it 
+static void init_curl() 
+{
+  curl_global_init(CURL_GLOBAL_ALL); 
+}
 
+static void ctx_init(beacon_hk_ctx_t * c) 
+{
+  pthread_once(&curl_once, init_curl); 
+  memset(c, 0, sizeof(*c)); 
+  pthread_mutex_init(&c->gpio_lock, NULL); 
+  pthread_mutex_init(&c->mate3.lock, NULL); 
+  pthread_mutex_init(&c->mate3.query_lock, NULL); 
+  pthread_cond_init(&c->mate3.cv, NULL); 
+  c->mate3.interval = MATE3_DEFAULT_INTERVAL; 
+  c->mate3.port = 8080; 
+  pthread_mutex_init(&c->sampler.control, NULL); 
+  pthread_mutex_init(&c->sampler.lock, NULL); 
+  pthread_cond_init(&c->sampler.stop_cv, NULL); 
+}
 
-  //load the http stuff
-  return http_update(hk); 
+static void ctx_fini(beacon_hk_ctx_t * c) 
+{
+  // the threads first, since they use everything else 
+  beacon_hk_ctx_sampler_stop(c); 
+  mate3_poller_stop(c); 
 
+  //do NOT unexport any of these!
+  if (c->master_fpga_ctl) bbb_gpio_close(c->master_fpga_ctl,0); 
+  if (c->comm_ctl) bbb_gpio_close(c->comm_ctl,0); 
+  if (c->mate3.addr) free(c->mate3.addr); 
+  if (c->mate3.curl) curl_easy_cleanup(c->mate3.curl); 
+
+  pthread_mutex_destroy(&c->gpio_lock); 
+  pthread_mutex_destroy(&c->mate3.lock); 
+  pthread_mutex_destroy(&c->mate3.query_lock); 
+  pthread_cond_destroy(&c->mate3.cv); 
+  pthread_mutex_destroy(&c->sampler.control); 
+  pthread_mutex_destroy(&c->sampler.lock); 
+  pthread_cond_destroy(&c->sampler.stop_cv); 
 }
 
 
-int beacon_set_gpio_power_state ( beacon_gpio_power_state_t state, beacon_gpio_power_state_t mask) 
+beacon_hk_ctx_t * beacon_hk_ctx_create() 
 {
-  if (! gpios_are_setup) setup_gpio(); 
+  beacon_hk_ctx_t * c = malloc(sizeof(*c)); 
+  if (c) ctx_init(c); 
+  return c; 
+}
 
-  int ret = 0; 
+void beacon_hk_ctx_destroy(beacon_hk_ctx_t * c) 
+{
+  if (!c) return; 
+  ctx_fini(c); 
+  free(c); 
+}
 
-  if (mask & BN_FPGA_POWER_MASTER) 
-  {
-    ret += !master_fpga_ctl || bbb_gpio_set( master_fpga_ctl, (state & BN_FPGA_POWER_MASTER)); 
-  }
 
-  if (mask & BN_SPI_ENABLE) 
-  {
-    //this one is active low
-    ret += !comm_ctl || bbb_gpio_set( comm_ctl, !(state & BN_SPI_ENABLE) ); 
-  }
+static beacon_hk_ctx_t default_ctx; 
+static pthread_once_t default_once = PTHREAD_ONCE_INIT; 
+static int default_ctx_used = 0; 
 
-  return ret; 
+static void default_ctx_init() 
+{
+  ctx_init(&default_ctx); 
+  default_ctx_used = 1; 
+}
+
+beacon_hk_ctx_t * beacon_hk_default_ctx() 
+{
+  pthread_once(&default_once, default_ctx_init); 
+  return &default_ctx; 
 }
 
 
-/** Sleep that resumes when interrupted by a signal */ 
-static void smart_sleep(int amount) 
+//-----------------------------------------
+//    the default context API 
+//-----------------------------------------
+
+int beacon_hk(beacon_hk_t * hk) 
 {
-  while(amount) amount = sleep(amount);
+  return beacon_hk_ctx_hk(beacon_hk_default_ctx(), hk); 
 }
 
-///////////////////////////////////////////
-////  FPGA reboot
-////////////////////////////////////////////
-int beacon_reboot_fpga_power(int sleep_after_off, int sleep_after_master_on)
+void beacon_hk_set_mate3_address(const char * addr, int port) 
 {
-  if (!gpios_are_setup) setup_gpio(); 
+  beacon_hk_ctx_set_mate3_address(beacon_hk_default_ctx(), addr, port); 
+}
 
-  int ret = 0; 
-  ret+=bbb_gpio_set(master_fpga_ctl, 0); 
-  smart_sleep(sleep_after_off); 
-  ret+=bbb_gpio_set(master_fpga_ctl, 1); 
-  smart_sleep(sleep_after_master_on); 
-  return ret; 
+void beacon_hk_set_mate3_interval(double seconds) 
+{
+  beacon_hk_ctx_set_mate3_interval(beacon_hk_default_ctx(), seconds); 
+}
+
+int beacon_hk_query_mate3(beacon_hk_t * hk) 
+{
+  return beacon_hk_ctx_query_mate3(beacon_hk_default_ctx(), hk); 
+}
+
+int beacon_hk_get_mate3_status(beacon_mate3_status_t * st) 
+{
+  return beacon_hk_ctx_get_mate3_status(beacon_hk_default_ctx(), st); 
+}
+
+int beacon_set_gpio_power_state ( beacon_gpio_power_state_t state, beacon_gpio_power_state_t mask) 
+{
+  return beacon_hk_ctx_set_gpio_power_state(beacon_hk_default_ctx(), state, mask); 
+}
+
+int beacon_reboot_fpga_power(int sleep_after_off, int sleep_after_master_on) 
+{
+  return beacon_hk_ctx_reboot_fpga_power(beacon_hk_default_ctx(), sleep_after_off, sleep_after_master_on); 
+}
+
+int beacon_hk_sampler_start(const beacon_hk_sampler_opts_t * opts) 
+{
+  return beacon_hk_ctx_sampler_start(beacon_hk_default_ctx(), opts); 
+}
+
+int beacon_hk_sampler_get(beacon_hk_t * hk, beacon_hk_summary_t * summary) 
+{
+  return beacon_hk_ctx_sampler_get(beacon_hk_default_ctx(), hk, summary); 
+}
+
+void beacon_hk_sampler_stop(void) 
+{
+  beacon_hk_ctx_sampler_stop(beacon_hk_default_ctx()); 
 }
 
 
@@ -379,14 +1169,6 @@ int beacon_reboot_fpga_power(int sleep_after_off, int sleep_after_master_on)
 __attribute__((destructor)) 
 static void beacon_hk_destroy() 
 {
-  //do NOT unexport any of these!
-  if (master_fpga_ctl) bbb_gpio_close(master_fpga_ctl,0); 
-  if (comm_ctl) bbb_gpio_close(comm_ctl,0); 
-  if (mate3_addr) free(mate3_addr); 
-  if (curl) curl_easy_cleanup(curl); 
+  if (default_ctx_used) ctx_fini(&default_ctx); 
 }
 
-
-
-
-
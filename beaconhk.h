@@ -12,7 +12,10 @@
  *   To set the GPIO power states  
  *
  *
- *  This module uses static internal buffers so it is not thread-safe nor reentrant! 
+ *   All the state (GPIO handles, the MATE3 connection and poller, the sampler) lives in a beacon_hk_ctx_t.
+ *   The functions here without a context use a default one, created on first use, and may be called from 
+ *   any thread. Several contexts (e.g. one per station) can be used at once without sharing anything but 
+ *   the hardware itself. 
  *
  *  Cosmin Deaconu
  *  <cozzyd@kicp.uchicago.edu> 
@@ -21,15 +24,41 @@
 
 
 
-/** Fills in this hk struct, using the specified method to communicate with the ASPS-DAQ */ 
+/** Fills in this hk struct, using the specified method to communicate with the ASPS-DAQ.
+ * If the sampler (see below) is running, this just copies its latest values.
+ *
+ * The power system values are whatever the MATE3 last answered (see below), so this doesn't wait for it.
+ * Returns nonzero if they're out of date (the last query failed) or there aren't any. */
 int beacon_hk(beacon_hk_t * hk); 
 
 
 /** In order to get information about the power system, we must communicate with the mate3
  * If you pass 0 for port, then the port is not updated (default is 8080). 
+ *
+ * This starts a background thread that polls it every so often (see beacon_hk_set_mate3_interval) and caches
+ * the last good values. While it doesn't answer, the polling backs off, up to 5 minutes between tries. 
  * */ 
 void beacon_hk_set_mate3_address(const char * addr, int port); 
 
+/** How often to poll the MATE3, in seconds (default 10) */ 
+void beacon_hk_set_mate3_interval(double seconds); 
+
+/** Query the MATE3 right now, waiting (up to a second) for it, and fill in the power system values of hk. 
+ * On failure, the cached values are filled in instead. Returns 0 on success. */ 
+int beacon_hk_query_mate3(beacon_hk_t * hk); 
+
+/** The state of the MATE3 polling */ 
+typedef struct beacon_mate3_status
+{
+  int have_values;     //!< whether there are any cached values 
+  double age;          //!< seconds since the MATE3 last answered, or -1 if it never has 
+  int failures;        //!< consecutive failed queries 
+  double next_poll;    //!< seconds until the next query 
+} beacon_mate3_status_t; 
+
+/** Get the state of the MATE3 polling. Returns 0 if the last query worked. */ 
+int beacon_hk_get_mate3_status(beacon_mate3_status_t * st); 
+
 /** Set the GPIO power state. For the FPGA's to be on, the relevant ASPS power state must also be enabled
  * Note that even for things with inverted state (active low instead of active high), you should use the 
  * logical state here. 
@@ -39,7 +68,112 @@ void beacon_hk_set_mate3_address(const char * addr, int port);
 int beacon_set_gpio_power_state ( beacon_gpio_power_state_t state, beacon_gpio_power_state_t mask); 
 
 /** Reboots the FPGA's via the gpio's */
-int beacon_reboot_fpga_power(int sleep_after_off, int sleep_after_master_on); 
+int beacon_reboot_fpga_power(int sleep_after_off, int sleep_after_master_on);
+
+
+/** \name Background sampling
+ *
+ * Instead of sampling everything once whenever beacon_hk is called, a sampler thread can read each
+ * source at its own cadence: the analog inputs (temperatures and currents) and GPIO state quickly, the
+ * disk, memory and cached MATE3 values slowly (on a second thread, so a slow disk doesn't hold up the rest).
+ * Min/max/mean of the analog quantities are accumulated over a window, so short current spikes show up
+ * even if hk is only recorded once a minute.
+ *
+ * The latest values are published with a seqlock, so beacon_hk_sampler_get (and beacon_hk, which just
+ * returns the latest values while the sampler runs) never blocks and makes no syscalls.
+ *
+ * There is one sampler per context (see below). The GPIO and MATE3 functions above may still be used while it runs.
+ * @{
+ */
+
+/** Options for beacon_hk_sampler_start(). Zero means default for any member. */
+typedef struct beacon_hk_sampler_opts
+{
+  double ain_interval;    //!< seconds between reads of the analog inputs (default 0.1)
+  int ain_navg;           //!< samples averaged per read (default 1, so spikes aren't smoothed away)
+  double gpio_interval;   //!< seconds between reads of the GPIO state (default 1)
+  double slow_interval;   //!< seconds between checks of the disk space and free memory (default 10)
+  double mate3_interval;  //!< seconds between MATE3 queries, see beacon_hk_set_mate3_interval (default: leave it)
+  double window;          //!< seconds the min/max/mean accumulate over (default 60)
+  const char * shm_name;  //!< if not NULL, also publish the latest hk to this shared memory segment (see beaconshm.h)
+} beacon_hk_sampler_opts_t;
+
+/** Statistics of one analog quantity over a window */
+typedef struct beacon_hk_stat
+{
+  float min;
+  float max;
+  float mean;
+  uint32_t n;             //!< number of samples
+} beacon_hk_stat_t;
+
+/** Statistics of all the analog quantities. Temperatures are in C and currents in mA, like beacon_hk_t */
+typedef struct beacon_hk_window
+{
+  double start;           //!< unix time the window started
+  double length;          //!< seconds it covers (so far, for the current window)
+  beacon_hk_stat_t temp_board;
+  beacon_hk_stat_t temp_adc;
+  beacon_hk_stat_t frontend_current;
+  beacon_hk_stat_t adc_current;
+  beacon_hk_stat_t aux_current;
+  beacon_hk_stat_t ant_current;
+} beacon_hk_window_t;
+
+/** A consistent snapshot of everything the sampler knows */
+typedef struct beacon_hk_summary
+{
+  beacon_hk_t latest;          //!< the most recent value of everything (unixTime is when it was published)
+  int mate3_ok;                //!< whether the last MATE3 query worked
+  uint64_t updates;            //!< number of times it's been published
+  beacon_hk_window_t current;  //!< the window being accumulated
+  beacon_hk_window_t last;     //!< the last complete window (n = 0 until there is one)
+} beacon_hk_summary_t;
+
+/** Start the sampler thread(s). opts may be NULL for defaults. Returns 0 on success, or if it's already running. */
+int beacon_hk_sampler_start(const beacon_hk_sampler_opts_t * opts);
+
+/** Get the latest snapshot. hk or summary may be NULL. Returns 0 on success, 1 if the sampler isn't running. */
+int beacon_hk_sampler_get(beacon_hk_t * hk, beacon_hk_summary_t * summary);
+
+/** Stop the sampler. beacon_hk goes back to sampling synchronously. */
+void beacon_hk_sampler_stop(void);
+
+/** @} */
+
+
+/** \name Contexts
+ *
+ * Each of the functions above has a version taking a context, which does the same thing to that context 
+ * only. Each context has its own MATE3 address, poller and sampler; they all read the same analog inputs and 
+ * GPIO's. 
+ * @{
+ */
+
+/** opaque handle */
+typedef struct beacon_hk_ctx beacon_hk_ctx_t; 
+
+/** Create a context. Nothing is started until it's used. Returns NULL on failure. */ 
+beacon_hk_ctx_t * beacon_hk_ctx_create(void); 
+
+/** Stop the context's sampler and MATE3 poller and free it */ 
+void beacon_hk_ctx_destroy(beacon_hk_ctx_t * ctx); 
+
+/** The context used by the functions without one (it's freed at exit) */ 
+beacon_hk_ctx_t * beacon_hk_default_ctx(void); 
+
+int beacon_hk_ctx_hk(beacon_hk_ctx_t * ctx, beacon_hk_t * hk); 
+void beacon_hk_ctx_set_mate3_address(beacon_hk_ctx_t * ctx, const char * addr, int port); 
+void beacon_hk_ctx_set_mate3_interval(beacon_hk_ctx_t * ctx, double seconds); 
+int beacon_hk_ctx_query_mate3(beacon_hk_ctx_t * ctx, beacon_hk_t * hk); 
+int beacon_hk_ctx_get_mate3_status(beacon_hk_ctx_t * ctx, beacon_mate3_status_t * st); 
+int beacon_hk_ctx_set_gpio_power_state(beacon_hk_ctx_t * ctx, beacon_gpio_power_state_t state, beacon_gpio_power_state_t mask); 
+int beacon_hk_ctx_reboot_fpga_power(beacon_hk_ctx_t * ctx, int sleep_after_off, int sleep_after_master_on); 
+int beacon_hk_ctx_sampler_start(beacon_hk_ctx_t * ctx, const beacon_hk_sampler_opts_t * opts); 
+int beacon_hk_ctx_sampler_get(beacon_hk_ctx_t * ctx, beacon_hk_t * hk, beacon_hk_summary_t * summary); 
+void beacon_hk_ctx_sampler_stop(beacon_hk_ctx_t * ctx); 
+
+/** @} */
 
 
 #endif
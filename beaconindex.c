@@ -0,0 +1,509 @@
+#include "beaconindex.h"
+#include "beaconreader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define INDEX_MAGIC "BNIX"
+#define INDEX_VERSION 1
+
+// the most dictionary inflate can use
+#define WINSIZE 32768
+
+struct index_entry
+{
+  uint64_t event_number;
+  uint64_t offset;
+};
+
+struct beacon_index
+{
+  size_t nentries;
+  struct index_entry * entries;   //sorted by event number
+  size_t npoints;
+  beacon_index_point_t * points;  //sorted by uoffset
+};
+
+struct beacon_index_writer
+{
+  FILE * f;
+  int err;
+  uint32_t point_events;     // full flush every this many records (0 for never)
+  uint64_t point_bytes;      // or this many uncompressed bytes (0 for never)
+  uint32_t since_point;      // records since the last access point
+  uint64_t last_point;       // uncompressed offset of the last access point
+};
+
+
+static int entry_cmp(const void * a, const void * b)
+{
+  const struct index_entry * ea = a;
+  const struct index_entry * eb = b;
+  if (ea->event_number != eb->event_number) return ea->event_number < eb->event_number ? -1 : 1;
+  return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+}
+
+static int point_cmp(const void * a, const void * b)
+{
+  const beacon_index_point_t * pa = a;
+  const beacon_index_point_t * pb = b;
+  return pa->uoffset < pb->uoffset ? -1 : pa->uoffset > pb->uoffset;
+}
+
+// returns 1 if all n bytes were read
+static int read_all(FILE * f, void * buf, size_t n)
+{
+  return fread(buf, 1, n, f) == n;
+}
+
+beacon_index_t * beacon_index_load(const char * path)
+{
+  FILE * f = fopen(path, "r");
+  char magic[4];
+  uint32_t version;
+  size_t entries_cap = 0, points_cap = 0;
+  beacon_index_t * idx;
+  int tag;
+
+  if (!f) return NULL;
+
+  if (!read_all(f, magic, sizeof(magic)) || memcmp(magic, INDEX_MAGIC, sizeof(magic))
+      || !read_all(f, &version, sizeof(version)) || version != INDEX_VERSION)
+  {
+    fclose(f);
+    return NULL;
+  }
+
+  idx = calloc(1, sizeof(*idx));
+
+  // anything truncated at the end is just ignored
+  while ((tag = fgetc(f)) != EOF)
+  {
+    if (tag == 'e')
+    {
+      struct index_entry e;
+      if (!read_all(f, &e.event_number, sizeof(e.event_number)) || !read_all(f, &e.offset, sizeof(e.offset))) break;
+      if (idx->nentries == entries_cap)
+      {
+        entries_cap = entries_cap ? 2 * entries_cap : 1024;
+        idx->entries = realloc(idx->entries, entries_cap * sizeof(*idx->entries));
+      }
+      idx->entries[idx->nentries++] = e;
+    }
+    else if (tag == 'p')
+    {
+      beacon_index_point_t pt;
+      uint32_t zlen;
+      uint8_t * z;
+      uLongf wlen;
+      if (!read_all(f, &pt.uoffset, sizeof(pt.uoffset)) || !read_all(f, &pt.coffset, sizeof(pt.coffset))
+          || !read_all(f, &pt.bits, sizeof(pt.bits)) || !read_all(f, &pt.flags, sizeof(pt.flags))
+          || !read_all(f, &pt.window_len, sizeof(pt.window_len)) || !read_all(f, &zlen, sizeof(zlen))
+          || pt.window_len > WINSIZE || zlen > compressBound(WINSIZE)) break;
+
+      pt.window = NULL;
+      z = malloc(zlen ? zlen : 1);
+      if (!read_all(f, z, zlen))
+      {
+        free(z);
+        break;
+      }
+
+      if (pt.window_len)
+      {
+        pt.window = malloc(pt.window_len);
+        wlen = pt.window_len;
+        if (uncompress(pt.window, &wlen, z, zlen) != Z_OK || wlen != pt.window_len)
+        {
+          free(z);
+          free(pt.window);
+          break;
+        }
+      }
+      free(z);
+
+      if (idx->npoints == points_cap)
+      {
+        points_cap = points_cap ? 2 * points_cap : 64;
+        idx->points = realloc(idx->points, points_cap * sizeof(*idx->points));
+      }
+      idx->points[idx->npoints++] = pt;
+    }
+    else
+    {
+      fprintf(stderr,"Garbage in index %s, ignoring the rest\n", path);
+      break;
+    }
+  }
+  fclose(f);
+
+  if (idx->nentries) qsort(idx->entries, idx->nentries, sizeof(*idx->entries), entry_cmp);
+  if (idx->npoints) qsort(idx->points, idx->npoints, sizeof(*idx->points), point_cmp);
+  return idx;
+}
+
+void beacon_index_free(beacon_index_t * idx)
+{
+  size_t i;
+  if (!idx) return;
+  for (i = 0; i < idx->npoints; i++) free(idx->points[i].window);
+  free(idx->points);
+  free(idx->entries);
+  free(idx);
+}
+
+int beacon_index_lookup(const beacon_index_t * idx, uint64_t event_number, uint64_t * offset)
+{
+  size_t lo = 0, hi = idx->nentries;
+
+  // first entry >= event_number
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (idx->entries[mid].event_number < event_number) lo = mid + 1;
+    else hi = mid;
+  }
+
+  if (lo == idx->nentries || idx->entries[lo].event_number != event_number) return BN_ERR_NO_SUCH_EVENT;
+  *offset = idx->entries[lo].offset;
+  return 0;
+}
+
+const beacon_index_point_t * beacon_index_find_point(const beacon_index_t * idx, uint64_t uoffset)
+{
+  size_t lo = 0, hi = idx->npoints;
+
+  // first point > uoffset
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (idx->points[mid].uoffset <= uoffset) lo = mid + 1;
+    else hi = mid;
+  }
+
+  return lo ? &idx->points[lo - 1] : NULL;
+}
+
+size_t beacon_index_nentries(const beacon_index_t * idx)
+{
+  return idx->nentries;
+}
+
+size_t beacon_index_npoints(const beacon_index_t * idx)
+{
+  return idx->npoints;
+}
+
+const beacon_index_point_t * beacon_index_get_point(const beacon_index_t * idx, size_t i)
+{
+  return i < idx->npoints ? &idx->points[i] : NULL;
+}
+
+
+beacon_index_writer_t * beacon_index_writer_open(const char * path)
+{
+  uint32_t version = INDEX_VERSION;
+  beacon_index_writer_t * w;
+  FILE * f = fopen(path, "w");
+  if (!f) return NULL;
+
+  w = calloc(1, sizeof(*w));
+  w->f = f;
+  if (fwrite(INDEX_MAGIC, 1, 4, f) != 4 || fwrite(&version, sizeof(version), 1, f) != 1) w->err = 1;
+  return w;
+}
+
+int beacon_index_writer_add(beacon_index_writer_t * w, uint64_t event_number, uint64_t offset)
+{
+  uint8_t buf[1 + 2 * sizeof(uint64_t)];
+  buf[0] = 'e';
+  memcpy(buf + 1, &event_number, sizeof(event_number));
+  memcpy(buf + 1 + sizeof(uint64_t), &offset, sizeof(offset));
+  if (fwrite(buf, sizeof(buf), 1, w->f) != 1) w->err = 1;
+  return w->err;
+}
+
+int beacon_index_writer_add_point(beacon_index_writer_t * w, const beacon_index_point_t * pt)
+{
+  uint8_t z[compressBound(WINSIZE)];
+  uLongf zlen32 = sizeof(z);
+  uint32_t zlen = 0;
+  uint8_t tag = 'p';
+
+  if (pt->window_len > WINSIZE) return 1;
+
+  if (pt->window_len)
+  {
+    if (compress2(z, &zlen32, pt->window, pt->window_len, Z_BEST_SPEED) != Z_OK) return 1;
+    zlen = zlen32;
+  }
+
+  if (fwrite(&tag, 1, 1, w->f) != 1
+      || fwrite(&pt->uoffset, sizeof(pt->uoffset), 1, w->f) != 1
+      || fwrite(&pt->coffset, sizeof(pt->coffset), 1, w->f) != 1
+      || fwrite(&pt->bits, sizeof(pt->bits), 1, w->f) != 1
+      || fwrite(&pt->flags, sizeof(pt->flags), 1, w->f) != 1
+      || fwrite(&pt->window_len, sizeof(pt->window_len), 1, w->f) != 1
+      || fwrite(&zlen, sizeof(zlen), 1, w->f) != 1
+      || fwrite(z, 1, zlen, w->f) != zlen)
+  {
+    w->err = 1;
+  }
+  return w->err;
+}
+
+void beacon_index_writer_set_flush(beacon_index_writer_t * w, uint32_t every_events, uint64_t every_bytes)
+{
+  w->point_events = every_events;
+  w->point_bytes = every_bytes;
+}
+
+/* if it's time, does a full flush and records an access point there, before the next record is written */
+static int maybe_add_point(beacon_index_writer_t * w, gzFile f)
+{
+  beacon_index_point_t pt;
+  uint64_t uoffset;
+
+  if (!w->point_events && !w->point_bytes) return 0;
+
+  uoffset = gztell(f);
+  if (!(w->point_events && w->since_point >= w->point_events)
+      && !(w->point_bytes && uoffset - w->last_point >= w->point_bytes))
+  {
+    return 0;
+  }
+
+  // after a full flush, the compressed stream is byte aligned and doesn't refer back to anything
+  if (gzflush(f, Z_FULL_FLUSH) != Z_OK) return BN_ERR_NOT_ENOUGH_BYTES;
+
+  memset(&pt, 0, sizeof(pt));
+  pt.uoffset = uoffset;
+  pt.coffset = gzoffset(f);
+  w->since_point = 0;
+  w->last_point = uoffset;
+  return beacon_index_writer_add_point(w, &pt);
+}
+
+int beacon_index_writer_close(beacon_index_writer_t * w)
+{
+  int ret = w->err;
+  if (fclose(w->f)) ret = 1;
+  free(w);
+  return ret;
+}
+
+int beacon_index_event_write(beacon_index_writer_t * w, FILE * f, const beacon_event_t * ev)
+{
+  uint64_t offset = ftello(f);
+  int ret = beacon_event_write(f, ev);
+  return ret ? ret : beacon_index_writer_add(w, ev->event_number, offset);
+}
+
+int beacon_index_event_gzwrite(beacon_index_writer_t * w, gzFile f, const beacon_event_t * ev)
+{
+  uint64_t offset;
+  int ret = maybe_add_point(w, f);
+  if (ret) return ret;
+
+  offset = gztell(f);
+  ret = beacon_event_gzwrite(f, ev);
+  w->since_point++;
+  return ret ? ret : beacon_index_writer_add(w, ev->event_number, offset);
+}
+
+int beacon_index_header_write(beacon_index_writer_t * w, FILE * f, const beacon_header_t * h)
+{
+  uint64_t offset = ftello(f);
+  int ret = beacon_header_write(f, h);
+  return ret ? ret : beacon_index_writer_add(w, h->event_number, offset);
+}
+
+int beacon_index_header_gzwrite(beacon_index_writer_t * w, gzFile f, const beacon_header_t * h)
+{
+  uint64_t offset;
+  int ret = maybe_add_point(w, f);
+  if (ret) return ret;
+
+  offset = gztell(f);
+  ret = beacon_header_gzwrite(f, h);
+  w->since_point++;
+  return ret ? ret : beacon_index_writer_add(w, h->event_number, offset);
+}
+
+
+/* Finds the access points of a gzip file, like zran.c's build_index(), except that every
+ * gzip member start is also a point (these need no window). */
+static int build_points(FILE * in, beacon_index_writer_t * w, size_t span)
+{
+  uint8_t input[1 << 14];
+  uint8_t window[WINSIZE];
+  uint8_t ordered[WINSIZE];
+  uint64_t totin = 0, totout = 0, last = 0, member_start = 0;
+  int ret = Z_OK;
+  z_stream strm;
+  beacon_index_point_t pt;
+
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, 15 + 16) != Z_OK) return 1;
+
+  memset(&pt, 0, sizeof(pt));
+  pt.flags = BN_INDEX_POINT_MEMBER;
+  beacon_index_writer_add_point(w, &pt);
+
+  strm.avail_out = 0;
+  while (1)
+  {
+    if (!strm.avail_in)
+    {
+      strm.avail_in = fread(input, 1, sizeof(input), in);
+      strm.next_in = input;
+      if (!strm.avail_in) break;
+    }
+
+    if (!strm.avail_out)
+    {
+      strm.avail_out = WINSIZE;
+      strm.next_out = window;
+    }
+
+    totin += strm.avail_in;
+    totout += strm.avail_out;
+    ret = inflate(&strm, Z_BLOCK);
+    totin -= strm.avail_in;
+    totout -= strm.avail_out;
+
+    if (ret == Z_NEED_DICT || ret == Z_MEM_ERROR || ret == Z_DATA_ERROR) break;
+
+    if (ret == Z_STREAM_END)
+    {
+      // another member may follow
+      int c;
+      if (!strm.avail_in)
+      {
+        if ((c = fgetc(in)) == EOF) break;
+        ungetc(c, in);
+      }
+      inflateReset(&strm);
+      memset(&pt, 0, sizeof(pt));
+      pt.uoffset = totout;
+      pt.coffset = totin;
+      pt.flags = BN_INDEX_POINT_MEMBER;
+      beacon_index_writer_add_point(w, &pt);
+      last = member_start = totout;
+      continue;
+    }
+
+    // at the end of a deflate block, but not the last one
+    if ((strm.data_type & 128) && !(strm.data_type & 64) && totout - last > span)
+    {
+      uint64_t have = totout - member_start < WINSIZE ? totout - member_start : WINSIZE;
+      size_t tail = WINSIZE - strm.avail_out;   // bytes at the start of window that are the newest
+
+      // unroll the circular buffer
+      if (have <= tail)
+      {
+        memcpy(ordered, window + tail - have, have);
+      }
+      else
+      {
+        memcpy(ordered, window + WINSIZE - (have - tail), have - tail);
+        memcpy(ordered + have - tail, window, tail);
+      }
+
+      pt.uoffset = totout;
+      pt.coffset = totin;
+      pt.bits = strm.data_type & 7;
+      pt.flags = 0;
+      pt.window_len = have;
+      pt.window = ordered;
+      beacon_index_writer_add_point(w, &pt);
+      last = totout;
+    }
+  }
+
+  inflateEnd(&strm);
+
+  // a truncated file or garbage after the last member still gives a usable index for what's there
+  return ret == Z_MEM_ERROR || (ret != Z_OK && ret != Z_STREAM_END && totout == 0);
+}
+
+int beacon_index_build(const char * data_path, const char * index_path, size_t span)
+{
+  beacon_index_writer_t * w;
+  beacon_reader_t * r;
+  uint8_t magic[2];
+  int ret = 0;
+  FILE * f = fopen(data_path, "r");
+  if (!f) return 1;
+
+  w = beacon_index_writer_open(index_path);
+  if (!w)
+  {
+    fclose(f);
+    return 1;
+  }
+
+  if (!span) span = BN_INDEX_DEFAULT_SPAN;
+
+  if (fread(magic, 1, 2, f) == 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+  {
+    rewind(f);
+    ret = build_points(f, w, span);
+  }
+  fclose(f);
+
+  r = ret ? NULL : beacon_reader_open(data_path);
+  if (r)
+  {
+    // read the records, noting where each is
+    beacon_event_t * ev = malloc(sizeof(beacon_event_t));
+    beacon_header_t h;
+    uint8_t start[4];
+    int is_header = 0, is_event = 0;
+
+    // a packet start alone is enough to tell the type
+    if (beacon_reader_read(r, start, sizeof(start)) == sizeof(start))
+    {
+      is_header = beacon_header_deserialize(start, sizeof(start), &h) != -BN_ERR_WRONG_TYPE;
+      is_event = beacon_event_deserialize(start, sizeof(start), ev) != -BN_ERR_WRONG_TYPE;
+      beacon_reader_seek(r, 0);
+    }
+
+    if (!is_header && !is_event)
+    {
+      fprintf(stderr,"%s is not a header or event file\n", data_path);
+      ret = 1;
+    }
+
+    while (is_header || is_event)
+    {
+      uint64_t offset = beacon_reader_tell(r);
+      beacon_read_error_t err;
+      int got = is_header ? beacon_header_read_many(r, &h, 1, &err) : beacon_event_read_many(r, ev, 1, &err);
+
+      // a corrupt or truncated record is an error, so the index doesn't quietly stop short
+      if (!got && err.code)
+      {
+        fprintf(stderr,"%s: error %d at offset %llu, not indexed past there\n", data_path, err.code, (unsigned long long) err.offset);
+        ret = 1;
+      }
+      if (!got) break;
+      if (beacon_index_writer_add(w, is_header ? h.event_number : ev->event_number, offset))
+      {
+        ret = 1;
+        break;
+      }
+    }
+
+    free(ev);
+    beacon_reader_close(r);
+  }
+  else
+  {
+    ret = 1;
+  }
+
+  if (beacon_index_writer_close(w)) ret = 1;
+  return ret;
+}
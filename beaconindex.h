@@ -0,0 +1,124 @@
+#ifndef _beaconindex_h
+#define _beaconindex_h
+
+#include "beacon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file beaconindex.h
+ *
+ * Event number index sidecar files, for random access into header and event files.
+ *
+ * An index maps event_number to the (uncompressed) offset of the record in the data file. For
+ * gzipped data files it may also have access points: places in the compressed stream where
+ * decompression can start, along with the last (up to) 32 kB of uncompressed data it needs
+ * as a dictionary (this is the same trick as zlib's zran.c). An access point with no window
+ * is at the start of a gzip member or at a full flush, where no dictionary is needed.
+ *
+ * The index for data.gz is conventionally data.gz.idx, which is what beacon_reader_open() looks for.
+ *
+ * Indices can be written while taking data (beacon_index_event_write() and friends) or built
+ * for existing files afterwards with beacon_index_build() (see examples/build_index.c). When
+ * writing gzip files, beacon_index_writer_set_flush() makes the writer do a full flush every so
+ * often and record an access point there, which costs a little compression but no dictionaries
+ * (and the file is still plain gzip). Otherwise the access points have to come from
+ * beacon_index_build(). Without them, seeking still works but has to decompress everything before
+ * the target.
+ *
+ * Since each access point is an independent place to start decompressing, a file can also be
+ * decompressed in pieces on several threads (see examples/seekable_gz.c).
+ *
+ * The file is a 4 byte magic ("BNIX"), a uint32_t version, and then tagged records, so it
+ * can be written as we go and a truncated index (e.g. from a crash) is still usable:
+ *
+ *    'e' uint64_t event_number, uint64_t offset
+ *    'p' uint64_t uoffset, uint64_t coffset, uint8_t bits, uint8_t flags, uint32_t window_len, uint32_t zlen, zlen bytes of deflated window
+ */
+
+/** An access point into a gzip stream */
+typedef struct beacon_index_point
+{
+  uint64_t uoffset;        //!< uncompressed offset
+  uint64_t coffset;        //!< compressed offset of the first full byte
+  uint8_t bits;            //!< number of bits of the previous byte that belong to this point (0-7)
+  uint8_t flags;           //!< BN_INDEX_POINT_MEMBER if this is the start of a gzip member
+  uint32_t window_len;     //!< bytes of dictionary (0 at member starts and full flushes)
+  uint8_t * window;        //!< the dictionary
+} beacon_index_point_t;
+
+/** The access point is at the beginning of a gzip member (i.e. a gzip header follows) */
+#define BN_INDEX_POINT_MEMBER 1
+
+/** Default spacing (in uncompressed bytes) between access points for beacon_index_build() */
+#define BN_INDEX_DEFAULT_SPAN (1 << 22)
+
+/** An index in memory */
+typedef struct beacon_index beacon_index_t;
+
+/** Load an index from a file. Returns NULL if it doesn't exist or isn't an index. */
+beacon_index_t * beacon_index_load(const char * path);
+
+/** Free a loaded index */
+void beacon_index_free(beacon_index_t * idx);
+
+/** Look up the offset of event_number. Returns 0 on success. */
+int beacon_index_lookup(const beacon_index_t * idx, uint64_t event_number, uint64_t * offset);
+
+/** The last access point at or before uoffset, or NULL if there is none */
+const beacon_index_point_t * beacon_index_find_point(const beacon_index_t * idx, uint64_t uoffset);
+
+/** Number of entries in the index */
+size_t beacon_index_nentries(const beacon_index_t * idx);
+
+/** Number of access points in the index */
+size_t beacon_index_npoints(const beacon_index_t * idx);
+
+/** The i'th access point (in order of uoffset), or NULL if there aren't that many */
+const beacon_index_point_t * beacon_index_get_point(const beacon_index_t * idx, size_t i);
+
+
+/** Writes an index as we go */
+typedef struct beacon_index_writer beacon_index_writer_t;
+
+/** Create (truncating) an index file. Returns NULL on failure */
+beacon_index_writer_t * beacon_index_writer_open(const char * path);
+
+/** Add an entry. Returns 0 on success. */
+int beacon_index_writer_add(beacon_index_writer_t * w, uint64_t event_number, uint64_t offset);
+
+/** Add an access point. Returns 0 on success. */
+int beacon_index_writer_add_point(beacon_index_writer_t * w, const beacon_index_point_t * point);
+
+/** Make beacon_index_event_gzwrite() and beacon_index_header_gzwrite() do a full flush and add an access point
+ * before a record whenever at least every_events records or every_bytes uncompressed bytes have been written
+ * since the last one (0 turns either off, the default being both off) */
+void beacon_index_writer_set_flush(beacon_index_writer_t * w, uint32_t every_events, uint64_t every_bytes);
+
+/** Flush and close. Returns 0 on success. */
+int beacon_index_writer_close(beacon_index_writer_t * w);
+
+/** Write an event to f, and record it in the index. Returns 0 on success. */
+int beacon_index_event_write(beacon_index_writer_t * w, FILE * f, const beacon_event_t * ev);
+
+/** Write an event to the compressed file f, and record it in the index. Returns 0 on success. */
+int beacon_index_event_gzwrite(beacon_index_writer_t * w, gzFile f, const beacon_event_t * ev);
+
+/** Write a header to f, and record it in the index. Returns 0 on success. */
+int beacon_index_header_write(beacon_index_writer_t * w, FILE * f, const beacon_header_t * h);
+
+/** Write a header to the compressed file f, and record it in the index. Returns 0 on success. */
+int beacon_index_header_gzwrite(beacon_index_writer_t * w, gzFile f, const beacon_header_t * h);
+
+
+/** Build an index for an existing header or event file (compressed or not), with access points
+ * about every span uncompressed bytes (0 for BN_INDEX_DEFAULT_SPAN) if it's compressed.
+ * Returns 0 on success. A corrupt or truncated record is a failure (the index then stops before it). */
+int beacon_index_build(const char * data_path, const char * index_path, size_t span);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
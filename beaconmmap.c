@@ -0,0 +1,347 @@
+#include "beaconmmap.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct beacon_mmap
+{
+  const uint8_t * data;
+  size_t size;
+  size_t offset;           // of the next record
+  int verify;
+  int skip_corrupt;
+  uint64_t skipped;        // bytes skipped over to get past corruption
+  uint8_t * scratch;       // for decoding packed events, allocated the first time we need it
+  beacon_header_t h;
+  beacon_status_t st;
+  beacon_hk_t hk;
+  beacon_event_view_t view;   // for beacon_mmap_read_event
+};
+
+
+beacon_mmap_t * beacon_mmap_open(const char * path)
+{
+  struct stat s;
+  beacon_mmap_t * m;
+  void * data = NULL;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  if (fstat(fd, &s) || !S_ISREG(s.st_mode) || (uint64_t) s.st_size > SIZE_MAX)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  // mmap doesn't like empty files, but they're still valid
+  if (s.st_size)
+  {
+    data = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);  // the mapping keeps it open
+
+  if (data == MAP_FAILED) return NULL;
+
+  // this is only for uncompressed files
+  if (s.st_size >= 2 && ((uint8_t*) data)[0] == 0x1f && ((uint8_t*) data)[1] == 0x8b)
+  {
+    munmap(data, s.st_size);
+    return NULL;
+  }
+
+  if (data) madvise(data, s.st_size, MADV_SEQUENTIAL);
+
+  m = calloc(1, sizeof(*m));
+  if (!m)
+  {
+    if (data) munmap(data, s.st_size);
+    return NULL;
+  }
+  m->data = data;
+  m->size = s.st_size;
+  m->verify = 1;
+  return m;
+}
+
+void beacon_mmap_set_verify(beacon_mmap_t * m, int verify)
+{
+  m->verify = verify;
+}
+
+uint64_t beacon_mmap_tell(const beacon_mmap_t * m)
+{
+  return m->offset;
+}
+
+int beacon_mmap_seek(beacon_mmap_t * m, uint64_t offset)
+{
+  if (offset > m->size) return 1;
+  m->offset = offset;
+  return 0;
+}
+
+void beacon_mmap_set_skip_corrupt(beacon_mmap_t * m, int skip)
+{
+  m->skip_corrupt = skip;
+}
+
+uint64_t beacon_mmap_skipped_bytes(const beacon_mmap_t * m)
+{
+  return m->skipped;
+}
+
+/* how far it is from the bad record at offset to the next good one (or the end) */
+static size_t resync(const uint8_t * data, size_t size, size_t offset, beacon_record_type_t wanted)
+{
+  int64_t found = beacon_record_find(data + offset + 1, size - offset - 1, wanted, 0);
+  return found < 0 ? size - offset : (size_t) found + 1;
+}
+
+/* checks that the next record is of the wanted type, skipping corruption if asked to. Returns its size, or the negative of an error */
+static int next_record(beacon_mmap_t * m, beacon_record_type_t wanted)
+{
+  beacon_record_type_t type;
+  int size;
+
+  while (1)
+  {
+    size_t skip;
+    if (m->offset == m->size) return -BN_ERR_NOT_ENOUGH_BYTES;
+
+    size = beacon_record_check(m->data + m->offset, m->size - m->offset, &type, m->verify);
+    if (size > 0 && type == wanted) return size;
+    if (!m->skip_corrupt) return size < 0 ? size : -BN_ERR_WRONG_TYPE;
+
+    skip = resync(m->data, m->size, m->offset, wanted);
+    m->skipped += skip;
+    m->offset += skip;
+  }
+}
+
+int beacon_mmap_next_header(beacon_mmap_t * m, const beacon_header_t ** h)
+{
+  int size = next_record(m, BN_RECORD_HEADER);
+  if (size < 0) return -size;
+  *h = beacon_header_view(m->data + m->offset, size, &m->h);
+  m->offset += size;
+  return 0;
+}
+
+int beacon_mmap_next_event(beacon_mmap_t * m, beacon_event_view_t * view)
+{
+  int size = next_record(m, BN_RECORD_EVENT);
+  if (size < 0) return -size;
+
+  if (!m->scratch)
+  {
+    m->scratch = malloc(BN_EVENT_VIEW_SCRATCH_BYTES);
+    if (!m->scratch) return BN_ERR_NOT_ENOUGH_BYTES;
+  }
+
+  size = beacon_event_view(m->data + m->offset, size, view, m->scratch);
+  if (size < 0) return -size;
+  m->offset += size;
+  return 0;
+}
+
+int beacon_mmap_read_event(beacon_mmap_t * m, beacon_event_t * ev)
+{
+  int ret = beacon_mmap_next_event(m, &m->view);
+  if (ret) return ret;
+  beacon_event_view_copy(&m->view, ev);
+  return 0;
+}
+
+int beacon_mmap_next_status(beacon_mmap_t * m, const beacon_status_t ** st)
+{
+  int size = next_record(m, BN_RECORD_STATUS);
+  if (size < 0) return -size;
+  *st = beacon_status_view(m->data + m->offset, size, &m->st);
+  m->offset += size;
+  return 0;
+}
+
+int beacon_mmap_next_hk(beacon_mmap_t * m, const beacon_hk_t ** hk)
+{
+  int size = next_record(m, BN_RECORD_HK);
+  if (size < 0) return -size;
+  *hk = beacon_hk_view(m->data + m->offset, size, &m->hk);
+  m->offset += size;
+  return 0;
+}
+
+
+/* One range of a parallel scan. Each thread works out where its range really starts (the first good record at or
+ * after its nominal start) and where the next one does, the same way the next thread will, so no record is
+ * missed or seen twice. */
+struct scan_thread
+{
+  const beacon_mmap_t * m;
+  beacon_record_type_t type;
+  beacon_mmap_scan_fn fn;
+  void * ctx;
+  int index;
+  size_t begin;              // nominal range
+  size_t end;
+  int * stop;
+  int ret;
+  uint64_t records;
+  uint64_t skipped;
+  uint64_t corrupt_regions;
+  pthread_t thread;
+  int started;
+};
+
+static size_t range_start(const beacon_mmap_t * m, beacon_record_type_t type, size_t nominal)
+{
+  int64_t found;
+  if (nominal == 0 || nominal >= m->size) return nominal < m->size ? nominal : m->size;
+  found = beacon_record_find(m->data + nominal, m->size - nominal, type, 0);
+  return found < 0 ? m->size : nominal + found;
+}
+
+static void * scan_thread(void * arg)
+{
+  struct scan_thread * t = arg;
+  const beacon_mmap_t * m = t->m;
+  size_t pos = range_start(m, t->type, t->begin);
+  size_t end = range_start(m, t->type, t->end);
+  uint8_t * scratch = NULL;
+  beacon_event_view_t view;
+  union
+  {
+    beacon_header_t h;
+    beacon_status_t st;
+    beacon_hk_t hk;
+  } decoded;
+
+  if (t->type == BN_RECORD_EVENT)
+  {
+    scratch = malloc(BN_EVENT_VIEW_SCRATCH_BYTES);
+    if (!scratch)
+    {
+      t->ret = BN_ERR_NOT_ENOUGH_BYTES;
+      return NULL;
+    }
+  }
+
+  while (pos < end && !__atomic_load_n(t->stop, __ATOMIC_RELAXED))
+  {
+    const void * record = NULL;
+    beacon_record_type_t type;
+    size_t skip;
+    int size = beacon_record_check(m->data + pos, m->size - pos, &type, m->verify);
+
+    if (size > 0 && type == t->type)
+    {
+      switch (t->type)
+      {
+        case BN_RECORD_HEADER: record = beacon_header_view(m->data + pos, size, &decoded.h); break;
+        case BN_RECORD_STATUS: record = beacon_status_view(m->data + pos, size, &decoded.st); break;
+        case BN_RECORD_HK:     record = beacon_hk_view(m->data + pos, size, &decoded.hk); break;
+        case BN_RECORD_EVENT:  record = beacon_event_view(m->data + pos, size, &view, scratch) > 0 ? &view : NULL; break;
+      }
+    }
+
+    if (record)
+    {
+      t->records++;
+      t->ret = t->fn(t->ctx, t->index, pos, record);
+      if (t->ret)
+      {
+        __atomic_store_n(t->stop, 1, __ATOMIC_RELAXED);
+        break;
+      }
+      pos += size;
+      continue;
+    }
+
+    // skip to the next good record, but not into the next range
+    skip = resync(m->data, m->size, pos, t->type);
+    if (pos + skip > end) skip = end - pos;
+    t->skipped += skip;
+    t->corrupt_regions++;
+    pos += skip;
+  }
+
+  free(scratch);
+  return NULL;
+}
+
+int beacon_mmap_scan(const beacon_mmap_t * m, beacon_record_type_t type, int nthreads,
+                     beacon_mmap_scan_fn fn, void * ctx, beacon_mmap_scan_stats_t * stats)
+{
+  struct scan_thread * threads;
+  struct timespec t0, t1;
+  int stop = 0;
+  int ret = 0;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (type != BN_RECORD_HEADER && type != BN_RECORD_EVENT && type != BN_RECORD_STATUS && type != BN_RECORD_HK) return BN_ERR_WRONG_TYPE;
+
+  if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  // not worth a thread for less than a few records
+  if ((size_t) nthreads > m->size / BN_MAX_EVENT_BYTES) nthreads = m->size / BN_MAX_EVENT_BYTES;
+  if (nthreads <= 0) nthreads = 1;
+
+  threads = calloc(nthreads, sizeof(struct scan_thread));
+  if (!threads) return BN_ERR_NOT_ENOUGH_BYTES;
+
+  for (i = 0; i < nthreads; i++)
+  {
+    threads[i].m = m;
+    threads[i].type = type;
+    threads[i].fn = fn;
+    threads[i].ctx = ctx;
+    threads[i].index = i;
+    threads[i].begin = m->size / nthreads * i;
+    threads[i].end = i == nthreads - 1 ? m->size : m->size / nthreads * (i + 1);
+    threads[i].stop = &stop;
+  }
+
+  // the first range runs on this thread, and also the rest if a thread can't be started
+  for (i = 1; i < nthreads; i++)
+  {
+    threads[i].started = !pthread_create(&threads[i].thread, NULL, scan_thread, &threads[i]);
+  }
+  scan_thread(&threads[0]);
+  for (i = 1; i < nthreads; i++)
+  {
+    if (threads[i].started) pthread_join(threads[i].thread, NULL);
+    else scan_thread(&threads[i]);
+  }
+
+  if (stats) memset(stats, 0, sizeof(*stats));
+  for (i = 0; i < nthreads; i++)
+  {
+    if (!ret) ret = threads[i].ret;
+    if (!stats) continue;
+    stats->records += threads[i].records;
+    stats->skipped_bytes += threads[i].skipped;
+    stats->corrupt_regions += threads[i].corrupt_regions;
+  }
+
+  if (stats)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    stats->nthreads = nthreads;
+    stats->elapsed = t1.tv_sec - t0.tv_sec + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+  }
+
+  free(threads);
+  return ret;
+}
+
+void beacon_mmap_close(beacon_mmap_t * m)
+{
+  if (!m) return;
+  if (m->data) munmap((void*) m->data, m->size);
+  free(m->scratch);
+  free(m);
+}
@@ -0,0 +1,105 @@
+#ifndef _beaconmmap_h
+#define _beaconmmap_h
+
+#include "beacon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file beaconmmap.h
+ *
+ * Zero-copy access to uncompressed data files.
+ *
+ * The file is memory mapped and the records are walked in place, so scanning a file costs about what
+ * paging it in does, rather than a read() and a copy into a full sized struct for every record. Events
+ * are handed out as beacon_event_view_t's, whose waveforms point into the mapping (packed events have to
+ * be decoded, into a buffer owned by the beacon_mmap_t). Headers, statuses and hk point into the mapping
+ * when they're stored as the struct itself and suitably aligned, and are otherwise (e.g. packed headers) decoded
+ * into a struct owned by the beacon_mmap_t. Either way, what you get back is only good until the next call.
+ *
+ * Checksums are verified by default; beacon_mmap_set_verify() turns that off for speed. Reading stops at the first bad
+ * record, unless beacon_mmap_set_skip_corrupt() says to skip ahead to the next good one (see beacon_record_find()).
+ *
+ * beacon_mmap_scan() decodes a whole file on several threads, each starting from the first good record in its share of
+ * the file.
+ *
+ * Typical usage:
+ *
+ *    beacon_mmap_t * m = beacon_mmap_open("headers.dat");
+ *    const beacon_header_t * h;
+ *    while (!beacon_mmap_next_header(m, &h)) do_something(h->event_number);
+ *    beacon_mmap_close(m);
+ *
+ * Compressed files can't be mapped; use beacon_reader_open() for those.
+ */
+
+/** opaque handle */
+typedef struct beacon_mmap beacon_mmap_t;
+
+/** Map a data file. Returns NULL if it can't be opened or mapped, or if it's compressed. */
+beacon_mmap_t * beacon_mmap_open(const char * path);
+
+/** Whether to verify checksums (the default is yes) */
+void beacon_mmap_set_verify(beacon_mmap_t * m, int verify);
+
+/** Whether to skip over corrupt records (and anything else that isn't a record of the type being read) rather than
+ * stopping at them (the default is no) */
+void beacon_mmap_set_skip_corrupt(beacon_mmap_t * m, int skip);
+
+/** How many bytes have been skipped over because of corruption */
+uint64_t beacon_mmap_skipped_bytes(const beacon_mmap_t * m);
+
+/** The offset of the next record */
+uint64_t beacon_mmap_tell(const beacon_mmap_t * m);
+
+/** Go to the given offset (e.g. from an index, see beaconindex.h). Returns 0 on success. */
+int beacon_mmap_seek(beacon_mmap_t * m, uint64_t offset);
+
+/** Point *h at the next header. Returns 0 on success, BN_ERR_NOT_ENOUGH_BYTES at the end of the file or another
+ * beacon_io_error_t. On failure the position is unchanged. */
+int beacon_mmap_next_header(beacon_mmap_t * m, const beacon_header_t ** h);
+
+/** Fill in a view of the next event. Returns 0 on success, see beacon_mmap_next_header(). */
+int beacon_mmap_next_event(beacon_mmap_t * m, beacon_event_view_t * view);
+
+/** Copy the next event into ev. Returns 0 on success, see beacon_mmap_next_header(). */
+int beacon_mmap_read_event(beacon_mmap_t * m, beacon_event_t * ev);
+
+/** Point *st at the next status. Returns 0 on success, see beacon_mmap_next_header(). */
+int beacon_mmap_next_status(beacon_mmap_t * m, const beacon_status_t ** st);
+
+/** Point *hk at the next hk. Returns 0 on success, see beacon_mmap_next_header(). */
+int beacon_mmap_next_hk(beacon_mmap_t * m, const beacon_hk_t ** hk);
+
+/** Called by beacon_mmap_scan() for every record. record is a const beacon_header_t *, const beacon_event_view_t *,
+ * const beacon_status_t * or const beacon_hk_t * according to the type, and is only good during the call. thread says
+ * which range (0 to nthreads-1) it's from. Return nonzero to stop the scan. */
+typedef int (*beacon_mmap_scan_fn)(void * ctx, int thread, uint64_t offset, const void * record);
+
+/** Statistics from beacon_mmap_scan() */
+typedef struct beacon_mmap_scan_stats
+{
+  uint64_t records;           //!< records handed to the callback
+  uint64_t skipped_bytes;     //!< bytes skipped over because of corruption
+  uint64_t corrupt_regions;   //!< number of places that had to be skipped
+  int nthreads;               //!< number of threads actually used
+  double elapsed;             //!< seconds
+} beacon_mmap_scan_stats_t;
+
+/** Decode every record of the given type in parallel. The file is split into nthreads (0 for one per cpu) byte ranges, each
+ * thread finds the first good record in its range with beacon_record_find() and decodes up to where the next range's first
+ * good record is, skipping over corruption along the way. Records from one range arrive in order, but ranges are done at
+ * the same time, so fn must be thread safe and use offset (or the event number) to put things back in order. The position
+ * and settings other than beacon_mmap_set_verify() don't matter. Returns 0 on success, otherwise whatever fn returned to stop. */
+int beacon_mmap_scan(const beacon_mmap_t * m, beacon_record_type_t type, int nthreads,
+                     beacon_mmap_scan_fn fn, void * ctx, beacon_mmap_scan_stats_t * stats);
+
+/** Unmap and free everything */
+void beacon_mmap_close(beacon_mmap_t * m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
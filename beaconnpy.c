@@ -0,0 +1,288 @@
+#include "beaconnpy.h"
+#include "beaconcol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+
+// records are written through a buffer this big
+#define FILE_BUFFER_SIZE (1 << 20)
+
+// room for the longest number that can go in the shape
+#define MAX_DIGITS_PLACEHOLDER UINT64_MAX
+
+
+/* One member of a struct, as a field of a NumPy structured dtype. n0/n1 are the array dimensions (0 if not an array). */
+struct npy_field
+{
+  const char * name;
+  char kind;        // 'u' or 'i'
+  size_t offset;
+  size_t elem;      // size of one element
+  size_t n0;
+  size_t n1;
+};
+
+#define MEMBER(S, m) (((S *) 0)->m)
+#define SCALAR(S, m, k) { #m, k, offsetof(S, m), sizeof(MEMBER(S, m)), 0, 0 }
+#define ARRAY(S, m, k) { #m, k, offsetof(S, m), sizeof(MEMBER(S, m)[0]), sizeof(MEMBER(S, m)) / sizeof(MEMBER(S, m)[0]), 0 }
+#define ARRAY2(S, m, k) { #m, k, offsetof(S, m), sizeof(MEMBER(S, m)[0][0]), \
+                          sizeof(MEMBER(S, m)) / sizeof(MEMBER(S, m)[0]), sizeof(MEMBER(S, m)[0]) / sizeof(MEMBER(S, m)[0][0]) }
+
+// 'i' for signed types, 'u' otherwise (compared with 1, since < 0 warns for unsigned types)
+#define KIND(type) ((type) -1 < 1 ? 'i' : 'u')
+#define HEADER_SCALAR(name, type) SCALAR(beacon_header_t, name, KIND(type)),
+#define HEADER_ARRAY(name, type, count) ARRAY(beacon_header_t, name, KIND(type)),
+
+/* these have to be in the same order as in the structs. The header's come from the column schema, which
+ * follows beacon_header_t, so a new header field shows up here too. */
+static const struct npy_field header_fields[] =
+{
+  BN_HEADER_COLUMNS(HEADER_SCALAR, HEADER_ARRAY)
+  { NULL, 0, sizeof(beacon_header_t), 0, 0, 0 }
+};
+
+#undef HEADER_SCALAR
+#undef HEADER_ARRAY
+
+static const struct npy_field status_fields[] =
+{
+  ARRAY(beacon_status_t, global_scalers, 'u'),
+  ARRAY2(beacon_status_t, beam_scalers, 'u'),
+  SCALAR(beacon_status_t, deadtime, 'u'),
+  SCALAR(beacon_status_t, readout_time, 'u'),
+  SCALAR(beacon_status_t, readout_time_ns, 'u'),
+  ARRAY(beacon_status_t, trigger_thresholds, 'u'),
+  SCALAR(beacon_status_t, latched_pps_time, 'u'),
+  SCALAR(beacon_status_t, board_id, 'u'),
+  SCALAR(beacon_status_t, dynamic_beam_mask, 'u'),
+  SCALAR(beacon_status_t, veto_status, 'u'),
+  { NULL, 0, sizeof(beacon_status_t), 0, 0, 0 }
+};
+
+static const struct npy_field hk_fields[] =
+{
+  SCALAR(beacon_hk_t, unixTime, 'u'),
+  SCALAR(beacon_hk_t, unixTimeMillisecs, 'u'),
+  SCALAR(beacon_hk_t, temp_board, 'i'),
+  SCALAR(beacon_hk_t, temp_adc, 'i'),
+  SCALAR(beacon_hk_t, frontend_current, 'u'),
+  SCALAR(beacon_hk_t, adc_current, 'u'),
+  SCALAR(beacon_hk_t, aux_current, 'u'),
+  SCALAR(beacon_hk_t, ant_current, 'u'),
+  SCALAR(beacon_hk_t, gpio_state, 'u'),
+  SCALAR(beacon_hk_t, disk_space_kB, 'u'),
+  SCALAR(beacon_hk_t, free_mem_kB, 'u'),
+  SCALAR(beacon_hk_t, inv_batt_dV, 'u'),
+  SCALAR(beacon_hk_t, cc_batt_dV, 'u'),
+  SCALAR(beacon_hk_t, pv_dV, 'u'),
+  SCALAR(beacon_hk_t, cc_daily_Ah, 'u'),
+  SCALAR(beacon_hk_t, cc_daily_hWh, 'u'),
+  { NULL, 0, sizeof(beacon_hk_t), 0, 0, 0 }
+};
+
+
+struct beacon_npy
+{
+  FILE * f;
+  char * fbuf;
+  beacon_record_type_t type;
+  const struct npy_field * fields;   // NULL for events
+  size_t record_size;
+  int nsamples;
+  uint64_t count;
+  size_t header_len;                 // including the padding, fixed when opening
+  int err;
+};
+
+
+static char byte_order(void)
+{
+  const uint16_t one = 1;
+  return *(const uint8_t *) &one ? '<' : '>';
+}
+
+static int put_type(char * out, size_t size, char kind, size_t elem)
+{
+  if (elem == 1) return snprintf(out, size, "'|%c1'", kind);
+  return snprintf(out, size, "'%c%c%zu'", byte_order(), kind, elem);
+}
+
+/* the structured dtype for fields, with the gaps between them as padding, into out. Returns the length. */
+static size_t put_descr(char * out, size_t size, const struct npy_field * fields)
+{
+  size_t len = 0, end = 0;
+  const struct npy_field * fld;
+
+#define PUT(...) len += snprintf(out + len, len < size ? size - len : 0, __VA_ARGS__)
+  PUT("[");
+  for (fld = fields; ; fld++)
+  {
+    if (fld->offset > end) PUT("('', '|V%zu'), ", fld->offset - end);
+    if (!fld->name) break;
+
+    PUT("('%s', ", fld->name);
+    len += put_type(out + len, len < size ? size - len : 0, fld->kind, fld->elem);
+    if (fld->n1) PUT(", (%zu, %zu)", fld->n0, fld->n1);
+    else if (fld->n0) PUT(", (%zu,)", fld->n0);
+    PUT("), ");
+
+    end = fld->offset + fld->elem * (fld->n0 ? fld->n0 : 1) * (fld->n1 ? fld->n1 : 1);
+  }
+  PUT("]");
+#undef PUT
+  return len;
+}
+
+/* the header dict for count records (and nsamples samples, for events) into out. Returns the length. */
+static size_t put_dict(const beacon_npy_t * n, char * out, size_t size, uint64_t count, uint64_t nsamples)
+{
+  size_t len;
+
+  len = snprintf(out, size, "{'descr': ");
+  if (n->fields) len += put_descr(out + len, len < size ? size - len : 0, n->fields);
+  else len += snprintf(out + len, len < size ? size - len : 0, "'|u1'");
+
+  if (n->fields)
+    len += snprintf(out + len, len < size ? size - len : 0, ", 'fortran_order': False, 'shape': (%llu,), }",
+                    (unsigned long long) count);
+  else
+    len += snprintf(out + len, len < size ? size - len : 0, ", 'fortran_order': False, 'shape': (%llu, %d, %llu), }",
+                    (unsigned long long) count, BN_MAX_BOARDS * BN_NUM_CHAN, (unsigned long long) nsamples);
+  return len;
+}
+
+/* the magic, version and dict, padded with spaces to header_len */
+static int write_header(beacon_npy_t * n, uint64_t count, uint64_t nsamples)
+{
+  char * hdr = malloc(n->header_len + 1);
+  size_t preamble = n->header_len > 65535 + 10 ? 12 : 10;
+  size_t dict_len = n->header_len - preamble;
+  size_t len;
+  int ret = 0;
+
+  if (!hdr) return 1;
+
+  memcpy(hdr, "\x93NUMPY", 6);
+  hdr[6] = preamble == 12 ? 2 : 1;
+  hdr[7] = 0;
+  // the length of what follows the preamble, little endian
+  hdr[8] = dict_len & 0xff;
+  hdr[9] = (dict_len >> 8) & 0xff;
+  if (preamble == 12)
+  {
+    hdr[10] = (dict_len >> 16) & 0xff;
+    hdr[11] = (dict_len >> 24) & 0xff;
+  }
+
+  len = put_dict(n, hdr + preamble, dict_len + 1, count, nsamples);
+  memset(hdr + preamble + len, ' ', dict_len - len - 1);
+  hdr[n->header_len - 1] = '\n';
+
+  if (fseek(n->f, 0, SEEK_SET) || fwrite(hdr, 1, n->header_len, n->f) != n->header_len) ret = 1;
+  free(hdr);
+  return ret;
+}
+
+
+beacon_npy_t * beacon_npy_open(const char * path, beacon_record_type_t type, int nsamples)
+{
+  beacon_npy_t * n = calloc(1, sizeof(beacon_npy_t));
+  char scratch[8192];
+  size_t len;
+
+  if (!n) return NULL;
+  n->type = type;
+  n->nsamples = nsamples > BN_MAX_WAVEFORM_LENGTH ? BN_MAX_WAVEFORM_LENGTH : nsamples;
+
+  switch (type)
+  {
+    case BN_RECORD_EVENT: n->fields = NULL; break;
+    case BN_RECORD_HEADER: n->fields = header_fields; n->record_size = sizeof(beacon_header_t); break;
+    case BN_RECORD_STATUS: n->fields = status_fields; n->record_size = sizeof(beacon_status_t); break;
+    case BN_RECORD_HK: n->fields = hk_fields; n->record_size = sizeof(beacon_hk_t); break;
+    default:
+      free(n);
+      return NULL;
+  }
+
+  // leave room for the biggest shape we might need to fill in, padded to a multiple of 64 as the format wants
+  len = 12 + put_dict(n, scratch, sizeof(scratch), MAX_DIGITS_PLACEHOLDER, MAX_DIGITS_PLACEHOLDER) + 1;
+  n->header_len = (len + 63) / 64 * 64;
+
+  n->f = fopen(path, "w");
+  n->fbuf = malloc(FILE_BUFFER_SIZE);
+  if (!n->f || !n->fbuf || setvbuf(n->f, n->fbuf, _IOFBF, FILE_BUFFER_SIZE) || write_header(n, 0, n->nsamples))
+  {
+    if (n->f) fclose(n->f);
+    free(n->fbuf);
+    free(n);
+    return NULL;
+  }
+
+  return n;
+}
+
+int beacon_npy_write_event(beacon_npy_t * n, const beacon_event_t * ev)
+{
+  static const uint8_t zeros[BN_MAX_WAVEFORM_LENGTH];
+  int ibd, ichan;
+  size_t len;
+
+  if (n->type != BN_RECORD_EVENT || n->err) return 1;
+
+  if (!n->nsamples && !n->count) n->nsamples = ev->buffer_length > BN_MAX_WAVEFORM_LENGTH ? BN_MAX_WAVEFORM_LENGTH : ev->buffer_length;
+  len = ev->buffer_length < n->nsamples ? ev->buffer_length : (size_t) n->nsamples;
+
+  for (ibd = 0; ibd < BN_MAX_BOARDS; ibd++)
+  {
+    for (ichan = 0; ichan < BN_NUM_CHAN; ichan++)
+    {
+      if (fwrite(ev->data[ibd][ichan], 1, len, n->f) != len) n->err = 1;
+      if (len < (size_t) n->nsamples && fwrite(zeros, 1, n->nsamples - len, n->f) != n->nsamples - len) n->err = 1;
+    }
+  }
+
+  n->count += !n->err;
+  return n->err;
+}
+
+static int write_record(beacon_npy_t * n, beacon_record_type_t type, const void * rec)
+{
+  if (n->type != type || n->err) return 1;
+  if (fwrite(rec, n->record_size, 1, n->f) != 1) return (n->err = 1);
+  n->count++;
+  return 0;
+}
+
+int beacon_npy_write_header(beacon_npy_t * n, const beacon_header_t * h)
+{
+  return write_record(n, BN_RECORD_HEADER, h);
+}
+
+int beacon_npy_write_status(beacon_npy_t * n, const beacon_status_t * st)
+{
+  return write_record(n, BN_RECORD_STATUS, st);
+}
+
+int beacon_npy_write_hk(beacon_npy_t * n, const beacon_hk_t * hk)
+{
+  return write_record(n, BN_RECORD_HK, hk);
+}
+
+uint64_t beacon_npy_count(const beacon_npy_t * n)
+{
+  return n->count;
+}
+
+int beacon_npy_close(beacon_npy_t * n)
+{
+  int ret = n->err;
+
+  if (fflush(n->f) || write_header(n, n->count, n->nsamples)) ret = 1;
+  if (fclose(n->f)) ret = 1;
+  free(n->fbuf);
+  free(n);
+  return ret;
+}
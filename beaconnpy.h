@@ -0,0 +1,58 @@
+#ifndef _beaconnpy_h
+#define _beaconnpy_h
+
+#include "beacon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file beaconnpy.h
+ *
+ * Export to NumPy .npy files, for analysis in Python without going through ROOT or text.
+ *
+ * Events become one uint8 array of shape (events, channels, samples), with the channels of all boards
+ * one after another (BN_MAX_BOARDS * BN_NUM_CHAN of them). Headers, status and hk become structured
+ * arrays whose dtype is generated from the C struct, so each record is written as it is in memory.
+ * Either way the data is one contiguous block after the .npy header, so numpy.load(path, mmap_mode='r')
+ * maps it without copying.
+ *
+ * Records are streamed straight to the file, so memory use doesn't depend on how many there are; the
+ * shape in the .npy header is filled in by beacon_npy_close().
+ *
+ *    beacon_npy_t * n = beacon_npy_open("events.npy", BN_RECORD_EVENT, 0);
+ *    while (!beacon_reader_read_event(r, &ev)) beacon_npy_write_event(n, &ev);
+ *    beacon_npy_close(n);
+ *
+ * and then in Python:
+ *
+ *    wf = numpy.load("events.npy", mmap_mode="r")   # wf[event, channel, sample]
+ *
+ * The files are written in the machine's byte order, which the dtypes say.
+ */
+
+/** opaque handle */
+typedef struct beacon_npy beacon_npy_t;
+
+/** Create (or truncate) an .npy file for records of the given type. For events, nsamples is the length of
+ * the sample axis: events with a different buffer_length are padded with zeros or cut short (0 means use
+ * the buffer_length of the first event). Returns NULL on failure. */
+beacon_npy_t * beacon_npy_open(const char * path, beacon_record_type_t type, int nsamples);
+
+/** Append one record (which must match the type given to beacon_npy_open()). These return 0 on success. */
+int beacon_npy_write_event(beacon_npy_t * n, const beacon_event_t * ev);
+int beacon_npy_write_header(beacon_npy_t * n, const beacon_header_t * h);
+int beacon_npy_write_status(beacon_npy_t * n, const beacon_status_t * st);
+int beacon_npy_write_hk(beacon_npy_t * n, const beacon_hk_t * hk);
+
+/** The number of records written so far */
+uint64_t beacon_npy_count(const beacon_npy_t * n);
+
+/** Fill in the final shape and close. Returns 0 if there have been no errors. */
+int beacon_npy_close(beacon_npy_t * n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,430 @@
+#include "beaconpgz.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <zlib.h>
+
+
+#define DEFAULT_BLOCK_SIZE (1 << 20)
+
+/* Each block goes FREE -> FILLING (owned by the caller) -> READY -> COMPRESSING (owned by a worker) -> DONE -> FREE (after it's written).
+ * Blocks are used round robin, so block seq always lives in blocks[seq % nblocks]
+ */
+enum block_state
+{
+  BLOCK_FREE,
+  BLOCK_FILLING,
+  BLOCK_READY,
+  BLOCK_COMPRESSING,
+  BLOCK_DONE
+};
+
+struct block
+{
+  enum block_state state;
+  uint64_t seq;
+  uint8_t * in;
+  size_t in_len;
+  uint8_t * out;
+  size_t out_len;
+  int err;
+};
+
+struct beacon_pgz
+{
+  beacon_pgz_opts_t opts;
+  size_t out_cap;
+  struct block * blocks;
+  pthread_t * workers;
+  pthread_t writer;
+
+  pthread_mutex_t lock;
+  pthread_cond_t ready_cv;    // signaled when a block becomes READY (or we're closing)
+  pthread_cond_t done_cv;     // signaled when a block becomes DONE (or we're closing)
+  pthread_cond_t free_cv;     // signaled when a block is written and becomes FREE
+
+  uint64_t fill_seq;          // the block the caller is filling
+  uint64_t compress_seq;      // the next block to hand to a worker
+  uint64_t write_seq;         // the next block to write out
+  struct block * filling;     // the block the caller is filling, or NULL if it has not been acquired yet
+  int closing;
+  int err;
+
+  int fd;
+  beacon_sink_t out;          // where the compressed blocks go
+  beacon_sink_t in;           // what we hand out in beacon_pgz_sink
+
+  struct timespec start;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  int max_queue_depth;
+  double compress_time;
+  double stall_time;
+};
+
+
+static double since_clock(clockid_t clk, const struct timespec * t0)
+{
+  struct timespec now;
+  clock_gettime(clk, &now);
+  return now.tv_sec - t0->tv_sec + 1e-9 * (now.tv_nsec - t0->tv_nsec);
+}
+
+static double since(const struct timespec * t0)
+{
+  return since_clock(CLOCK_MONOTONIC, t0);
+}
+
+
+static void * compress_thread(void * arg)
+{
+  beacon_pgz_t * pgz = arg;
+  z_stream strm;
+  int ok;
+
+  memset(&strm, 0, sizeof(strm));
+  //15+16 means gzip wrapper
+  ok = deflateInit2(&strm, pgz->opts.level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+
+  pthread_mutex_lock(&pgz->lock);
+  while (1)
+  {
+    struct block * b = &pgz->blocks[pgz->compress_seq % pgz->opts.max_blocks];
+    struct timespec t0;
+
+    if (b->state != BLOCK_READY || b->seq != pgz->compress_seq)
+    {
+      if (pgz->closing) break;
+      pthread_cond_wait(&pgz->ready_cv, &pgz->lock);
+      continue;
+    }
+
+    b->state = BLOCK_COMPRESSING;
+    pgz->compress_seq++;
+    pthread_mutex_unlock(&pgz->lock);
+
+    // cpu time, so that this is meaningful even if there are more threads than cores
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+    b->err = !ok;
+    if (ok)
+    {
+      deflateReset(&strm);
+      strm.next_in = b->in;
+      strm.avail_in = b->in_len;
+      strm.next_out = b->out;
+      strm.avail_out = pgz->out_cap;
+      b->err = deflate(&strm, Z_FINISH) != Z_STREAM_END;
+      b->out_len = pgz->out_cap - strm.avail_out;
+    }
+
+    pthread_mutex_lock(&pgz->lock);
+    pgz->compress_time += since_clock(CLOCK_THREAD_CPUTIME_ID, &t0);
+    b->state = BLOCK_DONE;
+    pthread_cond_broadcast(&pgz->done_cv);
+  }
+  pthread_mutex_unlock(&pgz->lock);
+
+  if (ok) deflateEnd(&strm);
+  return NULL;
+}
+
+
+static void * write_thread(void * arg)
+{
+  beacon_pgz_t * pgz = arg;
+
+  pthread_mutex_lock(&pgz->lock);
+  while (1)
+  {
+    struct block * b = &pgz->blocks[pgz->write_seq % pgz->opts.max_blocks];
+    int err;
+
+    if (b->state != BLOCK_DONE || b->seq != pgz->write_seq)
+    {
+      if (pgz->closing && pgz->write_seq == pgz->fill_seq) break;
+      pthread_cond_wait(&pgz->done_cv, &pgz->lock);
+      continue;
+    }
+
+    pthread_mutex_unlock(&pgz->lock);
+    err = b->err || pgz->out.write(pgz->out.ctx, b->out, b->out_len);
+    pthread_mutex_lock(&pgz->lock);
+
+    if (err) pgz->err = 1;
+    else pgz->bytes_out += b->out_len;
+    b->state = BLOCK_FREE;
+    pgz->write_seq++;
+    pthread_cond_broadcast(&pgz->free_cv);
+  }
+  pthread_mutex_unlock(&pgz->lock);
+  return NULL;
+}
+
+
+static int fd_write(void * ctx, const void * buf, size_t n)
+{
+  int fd = *((int*) ctx);
+  const uint8_t * p = buf;
+  while (n)
+  {
+    ssize_t w = write(fd, p, n);
+    if (w < 0)
+    {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += w;
+    n -= w;
+  }
+  return 0;
+}
+
+static int pgz_sink_write(void * ctx, const void * buf, size_t n)
+{
+  return beacon_pgz_write(ctx, buf, n);
+}
+
+
+static void pgz_free(beacon_pgz_t * pgz)
+{
+  int i;
+  if (pgz->blocks)
+  {
+    for (i = 0; i < pgz->opts.max_blocks; i++)
+    {
+      free(pgz->blocks[i].in);
+      free(pgz->blocks[i].out);
+    }
+  }
+  free(pgz->blocks);
+  free(pgz->workers);
+  if (pgz->fd >= 0) close(pgz->fd);
+  pthread_mutex_destroy(&pgz->lock);
+  pthread_cond_destroy(&pgz->ready_cv);
+  pthread_cond_destroy(&pgz->done_cv);
+  pthread_cond_destroy(&pgz->free_cv);
+  free(pgz);
+}
+
+/* takes ownership of fd, even on failure */
+static beacon_pgz_t * pgz_open(int fd, const beacon_sink_t * out, const beacon_pgz_opts_t * opts)
+{
+  int i;
+  beacon_pgz_t * pgz = calloc(1, sizeof(beacon_pgz_t));
+  if (!pgz)
+  {
+    if (fd >= 0) close(fd);
+    return NULL;
+  }
+
+  if (opts) pgz->opts = *opts;
+  if (pgz->opts.nthreads <= 0) pgz->opts.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (pgz->opts.nthreads <= 0) pgz->opts.nthreads = 1;
+  if (!pgz->opts.block_size) pgz->opts.block_size = DEFAULT_BLOCK_SIZE;
+  if (pgz->opts.level <= 0 || pgz->opts.level > 9) pgz->opts.level = Z_DEFAULT_COMPRESSION;
+  if (pgz->opts.max_blocks < 2) pgz->opts.max_blocks = 2 * pgz->opts.nthreads + 2;
+
+  pthread_mutex_init(&pgz->lock, NULL);
+  pthread_cond_init(&pgz->ready_cv, NULL);
+  pthread_cond_init(&pgz->done_cv, NULL);
+  pthread_cond_init(&pgz->free_cv, NULL);
+
+  pgz->fd = fd;
+  if (out)
+  {
+    pgz->out = *out;
+  }
+  else
+  {
+    pgz->out.write = fd_write;
+    pgz->out.ctx = &pgz->fd;
+  }
+  pgz->in.write = pgz_sink_write;
+  pgz->in.ctx = pgz;
+
+  // deflateBound for a gzip stream (the 18 is the gzip header + trailer)
+  pgz->out_cap = compressBound(pgz->opts.block_size) + 18;
+  pgz->blocks = calloc(pgz->opts.max_blocks, sizeof(struct block));
+  if (!pgz->blocks) goto fail;
+  for (i = 0; i < pgz->opts.max_blocks; i++)
+  {
+    pgz->blocks[i].in = malloc(pgz->opts.block_size);
+    pgz->blocks[i].out = malloc(pgz->out_cap);
+    if (!pgz->blocks[i].in || !pgz->blocks[i].out) goto fail;
+  }
+
+  pgz->workers = calloc(pgz->opts.nthreads, sizeof(pthread_t));
+  if (!pgz->workers) goto fail;
+
+  clock_gettime(CLOCK_MONOTONIC, &pgz->start);
+
+  if (pthread_create(&pgz->writer, NULL, write_thread, pgz)) goto fail;
+
+  for (i = 0; i < pgz->opts.nthreads; i++)
+  {
+    if (pthread_create(&pgz->workers[i], NULL, compress_thread, pgz))
+    {
+      //close joins the writer and the workers we did start
+      pgz->opts.nthreads = i;
+      beacon_pgz_close(pgz);
+      return NULL;
+    }
+  }
+
+  return pgz;
+
+fail:
+  pgz_free(pgz);
+  return NULL;
+}
+
+
+beacon_pgz_t * beacon_pgz_open(const char * path, const beacon_pgz_opts_t * opts)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return NULL;
+  return pgz_open(fd, NULL, opts);
+}
+
+beacon_pgz_t * beacon_pgz_open_sink(const beacon_sink_t * out, const beacon_pgz_opts_t * opts)
+{
+  return pgz_open(-1, out, opts);
+}
+
+const beacon_sink_t * beacon_pgz_sink(beacon_pgz_t * pgz)
+{
+  return &pgz->in;
+}
+
+
+// hands the block being filled to the workers. must hold the lock
+static void submit(beacon_pgz_t * pgz)
+{
+  int depth;
+  pgz->filling->state = BLOCK_READY;
+  pgz->filling = NULL;
+  pgz->fill_seq++;
+  depth = pgz->fill_seq - pgz->write_seq;
+  if (depth > pgz->max_queue_depth) pgz->max_queue_depth = depth;
+  pthread_cond_broadcast(&pgz->ready_cv);
+}
+
+
+int beacon_pgz_write(beacon_pgz_t * pgz, const void * buf, size_t n)
+{
+  const uint8_t * p = buf;
+  int err;
+
+  while (n)
+  {
+    size_t howmuch;
+    struct block * b = pgz->filling;
+
+    if (!b)
+    {
+      struct timespec t0;
+      int waited = 0;
+      pthread_mutex_lock(&pgz->lock);
+      b = &pgz->blocks[pgz->fill_seq % pgz->opts.max_blocks];
+      while (b->state != BLOCK_FREE)
+      {
+        if (!waited) clock_gettime(CLOCK_MONOTONIC, &t0);
+        waited = 1;
+        pthread_cond_wait(&pgz->free_cv, &pgz->lock);
+      }
+      if (waited) pgz->stall_time += since(&t0);
+      b->state = BLOCK_FILLING;
+      b->seq = pgz->fill_seq;
+      b->in_len = 0;
+      pgz->filling = b;
+      pthread_mutex_unlock(&pgz->lock);
+    }
+
+    howmuch = pgz->opts.block_size - b->in_len;
+    if (howmuch > n) howmuch = n;
+    memcpy(b->in + b->in_len, p, howmuch);
+    b->in_len += howmuch;
+    p += howmuch;
+    n -= howmuch;
+
+    if (b->in_len == pgz->opts.block_size)
+    {
+      pthread_mutex_lock(&pgz->lock);
+      pgz->bytes_in += b->in_len;
+      submit(pgz);
+      pthread_mutex_unlock(&pgz->lock);
+    }
+  }
+
+  // the writer thread sets it
+  pthread_mutex_lock(&pgz->lock);
+  err = pgz->err;
+  pthread_mutex_unlock(&pgz->lock);
+  return err;
+}
+
+
+int beacon_pgz_flush(beacon_pgz_t * pgz)
+{
+  int err;
+
+  pthread_mutex_lock(&pgz->lock);
+  if (pgz->filling && pgz->filling->in_len)
+  {
+    pgz->bytes_in += pgz->filling->in_len;
+    submit(pgz);
+  }
+
+  while (pgz->write_seq != pgz->fill_seq)
+  {
+    pthread_cond_wait(&pgz->free_cv, &pgz->lock);
+  }
+  err = pgz->err;
+  pthread_mutex_unlock(&pgz->lock);
+
+  return err;
+}
+
+
+int beacon_pgz_get_stats(beacon_pgz_t * pgz, beacon_pgz_stats_t * stats)
+{
+  pthread_mutex_lock(&pgz->lock);
+  stats->bytes_in = pgz->bytes_in + (pgz->filling ? pgz->filling->in_len : 0);
+  stats->bytes_out = pgz->bytes_out;
+  stats->blocks_written = pgz->write_seq;
+  stats->queue_depth = pgz->fill_seq - pgz->write_seq;
+  stats->max_queue_depth = pgz->max_queue_depth;
+  stats->nthreads = pgz->opts.nthreads;
+  stats->elapsed = since(&pgz->start);
+  stats->compress_time = pgz->compress_time;
+  stats->stall_time = pgz->stall_time;
+  stats->input_rate = stats->elapsed > 0 ? stats->bytes_in / stats->elapsed / (1 << 20) : 0;
+  stats->compress_rate = pgz->compress_time > 0 ? pgz->bytes_in / pgz->compress_time / (1 << 20) : 0;
+  pthread_mutex_unlock(&pgz->lock);
+  return 0;
+}
+
+
+int beacon_pgz_close(beacon_pgz_t * pgz)
+{
+  int i;
+  int ret = beacon_pgz_flush(pgz);
+
+  pthread_mutex_lock(&pgz->lock);
+  pgz->closing = 1;
+  pthread_cond_broadcast(&pgz->ready_cv);
+  pthread_cond_broadcast(&pgz->done_cv);
+  pthread_mutex_unlock(&pgz->lock);
+
+  for (i = 0; i < pgz->opts.nthreads; i++) pthread_join(pgz->workers[i], NULL);
+  pthread_join(pgz->writer, NULL);
+
+  if (pgz->fd >= 0 && close(pgz->fd)) ret = 1;
+  pgz->fd = -1;
+  pgz_free(pgz);
+  return ret;
+}
@@ -0,0 +1,88 @@
+#ifndef _beaconpgz_h
+#define _beaconpgz_h
+
+#include "beacon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file beaconpgz.h
+ *
+ * Parallel gzip writer.
+ *
+ * The stream written through this is cut into blocks, which are compressed
+ * on a pool of worker threads as independent gzip members and written out in
+ * order. A concatenation of gzip members is itself a valid gzip file, so the
+ * output can be read with beacon_*_gzread() (or gunzip) just like the output of
+ * beacon_*_gzwrite(). The compression ratio is very slightly worse, since each
+ * block starts with an empty dictionary.
+ *
+ * Records may straddle blocks, this doesn't matter to any reader.
+ *
+ * Typical usage:
+ *
+ *    beacon_pgz_t * pgz = beacon_pgz_open("events.gz", NULL);
+ *    while (...)  beacon_event_sinkwrite(beacon_pgz_sink(pgz), &ev);
+ *    beacon_pgz_close(pgz);
+ *
+ * A beacon_pgz_t must only be written from one thread at a time.
+ *
+ */
+
+/** opaque handle for the parallel gzip writer */
+typedef struct beacon_pgz beacon_pgz_t;
+
+/** Options for beacon_pgz_open(). Zero means default for any member. */
+typedef struct beacon_pgz_opts
+{
+  int nthreads;       //!< number of compression threads (default: number of online cpus)
+  size_t block_size;  //!< uncompressed bytes per gzip member (default: 1 MB)
+  int level;          //!< compression level, 1-9 (default: zlib default, same as gzopen)
+  int max_blocks;     //!< maximum number of blocks in flight, including the one being filled (default: 2*nthreads+2)
+} beacon_pgz_opts_t;
+
+/** Statistics, see beacon_pgz_get_stats() */
+typedef struct beacon_pgz_stats
+{
+  uint64_t bytes_in;          //!< uncompressed bytes written by the caller
+  uint64_t bytes_out;         //!< compressed bytes written to the output
+  uint64_t blocks_written;    //!< number of gzip members written
+  int queue_depth;            //!< blocks currently waiting to be compressed or written
+  int max_queue_depth;        //!< the maximum queue_depth seen so far
+  int nthreads;               //!< number of compression threads
+  double elapsed;             //!< seconds since open
+  double compress_time;       //!< total seconds spent compressing, summed over threads
+  double stall_time;          //!< seconds the caller spent waiting for a free block
+  double input_rate;          //!< bytes_in / elapsed, in MB/s
+  double compress_rate;       //!< bytes compressed per thread-second, in MB/s
+} beacon_pgz_stats_t;
+
+
+/** Open a parallel gzip writer to the given path. opts may be NULL for defaults. Returns NULL on failure. */
+beacon_pgz_t * beacon_pgz_open(const char * path, const beacon_pgz_opts_t * opts);
+
+/** Open a parallel gzip writer that sends its compressed output to a sink (e.g. to do your own I/O).
+ * The sink is called from an internal thread, always in order. The sink must remain valid until close. */
+beacon_pgz_t * beacon_pgz_open_sink(const beacon_sink_t * out, const beacon_pgz_opts_t * opts);
+
+/** Write n bytes into the stream. Returns 0 on success. */
+int beacon_pgz_write(beacon_pgz_t * pgz, const void * buf, size_t n);
+
+/** Returns a sink that writes into this stream, for use with beacon_*_sinkwrite() */
+const beacon_sink_t * beacon_pgz_sink(beacon_pgz_t * pgz);
+
+/** Ends the current gzip member and waits until everything so far has been written out. Returns 0 on success. */
+int beacon_pgz_flush(beacon_pgz_t * pgz);
+
+/** Fill in the current statistics */
+int beacon_pgz_get_stats(beacon_pgz_t * pgz, beacon_pgz_stats_t * stats);
+
+/** Flush, stop the threads, close the output and free. Returns 0 if everything was written successfully. */
+int beacon_pgz_close(beacon_pgz_t * pgz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
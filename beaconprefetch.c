@@ -0,0 +1,270 @@
+#include "beaconprefetch.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define DEFAULT_BUFFER_BYTES (1 << 20)
+
+/* Each buffer goes FREE -> FULL (filled by the thread) -> HELD (by the caller, until the next call) -> FREE.
+ * Buffers are used round robin, so batch seq always lives in buffers[seq % nbuffers]
+ */
+enum buffer_state
+{
+  BUFFER_FREE,
+  BUFFER_FULL,
+  BUFFER_HELD
+};
+
+struct buffer
+{
+  enum buffer_state state;
+  void * records;
+  int n;
+  beacon_read_error_t err;   // what stopped the batch (if it's short), and the offset just after it
+};
+
+struct beacon_prefetch
+{
+  beacon_reader_t * r;
+  beacon_record_type_t type;
+  beacon_prefetch_opts_t opts;
+  struct buffer * buffers;
+  pthread_t thread;
+  int started;
+
+  pthread_mutex_t lock;
+  pthread_cond_t full_cv;     // signaled when a buffer becomes FULL (or the thread is finished)
+  pthread_cond_t free_cv;     // signaled when a buffer becomes FREE (or we're stopping)
+
+  uint64_t fill_seq;          // the next batch the thread fills
+  uint64_t take_seq;          // the next batch the caller takes
+  struct buffer * held;       // the buffer the caller has, if any
+  int stopping;
+  int finished;               // the thread has filled its last batch
+  beacon_read_error_t last;   // err of the last batch handed out
+  uint64_t resume;            // offset just after the last record handed out
+
+  struct timespec start;
+  uint64_t records;
+  uint64_t consumer_stalls;
+  uint64_t producer_stalls;
+  double decode_time;
+  double consumer_stall_time;
+  double producer_stall_time;
+};
+
+
+static double since(const struct timespec * t0)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec - t0->tv_sec + 1e-9 * (now.tv_nsec - t0->tv_nsec);
+}
+
+static size_t record_size(beacon_record_type_t type)
+{
+  switch (type)
+  {
+    case BN_RECORD_HEADER: return sizeof(beacon_header_t);
+    case BN_RECORD_EVENT:  return sizeof(beacon_event_t);
+    case BN_RECORD_STATUS: return sizeof(beacon_status_t);
+    case BN_RECORD_HK:     return sizeof(beacon_hk_t);
+    default:               return 0;
+  }
+}
+
+static int read_batch(beacon_prefetch_t * p, struct buffer * b)
+{
+  switch (p->type)
+  {
+    case BN_RECORD_HEADER: return beacon_header_read_many(p->r, b->records, p->opts.batch, &b->err);
+    case BN_RECORD_EVENT:  return beacon_event_read_many(p->r, b->records, p->opts.batch, &b->err);
+    case BN_RECORD_STATUS: return beacon_status_read_many(p->r, b->records, p->opts.batch, &b->err);
+    case BN_RECORD_HK:     return beacon_hk_read_many(p->r, b->records, p->opts.batch, &b->err);
+    default:               return 0;
+  }
+}
+
+
+static void * prefetch_thread(void * arg)
+{
+  beacon_prefetch_t * p = arg;
+
+  pthread_mutex_lock(&p->lock);
+  while (!p->stopping)
+  {
+    struct buffer * b = &p->buffers[p->fill_seq % p->opts.nbuffers];
+    struct timespec t0;
+
+    if (b->state != BUFFER_FREE)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      p->producer_stalls++;
+      while (b->state != BUFFER_FREE && !p->stopping) pthread_cond_wait(&p->free_cv, &p->lock);
+      p->producer_stall_time += since(&t0);
+      continue;
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    b->n = read_batch(p, b);
+
+    pthread_mutex_lock(&p->lock);
+    p->decode_time += since(&t0);
+    b->state = BUFFER_FULL;
+    p->fill_seq++;
+    pthread_cond_broadcast(&p->full_cv);
+
+    // a short batch means the end of the file or an error, either way there's nothing more
+    if (b->n < p->opts.batch) break;
+  }
+  p->finished = 1;
+  pthread_cond_broadcast(&p->full_cv);
+  pthread_mutex_unlock(&p->lock);
+
+  return NULL;
+}
+
+
+static void prefetch_free(beacon_prefetch_t * p)
+{
+  int i;
+  if (p->buffers)
+  {
+    for (i = 0; i < p->opts.nbuffers; i++) free(p->buffers[i].records);
+  }
+  free(p->buffers);
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->full_cv);
+  pthread_cond_destroy(&p->free_cv);
+  free(p);
+}
+
+beacon_prefetch_t * beacon_prefetch_start(beacon_reader_t * r, beacon_record_type_t type, const beacon_prefetch_opts_t * opts)
+{
+  int i;
+  size_t size = record_size(type);
+  beacon_prefetch_t * p;
+
+  if (!r || !size) return NULL;
+  p = calloc(1, sizeof(beacon_prefetch_t));
+  if (!p) return NULL;
+
+  if (opts) p->opts = *opts;
+  if (p->opts.batch <= 0) p->opts.batch = DEFAULT_BUFFER_BYTES / size ? DEFAULT_BUFFER_BYTES / size : 1;
+  if (p->opts.nbuffers < 2) p->opts.nbuffers = 2;
+
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->full_cv, NULL);
+  pthread_cond_init(&p->free_cv, NULL);
+
+  p->r = r;
+  p->type = type;
+  p->resume = beacon_reader_tell(r);
+
+  p->buffers = calloc(p->opts.nbuffers, sizeof(struct buffer));
+  if (!p->buffers) goto fail;
+  for (i = 0; i < p->opts.nbuffers; i++)
+  {
+    p->buffers[i].records = malloc(p->opts.batch * size);
+    if (!p->buffers[i].records) goto fail;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &p->start);
+  if (pthread_create(&p->thread, NULL, prefetch_thread, p)) goto fail;
+  p->started = 1;
+  return p;
+
+fail:
+  prefetch_free(p);
+  return NULL;
+}
+
+
+int beacon_prefetch_next(beacon_prefetch_t * p, const void ** records, beacon_read_error_t * err)
+{
+  struct buffer * b;
+  int n = 0;
+
+  pthread_mutex_lock(&p->lock);
+
+  // done with the last one
+  if (p->held)
+  {
+    p->held->state = BUFFER_FREE;
+    p->held = NULL;
+    pthread_cond_broadcast(&p->free_cv);
+  }
+
+  b = &p->buffers[p->take_seq % p->opts.nbuffers];
+  if (b->state != BUFFER_FULL && !p->finished)
+  {
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    p->consumer_stalls++;
+    while (b->state != BUFFER_FULL && !p->finished) pthread_cond_wait(&p->full_cv, &p->lock);
+    p->consumer_stall_time += since(&t0);
+  }
+
+  if (b->state == BUFFER_FULL)
+  {
+    p->take_seq++;
+    p->last = b->err;
+    p->resume = b->err.offset;
+    n = b->n;
+    p->records += n;
+
+    if (n)
+    {
+      b->state = BUFFER_HELD;
+      p->held = b;
+      *records = b->records;
+    }
+    else
+    {
+      b->state = BUFFER_FREE;
+      pthread_cond_broadcast(&p->free_cv);
+    }
+  }
+
+  if (err) *err = p->last;
+  pthread_mutex_unlock(&p->lock);
+  return n;
+}
+
+
+int beacon_prefetch_get_stats(beacon_prefetch_t * p, beacon_prefetch_stats_t * stats)
+{
+  pthread_mutex_lock(&p->lock);
+  stats->records = p->records;
+  stats->batches = p->take_seq;
+  stats->consumer_stalls = p->consumer_stalls;
+  stats->producer_stalls = p->producer_stalls;
+  stats->elapsed = since(&p->start);
+  stats->decode_time = p->decode_time;
+  stats->consumer_stall_time = p->consumer_stall_time;
+  stats->producer_stall_time = p->producer_stall_time;
+  pthread_mutex_unlock(&p->lock);
+  return 0;
+}
+
+
+int beacon_prefetch_stop(beacon_prefetch_t * p)
+{
+  int ret = 0;
+
+  pthread_mutex_lock(&p->lock);
+  p->stopping = 1;
+  pthread_cond_broadcast(&p->free_cv);
+  pthread_mutex_unlock(&p->lock);
+
+  if (p->started) pthread_join(p->thread, NULL);
+
+  // put back whatever was read ahead but not handed out
+  if (beacon_reader_tell(p->r) != p->resume) ret = beacon_reader_seek(p->r, p->resume);
+
+  prefetch_free(p);
+  return ret;
+}
@@ -0,0 +1,79 @@
+#ifndef _beaconprefetch_h
+#define _beaconprefetch_h
+
+#include "beacon.h"
+#include "beaconreader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file beaconprefetch.h
+ *
+ * Read-ahead on a background thread.
+ *
+ * Normally decompression, checksumming and decoding happen on the same thread as whatever is looking
+ * at the records, so the two take turns. A beacon_prefetch_t moves the reading onto its own thread,
+ * which decodes batches of records into a small ring of buffers while the caller works on the
+ * previous batch. Sequential throughput then approaches the slower of the two, rather than their sum
+ * (given a spare core).
+ *
+ * Typical usage:
+ *
+ *    beacon_reader_t * r = beacon_reader_open("events.gz");
+ *    beacon_prefetch_t * p = beacon_prefetch_start(r, BN_RECORD_EVENT, NULL);
+ *    const beacon_event_t * ev;
+ *    int i, n;
+ *    while ((n = beacon_prefetch_next(p, (const void **) &ev, NULL)) > 0)
+ *      for (i = 0; i < n; i++) analyze(&ev[i]);
+ *    beacon_prefetch_stop(p);
+ *    beacon_reader_close(r);
+ *
+ * The reader belongs to the prefetch thread until beacon_prefetch_stop(), so don't touch it in between.
+ */
+
+/** opaque handle */
+typedef struct beacon_prefetch beacon_prefetch_t;
+
+/** Options for beacon_prefetch_start(). Zero means default for any member. */
+typedef struct beacon_prefetch_opts
+{
+  int batch;          //!< records per buffer (default: about 1 MB worth)
+  int nbuffers;       //!< number of buffers in the ring, including the one the caller has (default: 2)
+} beacon_prefetch_opts_t;
+
+/** Statistics, see beacon_prefetch_get_stats() */
+typedef struct beacon_prefetch_stats
+{
+  uint64_t records;           //!< records handed to the caller
+  uint64_t batches;           //!< batches handed to the caller
+  uint64_t consumer_stalls;   //!< times the caller had to wait for a batch
+  uint64_t producer_stalls;   //!< times the prefetch thread had to wait for a free buffer
+  double elapsed;             //!< seconds since start
+  double decode_time;         //!< seconds the prefetch thread spent reading and decoding
+  double consumer_stall_time; //!< seconds the caller spent waiting (time decoding was the bottleneck)
+  double producer_stall_time; //!< seconds the prefetch thread spent waiting (time the caller was the bottleneck)
+} beacon_prefetch_stats_t;
+
+/** Start prefetching records of the given type from the reader's current position. opts may be NULL for
+ * defaults. Returns NULL on failure. */
+beacon_prefetch_t * beacon_prefetch_start(beacon_reader_t * r, beacon_record_type_t type, const beacon_prefetch_opts_t * opts);
+
+/** Get the next batch of records: *records is pointed at an array of beacon_header_t, beacon_event_t,
+ * beacon_status_t or beacon_hk_t (according to the type), which is good until the next call. Returns the
+ * number of records, or 0 once there are no more, in which case *err (if not NULL) says why, just like
+ * beacon_header_read_many(). */
+int beacon_prefetch_next(beacon_prefetch_t * p, const void ** records, beacon_read_error_t * err);
+
+/** Fill in the current statistics */
+int beacon_prefetch_get_stats(beacon_prefetch_t * p, beacon_prefetch_stats_t * stats);
+
+/** Stop the thread and free everything. The reader is left just after the last record handed out, so it
+ * can carry on from there. Returns 0 on success, or 1 if the reader couldn't be put back (e.g. it's a pipe). */
+int beacon_prefetch_stop(beacon_prefetch_t * p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
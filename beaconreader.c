@@ -0,0 +1,655 @@
+#include "beaconreader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// the read ahead buffer for decoded data has to hold any record, with room to spare
+#define READER_MIN_AHEAD (2 * BN_MAX_EVENT_BYTES)
+
+struct beacon_reader
+{
+  beacon_source_t src;
+  const uint8_t * mem;   // for readers of memory, the whole (possibly compressed) thing
+  size_t mem_len;
+  size_t mem_pos;
+  beacon_reader_format_t format;
+  int raw;               // inflating raw deflate data, after jumping to an access point inside a member
+  int member_end;        // at the end of a gzip member, another may follow
+  int trailer;           // gzip trailer bytes left to skip (only in raw mode)
+  int done;              // hit garbage or a decompression error, nothing more comes out until a seek
+  int skip_corrupt;
+  uint64_t skipped;      // bytes skipped over to get past corruption
+  int err;
+  z_stream strm;         // for raw files, only next_in / avail_in are used
+  uint8_t * buf;         // input buffer (not used for memory)
+  size_t buf_size;
+  uint64_t offset;       // decoded offset of the next byte (after what's in ahead)
+  beacon_index_t * index;
+  uint8_t * ahead;       // decoded but not yet consumed
+  int ahead_pos;
+  int ahead_len;
+  int ahead_size;
+};
+
+
+/* file descriptors as sources */
+static int fd_read(void * ctx, void * buf, size_t n)
+{
+  ssize_t got;
+  do
+  {
+    got = read((int) (intptr_t) ctx, buf, n);
+  } while (got < 0 && errno == EINTR);
+  return got;
+}
+
+static int fd_seek(void * ctx, uint64_t offset)
+{
+  return lseek((int) (intptr_t) ctx, offset, SEEK_SET) == (off_t) offset ? 0 : 1;
+}
+
+static void fd_close(void * ctx)
+{
+  close((int) (intptr_t) ctx);
+}
+
+
+/* gets more input if there's none left. Returns how much input there is, 0 at the end or -1 on error */
+static int fill(beacon_reader_t * r)
+{
+  int n;
+  if (r->strm.avail_in) return r->strm.avail_in;
+
+  if (r->mem)
+  {
+    n = r->mem_len - r->mem_pos > r->buf_size ? r->buf_size : r->mem_len - r->mem_pos;
+    r->strm.next_in = (uint8_t*) r->mem + r->mem_pos;
+    r->mem_pos += n;
+  }
+  else
+  {
+    n = r->src.read(r->src.ctx, r->buf, r->buf_size);
+    if (n < 0)
+    {
+      r->err = 1;
+      return -1;
+    }
+    r->strm.next_in = r->buf;
+  }
+
+  r->strm.avail_in = n;
+  return n;
+}
+
+/* go to an offset in the (possibly compressed) input */
+static int input_seek(beacon_reader_t * r, uint64_t offset)
+{
+  r->strm.avail_in = 0;
+  r->done = 0;
+  r->err = 0;
+  if (r->mem)
+  {
+    if (offset > r->mem_len) return 1;
+    r->mem_pos = offset;
+    return 0;
+  }
+  return r->src.seek ? r->src.seek(r->src.ctx, offset) : 1;
+}
+
+static int read_raw(beacon_reader_t * r, uint8_t * out, int n)
+{
+  int got = 0;
+  while (got < n)
+  {
+    int chunk;
+
+    // big reads skip the input buffer
+    if (!r->strm.avail_in && !r->mem && (size_t) (n - got) >= r->buf_size)
+    {
+      chunk = r->src.read(r->src.ctx, out + got, n - got);
+      if (chunk < 0) r->err = 1;
+      if (chunk <= 0) break;
+      got += chunk;
+      continue;
+    }
+
+    if (fill(r) <= 0) break;
+    chunk = n - got < (int) r->strm.avail_in ? n - got : (int) r->strm.avail_in;
+    memcpy(out + got, r->strm.next_in, chunk);
+    r->strm.next_in += chunk;
+    r->strm.avail_in -= chunk;
+    got += chunk;
+  }
+  return got;
+}
+
+static int read_gz(beacon_reader_t * r, uint8_t * out, int n)
+{
+  r->strm.next_out = out;
+  r->strm.avail_out = n;
+
+  while (r->strm.avail_out)
+  {
+    int ret;
+    if (fill(r) <= 0) break;
+
+    if (r->trailer)
+    {
+      int skip = r->trailer < (int) r->strm.avail_in ? r->trailer : (int) r->strm.avail_in;
+      r->strm.next_in += skip;
+      r->strm.avail_in -= skip;
+      r->trailer -= skip;
+      if (!r->trailer) r->member_end = 1;
+      continue;
+    }
+
+    if (r->member_end)
+    {
+      inflateReset2(&r->strm, 15 + 16);
+      r->raw = 0;
+      r->member_end = 0;
+    }
+
+    ret = inflate(&r->strm, Z_NO_FLUSH);
+
+    if (ret == Z_STREAM_END)
+    {
+      if (r->raw) r->trailer = 8;
+      else r->member_end = 1;
+    }
+    else if (ret != Z_OK)
+    {
+      // garbage after the last member is ignored, like gzread does
+      if (!(ret == Z_DATA_ERROR && !r->raw && r->strm.total_out == 0)) r->err = 1;
+      r->strm.avail_in = 0;
+      r->done = 1;
+      break;
+    }
+  }
+
+  return n - r->strm.avail_out;
+}
+
+static int read_stream(beacon_reader_t * r, uint8_t * buf, int n)
+{
+  int got;
+  if (r->done) return 0;
+  got = r->format == BN_READER_GZIP ? read_gz(r, buf, n) : read_raw(r, buf, n);
+  r->offset += got;
+  return got;
+}
+
+int beacon_reader_read(beacon_reader_t * r, void * buf, int n)
+{
+  int got = r->ahead_len - r->ahead_pos < n ? r->ahead_len - r->ahead_pos : n;
+  memcpy(buf, r->ahead + r->ahead_pos, got);
+  r->ahead_pos += got;
+  if (got < n) got += read_stream(r, (uint8_t*) buf + got, n - got);
+  return got == 0 && r->err ? -1 : got;
+}
+
+uint64_t beacon_reader_tell(const beacon_reader_t * r)
+{
+  return r->offset - (r->ahead_len - r->ahead_pos);
+}
+
+/* restart decompression at an access point */
+static int jump(beacon_reader_t * r, const beacon_index_point_t * pt)
+{
+  if (input_seek(r, pt->coffset - (pt->bits ? 1 : 0))) return 1;
+
+  r->trailer = 0;
+  r->member_end = 0;
+
+  if (pt->flags & BN_INDEX_POINT_MEMBER)
+  {
+    inflateReset2(&r->strm, 15 + 16);
+    r->raw = 0;
+  }
+  else
+  {
+    inflateReset2(&r->strm, -15);
+    r->raw = 1;
+    if (pt->bits)
+    {
+      if (fill(r) <= 0) return 1;
+      inflatePrime(&r->strm, pt->bits, r->strm.next_in[0] >> (8 - pt->bits));
+      r->strm.next_in++;
+      r->strm.avail_in--;
+    }
+    if (pt->window_len && inflateSetDictionary(&r->strm, pt->window, pt->window_len) != Z_OK) return 1;
+  }
+
+  r->offset = pt->uoffset;
+  return 0;
+}
+
+int beacon_reader_seek(beacon_reader_t * r, uint64_t offset)
+{
+  const beacon_index_point_t * pt;
+  uint8_t scratch[1 << 14];
+
+  // maybe it's in what we've already read ahead
+  if (offset >= beacon_reader_tell(r) && offset <= r->offset)
+  {
+    r->ahead_pos += offset - beacon_reader_tell(r);
+    return 0;
+  }
+  r->ahead_pos = r->ahead_len = 0;
+
+  if (r->format == BN_READER_RAW)
+  {
+    if (input_seek(r, offset)) return 1;
+    r->offset = offset;
+    return 0;
+  }
+
+  pt = r->index ? beacon_index_find_point(r->index, offset) : NULL;
+
+  // jump if we have to go backwards or there's an access point ahead of us
+  if (offset < r->offset || (pt && pt->uoffset > r->offset))
+  {
+    beacon_index_point_t start;
+    if (!pt)
+    {
+      memset(&start, 0, sizeof(start));
+      start.flags = BN_INDEX_POINT_MEMBER;
+      pt = &start;
+    }
+    if (jump(r, pt)) return 1;
+  }
+
+  // and decompress the rest of the way
+  while (r->offset < offset)
+  {
+    int want = offset - r->offset < sizeof(scratch) ? (int) (offset - r->offset) : (int) sizeof(scratch);
+    if (beacon_reader_read(r, scratch, want) <= 0) return 1;
+  }
+
+  return 0;
+}
+
+/* Works out what we're reading from the first few bytes. Reads (into the input buffer) until there
+ * are enough of them or the input ends. Returns 0 if it's something we can read. */
+static int sniff(beacon_reader_t * r)
+{
+  const uint8_t * p;
+  size_t n = 0;
+
+  if (r->mem)
+  {
+    p = r->mem;
+    n = r->mem_len;
+  }
+  else
+  {
+    while (n < 6)
+    {
+      int got = r->src.read(r->src.ctx, r->buf + n, r->buf_size - n);
+      if (got < 0) return 1;
+      if (got == 0) break;
+      n += got;
+    }
+    r->strm.next_in = r->buf;
+    r->strm.avail_in = n;
+    p = r->buf;
+  }
+
+  r->format = BN_READER_RAW;
+  if (n >= 2 && p[0] == 0x1f && p[1] == 0x8b) r->format = BN_READER_GZIP;
+
+  // compressors we might support some day. Better to say no than hand out garbage.
+  if (n >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd) return 1; // zstd
+  if (n >= 6 && !memcmp(p, "\xfd" "7zXZ\0", 6)) return 1;                          // xz
+  if (n >= 3 && !memcmp(p, "BZh", 3)) return 1;                                   // bzip2
+
+  if (r->format == BN_READER_GZIP && inflateInit2(&r->strm, 15 + 16) != Z_OK)
+  {
+    r->format = BN_READER_RAW;   // so beacon_reader_close doesn't end it
+    return 1;
+  }
+  return 0;
+}
+
+static beacon_reader_t * reader_new()
+{
+  beacon_reader_t * r = calloc(1, sizeof(*r));
+  if (!r) return NULL;
+  r->buf_size = BN_READER_DEFAULT_BUFFER;
+  r->ahead_size = BN_READER_DEFAULT_BUFFER < READER_MIN_AHEAD ? READER_MIN_AHEAD : BN_READER_DEFAULT_BUFFER;
+  r->ahead = malloc(r->ahead_size);
+  if (!r->ahead)
+  {
+    free(r);
+    return NULL;
+  }
+  return r;
+}
+
+beacon_reader_t * beacon_reader_open_source(const beacon_source_t * src)
+{
+  beacon_reader_t * r = reader_new();
+  if (!r)
+  {
+    if (src->close) src->close(src->ctx);
+    return NULL;
+  }
+  r->src = *src;
+  r->buf = malloc(r->buf_size);
+
+  if (!r->buf || sniff(r))
+  {
+    beacon_reader_close(r);
+    return NULL;
+  }
+  return r;
+}
+
+beacon_reader_t * beacon_reader_open_fd(int fd)
+{
+  beacon_source_t src = { .read = fd_read, .seek = fd_seek, .close = fd_close, .ctx = (void*) (intptr_t) fd };
+  return beacon_reader_open_source(&src);
+}
+
+beacon_reader_t * beacon_reader_open_mem(const void * buf, size_t len)
+{
+  beacon_reader_t * r = reader_new();
+  if (!r) return NULL;
+  r->mem = buf;
+  r->mem_len = len;
+
+  if (sniff(r))
+  {
+    beacon_reader_close(r);
+    return NULL;
+  }
+  return r;
+}
+
+beacon_reader_t * beacon_reader_open(const char * path)
+{
+  char idxpath[strlen(path) + 5];
+  beacon_reader_t * r;
+  int fd = strcmp(path, "-") ? open(path, O_RDONLY) : dup(STDIN_FILENO);
+  if (fd < 0) return NULL;
+
+  // closed by the reader, even if opening it fails
+  r = beacon_reader_open_fd(fd);
+  if (!r) return NULL;
+
+  sprintf(idxpath, "%s.idx", path);
+  r->index = beacon_index_load(idxpath);
+  return r;
+}
+
+beacon_reader_format_t beacon_reader_format(const beacon_reader_t * r)
+{
+  return r->format;
+}
+
+int beacon_reader_set_buffer_size(beacon_reader_t * r, size_t size)
+{
+  int pending = r->ahead_len - r->ahead_pos;
+  size_t ahead_size = size < READER_MIN_AHEAD ? READER_MIN_AHEAD : size;
+  uint8_t * mem;
+
+  if (size < 4096 || size > (1 << 30)) return 1;
+
+  // keep whatever we haven't used yet
+  memmove(r->ahead, r->ahead + r->ahead_pos, pending);
+  r->ahead_pos = 0;
+  r->ahead_len = pending;
+  mem = realloc(r->ahead, ahead_size);
+  if (!mem) return 1;
+  r->ahead = mem;
+  r->ahead_size = ahead_size;
+
+  if (!r->mem)
+  {
+    if (r->strm.avail_in > size) return 1;
+    memmove(r->buf, r->strm.next_in, r->strm.avail_in);
+    mem = realloc(r->buf, size);
+    if (!mem) return 1;
+    r->buf = mem;
+    r->strm.next_in = r->buf;
+  }
+
+  r->buf_size = size;
+  return 0;
+}
+
+void beacon_reader_set_skip_corrupt(beacon_reader_t * r, int skip)
+{
+  r->skip_corrupt = skip;
+}
+
+uint64_t beacon_reader_skipped_bytes(const beacon_reader_t * r)
+{
+  return r->skipped;
+}
+
+int beacon_reader_use_index(beacon_reader_t * r, const char * index_path)
+{
+  beacon_index_t * idx = beacon_index_load(index_path);
+  if (!idx) return 1;
+  beacon_index_free(r->index);
+  r->index = idx;
+  return 0;
+}
+
+/* makes sure at least n bytes are in the read ahead buffer, if there are that many left. Returns how many there are. */
+static int ensure_ahead(beacon_reader_t * r, int n)
+{
+  int avail = r->ahead_len - r->ahead_pos;
+  while (avail < n)
+  {
+    int got;
+    if (r->ahead_pos)
+    {
+      memmove(r->ahead, r->ahead + r->ahead_pos, avail);
+      r->ahead_pos = 0;
+      r->ahead_len = avail;
+    }
+    got = read_stream(r, r->ahead + avail, r->ahead_size - avail);
+    if (got <= 0) break;
+    r->ahead_len += got;
+    avail += got;
+  }
+  return avail;
+}
+
+int beacon_reader_next_type(beacon_reader_t * r, beacon_record_type_t * type)
+{
+  int avail = ensure_ahead(r, 1);
+  if (!avail) return BN_ERR_NOT_ENOUGH_BYTES;
+
+  switch (r->ahead[r->ahead_pos])
+  {
+    case BN_RECORD_HEADER:
+    case BN_RECORD_EVENT:
+    case BN_RECORD_STATUS:
+    case BN_RECORD_HK:
+      *type = (beacon_record_type_t) r->ahead[r->ahead_pos];
+      return 0;
+    default:
+      return BN_ERR_WRONG_TYPE;
+  }
+}
+
+/* skips n bytes of the read ahead buffer as corrupt */
+static void skip_ahead(beacon_reader_t * r, int n)
+{
+  r->ahead_pos += n;
+  r->skipped += n;
+}
+
+/* Decodes up to n records of the given type straight out of the read ahead buffer, refilling it as needed.
+ * deserialize is one of the beacon_*_deserialize functions, and out an array of its records. */
+static int read_many(beacon_reader_t * r, beacon_record_type_t type, int (*deserialize)(const void *, size_t, void *),
+                     void * out, size_t stride, int n, beacon_read_error_t * err)
+{
+  int got = 0;
+  int code = 0;
+
+  while (got < n)
+  {
+    int avail = r->ahead_len - r->ahead_pos;
+    int size = avail ? deserialize(r->ahead + r->ahead_pos, avail, (uint8_t*) out + got * stride) : -BN_ERR_NOT_ENOUGH_BYTES;
+
+    if (size > 0)
+    {
+      r->ahead_pos += size;
+      got++;
+      continue;
+    }
+
+    if (size != -BN_ERR_NOT_ENOUGH_BYTES)
+    {
+      int64_t found;
+      if (!r->skip_corrupt)
+      {
+        code = -size;
+        break;
+      }
+
+      // get back in step. Something that might be a record at the end of the buffer needs a closer look once there's more.
+      found = beacon_record_find(r->ahead + r->ahead_pos + 1, avail - 1, type, 1);
+      skip_ahead(r, found < 0 ? avail : found + 1);
+      continue;
+    }
+
+    // we need more
+    if (ensure_ahead(r, avail + 1) == avail)
+    {
+      // at the end, all that's left could be a bogus partial record with good ones hidden inside it
+      if (avail && r->skip_corrupt && !r->err)
+      {
+        int64_t found = beacon_record_find(r->ahead + r->ahead_pos + 1, avail - 1, type, 0);
+        skip_ahead(r, found < 0 ? avail : found + 1);
+        continue;
+      }
+
+      // a clean end is only between records
+      if (avail || r->err) code = BN_ERR_NOT_ENOUGH_BYTES;
+      break;
+    }
+  }
+
+  if (err)
+  {
+    err->code = code;
+    err->offset = beacon_reader_tell(r);
+  }
+  return got;
+}
+
+static int header_deserialize(const void * buf, size_t len, void * h) { return beacon_header_deserialize(buf, len, h); }
+static int event_deserialize(const void * buf, size_t len, void * ev) { return beacon_event_deserialize(buf, len, ev); }
+static int status_deserialize(const void * buf, size_t len, void * st) { return beacon_status_deserialize(buf, len, st); }
+static int hk_deserialize(const void * buf, size_t len, void * hk) { return beacon_hk_deserialize(buf, len, hk); }
+
+int beacon_header_read_many(beacon_reader_t * r, beacon_header_t * h, int n, beacon_read_error_t * err)
+{
+  return read_many(r, BN_RECORD_HEADER, header_deserialize, h, sizeof(*h), n, err);
+}
+
+int beacon_event_read_many(beacon_reader_t * r, beacon_event_t * ev, int n, beacon_read_error_t * err)
+{
+  return read_many(r, BN_RECORD_EVENT, event_deserialize, ev, sizeof(*ev), n, err);
+}
+
+int beacon_status_read_many(beacon_reader_t * r, beacon_status_t * st, int n, beacon_read_error_t * err)
+{
+  return read_many(r, BN_RECORD_STATUS, status_deserialize, st, sizeof(*st), n, err);
+}
+
+int beacon_hk_read_many(beacon_reader_t * r, beacon_hk_t * hk, int n, beacon_read_error_t * err)
+{
+  return read_many(r, BN_RECORD_HK, hk_deserialize, hk, sizeof(*hk), n, err);
+}
+
+/* single records are just bulk reads of one */
+static int read_one(beacon_reader_t * r, beacon_record_type_t type, int (*deserialize)(const void *, size_t, void *), void * out)
+{
+  beacon_read_error_t err;
+  if (read_many(r, type, deserialize, out, 0, 1, &err)) return 0;
+  return err.code ? err.code : BN_ERR_NOT_ENOUGH_BYTES;
+}
+
+int beacon_reader_read_header(beacon_reader_t * r, beacon_header_t * h)
+{
+  return read_one(r, BN_RECORD_HEADER, header_deserialize, h);
+}
+
+int beacon_reader_read_event(beacon_reader_t * r, beacon_event_t * ev)
+{
+  return read_one(r, BN_RECORD_EVENT, event_deserialize, ev);
+}
+
+int beacon_reader_read_status(beacon_reader_t * r, beacon_status_t * st)
+{
+  return read_one(r, BN_RECORD_STATUS, status_deserialize, st);
+}
+
+int beacon_reader_read_hk(beacon_reader_t * r, beacon_hk_t * hk)
+{
+  return read_one(r, BN_RECORD_HK, hk_deserialize, hk);
+}
+
+/* shared by event and header seeking. Without an index, reads through the file from the beginning. */
+static int seek_event_number(beacon_reader_t * r, uint64_t event_number, int is_event)
+{
+  uint64_t offset;
+  beacon_event_t * ev;
+  beacon_header_t h;
+  int found = 0;
+
+  if (r->index)
+  {
+    if (beacon_index_lookup(r->index, event_number, &offset)) return BN_ERR_NO_SUCH_EVENT;
+    return beacon_reader_seek(r, offset) ? BN_ERR_NOT_ENOUGH_BYTES : 0;
+  }
+
+  if (beacon_reader_seek(r, 0)) return BN_ERR_NOT_ENOUGH_BYTES;
+  ev = is_event ? malloc(sizeof(beacon_event_t)) : NULL;
+
+  while (1)
+  {
+    offset = beacon_reader_tell(r);
+    if (is_event ? beacon_reader_read_event(r, ev) : beacon_reader_read_header(r, &h)) break;
+    if ((is_event ? ev->event_number : h.event_number) == event_number)
+    {
+      found = 1;
+      break;
+    }
+  }
+
+  free(ev);
+  if (!found) return BN_ERR_NO_SUCH_EVENT;
+  return beacon_reader_seek(r, offset) ? BN_ERR_NOT_ENOUGH_BYTES : 0;
+}
+
+int beacon_event_seek(beacon_reader_t * r, uint64_t event_number)
+{
+  return seek_event_number(r, event_number, 1);
+}
+
+int beacon_header_seek(beacon_reader_t * r, uint64_t event_number)
+{
+  return seek_event_number(r, event_number, 0);
+}
+
+void beacon_reader_close(beacon_reader_t * r)
+{
+  if (!r) return;
+  if (r->format == BN_READER_GZIP) inflateEnd(&r->strm);
+  if (r->src.close) r->src.close(r->src.ctx);
+  beacon_index_free(r->index);
+  free(r->buf);
+  free(r->ahead);
+  free(r);
+}
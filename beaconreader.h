@@ -0,0 +1,145 @@
+#ifndef _beaconreader_h
+#define _beaconreader_h
+
+#include "beacon.h"
+#include "beaconindex.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file beaconreader.h
+ *
+ * A buffered reader for data files that can seek by event number.
+ *
+ * The reader works out what it's reading from the first few bytes (not the name), so plain and gzipped
+ * files, pipes and memory are all read the same way, through one large (tunable) buffer. Formats it
+ * recognizes but can't read (zstd, xz, bzip2) are refused rather than read as garbage. Anything else can
+ * be read by supplying a beacon_source_t.
+ *
+ * If an index (see beaconindex.h) is available, beacon_event_seek() and beacon_header_seek() jump
+ * straight to the record, using the index's access points to start decompressing near it. Otherwise
+ * they read through the file until they find it. Seeking needs a seekable source.
+ *
+ * Typical usage:
+ *
+ *    beacon_reader_t * r = beacon_reader_open("events.gz");   // uses events.gz.idx if it exists
+ *    if (!beacon_event_seek(r, 12345)) beacon_reader_read_event(r, &ev);
+ *    beacon_reader_close(r);
+ */
+
+/** opaque reader handle */
+typedef struct beacon_reader beacon_reader_t;
+
+/** What the reader found it was reading */
+typedef enum beacon_reader_format
+{
+  BN_READER_RAW,      //!< uncompressed records
+  BN_READER_GZIP      //!< one or more gzip members
+} beacon_reader_format_t;
+
+/** Default size of the read buffers */
+#define BN_READER_DEFAULT_BUFFER (1 << 18)
+
+/** Somewhere to read bytes from, for beacon_reader_open_source() */
+typedef struct beacon_source
+{
+  int (*read)(void * ctx, void * buf, size_t n);    //!< read up to n bytes, returning how many (0 at the end) or -1 on error
+  int (*seek)(void * ctx, uint64_t offset);         //!< go to offset, returning 0 on success. May be NULL if seeking isn't possible.
+  void (*close)(void * ctx);                        //!< called by beacon_reader_close(). May be NULL.
+  void * ctx;
+} beacon_source_t;
+
+/** Open a data file for reading ("-" for stdin). If path.idx exists, it's loaded as the index. Returns NULL on failure. */
+beacon_reader_t * beacon_reader_open(const char * path);
+
+/** Read from an already open file descriptor, which is closed by beacon_reader_close(), or right away if this fails.
+ * Returns NULL on failure. */
+beacon_reader_t * beacon_reader_open_fd(int fd);
+
+/** Read from memory, which must stay around until beacon_reader_close(). Returns NULL on failure. */
+beacon_reader_t * beacon_reader_open_mem(const void * buf, size_t len);
+
+/** Read from a custom source (which is copied). The reader owns the source from then on: it's closed by
+ * beacon_reader_close(), or right away if this fails, so the caller must not close it either way. Returns NULL on failure. */
+beacon_reader_t * beacon_reader_open_source(const beacon_source_t * src);
+
+/** What's being read */
+beacon_reader_format_t beacon_reader_format(const beacon_reader_t * r);
+
+/** Change the size of the read buffers (the default is BN_READER_DEFAULT_BUFFER). Bigger means fewer system calls.
+ * Returns 0 on success. */
+int beacon_reader_set_buffer_size(beacon_reader_t * r, size_t size);
+
+/** Whether to skip over corrupt records (and anything else that isn't a record of the type being read) rather than
+ * stopping at them, the default being no. The reader gets back in step with beacon_record_find(). */
+void beacon_reader_set_skip_corrupt(beacon_reader_t * r, int skip);
+
+/** How many bytes have been skipped over because of corruption */
+uint64_t beacon_reader_skipped_bytes(const beacon_reader_t * r);
+
+/** Use the index at index_path (replacing any loaded one). Returns 0 on success. */
+int beacon_reader_use_index(beacon_reader_t * r, const char * index_path);
+
+/** Read up to n bytes of the (uncompressed) stream. Returns the number of bytes read, or -1 on error. */
+int beacon_reader_read(beacon_reader_t * r, void * buf, int n);
+
+/** The (uncompressed) offset of the next byte to be read */
+uint64_t beacon_reader_tell(const beacon_reader_t * r);
+
+/** Go to the given (uncompressed) offset. Returns 0 on success. */
+int beacon_reader_seek(beacon_reader_t * r, uint64_t offset);
+
+/** Read the next event. Returns 0 on success, BN_ERR_NOT_ENOUGH_BYTES at the end of the file, or another beacon_io_error_t. */
+int beacon_reader_read_event(beacon_reader_t * r, beacon_event_t * ev);
+
+/** Read the next header. Returns 0 on success, see beacon_reader_read_event(). */
+int beacon_reader_read_header(beacon_reader_t * r, beacon_header_t * h);
+
+/** Read the next status. Returns 0 on success, see beacon_reader_read_event(). */
+int beacon_reader_read_status(beacon_reader_t * r, beacon_status_t * st);
+
+/** Read the next hk. Returns 0 on success, see beacon_reader_read_event(). */
+int beacon_reader_read_hk(beacon_reader_t * r, beacon_hk_t * hk);
+
+/** The type of the next record, without reading it. Returns 0 on success, BN_ERR_NOT_ENOUGH_BYTES at the end or
+ * BN_ERR_WRONG_TYPE if it isn't the start of any record. */
+int beacon_reader_next_type(beacon_reader_t * r, beacon_record_type_t * type);
+
+/** What stopped a bulk read */
+typedef struct beacon_read_error
+{
+  int code;           //!< 0 if nothing went wrong (including reaching the end of the file cleanly), otherwise a beacon_io_error_t
+  uint64_t offset;    //!< the (uncompressed) offset of the next record, i.e. the bad one if code is set
+} beacon_read_error_t;
+
+/** Read up to n headers into h. This decodes straight out of a large internal buffer, so it's much cheaper per record
+ * than beacon_reader_read_header(), and never prints anything. Returns the number read; if that's less than n, either
+ * the file ended or something went wrong, which is described in *err (if not NULL). A bad record is not consumed. */
+int beacon_header_read_many(beacon_reader_t * r, beacon_header_t * h, int n, beacon_read_error_t * err);
+
+/** Read up to n events into ev, see beacon_header_read_many() */
+int beacon_event_read_many(beacon_reader_t * r, beacon_event_t * ev, int n, beacon_read_error_t * err);
+
+/** Read up to n statuses into st, see beacon_header_read_many() */
+int beacon_status_read_many(beacon_reader_t * r, beacon_status_t * st, int n, beacon_read_error_t * err);
+
+/** Read up to n hk into hk, see beacon_header_read_many() */
+int beacon_hk_read_many(beacon_reader_t * r, beacon_hk_t * hk, int n, beacon_read_error_t * err);
+
+/** Position an event reader so that the next beacon_reader_read_event() returns event_number.
+ * Returns 0 on success, or BN_ERR_NO_SUCH_EVENT. */
+int beacon_event_seek(beacon_reader_t * r, uint64_t event_number);
+
+/** Position a header reader so that the next beacon_reader_read_header() returns event_number.
+ * Returns 0 on success, or BN_ERR_NO_SUCH_EVENT. */
+int beacon_header_seek(beacon_reader_t * r, uint64_t event_number);
+
+/** Close the file and free everything */
+void beacon_reader_close(beacon_reader_t * r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,245 @@
+#include "beaconshm.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHM_MAGIC 0x4e434542  // "BECN"
+#define SHM_VERSION 1
+
+// readers spin this many times on a record being written before yielding, and give up after SPIN_LIMIT
+#define SPIN_YIELD 100
+#define SPIN_LIMIT 100000
+
+/* What's at the start of the segment. Everything is at a fixed offset, but the offsets and sizes are recorded
+ * so that an incompatible reader can tell. */
+struct shm_layout
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t layout_bytes;
+  uint32_t hk_offset;
+  uint32_t hk_bytes;
+  uint32_t status_offset;
+  uint32_t status_bytes;
+  uint64_t total_bytes;
+};
+
+/* Each record: the sequence number, which is odd while it's being written and goes up by two each time, then
+ * the record itself, as words so it can be copied with relaxed atomics */
+struct slot
+{
+  uint32_t seq;
+  uint32_t pad;
+  uint32_t w[];
+};
+
+#define WORDS(bytes) (((bytes) + 3) / 4)
+#define ROUND64(x) (((x) + 63) & ~(size_t) 63)
+#define HK_OFFSET ROUND64(sizeof(struct shm_layout))
+#define STATUS_OFFSET (HK_OFFSET + ROUND64(sizeof(struct slot) + 4 * WORDS(sizeof(beacon_hk_t))))
+#define TOTAL_BYTES (STATUS_OFFSET + ROUND64(sizeof(struct slot) + 4 * WORDS(sizeof(beacon_status_t))))
+
+struct beacon_shm
+{
+  void * base;
+  size_t size;
+  int writable;
+};
+
+
+static struct slot * slot_at(const beacon_shm_t * s, size_t offset)
+{
+  return (struct slot *) ((char *) s->base + offset);
+}
+
+static void fill_layout(struct shm_layout * l)
+{
+  memset(l, 0, sizeof(*l));
+  l->magic = SHM_MAGIC;
+  l->version = SHM_VERSION;
+  l->layout_bytes = sizeof(struct shm_layout);
+  l->hk_offset = HK_OFFSET;
+  l->hk_bytes = sizeof(beacon_hk_t);
+  l->status_offset = STATUS_OFFSET;
+  l->status_bytes = sizeof(beacon_status_t);
+  l->total_bytes = TOTAL_BYTES;
+}
+
+
+beacon_shm_t * beacon_shm_create(const char * name)
+{
+  struct shm_layout want;
+  struct shm_layout * have;
+  beacon_shm_t * s;
+  int fd;
+
+  fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return NULL;
+  if (ftruncate(fd, TOTAL_BYTES))
+  {
+    close(fd);
+    return NULL;
+  }
+
+  s = calloc(1, sizeof(*s));
+  if (!s)
+  {
+    close(fd);
+    return NULL;
+  }
+  s->size = TOTAL_BYTES;
+  s->writable = 1;
+  s->base = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (s->base == MAP_FAILED)
+  {
+    free(s);
+    return NULL;
+  }
+
+  // keep what's there if it's compatible (e.g. the publisher restarted), so the counts carry on
+  fill_layout(&want);
+  have = s->base;
+  if (memcmp(have, &want, sizeof(want)))
+  {
+    __atomic_store_n(&have->magic, 0, __ATOMIC_RELAXED);
+    memset((char *) s->base + sizeof(want), 0, s->size - sizeof(want));
+    want.magic = 0;
+    memcpy(have, &want, sizeof(want));
+    __atomic_store_n(&have->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+  }
+  return s;
+}
+
+
+beacon_shm_t * beacon_shm_open(const char * name)
+{
+  struct shm_layout want;
+  beacon_shm_t * s;
+  struct stat st;
+  int fd;
+
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) return NULL;
+  if (fstat(fd, &st) || (size_t) st.st_size < TOTAL_BYTES)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  s = calloc(1, sizeof(*s));
+  if (!s)
+  {
+    close(fd);
+    return NULL;
+  }
+  s->size = TOTAL_BYTES;
+  s->base = mmap(NULL, s->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (s->base == MAP_FAILED)
+  {
+    free(s);
+    return NULL;
+  }
+
+  fill_layout(&want);
+  if (__atomic_load_n(&((struct shm_layout *) s->base)->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC
+      || memcmp(s->base, &want, sizeof(want)))
+  {
+    beacon_shm_close(s);
+    return NULL;
+  }
+  return s;
+}
+
+
+static int publish(beacon_shm_t * s, size_t offset, const void * rec, size_t bytes)
+{
+  struct slot * sl = slot_at(s, offset);
+  uint32_t w[WORDS(bytes)];
+  uint32_t seq;
+  size_t i;
+
+  if (!s->writable) return 1;
+
+  w[WORDS(bytes) - 1] = 0;
+  memcpy(w, rec, bytes);
+
+  // seq is already odd if a publisher died while writing; the record stays unreadable until this write ends
+  seq = __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) | 1;
+  __atomic_store_n(&sl->seq, seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  for (i = 0; i < WORDS(bytes); i++) __atomic_store_n(&sl->w[i], w[i], __ATOMIC_RELAXED);
+  __atomic_store_n(&sl->seq, seq + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static int read_slot(const beacon_shm_t * s, size_t offset, void * rec, size_t bytes, uint64_t * count)
+{
+  const struct slot * sl = slot_at(s, offset);
+  uint32_t w[WORDS(bytes)];
+  uint32_t seq0, seq1;
+  size_t i;
+  int tries;
+
+  for (tries = 0; tries < SPIN_LIMIT; tries++)
+  {
+    seq0 = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE);
+    if (!seq0) return 1;
+    if (seq0 & 1)
+    {
+      if (tries >= SPIN_YIELD) sched_yield();
+      continue;
+    }
+
+    for (i = 0; i < WORDS(bytes); i++) w[i] = __atomic_load_n(&sl->w[i], __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    seq1 = __atomic_load_n(&sl->seq, __ATOMIC_RELAXED);
+
+    if (seq0 == seq1)
+    {
+      memcpy(rec, w, bytes);
+      if (count) *count = seq0 / 2;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+int beacon_shm_publish_hk(beacon_shm_t * s, const beacon_hk_t * hk)
+{
+  return publish(s, HK_OFFSET, hk, sizeof(*hk));
+}
+
+int beacon_shm_publish_status(beacon_shm_t * s, const beacon_status_t * st)
+{
+  return publish(s, STATUS_OFFSET, st, sizeof(*st));
+}
+
+int beacon_shm_read_hk(const beacon_shm_t * s, beacon_hk_t * hk, uint64_t * count)
+{
+  return read_slot(s, HK_OFFSET, hk, sizeof(*hk), count);
+}
+
+int beacon_shm_read_status(const beacon_shm_t * s, beacon_status_t * st, uint64_t * count)
+{
+  return read_slot(s, STATUS_OFFSET, st, sizeof(*st), count);
+}
+
+
+void beacon_shm_close(beacon_shm_t * s)
+{
+  if (!s) return;
+  munmap(s->base, s->size);
+  free(s);
+}
+
+int beacon_shm_unlink(const char * name)
+{
+  return shm_unlink(name);
+}
@@ -0,0 +1,67 @@
+#ifndef _beaconshm_h
+#define _beaconshm_h
+
+#include "beacon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file beaconshm.h
+ *
+ * Publishing the latest hk (and status) in POSIX shared memory.
+ *
+ * The acquisition side creates a segment and publishes into it whenever it has new values; any number of
+ * other processes (dashboards, watchdogs, dump_shared_hk) open it read-only and read the latest values
+ * without any syscalls, locks or disk access. Each record is guarded by a seqlock: a sequence number that is
+ * odd while the record is being written, so a reader that raced with the writer just tries again.
+ *
+ * The segment starts with a magic number, a layout version and the record sizes, so readers built against a
+ * different beacon.h refuse to open it rather than misreading it.
+ *
+ * Typical usage:
+ *
+ *    // publisher
+ *    beacon_shm_t * s = beacon_shm_create(BN_SHM_DEFAULT_NAME);
+ *    while (...) beacon_shm_publish_hk(s, &hk);
+ *
+ *    // reader
+ *    beacon_shm_t * s = beacon_shm_open(BN_SHM_DEFAULT_NAME);
+ *    if (!beacon_shm_read_hk(s, &hk, NULL)) beacon_hk_print(stdout, &hk);
+ *
+ * There must only be one publisher at a time for a segment.
+ */
+
+/** The segment name used if there's no reason to use another (it shows up as /dev/shm/beacon) */
+#define BN_SHM_DEFAULT_NAME "/beacon"
+
+/** opaque handle */
+typedef struct beacon_shm beacon_shm_t;
+
+/** Create (or take over) a segment for publishing. Returns NULL on failure. */
+beacon_shm_t * beacon_shm_create(const char * name);
+
+/** Open an existing segment for reading. Returns NULL if it doesn't exist or has an incompatible layout. */
+beacon_shm_t * beacon_shm_open(const char * name);
+
+/** Publish hk or status. Returns 0 on success, or nonzero if the segment was opened read-only. */
+int beacon_shm_publish_hk(beacon_shm_t * s, const beacon_hk_t * hk);
+int beacon_shm_publish_status(beacon_shm_t * s, const beacon_status_t * st);
+
+/** Read the latest hk or status, and optionally the (monotonically increasing) number of times it has been
+ * published, which shows whether it changed since the last read. Returns 0 on success, 1 if nothing has been
+ * published yet, or -1 if the publisher seems to have died in the middle of writing. */
+int beacon_shm_read_hk(const beacon_shm_t * s, beacon_hk_t * hk, uint64_t * count);
+int beacon_shm_read_status(const beacon_shm_t * s, beacon_status_t * st, uint64_t * count);
+
+/** Unmap the segment. It stays around for others (see beacon_shm_unlink). */
+void beacon_shm_close(beacon_shm_t * s);
+
+/** Remove the segment. Processes that have it open can keep using it. Returns 0 on success. */
+int beacon_shm_unlink(const char * name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
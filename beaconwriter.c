@@ -0,0 +1,603 @@
+#include "beaconwriter.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <zlib.h>
+
+
+#define DEFAULT_QUEUE_BYTES (8 << 20)
+
+// the smallest record is a bit bigger than this, so this many entries is always enough
+#define MIN_RECORD_BYTES 64
+
+// bigger than zlib's default, so gzip files are written in fewer, larger pieces
+#define GZ_BUFFER_SIZE (1 << 17)
+
+// most written in one call, so that the latencies mean something
+#define WRITE_CHUNK (1 << 18)
+
+
+/* Latency histogram: 8 buckets per power of two of nanoseconds, so a bucket is at most 12.5% wide */
+#define HIST_SUB 8
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+struct histogram
+{
+  uint64_t n;
+  uint64_t max_ns;
+  uint64_t counts[HIST_BUCKETS];
+};
+
+static void hist_add(struct histogram * h, uint64_t ns)
+{
+  int octave, sub;
+  if (!ns) ns = 1;
+  octave = 63 - __builtin_clzll(ns);
+  sub = octave < 3 ? 0 : (ns >> (octave - 3)) & (HIST_SUB - 1);
+  h->counts[octave * HIST_SUB + sub]++;
+  h->n++;
+  if (ns > h->max_ns) h->max_ns = ns;
+}
+
+/* the middle of the bucket the p'th quantile is in, in seconds */
+static double hist_quantile(const struct histogram * h, double p)
+{
+  uint64_t want, seen = 0;
+  int i;
+
+  if (!h->n) return 0;
+  want = p * h->n;
+  if (want >= h->n) want = h->n - 1;
+
+  for (i = 0; i < HIST_BUCKETS; i++)
+  {
+    seen += h->counts[i];
+    if (seen > want)
+    {
+      int octave = i / HIST_SUB;
+      int sub = i % HIST_SUB;
+      double width = octave < 3 ? (double) (1ull << octave) : (double) (1ull << (octave - 3));
+      double mid = (double) (1ull << octave) + sub * width + width / 2;
+      return (mid < h->max_ns ? mid : h->max_ns) * 1e-9;
+    }
+  }
+  return h->max_ns * 1e-9;
+}
+
+
+/* a queued record, at pos (counting every byte ever queued) in the ring */
+struct entry
+{
+  uint64_t pos;
+  size_t len;
+};
+
+struct beacon_writer
+{
+  beacon_writer_opts_t opts;
+  char * path;
+  int numbered;               // path has a printf conversion for the file number
+
+  uint8_t * ring;
+  struct entry * entries;
+  size_t max_entries;
+  pthread_t thread;
+  int started;
+
+  pthread_mutex_t lock;
+  pthread_cond_t data_cv;     // signaled when something is queued (or we're closing)
+  pthread_cond_t space_cv;    // signaled when something has been written out
+
+  uint64_t head_bytes;        // everything queued
+  uint64_t tail_bytes;        // everything written out
+  uint64_t head_rec;
+  uint64_t tail_rec;
+  int closing;
+  int err;
+
+  beacon_sink_t sink;
+
+  // the current file, only touched by the thread (and open, before it starts)
+  int fd;
+  gzFile gz;
+  int file_number;
+  uint64_t file_records;
+  uint64_t file_bytes;
+  struct timespec file_opened;
+  uint64_t prealloc_end;
+  int prealloc_ok;
+  int dirty;                  // written to since the last sync
+  struct timespec last_sync;
+
+  uint64_t records_in;
+  uint64_t records_written;
+  uint64_t records_dropped;
+  uint64_t bytes_written;
+  uint64_t files;
+  uint64_t errors;
+  size_t max_queue_bytes;
+  double stall_time;
+  struct histogram write_hist;
+  struct histogram sync_hist;
+};
+
+
+static double since(const struct timespec * t0)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec - t0->tv_sec + 1e-9 * (now.tv_nsec - t0->tv_nsec);
+}
+
+static void note_error(beacon_writer_t * w)
+{
+  pthread_mutex_lock(&w->lock);
+  w->errors++;
+  w->err = 1;
+  pthread_mutex_unlock(&w->lock);
+}
+
+static void note_latency(beacon_writer_t * w, struct histogram * h, const struct timespec * t0)
+{
+  uint64_t ns = since(t0) * 1e9;
+  pthread_mutex_lock(&w->lock);
+  hist_add(h, ns);
+  pthread_mutex_unlock(&w->lock);
+}
+
+static int rotating(const beacon_writer_t * w)
+{
+  return w->opts.rotate_records || w->opts.rotate_bytes || w->opts.rotate_seconds > 0;
+}
+
+
+static int open_file(beacon_writer_t * w)
+{
+  char name[strlen(w->path) + 32];
+
+  if (w->numbered) snprintf(name, sizeof(name), w->path, w->file_number);
+  else if (rotating(w)) snprintf(name, sizeof(name), "%s.%d", w->path, w->file_number);
+  else snprintf(name, sizeof(name), "%s", w->path);
+  w->file_number++;
+
+  w->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (w->fd < 0) return 1;
+
+  if (w->opts.level >= 0)
+  {
+    char mode[16] = "w";
+    // the gzFile gets its own fd, so that we can still sync after gzclose()
+    int gzfd = dup(w->fd);
+    if (w->opts.level > 0) snprintf(mode, sizeof(mode), "w%d", w->opts.level);
+    w->gz = gzfd >= 0 ? gzdopen(gzfd, mode) : NULL;
+    if (!w->gz)
+    {
+      if (gzfd >= 0) close(gzfd);
+      close(w->fd);
+      w->fd = -1;
+      return 1;
+    }
+    gzbuffer(w->gz, GZ_BUFFER_SIZE);
+  }
+
+  w->file_records = 0;
+  w->file_bytes = 0;
+  w->prealloc_end = 0;
+  w->prealloc_ok = w->opts.prealloc_bytes > 0;
+  w->dirty = 0;
+  clock_gettime(CLOCK_MONOTONIC, &w->file_opened);
+  w->last_sync = w->file_opened;
+
+  pthread_mutex_lock(&w->lock);
+  w->files++;
+  pthread_mutex_unlock(&w->lock);
+  return 0;
+}
+
+/* keeps at least half of prealloc_bytes allocated ahead of where we're writing */
+static void preallocate(beacon_writer_t * w)
+{
+  off_t where;
+  uint64_t want;
+
+  if (!w->prealloc_ok) return;
+  where = lseek(w->fd, 0, SEEK_CUR);
+  if (where < 0 || (uint64_t) where + w->opts.prealloc_bytes / 2 < w->prealloc_end) return;
+
+  want = where + w->opts.prealloc_bytes;
+  // KEEP_SIZE, so that anyone reading the file while we write doesn't see a tail of zeros
+  if (fallocate(w->fd, FALLOC_FL_KEEP_SIZE, w->prealloc_end, want - w->prealloc_end))
+  {
+    w->prealloc_ok = 0;   // not supported here, don't keep trying
+    return;
+  }
+  w->prealloc_end = want;
+}
+
+static void sync_file(beacon_writer_t * w, int finishing)
+{
+  struct timespec t0;
+  int ret;
+
+  if (w->opts.sync == BN_WRITER_NOSYNC || !w->dirty) return;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  // push out what zlib is sitting on (after gzclose() there's nothing)
+  if (w->gz && !finishing && gzflush(w->gz, Z_SYNC_FLUSH) != Z_OK) note_error(w);
+  ret = w->opts.sync == BN_WRITER_FSYNC ? fsync(w->fd) : fdatasync(w->fd);
+  if (ret) note_error(w);
+  note_latency(w, &w->sync_hist, &t0);
+
+  w->dirty = 0;
+  clock_gettime(CLOCK_MONOTONIC, &w->last_sync);
+}
+
+static void close_file(beacon_writer_t * w)
+{
+  off_t size;
+
+  if (w->fd < 0) return;
+
+  if (w->gz)
+  {
+    if (gzclose(w->gz) != Z_OK) note_error(w);
+    w->gz = NULL;
+    w->dirty = 1;
+  }
+  sync_file(w, 1);
+
+  // give back whatever was preallocated past the end (truncating to the current size frees the blocks
+  // fallocate kept beyond it, which punching a hole there doesn't)
+  size = lseek(w->fd, 0, SEEK_END);
+  if (size >= 0 && w->prealloc_end > (uint64_t) size)
+  {
+    if (ftruncate(w->fd, size)) note_error(w);
+  }
+
+  if (close(w->fd)) note_error(w);
+  w->fd = -1;
+}
+
+static int write_all(int fd, const uint8_t * p, size_t n)
+{
+  while (n)
+  {
+    ssize_t wrote = write(fd, p, n);
+    if (wrote < 0 && errno == EINTR) continue;
+    if (wrote <= 0) return 1;
+    p += wrote;
+    n -= wrote;
+  }
+  return 0;
+}
+
+/* writes len bytes from pos in the ring to the current file, as nrec records */
+static void write_run(beacon_writer_t * w, uint64_t pos, size_t len, uint64_t nrec)
+{
+  size_t start = pos % w->opts.queue_bytes;
+  size_t total = len;
+  int ok = w->fd >= 0;
+
+  if (!len) return;
+
+  if (ok) preallocate(w);
+
+  // in pieces, which may wrap around the end of the ring
+  while (ok && len)
+  {
+    size_t n = start + len > w->opts.queue_bytes ? w->opts.queue_bytes - start : len;
+    struct timespec t0;
+
+    if (n > WRITE_CHUNK) n = WRITE_CHUNK;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ok = w->gz ? gzwrite(w->gz, w->ring + start, n) == (int) n : !write_all(w->fd, w->ring + start, n);
+    note_latency(w, &w->write_hist, &t0);
+
+    start = (start + n) % w->opts.queue_bytes;
+    len -= n;
+  }
+
+  if (!ok && w->fd >= 0) note_error(w);
+  w->dirty = 1;
+
+  pthread_mutex_lock(&w->lock);
+  if (ok)
+  {
+    w->records_written += nrec;
+    w->bytes_written += total;
+  }
+  else
+  {
+    w->records_dropped += nrec;
+  }
+  pthread_mutex_unlock(&w->lock);
+}
+
+static int needs_rotation(const beacon_writer_t * w)
+{
+  if (!w->file_records) return 0;
+  return (w->opts.rotate_records && w->file_records >= w->opts.rotate_records)
+      || (w->opts.rotate_bytes && w->file_bytes >= w->opts.rotate_bytes)
+      || (w->opts.rotate_seconds > 0 && since(&w->file_opened) >= w->opts.rotate_seconds);
+}
+
+/* writes queued entries [first, last) */
+static void write_entries(beacon_writer_t * w, uint64_t first, uint64_t last)
+{
+  uint64_t run_pos = w->entries[first % w->max_entries].pos;
+  size_t run_len = 0;
+  uint64_t run_rec = 0;
+  uint64_t i;
+
+  // try again if the last file couldn't be opened
+  if (w->fd < 0 && open_file(w)) note_error(w);
+
+  for (i = first; i < last; i++)
+  {
+    const struct entry * e = &w->entries[i % w->max_entries];
+
+    if (w->fd >= 0 && needs_rotation(w))
+    {
+      write_run(w, run_pos, run_len, run_rec);
+      run_pos = e->pos;
+      run_len = 0;
+      run_rec = 0;
+      close_file(w);
+      if (open_file(w)) note_error(w);
+    }
+
+    // consecutive records are consecutive in the ring, so they're written together
+    run_len += e->len;
+    run_rec++;
+    w->file_records++;
+    w->file_bytes += e->len;
+  }
+
+  write_run(w, run_pos, run_len, run_rec);
+}
+
+
+static void * write_thread(void * arg)
+{
+  beacon_writer_t * w = arg;
+
+  pthread_mutex_lock(&w->lock);
+  while (1)
+  {
+    uint64_t first, last;
+    const struct entry * e;
+
+    if (w->head_rec == w->tail_rec)
+    {
+      if (w->closing) break;
+
+      // wake up in time for a periodic sync
+      if (w->dirty && w->opts.sync != BN_WRITER_NOSYNC && w->opts.sync_seconds > 0)
+      {
+        double left = w->opts.sync_seconds - since(&w->last_sync);
+        struct timespec until;
+
+        if (left <= 0)
+        {
+          pthread_mutex_unlock(&w->lock);
+          sync_file(w, 0);
+          pthread_mutex_lock(&w->lock);
+          continue;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += (time_t) left;
+        until.tv_nsec += (left - (time_t) left) * 1e9;
+        if (until.tv_nsec >= 1000000000)
+        {
+          until.tv_sec++;
+          until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&w->data_cv, &w->lock, &until);
+      }
+      else
+      {
+        pthread_cond_wait(&w->data_cv, &w->lock);
+      }
+      continue;
+    }
+
+    // the producer only ever adds past head, so what's queued now can be written without the lock
+    first = w->tail_rec;
+    last = w->head_rec;
+    pthread_mutex_unlock(&w->lock);
+
+    write_entries(w, first, last);
+    if (w->opts.sync_seconds > 0 && since(&w->last_sync) >= w->opts.sync_seconds) sync_file(w, 0);
+
+    pthread_mutex_lock(&w->lock);
+    e = &w->entries[(last - 1) % w->max_entries];
+    w->tail_rec = last;
+    w->tail_bytes = e->pos + e->len;
+    pthread_cond_broadcast(&w->space_cv);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  close_file(w);
+  return NULL;
+}
+
+
+static int writer_sink_write(void * ctx, const void * buf, size_t n)
+{
+  return beacon_writer_write(ctx, buf, n);
+}
+
+static void writer_free(beacon_writer_t * w)
+{
+  free(w->path);
+  free(w->ring);
+  free(w->entries);
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->data_cv);
+  pthread_cond_destroy(&w->space_cv);
+  free(w);
+}
+
+beacon_writer_t * beacon_writer_open(const char * path, const beacon_writer_opts_t * opts)
+{
+  const char * conversion = strchr(path, '%');
+  beacon_writer_t * w = calloc(1, sizeof(beacon_writer_t));
+  if (!w) return NULL;
+
+  if (opts) w->opts = *opts;
+  if (!w->opts.queue_bytes) w->opts.queue_bytes = DEFAULT_QUEUE_BYTES;
+  if (w->opts.level > 9) w->opts.level = 0;
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->data_cv, NULL);
+  pthread_cond_init(&w->space_cv, NULL);
+
+  w->fd = -1;
+  w->path = strdup(path);
+  w->numbered = conversion && conversion[1] != '%';
+  w->sink.write = writer_sink_write;
+  w->sink.ctx = w;
+
+  w->max_entries = w->opts.queue_bytes / MIN_RECORD_BYTES + 1;
+  w->ring = malloc(w->opts.queue_bytes);
+  w->entries = malloc(w->max_entries * sizeof(struct entry));
+  if (!w->path || !w->ring || !w->entries) goto fail;
+
+  // the first file is opened here, so that not being able to is an error straight away
+  if (open_file(w)) goto fail;
+
+  if (pthread_create(&w->thread, NULL, write_thread, w))
+  {
+    close_file(w);
+    goto fail;
+  }
+  w->started = 1;
+  return w;
+
+fail:
+  writer_free(w);
+  return NULL;
+}
+
+const beacon_sink_t * beacon_writer_sink(beacon_writer_t * w)
+{
+  return &w->sink;
+}
+
+
+int beacon_writer_write(beacon_writer_t * w, const void * buf, size_t n)
+{
+  size_t start, first_piece;
+  uint64_t pos;
+  size_t queued;
+
+  pthread_mutex_lock(&w->lock);
+
+  if (n > w->opts.queue_bytes)
+  {
+    w->records_dropped++;
+    pthread_mutex_unlock(&w->lock);
+    return 1;
+  }
+
+  if (w->head_bytes + n - w->tail_bytes > w->opts.queue_bytes || w->head_rec - w->tail_rec == w->max_entries)
+  {
+    struct timespec t0;
+
+    if (w->opts.drop_when_full)
+    {
+      w->records_dropped++;
+      pthread_mutex_unlock(&w->lock);
+      return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (w->head_bytes + n - w->tail_bytes > w->opts.queue_bytes || w->head_rec - w->tail_rec == w->max_entries)
+    {
+      pthread_cond_wait(&w->space_cv, &w->lock);
+    }
+    w->stall_time += since(&t0);
+  }
+
+  pos = w->head_bytes;
+  pthread_mutex_unlock(&w->lock);
+
+  // nobody else touches the space past head
+  start = pos % w->opts.queue_bytes;
+  first_piece = start + n > w->opts.queue_bytes ? w->opts.queue_bytes - start : n;
+  memcpy(w->ring + start, buf, first_piece);
+  memcpy(w->ring, (const uint8_t*) buf + first_piece, n - first_piece);
+
+  pthread_mutex_lock(&w->lock);
+  w->entries[w->head_rec % w->max_entries].pos = pos;
+  w->entries[w->head_rec % w->max_entries].len = n;
+  w->head_rec++;
+  w->head_bytes += n;
+  w->records_in++;
+  queued = w->head_bytes - w->tail_bytes;
+  if (queued > w->max_queue_bytes) w->max_queue_bytes = queued;
+  pthread_cond_signal(&w->data_cv);
+  pthread_mutex_unlock(&w->lock);
+
+  return 0;
+}
+
+
+int beacon_writer_flush(beacon_writer_t * w)
+{
+  int ret;
+  pthread_mutex_lock(&w->lock);
+  while (w->tail_rec != w->head_rec) pthread_cond_wait(&w->space_cv, &w->lock);
+  ret = w->err;
+  pthread_mutex_unlock(&w->lock);
+  return ret;
+}
+
+
+int beacon_writer_get_stats(beacon_writer_t * w, beacon_writer_stats_t * stats)
+{
+  pthread_mutex_lock(&w->lock);
+  stats->records_in = w->records_in;
+  stats->records_written = w->records_written;
+  stats->records_dropped = w->records_dropped;
+  stats->bytes_written = w->bytes_written;
+  stats->files = w->files;
+  stats->errors = w->errors;
+  stats->queue_records = w->head_rec - w->tail_rec;
+  stats->queue_bytes = w->head_bytes - w->tail_bytes;
+  stats->max_queue_bytes = w->max_queue_bytes;
+  stats->stall_time = w->stall_time;
+  stats->write_p50 = hist_quantile(&w->write_hist, 0.5);
+  stats->write_p99 = hist_quantile(&w->write_hist, 0.99);
+  stats->write_p999 = hist_quantile(&w->write_hist, 0.999);
+  stats->write_max = w->write_hist.max_ns * 1e-9;
+  stats->sync_p50 = hist_quantile(&w->sync_hist, 0.5);
+  stats->sync_p99 = hist_quantile(&w->sync_hist, 0.99);
+  stats->sync_max = w->sync_hist.max_ns * 1e-9;
+  pthread_mutex_unlock(&w->lock);
+  return 0;
+}
+
+
+int beacon_writer_close(beacon_writer_t * w)
+{
+  int ret;
+
+  pthread_mutex_lock(&w->lock);
+  w->closing = 1;
+  pthread_cond_broadcast(&w->data_cv);
+  pthread_mutex_unlock(&w->lock);
+
+  // the thread writes out everything queued and closes the file before it exits
+  if (w->started) pthread_join(w->thread, NULL);
+
+  ret = w->err;
+  writer_free(w);
+  return ret;
+}
@@ -0,0 +1,102 @@
+#ifndef _beaconwriter_h
+#define _beaconwriter_h
+
+#include "beacon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file beaconwriter.h
+ *
+ * Asynchronous file writer, so that slow storage doesn't hold up acquisition.
+ *
+ * Records go into a bounded queue and are written (optionally gzipped) by a background thread, which
+ * also rotates files by record count, size or age, preallocates space with fallocate() and syncs
+ * according to a policy. If the queue fills up, writing either waits or drops the record (and counts
+ * it), as configured. Write and sync latencies are kept as histograms, so storage hiccups show up in
+ * the statistics rather than as deadtime.
+ *
+ * Typical usage:
+ *
+ *    beacon_writer_opts_t opts = { .rotate_records = 10000, .sync = BN_WRITER_FDATASYNC };
+ *    beacon_writer_t * w = beacon_writer_open("/data/run42/events_%05d.gz", &opts);
+ *    while (...)  beacon_event_sinkwrite(beacon_writer_sink(w), &ev);
+ *    beacon_writer_close(w);
+ *
+ * A beacon_writer_t must only be written from one thread at a time.
+ */
+
+/** opaque handle */
+typedef struct beacon_writer beacon_writer_t;
+
+/** What to do to make written data durable */
+typedef enum beacon_writer_sync
+{
+  BN_WRITER_NOSYNC,      //!< leave it to the kernel
+  BN_WRITER_FDATASYNC,   //!< fdatasync()
+  BN_WRITER_FSYNC        //!< fsync()
+} beacon_writer_sync_t;
+
+/** Options for beacon_writer_open(). Zero means default for any member. */
+typedef struct beacon_writer_opts
+{
+  int level;                   //!< gzip level 1-9, or -1 to write uncompressed (default: zlib default, same as gzopen)
+  size_t queue_bytes;          //!< size of the queue (default: 8 MB)
+  int drop_when_full;          //!< drop records when the queue is full, rather than waiting for room
+  uint64_t rotate_records;     //!< start a new file after this many records (default: never)
+  uint64_t rotate_bytes;       //!< or after this many (uncompressed) bytes (default: never)
+  double rotate_seconds;       //!< or when the file is this old (default: never)
+  size_t prealloc_bytes;       //!< preallocate the file this much at a time (default: don't)
+  beacon_writer_sync_t sync;   //!< how to sync (default: don't)
+  double sync_seconds;         //!< sync at most this often while writing (default: only when a file is finished)
+} beacon_writer_opts_t;
+
+/** Statistics, see beacon_writer_get_stats(). Latencies are in seconds, and are accurate to about 10%. */
+typedef struct beacon_writer_stats
+{
+  uint64_t records_in;         //!< records queued
+  uint64_t records_written;    //!< records written out
+  uint64_t records_dropped;    //!< records dropped because the queue was full or writing failed
+  uint64_t bytes_written;      //!< uncompressed bytes written out
+  uint64_t files;              //!< number of files opened
+  uint64_t errors;             //!< failed opens, writes and syncs
+  int queue_records;           //!< records currently queued
+  size_t queue_bytes;          //!< bytes currently queued
+  size_t max_queue_bytes;      //!< the most bytes there have been queued
+  double stall_time;           //!< seconds the caller spent waiting for room in the queue
+  double write_p50;            //!< median latency of writing a piece of up to 256 kB (for gzip, that includes compressing it)
+  double write_p99;            //!< 99th percentile write latency
+  double write_p999;           //!< 99.9th percentile write latency
+  double write_max;            //!< the slowest write
+  double sync_p50;             //!< median sync latency
+  double sync_p99;             //!< 99th percentile sync latency
+  double sync_max;             //!< the slowest sync
+} beacon_writer_stats_t;
+
+/** Open a writer. If rotating, path is a printf format for the file number (starting from 0), e.g. "events_%05d.gz"
+ * (if it doesn't have one, ".N" is appended). opts may be NULL for defaults. Returns NULL on failure, including failing
+ * to create the first file. */
+beacon_writer_t * beacon_writer_open(const char * path, const beacon_writer_opts_t * opts);
+
+/** Queue one record (n bytes). Returns 0 on success, or nonzero if it was dropped. */
+int beacon_writer_write(beacon_writer_t * w, const void * buf, size_t n);
+
+/** Returns a sink that queues into this writer, for use with beacon_*_sinkwrite() */
+const beacon_sink_t * beacon_writer_sink(beacon_writer_t * w);
+
+/** Wait until everything queued so far has been written (not necessarily synced). Returns 0 if there have been no errors. */
+int beacon_writer_flush(beacon_writer_t * w);
+
+/** Fill in the current statistics */
+int beacon_writer_get_stats(beacon_writer_t * w, beacon_writer_stats_t * stats);
+
+/** Write everything out, finish (and sync, according to the policy) the file, stop the thread and free.
+ * Returns 0 if there have been no errors. */
+int beacon_writer_close(beacon_writer_t * w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
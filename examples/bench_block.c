@@ -0,0 +1,141 @@
+#include "beacon.h"
+#include "beaconblock.h"
+#include "beaconreader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Compares writing events with beacon_event_gzwrite() / beacon_event_write() against writing them
+ * through a beacon_blockfile_t (with and without O_DIRECT), and checks that the files read back.
+ *
+ *  bench_block [dir=/tmp] [nevents=20000] [block_kb=4096]
+ *
+ * Point dir at the SD card or eMMC to see the difference there.
+ * The times include syncing the file, since otherwise buffered writes just measure the page cache.
+ */
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void fill(beacon_event_t * ev, int i)
+{
+  int c, s;
+  ev->event_number = i;
+  ev->buffer_length = 512;
+  ev->board_id[0] = 1;
+  for (c = 0; c < BN_NUM_CHAN; c++)
+    for (s = 0; s < ev->buffer_length; s++) ev->data[0][c][s] = 64 + (rand() % 9) - 4;
+}
+
+static int check(const char * path, int nevents, beacon_event_t * ev)
+{
+  beacon_reader_t * r = beacon_reader_open(path);
+  int n = 0, nbad = 0;
+  if (!r) return 1;
+  while (!beacon_reader_read_event(r, ev))
+  {
+    if (ev->event_number != (uint64_t) n) nbad++;
+    n++;
+  }
+  beacon_reader_close(r);
+  remove(path);
+  return nbad || n != nevents;
+}
+
+int main(int nargs, char ** args)
+{
+  const char * dir = nargs > 1 ? args[1] : "/tmp";
+  int nevents = nargs > 2 ? atoi(args[2]) : 20000;
+  int block_kb = nargs > 3 ? atoi(args[3]) : 4096;
+  char path[strlen(dir) + 64];
+  beacon_event_t * ev = calloc(1, sizeof(beacon_event_t));
+  int i, gz, buffered, nbad = 0;
+  double t;
+
+  for (gz = 0; gz < 2; gz++)
+  {
+    const char * ext = gz ? ".gz" : ".dat";
+    beacon_blockfile_opts_t opts;
+    beacon_blockfile_stats_t stats;
+
+    // the usual way
+    sprintf(path, "%s/bench_block_stdio%s", dir, ext);
+    srand(1);
+    t = now();
+    if (gz)
+    {
+      gzFile f = gzopen(path, "w");
+      for (i = 0; i < nevents; i++)
+      {
+        fill(ev, i);
+        beacon_event_gzwrite(f, ev);
+      }
+      gzclose(f);
+    }
+    else
+    {
+      FILE * f = fopen(path, "w");
+      for (i = 0; i < nevents; i++)
+      {
+        fill(ev, i);
+        beacon_event_write(f, ev);
+      }
+      fflush(f);
+      fdatasync(fileno(f));
+      fclose(f);
+    }
+    printf("%-10s %-18s %.3f s\n", gz ? "gzip" : "raw", gz ? "gzwrite" : "fwrite", now() - t);
+    nbad += check(path, nevents, ev);
+
+    for (buffered = 0; buffered < 2; buffered++)
+    {
+      beacon_blockfile_t * b;
+      memset(&opts, 0, sizeof(opts));
+      opts.block_bytes = (size_t) block_kb << 10;
+      opts.level = gz ? 0 : -1;
+      opts.buffered = buffered;
+
+      sprintf(path, "%s/bench_block_%d%s", dir, buffered, ext);
+      srand(1);
+      t = now();
+      b = beacon_blockfile_open(path, &opts);
+      if (!b)
+      {
+        fprintf(stderr, "Could not open %s\n", path);
+        return 1;
+      }
+      for (i = 0; i < nevents; i++)
+      {
+        fill(ev, i);
+        beacon_event_sinkwrite(beacon_blockfile_sink(b), ev);
+      }
+      beacon_blockfile_get_stats(b, &stats);
+      if (beacon_blockfile_close(b)) nbad++;
+      if (!stats.direct)
+      {
+        // close() doesn't sync buffered writes, so do it here to compare like with like
+        FILE * f = fopen(path, "r+");
+        if (f)
+        {
+          fdatasync(fileno(f));
+          fclose(f);
+        }
+      }
+      printf("%-10s %-18s %.3f s, %llu blocks of %d kB, %.3f s writing\n", gz ? "gzip" : "raw",
+             stats.direct ? "blockfile O_DIRECT" : "blockfile buffered", now() - t,
+             (unsigned long long) stats.blocks, block_kb, stats.write_time);
+      nbad += check(path, nevents, ev);
+    }
+  }
+
+  printf("%s\n", nbad ? "MISMATCH!" : "all files read back");
+  free(ev);
+  return nbad != 0;
+}
@@ -0,0 +1,129 @@
+#include "beacon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Benchmarks (and checks) the packet checksums.
+ *
+ *  bench_checksum [MB=64] [nevents=2000]
+ *
+ * Compares the original fletcher implementation against the one in the library
+ * (they must agree bit for bit), CRC32C, and then times writing and reading
+ * events with each checksum type.
+ */
+
+
+// this is the implementation we used to have in beacon.c, kept for comparison
+static uint16_t stupid_fletcher16_append(int N, const void * vbuf, uint16_t append)
+{
+  int i;
+  uint16_t sum1 = append  & 0xff;
+  uint16_t sum2 = append >> 8;;
+  uint8_t * buf = (uint8_t*) vbuf;
+
+  for (i = 0; i < N; i++)
+  {
+    sum1 =  (sum1 +buf[i]) % 255;
+    sum2 += (sum1 + sum2) % 255;;
+  }
+
+  return sum1 | (sum2 << 8) ;
+}
+
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static volatile uint32_t sink;
+
+int main(int nargs, char ** args)
+{
+  int MB = nargs > 1 ? atoi(args[1]) : 64;
+  int nevents = nargs > 2 ? atoi(args[2]) : 2000;
+  size_t N = MB * (1 << 20);
+  size_t i;
+  int nbad = 0;
+  double t0,t1;
+
+  uint8_t * buf = malloc(N);
+  srand(1234);
+  for (i = 0; i < N; i++) buf[i] = rand();
+
+  /* check compatibility, including odd lengths and appending */
+  for (i = 0; i < 10000; i++)
+  {
+    int len = rand() % 5000;
+    int off = rand() % 1000;
+    uint16_t seed = i < 5000 ? 0 : rand();
+    uint16_t old = stupid_fletcher16_append(len, buf + off, seed);
+    uint16_t new = beacon_fletcher16(len, buf + off, seed);
+    if (old != new)
+    {
+      if (nbad++ < 10) fprintf(stderr,"MISMATCH: len=%d seed=0x%x old=0x%x new=0x%x\n", len, seed, old, new);
+    }
+  }
+  printf("fletcher16 compatibility: %s (%d mismatches)\n", nbad ? "FAILED" : "OK", nbad);
+
+  // "123456789" is the standard check value
+  printf("crc32c check: 0x%08x (expect 0xe3069283)\n", beacon_crc32c(9,"123456789",0));
+
+  t0 = now();
+  sink = stupid_fletcher16_append(N, buf, 0);
+  t1 = now();
+  printf("old fletcher16: %8.1f MB/s\n", MB / (t1-t0));
+
+  t0 = now();
+  sink = beacon_fletcher16(N, buf, 0);
+  t1 = now();
+  printf("new fletcher16: %8.1f MB/s\n", MB / (t1-t0));
+
+  t0 = now();
+  sink = beacon_crc32c(N, buf, 0);
+  t1 = now();
+  printf("crc32c:         %8.1f MB/s\n", MB / (t1-t0));
+
+
+  /* Now the whole event path */
+  beacon_event_t * ev = calloc(1,sizeof(beacon_event_t));
+  ev->buffer_length = 624;
+  ev->board_id[0] = 1;
+  for (i = 0; i < BN_NUM_CHAN; i++) memcpy(ev->data[0][i], buf + i * ev->buffer_length, ev->buffer_length);
+
+  int type;
+  for (type = BN_CKSUM_FLETCHER16; type <= BN_CKSUM_CRC32C; type++)
+  {
+    int iev;
+    int ok = 1;
+    FILE * f = tmpfile();
+    beacon_set_write_checksum(type);
+    t0 = now();
+    for (iev = 0; iev < nevents; iev++)
+    {
+      ev->event_number = iev;
+      if (beacon_event_write(f, ev)) ok = 0;
+    }
+    fflush(f);
+    t1 = now();
+    double MBev = nevents * (BN_NUM_CHAN * ev->buffer_length) / (double) (1 << 20);
+    printf("%s event write: %8.1f MB/s\n", type == BN_CKSUM_CRC32C ? "crc32c    " : "fletcher16", MBev / (t1-t0));
+
+    rewind(f);
+    t0 = now();
+    for (iev = 0; iev < nevents; iev++)
+    {
+      if (beacon_event_read(f, ev) || ev->event_number != (uint64_t) iev) ok = 0;
+    }
+    t1 = now();
+    printf("%s event read:  %8.1f MB/s %s\n", type == BN_CKSUM_CRC32C ? "crc32c    " : "fletcher16", MBev / (t1-t0), ok ? "" : "(ERRORS!)");
+    fclose(f);
+  }
+
+  free(ev);
+  free(buf);
+  return nbad != 0;
+}
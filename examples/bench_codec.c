@@ -0,0 +1,191 @@
+#include "beacon.h"
+#include "beaconcodec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <zlib.h>
+
+/* Compares the waveform codec against gzip, and checks that it round trips.
+ *
+ *  bench_codec [events.dat[.gz]]
+ *
+ * If a file is given, its events are used, otherwise some fake ones are made
+ * up (band limited gaussian noise around a baseline, some pulses, and a saturated channel now and then).
+ * Then the same events are written and read back with each event codec.
+ */
+
+#define NFAKE 2000
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static double gaus()
+{
+  double u = (rand() + 1.) / (RAND_MAX + 2.);
+  double v = (rand() + 1.) / (RAND_MAX + 2.);
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static void fake_event(beacon_event_t * ev, int iev)
+{
+  int ich, i;
+  memset(ev, 0, sizeof(*ev));
+  ev->event_number = iev;
+  ev->buffer_length = 624;
+  ev->board_id[0] = 1;
+  for (ich = 0; ich < BN_NUM_CHAN; ich++)
+  {
+    int saturated = rand() % 50 == 0;
+    int pulse = rand() % 4 == 0 ? rand() % ev->buffer_length : -1;
+    double noise = gaus();
+    for (i = 0; i < ev->buffer_length; i++)
+    {
+      // we sample well above the band, so neighbouring samples are correlated
+      noise = 0.7 * noise + 0.71 * gaus();
+      double x = 64 + 4 * noise;
+      if (pulse >= 0 && i >= pulse) x += 40 * exp(-(i - pulse) / 20.) * sin((i - pulse) / 3.);
+      if (saturated) x = 64 + 200 * sin(i / 7.);
+      ev->data[0][ich][i] = x < 0 ? 0 : x > 127 ? 127 : x;
+    }
+  }
+}
+
+int main(int nargs, char ** args)
+{
+  int nev = 0, iev, ich;
+  int nalloc = NFAKE;
+  beacon_event_t * evs = malloc(nalloc * sizeof(beacon_event_t));
+  size_t raw = 0, packed = 0, gz1 = 0, gz6 = 0;
+  double t_enc = 0, t_dec = 0, t_gz1 = 0, t_gz6 = 0, t_gunzip = 0, t0;
+  int nbad = 0;
+  srand(1234);
+
+  if (nargs > 1)
+  {
+    gzFile f = gzopen(args[1], "r");
+    if (!f)
+    {
+      fprintf(stderr, "Could not open %s\n", args[1]);
+      return 1;
+    }
+    while (1)
+    {
+      if (nev == nalloc)
+      {
+        nalloc *= 2;
+        evs = realloc(evs, nalloc * sizeof(beacon_event_t));
+      }
+      if (beacon_event_gzread(f, &evs[nev])) break;
+      nev++;
+    }
+    gzclose(f);
+  }
+  else
+  {
+    for (nev = 0; nev < NFAKE; nev++) fake_event(&evs[nev], nev);
+  }
+
+  if (!nev)
+  {
+    fprintf(stderr, "No events!\n");
+    return 1;
+  }
+
+  /* per channel, as in the file */
+  uint8_t enc[BN_CODEC_MAX_BYTES(BN_MAX_WAVEFORM_LENGTH)];
+  uint8_t dec[BN_MAX_WAVEFORM_LENGTH];
+  uLongf zlen;
+  uint8_t * zbuf = malloc(compressBound(BN_NUM_CHAN * BN_MAX_WAVEFORM_LENGTH));
+  uint8_t * flat = malloc(BN_NUM_CHAN * BN_MAX_WAVEFORM_LENGTH);
+
+  for (iev = 0; iev < nev; iev++)
+  {
+    beacon_event_t * ev = &evs[iev];
+    int n = ev->buffer_length;
+    for (ich = 0; ich < BN_NUM_CHAN; ich++)
+    {
+      t0 = now();
+      int len = beacon_wf_encode(ev->data[0][ich], n, enc);
+      t_enc += now() - t0;
+
+      t0 = now();
+      int used = beacon_wf_decode(enc, len, dec, n);
+      t_dec += now() - t0;
+
+      if (used != len || memcmp(dec, ev->data[0][ich], n))
+      {
+        if (nbad++ < 10) fprintf(stderr, "MISMATCH: event %d channel %d\n", iev, ich);
+      }
+      raw += n;
+      packed += len;
+      memcpy(flat + ich * n, ev->data[0][ich], n);
+    }
+
+    /* gzip gets the whole event, which is what the gzwrite path sees */
+    zlen = compressBound(BN_NUM_CHAN * n);
+    t0 = now();
+    compress2(zbuf, &zlen, flat, BN_NUM_CHAN * n, 1);
+    t_gz1 += now() - t0;
+    gz1 += zlen;
+
+    zlen = compressBound(BN_NUM_CHAN * n);
+    t0 = now();
+    compress2(zbuf, &zlen, flat, BN_NUM_CHAN * n, 6);
+    t_gz6 += now() - t0;
+    gz6 += zlen;
+
+    uLongf ulen = BN_NUM_CHAN * BN_MAX_WAVEFORM_LENGTH;
+    t0 = now();
+    uncompress(flat, &ulen, zbuf, zlen);
+    t_gunzip += now() - t0;
+  }
+
+  double MB = raw / (double) (1 << 20);
+  printf("%d events, %zu waveform bytes\n", nev, raw);
+  printf("codec:   ratio %5.2f, encode %8.1f MB/s, decode %8.1f MB/s %s\n", (double) raw / packed, MB / t_enc, MB / t_dec, nbad ? "(ERRORS!)" : "");
+  printf("zlib -1: ratio %5.2f, encode %8.1f MB/s\n", (double) raw / gz1, MB / t_gz1);
+  printf("zlib -6: ratio %5.2f, encode %8.1f MB/s, decode %8.1f MB/s\n", (double) raw / gz6, MB / t_gz6, MB / t_gunzip);
+
+  /* and through the event format */
+  beacon_event_t * ev = malloc(sizeof(beacon_event_t));
+  int codec;
+  for (codec = BN_EVENT_CODEC_RAW; codec <= BN_EVENT_CODEC_PACKED; codec++)
+  {
+    FILE * f = tmpfile();
+    int ok = 1;
+    beacon_set_write_event_codec(codec);
+    t0 = now();
+    for (iev = 0; iev < nev; iev++)
+    {
+      if (beacon_event_write(f, &evs[iev])) ok = 0;
+    }
+    fflush(f);
+    double t_write = now() - t0;
+    long size = ftell(f);
+
+    rewind(f);
+    t0 = now();
+    for (iev = 0; iev < nev; iev++)
+    {
+      if (beacon_event_read(f, ev) || memcmp(ev, &evs[iev], sizeof(*ev))) ok = 0;
+    }
+    double t_read = now() - t0;
+    fclose(f);
+
+    if (!ok) nbad++;
+    printf("%s events: %ld bytes, write %8.1f MB/s, read %8.1f MB/s %s\n", codec == BN_EVENT_CODEC_PACKED ? "packed" : "raw   ",
+        size, MB / t_write, MB / t_read, ok ? "" : "(ERRORS!)");
+  }
+
+  free(ev);
+  free(zbuf);
+  free(flat);
+  free(evs);
+  return nbad != 0;
+}
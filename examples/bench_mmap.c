@@ -0,0 +1,125 @@
+#include "beacon.h"
+#include "beaconmmap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Compares scanning uncompressed files with beacon_header_read()/beacon_event_read() against the
+ * memory mapped reader, and that against beacon_mmap_scan() on several threads (and checks that they agree).
+ *
+ *  bench_mmap [nheaders=200000] [nevents=5000]
+ *
+ * Files are written to /tmp. The second scan of each file is from the page cache either way.
+ */
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static int sum_event(void * ctx, int thread, uint64_t offset, const void * record)
+{
+  const beacon_event_view_t * view = record;
+  int n = view->event_number;
+  (void) thread;
+  (void) offset;
+  __atomic_add_fetch((uint64_t*) ctx, view->data[0][n % BN_NUM_CHAN][n % 512], __ATOMIC_RELAXED);
+  return 0;
+}
+
+int main(int nargs, char ** args)
+{
+  int nheaders = nargs > 1 ? atoi(args[1]) : 200000;
+  int nevents = nargs > 2 ? atoi(args[2]) : 5000;
+  const char * hfile = "/tmp/bench_mmap_headers.dat";
+  const char * efile = "/tmp/bench_mmap_events.dat";
+  beacon_header_t h;
+  const beacon_header_t * hv;
+  beacon_event_t * ev = calloc(1, sizeof(beacon_event_t));
+  beacon_event_view_t view;
+  beacon_mmap_t * m;
+  uint64_t sum_read = 0, sum_mmap = 0;
+  beacon_mmap_scan_stats_t stats;
+  int nthreads[] = { 1, 2, 4, 0 };
+  int i, j, n, verify;
+  double t;
+  FILE * f;
+
+  memset(&h, 0, sizeof(h));
+  f = fopen(hfile, "w");
+  for (i = 0; i < nheaders; i++)
+  {
+    h.event_number = i;
+    h.trig_number = 3 * i;
+    h.buffer_length = 512;
+    beacon_header_write(f, &h);
+  }
+  fclose(f);
+
+  f = fopen(efile, "w");
+  ev->buffer_length = 512;
+  ev->board_id[0] = 1;
+  for (i = 0; i < nevents; i++)
+  {
+    ev->event_number = i;
+    for (j = 0; j < BN_NUM_CHAN; j++) memset(ev->data[0][j], i + j, ev->buffer_length);
+    beacon_event_write(f, ev);
+  }
+  fclose(f);
+
+  for (i = 0; i < 2; i++)
+  {
+    t = now();
+    f = fopen(hfile, "r");
+    for (n = 0, sum_read = 0; !beacon_header_read(f, &h); n++) sum_read += h.trig_number;
+    fclose(f);
+    printf("headers, beacon_header_read:  %d in %.3f s\n", n, now() - t);
+  }
+
+  for (verify = 1; verify >= 0; verify--)
+  {
+    t = now();
+    m = beacon_mmap_open(hfile);
+    beacon_mmap_set_verify(m, verify);
+    for (n = 0, sum_mmap = 0; !beacon_mmap_next_header(m, &hv); n++) sum_mmap += hv->trig_number;
+    beacon_mmap_close(m);
+    printf("headers, mmap (verify=%d):     %d in %.3f s %s\n", verify, n, now() - t, sum_mmap == sum_read ? "" : "MISMATCH!");
+  }
+
+  for (i = 0; i < 2; i++)
+  {
+    t = now();
+    f = fopen(efile, "r");
+    for (n = 0, sum_read = 0; !beacon_event_read(f, ev); n++) sum_read += ev->data[0][n % BN_NUM_CHAN][n % 512];
+    fclose(f);
+    printf("events, beacon_event_read:    %d in %.3f s\n", n, now() - t);
+  }
+
+  for (verify = 1; verify >= 0; verify--)
+  {
+    t = now();
+    m = beacon_mmap_open(efile);
+    beacon_mmap_set_verify(m, verify);
+    for (n = 0, sum_mmap = 0; !beacon_mmap_next_event(m, &view); n++) sum_mmap += view.data[0][n % BN_NUM_CHAN][n % 512];
+    beacon_mmap_close(m);
+    printf("events, mmap (verify=%d):      %d in %.3f s %s\n", verify, n, now() - t, sum_mmap == sum_read ? "" : "MISMATCH!");
+  }
+
+  m = beacon_mmap_open(efile);
+  for (i = 0; i < (int) (sizeof(nthreads) / sizeof(*nthreads)); i++)
+  {
+    sum_mmap = 0;
+    beacon_mmap_scan(m, BN_RECORD_EVENT, nthreads[i], sum_event, &sum_mmap, &stats);
+    printf("events, mmap scan (%d threads): %llu in %.3f s %s\n", stats.nthreads, (unsigned long long) stats.records, stats.elapsed,
+           sum_mmap == sum_read && stats.records == (uint64_t) nevents ? "" : "MISMATCH!");
+  }
+  beacon_mmap_close(m);
+
+  remove(hfile);
+  remove(efile);
+  free(ev);
+  return 0;
+}
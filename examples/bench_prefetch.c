@@ -0,0 +1,112 @@
+#include "beacon.h"
+#include "beaconreader.h"
+#include "beaconprefetch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+/* Compares reading events and then "analyzing" them on one thread against doing the reading on a
+ * prefetch thread (see beaconprefetch.h), and checks that both see the same events.
+ *
+ *  bench_prefetch [events.dat[.gz]] [analysis_us=100]
+ *
+ * Without a file, a gzipped one is written to /tmp. analysis_us is how long to spin on each event,
+ * to stand in for real work. With a spare core, the prefetched time should be about the larger
+ * of the read time and the analysis time, not their sum.
+ */
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static uint64_t analyze(const beacon_event_t * ev, double us)
+{
+  uint64_t sum = ev->event_number;
+  double t0 = now();
+  int c, s;
+  for (c = 0; c < BN_NUM_CHAN; c++)
+    for (s = 0; s < ev->buffer_length; s++) sum += ev->data[0][c][s];
+  while ((now() - t0) * 1e6 < us);
+  return sum;
+}
+
+int main(int nargs, char ** args)
+{
+  const char * path = nargs > 1 ? args[1] : "/tmp/bench_prefetch_events.gz";
+  double us = nargs > 2 ? atof(args[2]) : 100;
+  beacon_event_t * ev = calloc(1, sizeof(beacon_event_t));
+  const beacon_event_t * evs;
+  beacon_prefetch_stats_t stats;
+  beacon_read_error_t err;
+  beacon_prefetch_t * p;
+  beacon_reader_t * r;
+  uint64_t sum_plain = 0, sum_prefetch = 0;
+  int i, n, nplain = 0, nprefetch = 0;
+  double t, t_read;
+
+  if (nargs < 2)
+  {
+    gzFile f = gzopen(path, "w");
+    ev->buffer_length = 512;
+    ev->board_id[0] = 1;
+    for (i = 0; i < 5000; i++)
+    {
+      int c, s;
+      ev->event_number = i;
+      for (c = 0; c < BN_NUM_CHAN; c++)
+        for (s = 0; s < ev->buffer_length; s++) ev->data[0][c][s] = 64 + (rand() % 9) - 4;
+      beacon_event_gzwrite(f, ev);
+    }
+    gzclose(f);
+  }
+
+  // how long does reading alone take?
+  t = now();
+  r = beacon_reader_open(path);
+  if (!r)
+  {
+    fprintf(stderr, "Could not open %s\n", path);
+    return 1;
+  }
+  while (!beacon_reader_read_event(r, ev)) nplain++;
+  beacon_reader_close(r);
+  t_read = now() - t;
+  printf("read only:  %d events in %.3f s, analysis alone would be %.3f s\n", nplain, t_read, nplain * us * 1e-6);
+
+  nplain = 0;
+  t = now();
+  r = beacon_reader_open(path);
+  while (!beacon_reader_read_event(r, ev))
+  {
+    sum_plain += analyze(ev, us);
+    nplain++;
+  }
+  beacon_reader_close(r);
+  printf("one thread: %d events in %.3f s\n", nplain, now() - t);
+
+  t = now();
+  r = beacon_reader_open(path);
+  p = beacon_prefetch_start(r, BN_RECORD_EVENT, NULL);
+  while ((n = beacon_prefetch_next(p, (const void **) &evs, &err)) > 0)
+  {
+    for (i = 0; i < n; i++) sum_prefetch += analyze(&evs[i], us);
+    nprefetch += n;
+  }
+  beacon_prefetch_get_stats(p, &stats);
+  beacon_prefetch_stop(p);
+  beacon_reader_close(r);
+  printf("prefetched: %d events in %.3f s %s\n", nprefetch, now() - t,
+         nprefetch == nplain && sum_prefetch == sum_plain && !err.code ? "" : "MISMATCH!");
+  printf("  %llu batches, decoding %.3f s, caller waited %llu times (%.3f s), prefetcher waited %llu times (%.3f s)\n",
+         (unsigned long long) stats.batches, stats.decode_time,
+         (unsigned long long) stats.consumer_stalls, stats.consumer_stall_time,
+         (unsigned long long) stats.producer_stalls, stats.producer_stall_time);
+
+  free(ev);
+  return nprefetch != nplain || sum_prefetch != sum_plain;
+}
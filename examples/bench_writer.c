@@ -0,0 +1,126 @@
+#include "beacon.h"
+#include "beaconwriter.h"
+#include "beaconreader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+/* Compares how long the acquisition side is held up writing events with beacon_event_gzwrite()
+ * against queueing them to a beacon_writer_t, and checks that the rotated files read back.
+ *
+ *  bench_writer [dir=/tmp] [nevents=20000] [events_per_file=5000] [sync: none|fdatasync|fsync]
+ */
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void fill(beacon_event_t * ev, int i)
+{
+  int c, s;
+  ev->event_number = i;
+  ev->buffer_length = 512;
+  ev->board_id[0] = 1;
+  for (c = 0; c < BN_NUM_CHAN; c++)
+    for (s = 0; s < ev->buffer_length; s++) ev->data[0][c][s] = 64 + (rand() % 9) - 4;
+}
+
+int main(int nargs, char ** args)
+{
+  const char * dir = nargs > 1 ? args[1] : "/tmp";
+  int nevents = nargs > 2 ? atoi(args[2]) : 20000;
+  int per_file = nargs > 3 ? atoi(args[3]) : 5000;
+  const char * sync = nargs > 4 ? args[4] : "fdatasync";
+  char path[strlen(dir) + 64];
+  beacon_writer_opts_t opts;
+  beacon_writer_stats_t stats;
+  beacon_event_t * ev = calloc(1, sizeof(beacon_event_t));
+  beacon_writer_t * w;
+  double t, t_call, worst;
+  int i, nfiles, nread = 0, nbad = 0;
+  gzFile f;
+
+  // direct
+  sprintf(path, "%s/bench_writer_direct.gz", dir);
+  f = gzopen(path, "w");
+  srand(1);
+  worst = 0;
+  t = now();
+  for (i = 0; i < nevents; i++)
+  {
+    fill(ev, i);
+    t_call = now();
+    beacon_event_gzwrite(f, ev);
+    t_call = now() - t_call;
+    if (t_call > worst) worst = t_call;
+  }
+  gzclose(f);
+  printf("gzwrite:      %d events in %.3f s, slowest call %.2f ms\n", nevents, now() - t, worst * 1e3);
+  remove(path);
+
+  // queued
+  memset(&opts, 0, sizeof(opts));
+  opts.rotate_records = per_file;
+  opts.prealloc_bytes = 16 << 20;
+  opts.sync = !strcmp(sync, "fsync") ? BN_WRITER_FSYNC : !strcmp(sync, "fdatasync") ? BN_WRITER_FDATASYNC : BN_WRITER_NOSYNC;
+  opts.sync_seconds = 1;
+  sprintf(path, "%s/bench_writer_%%03d.gz", dir);
+  w = beacon_writer_open(path, &opts);
+  if (!w)
+  {
+    fprintf(stderr, "Could not open %s\n", path);
+    return 1;
+  }
+
+  srand(1);
+  worst = 0;
+  t = now();
+  for (i = 0; i < nevents; i++)
+  {
+    fill(ev, i);
+    t_call = now();
+    beacon_event_sinkwrite(beacon_writer_sink(w), ev);
+    t_call = now() - t_call;
+    if (t_call > worst) worst = t_call;
+  }
+  t_call = now() - t;
+  beacon_writer_get_stats(w, &stats);
+  if (beacon_writer_close(w)) nbad++;
+  printf("beacon_writer: %d events queued in %.3f s (%.3f s to finish), slowest call %.2f ms\n", nevents, t_call, now() - t, worst * 1e3);
+  printf("  %llu files, %llu written, %llu dropped, %llu errors, queue %zu bytes (max %zu), caller stalled %.3f s\n",
+         (unsigned long long) stats.files, (unsigned long long) stats.records_written, (unsigned long long) stats.records_dropped,
+         (unsigned long long) stats.errors, stats.queue_bytes, stats.max_queue_bytes, stats.stall_time);
+  printf("  write latency p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms\n",
+         stats.write_p50 * 1e3, stats.write_p99 * 1e3, stats.write_p999 * 1e3, stats.write_max * 1e3);
+  printf("  sync latency p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", stats.sync_p50 * 1e3, stats.sync_p99 * 1e3, stats.sync_max * 1e3);
+
+  // read them back
+  nfiles = per_file > 0 ? (nevents + per_file - 1) / per_file : 1;
+  for (i = 0; i < nfiles; i++)
+  {
+    beacon_reader_t * r;
+    sprintf(path, "%s/bench_writer_%03d.gz", dir, i);
+    r = beacon_reader_open(path);
+    if (!r)
+    {
+      nbad++;
+      continue;
+    }
+    while (!beacon_reader_read_event(r, ev))
+    {
+      if (ev->event_number != (uint64_t) nread) nbad++;
+      nread++;
+    }
+    beacon_reader_close(r);
+    remove(path);
+  }
+  printf("read back %d events from %d files %s\n", nread, nfiles, nread == nevents && !nbad ? "" : "MISMATCH!");
+
+  free(ev);
+  return nbad != 0;
+}
@@ -0,0 +1,60 @@
+#include "beaconindex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* Builds an event number index for an existing header or event file, so that
+ * beacon_event_seek() / beacon_header_seek() (and the viewer) can jump straight to an event.
+ *
+ *   build_index [-s span_kB] data_file [index_file=data_file.idx]
+ *
+ * For compressed files, the span is the (uncompressed) distance between access points.
+ * Smaller means faster seeks but a bigger index (each point holds up to 32 kB of dictionary).
+ */
+
+int main(int nargs, char ** args)
+{
+  size_t span = 0;
+  int c;
+
+  while ((c = getopt(nargs, args, "s:")) != -1)
+  {
+    switch(c)
+    {
+      case 's': span = atoi(optarg) * 1024; break;
+      default:
+        fprintf(stderr,"build_index [-s span_kB] data_file [index_file]\n");
+        return 1;
+    }
+  }
+
+  if (nargs - optind < 1)
+  {
+    fprintf(stderr,"build_index [-s span_kB] data_file [index_file]\n");
+    return 1;
+  }
+
+  const char * data = args[optind];
+  char idxpath[strlen(data) + 5];
+  sprintf(idxpath, "%s.idx", data);
+  const char * idx = nargs - optind > 1 ? args[optind+1] : idxpath;
+
+  if (beacon_index_build(data, idx, span))
+  {
+    fprintf(stderr,"Failed to build index for %s\n", data);
+    return 1;
+  }
+
+  beacon_index_t * index = beacon_index_load(idx);
+  if (!index)
+  {
+    fprintf(stderr,"Could not read back %s\n", idx);
+    return 1;
+  }
+
+  printf("%s: %zu entries, %zu access points\n", idx, beacon_index_nentries(index), beacon_index_npoints(index));
+  beacon_index_free(index);
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include "beacon.h"
+#include "beaconcol.h"
+#include "beaconreader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* Converts a header file (compressed or not) into the columnar format (see beaconcol.h),
+ * checks that it reads back the same, and times scanning a few fields each way.
+ *
+ *   columnize headers.dat headers.col [block_size]
+ */
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static long file_size(const char * path)
+{
+  struct stat s;
+  return stat(path, &s) ? -1 : (long) s.st_size;
+}
+
+// compare field by field, since the padding doesn't survive
+#define SAME_S(name, type) && a->name == b->name
+#define SAME_A(name, type, count) && !memcmp(a->name, b->name, sizeof(a->name))
+static int same(const beacon_header_t * a, const beacon_header_t * b)
+{
+  return 1 BN_HEADER_COLUMNS(SAME_S, SAME_A);
+}
+
+int main(int nargs, char ** args)
+{
+  beacon_header_columns_t cols;
+  beacon_col_reader_t * cr;
+  beacon_reader_t * r;
+  beacon_header_t h, hc;
+  uint64_t sum_rows = 0, sum_cols = 0;
+  size_t i, n = 0, nbad = 0;
+  double t;
+  int got;
+
+  if (nargs < 3)
+  {
+    fprintf(stderr,"columnize headers.dat headers.col [block_size]\n");
+    return 1;
+  }
+
+  t = now();
+  if (beacon_col_convert(args[1], args[2], nargs > 3 ? atoi(args[3]) : 0))
+  {
+    fprintf(stderr,"Could not convert %s\n", args[1]);
+    return 1;
+  }
+  printf("converted in %.3f s: %ld bytes -> %ld bytes\n", now() - t, file_size(args[1]), file_size(args[2]));
+
+  // check everything round trips
+  r = beacon_reader_open(args[1]);
+  cr = beacon_col_reader_open(args[2]);
+  while ((got = beacon_col_read_block(cr, BN_HCOL_ALL, &cols)) > 0)
+  {
+    for (i = 0; i < cols.n; i++, n++)
+    {
+      if (beacon_reader_read_header(r, &h)) { nbad++; break; }
+      beacon_header_columns_get(&cols, i, &hc);
+      if (!same(&h, &hc)) nbad++;
+    }
+  }
+  beacon_col_reader_close(cr);
+  beacon_reader_close(r);
+  printf("%zu headers read back, %zu mismatches%s\n", n, nbad, got < 0 ? " (and a read error)" : "");
+
+  // scan trig_type, triggered_beams and trig_time
+  t = now();
+  r = beacon_reader_open(args[1]);
+  while (!beacon_reader_read_header(r, &h))
+  {
+    if (h.trig_type == BN_TRIG_RF) sum_rows += h.triggered_beams ^ h.trig_time[0];
+  }
+  beacon_reader_close(r);
+  printf("row scan:    %.3f s\n", now() - t);
+
+  t = now();
+  cr = beacon_col_reader_open(args[2]);
+  while (beacon_col_read_block(cr, BN_HCOL_BIT(trig_type) | BN_HCOL_BIT(triggered_beams) | BN_HCOL_BIT(trig_time), &cols) > 0)
+  {
+    for (i = 0; i < cols.n; i++)
+    {
+      if (cols.trig_type[i] == BN_TRIG_RF) sum_cols += cols.triggered_beams[i] ^ cols.trig_time[i][0];
+    }
+  }
+  beacon_col_reader_close(cr);
+  printf("column scan: %.3f s %s\n", now() - t, sum_rows == sum_cols ? "" : "MISMATCH!");
+
+  return nbad != 0;
+}
@@ -0,0 +1,363 @@
+#include "beacon.h"
+#include "beaconreader.h"
+#include "beaconnpy.h"
+#include "beaconcol.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Converts a whole run directory (header/, event/, status/ and hk/, each a series of record files) into
+ * .npy files (see beaconnpy.h), replacing root/makeTrees.C.
+ *
+ *  convert_run [-j nthreads] [-c] rundir outdir
+ *
+ * Files are decoded by a pool of threads (default: one per core) and written out in order by the main
+ * thread. Each file is decoded whole into memory, and at most 2N+1 of them (for N threads) are decoded or
+ * waiting to be written at once. Peak memory is therefore about 2N+1 times the largest decoded file, where
+ * an event takes 32 KB decoded: 1000-event files with 8 threads need about 560 MB. Use -j to bring that down.
+ * Files within each directory are taken in numerical order of their names. With -c, headers go to the columnar format
+ * (header.col, see beaconcol.h) rather than header.npy.
+ *
+ * Progress and throughput go to stderr.
+ */
+
+#define NKINDS 4
+
+static const char * kind_dirs[NKINDS] = { "header", "event", "status", "hk" };
+static const beacon_record_type_t kind_types[NKINDS] = { BN_RECORD_HEADER, BN_RECORD_EVENT, BN_RECORD_STATUS, BN_RECORD_HK };
+static const size_t kind_sizes[NKINDS] = { sizeof(beacon_header_t), sizeof(beacon_event_t), sizeof(beacon_status_t), sizeof(beacon_hk_t) };
+
+// records decoded per bulk read
+#define BATCH 64
+
+/* one input file */
+struct job
+{
+  int kind;
+  char * path;
+  long bytes;            // size on disk
+
+  // filled in by a worker
+  int done;
+  int error;
+  void * records;
+  size_t n;
+};
+
+static struct
+{
+  struct job * jobs;
+  int njobs;
+  int next_job;          // next one for a worker to take
+  int next_write;        // next one for the main thread to write
+  int window;            // most jobs taken but not yet written
+
+  pthread_mutex_t lock;
+  pthread_cond_t done_cv;
+  pthread_cond_t room_cv;
+} q = { .lock = PTHREAD_MUTEX_INITIALIZER, .done_cv = PTHREAD_COND_INITIALIZER, .room_cv = PTHREAD_COND_INITIALIZER };
+
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static int read_batch(beacon_reader_t * r, int kind, void * recs, beacon_read_error_t * err)
+{
+  switch (kind_types[kind])
+  {
+    case BN_RECORD_HEADER: return beacon_header_read_many(r, recs, BATCH, err);
+    case BN_RECORD_EVENT: return beacon_event_read_many(r, recs, BATCH, err);
+    case BN_RECORD_STATUS: return beacon_status_read_many(r, recs, BATCH, err);
+    default: return beacon_hk_read_many(r, recs, BATCH, err);
+  }
+}
+
+/* decodes a whole file into memory */
+static void decode(struct job * j)
+{
+  beacon_reader_t * r = beacon_reader_open(j->path);
+  size_t size = kind_sizes[j->kind], cap = 0;
+  beacon_read_error_t err = { 0, 0 };
+  int got;
+
+  if (!r)
+  {
+    j->error = 1;
+    return;
+  }
+
+  do
+  {
+    if (j->n + BATCH > cap)
+    {
+      void * bigger;
+      cap = cap ? 2 * cap : 4 * BATCH;
+      bigger = realloc(j->records, cap * size);
+      if (!bigger)
+      {
+        j->error = 1;
+        break;
+      }
+      j->records = bigger;
+    }
+    got = read_batch(r, j->kind, (char *) j->records + j->n * size, &err);
+    if (got > 0) j->n += got;
+  } while (got == BATCH && !err.code);
+
+  if (err.code)
+  {
+    fprintf(stderr, "%s: error %d at offset %llu, keeping the %zu records before it\n", j->path, err.code, (unsigned long long) err.offset, j->n);
+    j->error = 1;
+  }
+  beacon_reader_close(r);
+}
+
+static void * worker(void * arg)
+{
+  (void) arg;
+  pthread_mutex_lock(&q.lock);
+  while (q.next_job < q.njobs)
+  {
+    struct job * j;
+    if (q.next_job - q.next_write >= q.window)
+    {
+      pthread_cond_wait(&q.room_cv, &q.lock);
+      continue;
+    }
+    j = &q.jobs[q.next_job++];
+    pthread_mutex_unlock(&q.lock);
+
+    decode(j);
+
+    pthread_mutex_lock(&q.lock);
+    j->done = 1;
+    pthread_cond_broadcast(&q.done_cv);
+  }
+  pthread_mutex_unlock(&q.lock);
+  return NULL;
+}
+
+
+/* the leading number in a file name, for sorting "2.gz" before "10.gz" */
+static int by_number(const void * a, const void * b)
+{
+  const char * sa = *(const char * const *) a;
+  const char * sb = *(const char * const *) b;
+  const char * na = strrchr(sa, '/') + 1;
+  const char * nb = strrchr(sb, '/') + 1;
+  unsigned long long ia = strtoull(na, NULL, 10);
+  unsigned long long ib = strtoull(nb, NULL, 10);
+  if (ia != ib) return ia < ib ? -1 : 1;
+  return strcmp(na, nb);
+}
+
+/* adds jobs for every file in rundir/kind_dirs[kind], in order. Returns nonzero if out of memory. */
+static int add_jobs(const char * rundir, int kind)
+{
+  char dir[strlen(rundir) + 32];
+  char ** paths = NULL;
+  struct job * jobs;
+  struct dirent * ent;
+  int i, n = 0;
+  DIR * d;
+
+  sprintf(dir, "%s/%s", rundir, kind_dirs[kind]);
+  d = opendir(dir);
+  if (!d) return 0;
+
+  while ((ent = readdir(d)))
+  {
+    char ** more;
+    if (ent->d_name[0] == '.' || strstr(ent->d_name, ".idx")) continue;
+    more = realloc(paths, (n + 1) * sizeof(char *));
+    if (!more) goto fail;
+    paths = more;
+    paths[n] = malloc(strlen(dir) + strlen(ent->d_name) + 2);
+    if (!paths[n]) goto fail;
+    sprintf(paths[n], "%s/%s", dir, ent->d_name);
+    n++;
+  }
+  closedir(d);
+  d = NULL;
+  qsort(paths, n, sizeof(char *), by_number);
+
+  jobs = realloc(q.jobs, (q.njobs + n) * sizeof(struct job));
+  if (!jobs) goto fail;
+  q.jobs = jobs;
+  for (i = 0; i < n; i++)
+  {
+    struct job * j = &q.jobs[q.njobs++];
+    struct stat st;
+    memset(j, 0, sizeof(*j));
+    j->kind = kind;
+    j->path = paths[i];
+    j->bytes = stat(paths[i], &st) ? 0 : st.st_size;
+  }
+  free(paths);
+  return 0;
+
+fail:
+  if (d) closedir(d);
+  for (i = 0; i < n; i++) free(paths[i]);
+  free(paths);
+  return 1;
+}
+
+
+int main(int nargs, char ** args)
+{
+  int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  int columnar = 0, i, k, opt, nerrors = 0, nstarted = 0;
+  beacon_npy_t * npy[NKINDS] = { 0 };
+  beacon_col_writer_t * col = NULL;
+  uint64_t nrecords[NKINDS] = { 0 };
+  long bytes_in = 0, total_bytes = 0;
+  double t0, last_report;
+  pthread_t * threads;
+  const char * outdir;
+
+  while ((opt = getopt(nargs, args, "j:c")) != -1)
+  {
+    if (opt == 'j') nthreads = atoi(optarg);
+    else if (opt == 'c') columnar = 1;
+    else break;
+  }
+  if (nargs - optind < 2)
+  {
+    fprintf(stderr, "convert_run [-j nthreads] [-c] rundir outdir\n");
+    return 1;
+  }
+  if (nthreads < 1) nthreads = 1;
+  outdir = args[optind + 1];
+  mkdir(outdir, 0755);
+
+  for (k = 0; k < NKINDS; k++)
+  {
+    if (add_jobs(args[optind], k))
+    {
+      fprintf(stderr, "Out of memory listing %s\n", args[optind]);
+      return 1;
+    }
+  }
+  for (i = 0; i < q.njobs; i++) total_bytes += q.jobs[i].bytes;
+  if (!q.njobs)
+  {
+    fprintf(stderr, "Nothing to convert in %s\n", args[optind]);
+    return 1;
+  }
+
+  // a few decoded files per thread can be waiting to be written
+  q.window = 2 * nthreads + 1;
+  threads = calloc(nthreads, sizeof(pthread_t));
+  if (!threads)
+  {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  t0 = last_report = now();
+
+  // carry on with however many threads start, as long as there's one
+  for (nstarted = 0; nstarted < nthreads; nstarted++)
+  {
+    if (pthread_create(&threads[nstarted], NULL, worker, NULL)) break;
+  }
+  if (!nstarted)
+  {
+    fprintf(stderr, "Could not start any threads\n");
+    return 1;
+  }
+  if (nstarted < nthreads) fprintf(stderr, "Only started %d of %d threads\n", nstarted, nthreads);
+  nthreads = nstarted;
+
+  // only open outputs for the kinds there are
+  for (i = 0; i < q.njobs; i++)
+  {
+    char path[strlen(outdir) + 32];
+    k = q.jobs[i].kind;
+    if (npy[k] || (k == 0 && col)) continue;
+    if (k == 0 && columnar)
+    {
+      sprintf(path, "%s/header.col", outdir);
+      col = beacon_col_writer_open(path, 0);
+    }
+    else
+    {
+      sprintf(path, "%s/%s.npy", outdir, kind_dirs[k]);
+      npy[k] = beacon_npy_open(path, kind_types[k], 0);
+    }
+    if (!npy[k] && !(k == 0 && col))
+    {
+      fprintf(stderr, "Could not open %s\n", path);
+      return 1;
+    }
+  }
+
+  // write everything out in order
+  for (i = 0; i < q.njobs; i++)
+  {
+    struct job * j = &q.jobs[i];
+    size_t r;
+
+    pthread_mutex_lock(&q.lock);
+    while (!j->done) pthread_cond_wait(&q.done_cv, &q.lock);
+    pthread_mutex_unlock(&q.lock);
+
+    k = j->kind;
+    for (r = 0; r < j->n; r++)
+    {
+      const void * rec = (const char *) j->records + r * kind_sizes[k];
+      int ret;
+      switch (kind_types[k])
+      {
+        case BN_RECORD_HEADER: ret = col ? beacon_col_writer_add(col, rec) : beacon_npy_write_header(npy[k], rec); break;
+        case BN_RECORD_EVENT: ret = beacon_npy_write_event(npy[k], rec); break;
+        case BN_RECORD_STATUS: ret = beacon_npy_write_status(npy[k], rec); break;
+        default: ret = beacon_npy_write_hk(npy[k], rec); break;
+      }
+      if (ret)
+      {
+        j->error = 1;
+        break;
+      }
+    }
+    nrecords[k] += r;
+    nerrors += j->error;
+    bytes_in += j->bytes;
+    free(j->records);
+    free(j->path);
+
+    pthread_mutex_lock(&q.lock);
+    q.next_write++;
+    pthread_cond_broadcast(&q.room_cv);
+    pthread_mutex_unlock(&q.lock);
+
+    if (now() - last_report > 1 || i == q.njobs - 1)
+    {
+      double t = now() - t0;
+      last_report = now();
+      fprintf(stderr, "%d/%d files, %.1f/%.1f MB, %.1f MB/s: %llu headers, %llu events, %llu status, %llu hk\n",
+              i + 1, q.njobs, bytes_in / 1e6, total_bytes / 1e6, t > 0 ? bytes_in / 1e6 / t : 0,
+              (unsigned long long) nrecords[0], (unsigned long long) nrecords[1],
+              (unsigned long long) nrecords[2], (unsigned long long) nrecords[3]);
+    }
+  }
+
+  for (i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+  for (k = 0; k < NKINDS; k++)
+    if (npy[k] && beacon_npy_close(npy[k])) nerrors++;
+  if (col && beacon_col_writer_close(col)) nerrors++;
+
+  fprintf(stderr, "done in %.2f s with %d threads%s\n", now() - t0, nthreads, nerrors ? ", with errors" : "");
+  free(threads);
+  free(q.jobs);
+  return nerrors != 0;
+}
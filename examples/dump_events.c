@@ -1,6 +1,6 @@
 #include "beacon.h" 
 #include <stdio.h> 
-#include "zlib.h"
+#include "beaconreader.h" 
 #include <string.h> 
 
 
@@ -14,33 +14,22 @@ int main(int nargs, char ** args)
   }
 
 
-  int is_zipped = strstr(args[1],".gz") != 0; 
+  // works for compressed or uncompressed files (or - for stdin)
+  beacon_reader_t * r = beacon_reader_open(args[1]); 
+  beacon_event_t ev;
 
-  if (!is_zipped)
+  if (!r) 
   {
-    FILE * f = fopen(args[1], "r"); 
-    beacon_event_t ev;
-
-    while (!beacon_event_read(f,&ev))
-    {
-        beacon_event_print(stdout, &ev, ','); 
-    }
-
-    fclose(f); 
+    fprintf(stderr,"Could not open %s\n", args[1]); 
+    return 1; 
   }
-  else
-  {
-    gzFile f = gzopen(args[1], "r"); 
-    beacon_event_t ev;
-
-    while (!beacon_event_gzread(f,&ev))
-    {
-        beacon_event_print(stdout, &ev, ','); 
-    }
 
-    gzclose(f); 
+  while (!beacon_reader_read_event(r,&ev))
+  {
+    beacon_event_print(stdout, &ev, ','); 
   }
 
+  beacon_reader_close(r); 
 
   return 0; 
 
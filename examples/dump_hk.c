@@ -1,6 +1,6 @@
 #include "beacon.h" 
 #include <stdio.h> 
-#include "zlib.h"
+#include "beaconreader.h" 
 #include "string.h" 
 
 
@@ -15,35 +15,23 @@ int main(int nargs, char ** args)
 
 
 
-  int is_zipped = strstr(args[1],".gz") != 0; 
+  // works for compressed or uncompressed files (or - for stdin)
+  beacon_reader_t * r = beacon_reader_open(args[1]); 
+  beacon_hk_t hk;
 
-  if (!is_zipped)
+  if (!r) 
   {
-    FILE * f = fopen(args[1], "r"); 
-    beacon_hk_t hk;
-
-
-    while (!beacon_hk_read(f,&hk))
-    {
-      beacon_hk_print(stdout, &hk); 
-    }
-
-    fclose(f); 
+    fprintf(stderr,"Could not open %s\n", args[1]); 
+    return 1; 
   }
-  else
-  {
-    gzFile f = gzopen(args[1], "r"); 
-    beacon_hk_t hk;
-
-    while (!beacon_hk_gzread(f,&hk))
-    {
-      beacon_hk_print(stdout, &hk); 
-    }
-
-    gzclose(f); 
 
+  while (!beacon_reader_read_hk(r,&hk))
+  {
+    beacon_hk_print(stdout, &hk); 
   }
 
+  beacon_reader_close(r); 
+
   return 0; 
 
 
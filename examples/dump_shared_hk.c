@@ -1,28 +1,45 @@
 #include "beacon.h" 
+#include "beaconshm.h" 
 #include <stdio.h> 
-#include "zlib.h"
-#include "string.h" 
+#include <string.h> 
 
+/* dump_shared_hk [-s] [segment]: prints the latest hk (and with -s, status) published in shared memory 
+ * (see beaconshm.h). The segment defaults to BN_SHM_DEFAULT_NAME. */ 
 
 int main(int nargs, char ** args) 
 {
+  const char * name = BN_SHM_DEFAULT_NAME; 
+  int want_status = 0; 
+  int i, ret; 
 
-  if (nargs < 2) 
+  for (i = 1; i < nargs; i++) 
   {
-    fprintf(stderr,"dump_shared_hk hk.bin"); 
-    return 1; 
+    if (!strcmp(args[i], "-s")) want_status = 1; 
+    else name = args[i]; 
   }
 
+  beacon_shm_t * shm = beacon_shm_open(name); 
+  if (!shm) 
+  {
+    fprintf(stderr,"Could not open shared memory segment %s (not there, or incompatible)\n", name); 
+    return 1; 
+  }
 
-
-  FILE * f = fopen(args[1], "r"); 
   beacon_hk_t hk;
+  ret = beacon_shm_read_hk(shm, &hk, NULL); 
+  if (!ret) beacon_hk_print(stdout, &hk); 
+  else fprintf(stderr, ret > 0 ? "No hk published yet\n" : "hk publisher seems stuck\n"); 
 
-  fread(&hk, sizeof(hk),1,f); 
-
-  beacon_hk_print(stdout, &hk); 
-  fclose(f); 
+  if (want_status) 
+  {
+    beacon_status_t st; 
+    int sret = beacon_shm_read_status(shm, &st, NULL); 
+    if (!sret) beacon_status_print(stdout, &st); 
+    else fprintf(stderr, sret > 0 ? "No status published yet\n" : "status publisher seems stuck\n"); 
+    if (sret) ret = sret; 
+  }
 
-  return 0; 
+  beacon_shm_close(shm); 
+  return ret != 0; 
 
 }
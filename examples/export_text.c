@@ -0,0 +1,120 @@
+#include "beacon.h"
+#include "beaconreader.h"
+#include "beaconexport.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Converts a file of records (events, headers, status or hk, gzipped or not, or - for stdin) to
+ * CSV, TSV or JSON Lines.
+ *
+ *  export_text csv|tsv|jsonl file [out=-] [compare]
+ *
+ * With "compare", the events are also written with beacon_event_print() to /dev/null, to see how
+ * long that takes.
+ */
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+int main(int nargs, char ** args)
+{
+  beacon_export_format_t format;
+  beacon_record_type_t type;
+  beacon_exporter_t * x;
+  beacon_reader_t * r;
+  FILE * out = stdout;
+  union
+  {
+    beacon_event_t ev;
+    beacon_header_t h;
+    beacon_status_t st;
+    beacon_hk_t hk;
+  } * rec = malloc(sizeof(*rec));
+  int n = 0, ret = 0;
+  double t;
+
+  if (nargs < 3)
+  {
+    fprintf(stderr, "export_text csv|tsv|jsonl file [out=-] [compare]\n");
+    return 1;
+  }
+
+  if (!strcmp(args[1], "csv")) format = BN_EXPORT_CSV;
+  else if (!strcmp(args[1], "tsv")) format = BN_EXPORT_TSV;
+  else if (!strcmp(args[1], "jsonl")) format = BN_EXPORT_JSONL;
+  else
+  {
+    fprintf(stderr, "Unknown format %s\n", args[1]);
+    return 1;
+  }
+
+  r = beacon_reader_open(args[2]);
+  if (!r)
+  {
+    fprintf(stderr, "Could not open %s\n", args[2]);
+    return 1;
+  }
+
+  if (nargs > 3 && strcmp(args[3], "-"))
+  {
+    out = fopen(args[3], "w");
+    if (!out)
+    {
+      fprintf(stderr, "Could not open %s\n", args[3]);
+      return 1;
+    }
+  }
+
+  x = beacon_exporter_open(out, format);
+  t = now();
+  while (!ret && !beacon_reader_next_type(r, &type))
+  {
+    switch (type)
+    {
+      case BN_RECORD_EVENT:
+        ret = beacon_reader_read_event(r, &rec->ev) || beacon_export_event(x, &rec->ev);
+        break;
+      case BN_RECORD_HEADER:
+        ret = beacon_reader_read_header(r, &rec->h) || beacon_export_header(x, &rec->h);
+        break;
+      case BN_RECORD_STATUS:
+        ret = beacon_reader_read_status(r, &rec->st) || beacon_export_status(x, &rec->st);
+        break;
+      case BN_RECORD_HK:
+        ret = beacon_reader_read_hk(r, &rec->hk) || beacon_export_hk(x, &rec->hk);
+        break;
+      default:
+        ret = 1;
+    }
+    n += !ret;
+  }
+  if (beacon_exporter_close(x)) ret = 1;
+  if (out != stdout) fclose(out);
+  beacon_reader_close(r);
+  fprintf(stderr, "exported %d records in %.3f s\n", n, now() - t);
+
+  if (nargs > 4 && !strcmp(args[4], "compare"))
+  {
+    FILE * null = fopen("/dev/null", "w");
+    int m = 0;
+    r = beacon_reader_open(args[2]);
+    t = now();
+    while (!beacon_reader_read_event(r, &rec->ev))
+    {
+      beacon_event_print(null, &rec->ev, ',');
+      m++;
+    }
+    fprintf(stderr, "beacon_event_print: %d events in %.3f s\n", m, now() - t);
+    beacon_reader_close(r);
+    fclose(null);
+  }
+
+  free(rec);
+  return ret;
+}
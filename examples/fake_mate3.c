@@ -0,0 +1,85 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* A stand-in for the MATE3's web server, for testing the hk code without a power system.
+ *
+ *  fake_mate3 [-p port] [-d delay_ms] [-f fail_every] [-n requests]
+ *
+ * Answers every request (whatever the path) with a Dev_status.cgi style response with an inverter (FX) and a
+ * charge controller (CC), whose values change a little each time. With -d it waits before answering, and
+ * with -f it drops every fail_every'th connection without answering. It exits after -n requests (default:
+ * never). Then e.g. test_mate3 127.0.0.1:8080.
+ */
+
+static const char * response_fmt =
+  "{\"devstatus\": {\"Gateway_Type\": \"Mate3\", \"Sys_Time\": %d, \"Sys_Batt_V\": %.1f, \"ports\": [\n"
+  "  {\"Port\": 1, \"Dev\": \"FX\", \"Type\": \"60Hz\", \"Inv_I\": 2, \"Chg_I\": 0, \"Buy_I\": 0, \"Sell_I\": 0,"
+  " \"VAC_in\": 0, \"VAC_out\": 120, \"Batt_V\": %.1f, \"AC_mode\": \"NO AC\", \"INV_mode\": \"Inverting\"},\n"
+  "  {\"Port\": 2, \"Dev\": \"CC\", \"Type\": \"FM80\", \"Out_I\": 10.2, \"In_I\": 4, \"Batt_V\": %.1f,"
+  " \"In_V\": %.1f, \"Out_kWh\": %.1f, \"Out_AH\": %d, \"CC_mode\": \"Bulk\"}\n"
+  "]}}\n";
+
+int main(int nargs, char ** args)
+{
+  int port = 8080, delay_ms = 0, fail_every = 0, max_requests = 0, opt, n = 0, one = 1;
+  struct sockaddr_in addr;
+  int srv;
+
+  while ((opt = getopt(nargs, args, "p:d:f:n:")) != -1)
+  {
+    if (opt == 'p') port = atoi(optarg);
+    else if (opt == 'd') delay_ms = atoi(optarg);
+    else if (opt == 'f') fail_every = atoi(optarg);
+    else if (opt == 'n') max_requests = atoi(optarg);
+    else
+    {
+      fprintf(stderr, "fake_mate3 [-p port] [-d delay_ms] [-f fail_every] [-n requests]\n");
+      return 1;
+    }
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  srv = socket(AF_INET, SOCK_STREAM, 0);
+  setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(srv, (struct sockaddr *) &addr, sizeof(addr)) || listen(srv, 8))
+  {
+    perror("fake_mate3");
+    return 1;
+  }
+  fprintf(stderr, "fake_mate3 listening on 127.0.0.1:%d\n", port);
+
+  while (!max_requests || n < max_requests)
+  {
+    char req[4096], body[1024], head[256];
+    int c = accept(srv, NULL, NULL);
+    int blen, hlen;
+    if (c < 0) continue;
+    n++;
+
+    // read (and ignore) the request
+    if (read(c, req, sizeof(req)) <= 0 || (fail_every && n % fail_every == 0))
+    {
+      close(c);
+      continue;
+    }
+    if (delay_ms) usleep(delay_ms * 1000);
+
+    blen = snprintf(body, sizeof(body), response_fmt, 1500000000 + n, 51.2 + 0.1 * (n % 5),
+                    51.2 + 0.1 * (n % 5), 51.6 + 0.1 * (n % 3), 95.5 + (n % 7), 1.2 + 0.1 * (n % 10), 25 + n % 10);
+    hlen = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", blen);
+    if (write(c, head, hlen) != hlen || write(c, body, blen) != blen) fprintf(stderr, "fake_mate3: write failed\n");
+    close(c);
+  }
+  close(srv);
+  return 0;
+}
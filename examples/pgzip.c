@@ -0,0 +1,74 @@
+#include "beaconpgz.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* Compresses a (raw) data file using the parallel gzip writer. The output is readable by
+ * beacon_*_gzread() and gunzip. Useful for compressing raw files on a bigger machine.
+ *
+ *   pgzip [-j nthreads] [-b block_kB] [-l level] input output.gz
+ */
+
+int main(int nargs, char ** args)
+{
+  beacon_pgz_opts_t opts;
+  beacon_pgz_stats_t stats;
+  int c;
+  memset(&opts,0,sizeof(opts));
+
+  while ((c = getopt(nargs, args, "j:b:l:")) != -1)
+  {
+    switch(c)
+    {
+      case 'j': opts.nthreads = atoi(optarg); break;
+      case 'b': opts.block_size = atoi(optarg) * 1024; break;
+      case 'l': opts.level = atoi(optarg); break;
+      default:
+        fprintf(stderr,"pgzip [-j nthreads] [-b block_kB] [-l level] input output.gz\n");
+        return 1;
+    }
+  }
+
+  if (nargs - optind < 2)
+  {
+    fprintf(stderr,"pgzip [-j nthreads] [-b block_kB] [-l level] input output.gz\n");
+    return 1;
+  }
+
+  FILE * fin = fopen(args[optind],"r");
+  if (!fin)
+  {
+    fprintf(stderr,"Could not open %s\n", args[optind]);
+    return 1;
+  }
+
+  beacon_pgz_t * pgz = beacon_pgz_open(args[optind+1], &opts);
+  if (!pgz)
+  {
+    fprintf(stderr,"Could not open %s\n", args[optind+1]);
+    return 1;
+  }
+
+  static char buf[1 << 16];
+  size_t n;
+  int ret = 0;
+  while (!ret && (n = fread(buf,1,sizeof(buf),fin)))
+  {
+    ret = beacon_pgz_write(pgz, buf, n);
+  }
+  fclose(fin);
+
+  beacon_pgz_flush(pgz);
+  beacon_pgz_get_stats(pgz, &stats);
+  ret += beacon_pgz_close(pgz);
+
+  printf("%llu -> %llu bytes (%.1f%%) in %llu blocks\n", (unsigned long long) stats.bytes_in,
+      (unsigned long long) stats.bytes_out, 100. * stats.bytes_out / (stats.bytes_in ? stats.bytes_in : 1),
+      (unsigned long long) stats.blocks_written);
+  printf("%d threads: %.1f MB/s overall, %.1f MB/s per thread, max queue depth %d, stalled %.2f s\n",
+      stats.nthreads, stats.input_rate, stats.compress_rate, stats.max_queue_depth, stats.stall_time);
+
+  return ret;
+}
@@ -2,8 +2,27 @@
 #include <stdio.h> 
 #include <stdlib.h>
 
+/* read_ain [ain] [navg]: prints one input in volts, or all of them (with the raw counts) with no argument */ 
+
 int main(int nargs, char **args) 
 {
-  printf("%f\n",bbb_ain_V(atoi(args[1]))); 
+  float V[BBB_AIN_NUM]; 
+  int raw[BBB_AIN_NUM]; 
+  int ain; 
+  int navg = nargs > 2 ? atoi(args[2]) : 1; 
+
+  if (nargs > 1 && atoi(args[1]) >= 0) 
+  {
+    ain = atoi(args[1]); 
+    if (ain >= BBB_AIN_NUM || bbb_ain_V_many(BBB_AIN_BIT(ain), navg, V)) return 1; 
+    printf("%f\n",V[ain]); 
+    return 0; 
+  }
+
+  if (bbb_ain_raw_many((1u << BBB_AIN_NUM) - 1, navg, raw)) return 1; 
+  for (ain = 0; ain < BBB_AIN_NUM; ain++) 
+  {
+    printf("AIN%d: %4d %f\n", ain, raw[ain], 1.8*raw[ain]/4096.0); 
+  }
   return 0; 
 }
@@ -0,0 +1,166 @@
+#include "beacon.h"
+#include "beaconindex.h"
+#include "beaconreader.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <zlib.h>
+
+/* Writes a gzipped event file with a full flush (and an index access point) every so often, then
+ * compares random seeks in it against a file without them, and decompresses it in pieces on several
+ * threads. The file is still plain gzip (try gunzip -t).
+ *
+ *  seekable_gz [nevents=20000] [flush_every=500] [nthreads=4]
+ *
+ * Files are written to /tmp.
+ */
+
+static const char * seekable = "/tmp/seekable_gz_events.gz";
+static const char * seekable_idx = "/tmp/seekable_gz_events.gz.idx";
+static const char * plain = "/tmp/seekable_gz_plain.gz";
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static long file_size(const char * path)
+{
+  struct stat s;
+  return stat(path, &s) ? -1 : (long) s.st_size;
+}
+
+static void fill(beacon_event_t * ev, int i)
+{
+  int c, s;
+  ev->event_number = 1000 + i;
+  ev->buffer_length = 512;
+  ev->board_id[0] = 1;
+  for (c = 0; c < BN_NUM_CHAN; c++)
+    for (s = 0; s < ev->buffer_length; s++) ev->data[0][c][s] = 64 + (rand() % 9) - 4;
+}
+
+static int write_file(const char * path, int nevents, int flush_every)
+{
+  char idxpath[strlen(path) + 5];
+  beacon_event_t * ev = calloc(1, sizeof(beacon_event_t));
+  beacon_index_writer_t * w;
+  gzFile f = gzopen(path, "w");
+  int i, ret = 0;
+
+  sprintf(idxpath, "%s.idx", path);
+  w = beacon_index_writer_open(idxpath);
+  beacon_index_writer_set_flush(w, flush_every, 0);
+
+  srand(1);
+  for (i = 0; i < nevents && !ret; i++)
+  {
+    fill(ev, i);
+    ret = beacon_index_event_gzwrite(w, f, ev);
+  }
+
+  if (gzclose(f) != Z_OK) ret = 1;
+  if (beacon_index_writer_close(w)) ret = 1;
+  free(ev);
+  return ret;
+}
+
+/* one piece of the file: from one access point up to another */
+struct piece
+{
+  uint64_t begin;
+  uint64_t end;           // 0 for the end of the file
+  int nevents;
+  uint64_t sum;
+  pthread_t thread;
+};
+
+static void * decompress_piece(void * arg)
+{
+  struct piece * p = arg;
+  beacon_event_t * ev = malloc(sizeof(beacon_event_t));
+  beacon_reader_t * r = beacon_reader_open(seekable);
+
+  if (r && !beacon_reader_seek(r, p->begin))
+  {
+    while ((!p->end || beacon_reader_tell(r) < p->end) && !beacon_reader_read_event(r, ev))
+    {
+      p->nevents++;
+      p->sum += ev->event_number;
+    }
+  }
+
+  beacon_reader_close(r);
+  free(ev);
+  return NULL;
+}
+
+int main(int nargs, char ** args)
+{
+  int nevents = nargs > 1 ? atoi(args[1]) : 20000;
+  int flush_every = nargs > 2 ? atoi(args[2]) : 500;
+  int nthreads = nargs > 3 ? atoi(args[3]) : 4;
+  const char * files[] = { plain, seekable };
+  beacon_event_t * ev = malloc(sizeof(beacon_event_t));
+  struct piece * pieces;
+  beacon_index_t * idx;
+  uint64_t sum = 0;
+  int i, k, n = 0, nbad = 0;
+  size_t npoints;
+  double t;
+
+  if (write_file(plain, nevents, 0) || write_file(seekable, nevents, flush_every))
+  {
+    fprintf(stderr, "Could not write the files\n");
+    return 1;
+  }
+  printf("without access points: %ld bytes, with one every %d events: %ld bytes\n", file_size(plain), flush_every, file_size(seekable));
+
+  for (k = 0; k < 2; k++)
+  {
+    beacon_reader_t * r = beacon_reader_open(files[k]);
+    srand(2);
+    t = now();
+    for (i = 0; i < 50; i++)
+    {
+      uint64_t want = 1000 + rand() % nevents;
+      if (beacon_event_seek(r, want) || beacon_reader_read_event(r, ev) || ev->event_number != want) nbad++;
+    }
+    printf("50 random seeks %s: %.3f s\n", k ? "with access points   " : "without access points", now() - t);
+    beacon_reader_close(r);
+  }
+
+  // split the access points between the threads
+  idx = beacon_index_load(seekable_idx);
+  npoints = beacon_index_npoints(idx);
+  if (nthreads < 1) nthreads = 1;
+  if ((size_t) nthreads > npoints + 1) nthreads = npoints + 1;
+  pieces = calloc(nthreads, sizeof(struct piece));
+  for (i = 0; i < nthreads; i++)
+  {
+    const beacon_index_point_t * pt = i ? beacon_index_get_point(idx, (npoints + 1) * i / nthreads - 1) : NULL;
+    pieces[i].begin = pt ? pt->uoffset : 0;
+    if (i) pieces[i - 1].end = pieces[i].begin;
+  }
+  beacon_index_free(idx);
+
+  t = now();
+  for (i = 0; i < nthreads; i++) pthread_create(&pieces[i].thread, NULL, decompress_piece, &pieces[i]);
+  for (i = 0; i < nthreads; i++)
+  {
+    pthread_join(pieces[i].thread, NULL);
+    n += pieces[i].nevents;
+    sum += pieces[i].sum;
+  }
+  printf("decompressed in %d pieces: %d events in %.3f s %s\n", nthreads, n, now() - t,
+         n == nevents && sum == (uint64_t) nevents * 1000 + (uint64_t) nevents * (nevents - 1) / 2 ? "" : "MISMATCH!");
+
+  free(pieces);
+  free(ev);
+  return nbad != 0;
+}
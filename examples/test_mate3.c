@@ -1,46 +1,60 @@
-
 #include "beacon.h"
-#include <curl/curl.h> 
+#include "beaconhk.h"
 #include <stdlib.h> 
 #include <stdio.h> 
 #include <string.h> 
+#include <time.h> 
+#include <unistd.h> 
 
+/* test_mate3 [address[:port]] [seconds]: queries the MATE3 once (waiting for it) and prints the result, then 
+ * optionally watches the background polling for a while, showing that beacon_hk doesn't wait for it. 
+ * See fake_mate3 for something to test against. */ 
 
-static int mate3_port = 8080; 
-static char * mate3_addr = 0;
-static CURL * curl = 0; 
-typedef struct http_buf
+static double now() 
 {
-  char * buf; 
-  size_t pos; 
-  size_t size; 
-} http_buf_t; 
-
-
-// if we ever wanted to make this nonreentrant, it's not so hard... 
-static http_buf_t http_buf; 
-
-
+  struct timespec ts; 
+  clock_gettime(CLOCK_MONOTONIC, &ts); 
+  return ts.tv_sec + 1e-9 * ts.tv_nsec; 
+}
 
 int main(int nargs, char ** args) 
 {
 
   char * url = "162.252.89.77"; 
+  int port = 0, seconds = 0, i; 
   if (nargs > 1) url = args[1]; 
-  beacon_hk_set_mate3_address(url,0); 
+  if (nargs > 2) seconds = atoi(args[2]); 
+
+  char * colon = strchr(url, ':'); 
+  if (colon) 
+  {
+    *colon = 0; 
+    port = atoi(colon + 1); 
+  }
+
+  beacon_hk_set_mate3_interval(1); 
+  beacon_hk_set_mate3_address(url,port); 
 
   beacon_hk_t hk; 
   memset(&hk,0,sizeof(hk)); 
 
-
-  http_update(&hk); 
+  double t0 = now(); 
+  int ret = beacon_hk_query_mate3(&hk); 
+  printf("query %s in %.3f s\n", ret ? "failed" : "worked", now() - t0); 
   beacon_hk_print(stdout, &hk); 
 
-  return 0; 
-
-
-
-
-
+  for (i = 0; i < seconds; i++) 
+  {
+    beacon_mate3_status_t st; 
+    sleep(1); 
+    t0 = now(); 
+    ret = beacon_hk(&hk); 
+    double dt = now() - t0; 
+    beacon_hk_get_mate3_status(&st); 
+    printf("beacon_hk took %.3f ms (ret %d): batt %.1f V, pv %.1f V; age %.1f s, %d failures, next poll in %.1f s\n", 
+           dt * 1e3, ret, hk.inv_batt_dV / 10., hk.pv_dV / 10., st.age, st.failures, st.next_poll); 
+  }
+
+  return ret; 
 
 }
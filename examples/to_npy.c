@@ -0,0 +1,80 @@
+#include "beacon.h"
+#include "beaconreader.h"
+#include "beaconnpy.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Converts a file of events, headers, status or hk (gzipped or not, or - for stdin) to a .npy file,
+ * see beaconnpy.h.
+ *
+ *  to_npy file out.npy [nsamples]
+ *
+ * Then e.g. numpy.load("out.npy", mmap_mode="r").
+ */
+
+int main(int nargs, char ** args)
+{
+  beacon_record_type_t type;
+  beacon_reader_t * r;
+  beacon_npy_t * n;
+  union
+  {
+    beacon_event_t ev;
+    beacon_header_t h;
+    beacon_status_t st;
+    beacon_hk_t hk;
+  } * rec = malloc(sizeof(*rec));
+  int ret = 0;
+
+  if (nargs < 3)
+  {
+    fprintf(stderr, "to_npy file out.npy [nsamples]\n");
+    return 1;
+  }
+
+  r = beacon_reader_open(args[1]);
+  if (!r || beacon_reader_next_type(r, &type))
+  {
+    fprintf(stderr, "Could not read %s\n", args[1]);
+    return 1;
+  }
+
+  n = beacon_npy_open(args[2], type, nargs > 3 ? atoi(args[3]) : 0);
+  if (!n)
+  {
+    fprintf(stderr, "Could not open %s\n", args[2]);
+    return 1;
+  }
+
+  while (!ret)
+  {
+    switch (type)
+    {
+      case BN_RECORD_EVENT:
+        if (beacon_reader_read_event(r, &rec->ev)) goto done;
+        ret = beacon_npy_write_event(n, &rec->ev);
+        break;
+      case BN_RECORD_HEADER:
+        if (beacon_reader_read_header(r, &rec->h)) goto done;
+        ret = beacon_npy_write_header(n, &rec->h);
+        break;
+      case BN_RECORD_STATUS:
+        if (beacon_reader_read_status(r, &rec->st)) goto done;
+        ret = beacon_npy_write_status(n, &rec->st);
+        break;
+      case BN_RECORD_HK:
+        if (beacon_reader_read_hk(r, &rec->hk)) goto done;
+        ret = beacon_npy_write_hk(n, &rec->hk);
+        break;
+      default:
+        ret = 1;
+    }
+  }
+
+done:
+  fprintf(stderr, "wrote %llu records to %s\n", (unsigned long long) beacon_npy_count(n), args[2]);
+  if (beacon_npy_close(n)) ret = 1;
+  beacon_reader_close(r);
+  free(rec);
+  return ret;
+}
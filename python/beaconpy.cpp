@@ -0,0 +1,448 @@
+/* Python bindings for libbeacon (and libbeacondaq, if built with BEACON_PY_DAQ).
+ *
+ * pybind11 has to be included before beacon.h, so that the ARRAY macros there turn the array members
+ * into std::arrays (which pybind11 understands) rather than C arrays. The layout is the same either way.
+ *
+ * Records come back as NumPy structured arrays whose dtypes mirror the structs, and are read straight
+ * into the arrays' memory. An Event's data is a view of the event's own samples, and the 'data' field
+ * of an array of events is a (n, boards, channels, BN_MAX_WAVEFORM_LENGTH) view, so neither copies.
+ * The GIL is released while reading, writing, waiting and talking to the boards.
+ *
+ *   import beacon
+ *   r = beacon.Reader("run1234/header/1000.gz")
+ *   h = r.read_headers(100000)            # h['event_number'], h['readout_time'][:, 0], ...
+ *   for ev in beacon.Reader("run1234/event/1000.gz"):
+ *       wf = ev.data[0, 3, :]             # board 0, channel 3, no copy
+ */
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "beacon.h"
+#include "beaconreader.h"
+#include "beaconwriter.h"
+#ifdef BEACON_PY_DAQ
+#include "beacondaq.h"
+#endif
+
+namespace py = pybind11;
+
+
+PYBIND11_NUMPY_DTYPE(beacon_header_t, event_number, trig_number, buffer_length, pretrigger_samples, readout_time,
+                     readout_time_ns, trig_time, approx_trigger_time, approx_trigger_time_nsecs, triggered_beams, beam_mask,
+                     beam_power, deadtime, buffer_number, channel_mask, channel_read_mask, gate_flag, buffer_mask, board_id,
+                     trig_type, trig_pol, calpulser, sync_problem, pps_counter, dynamic_beam_mask, veto_deadtime_counter);
+
+PYBIND11_NUMPY_DTYPE(beacon_status_t, global_scalers, beam_scalers, deadtime, readout_time, readout_time_ns,
+                     trigger_thresholds, latched_pps_time, board_id, dynamic_beam_mask, veto_status);
+
+PYBIND11_NUMPY_DTYPE(beacon_hk_t, unixTime, unixTimeMillisecs, temp_board, temp_adc, frontend_current, adc_current,
+                     aux_current, ant_current, gpio_state, disk_space_kB, free_mem_kB, inv_batt_dV, cc_batt_dV, pv_dV,
+                     cc_daily_Ah, cc_daily_hWh);
+
+PYBIND11_NUMPY_DTYPE(beacon_event_t, event_number, buffer_length, board_id, data);
+
+
+/* the samples of an event, as a view that keeps the Event alive */
+static py::array event_data(py::object self)
+{
+  beacon_event_t & ev = self.cast<beacon_event_t &>();
+  py::ssize_t len = ev.buffer_length > BN_MAX_WAVEFORM_LENGTH ? BN_MAX_WAVEFORM_LENGTH : ev.buffer_length;
+  return py::array_t<uint8_t>({ (py::ssize_t) BN_MAX_BOARDS, (py::ssize_t) BN_NUM_CHAN, len },
+                              { (py::ssize_t) (BN_NUM_CHAN * BN_MAX_WAVEFORM_LENGTH), (py::ssize_t) BN_MAX_WAVEFORM_LENGTH, (py::ssize_t) 1 },
+                              &ev.data[0][0][0], self);
+}
+
+static py::array event_board_id(py::object self)
+{
+  beacon_event_t & ev = self.cast<beacon_event_t &>();
+  return py::array_t<uint8_t>({ (py::ssize_t) BN_MAX_BOARDS }, { (py::ssize_t) 1 }, &ev.board_id[0], self);
+}
+
+/* the first n elements of a. Resizing copies them into a smaller array, which frees the rest (a view would keep
+ * the whole thing around). */
+template <typename T>
+static py::array_t<T> shrink(py::array_t<T> a, py::ssize_t n)
+{
+  if (n < a.shape(0)) a.resize({ n }, false);
+  return a;
+}
+
+
+class Reader
+{
+  public:
+    explicit Reader(const std::string & path)
+    {
+      r = beacon_reader_open(path.c_str());
+      if (!r) throw std::runtime_error("Could not open " + path);
+    }
+
+    ~Reader() { close(); }
+
+    void close()
+    {
+      if (r) beacon_reader_close(r);
+      r = nullptr;
+    }
+
+    /* up to n records in a structured array, shorter at the end of the file */
+    template <typename T, int (*read_many)(beacon_reader_t *, T *, int, beacon_read_error_t *)>
+    py::array_t<T> read(int n)
+    {
+      if (n <= 0) throw std::invalid_argument("n must be positive");
+      py::array_t<T> a(n);
+      beacon_read_error_t err;
+      int got;
+      check();
+      {
+        py::gil_scoped_release nogil;
+        got = read_many(r, a.mutable_data(), n, &err);
+      }
+      // a problem partway through shows up on the next call
+      if (got <= 0 && err.code) throw std::runtime_error("Read error " + std::to_string(err.code) + " at offset " + std::to_string(err.offset));
+      return shrink(a, got < 0 ? 0 : got);
+    }
+
+    /* one record, or None at the end */
+    template <typename T, int (*read_many)(beacon_reader_t *, T *, int, beacon_read_error_t *)>
+    py::object read_one()
+    {
+      py::array_t<T> a = read<T, read_many>(1);
+      if (!a.shape(0)) return py::none();
+      return a[py::int_(0)];
+    }
+
+    py::object read_event()
+    {
+      std::unique_ptr<beacon_event_t> ev(new beacon_event_t());
+      int ret;
+      check();
+      {
+        py::gil_scoped_release nogil;
+        ret = beacon_reader_read_event(r, ev.get());
+      }
+      if (ret) return py::none();
+      return py::cast(std::move(ev));
+    }
+
+    py::object next_event()
+    {
+      py::object ev = read_event();
+      if (ev.is_none()) throw py::stop_iteration();
+      return ev;
+    }
+
+    void seek_event(uint64_t event_number)
+    {
+      check();
+      if (beacon_event_seek(r, event_number)) throw std::runtime_error("No event " + std::to_string(event_number));
+    }
+
+    uint64_t tell() { check(); return beacon_reader_tell(r); }
+
+  private:
+    void check()
+    {
+      if (!r) throw std::runtime_error("Reader is closed");
+    }
+
+    beacon_reader_t * r;
+};
+
+
+class Writer
+{
+  public:
+    Writer(const std::string & path, int level, uint64_t rotate_records, uint64_t rotate_bytes, double rotate_seconds,
+           const std::string & sync, size_t queue_bytes, bool drop_when_full)
+    {
+      beacon_writer_opts_t opts = {};
+      opts.level = level;
+      opts.rotate_records = rotate_records;
+      opts.rotate_bytes = rotate_bytes;
+      opts.rotate_seconds = rotate_seconds;
+      opts.queue_bytes = queue_bytes;
+      opts.drop_when_full = drop_when_full;
+      if (sync == "fsync") opts.sync = BN_WRITER_FSYNC;
+      else if (sync == "fdatasync") opts.sync = BN_WRITER_FDATASYNC;
+      else if (sync == "none") opts.sync = BN_WRITER_NOSYNC;
+      else throw std::invalid_argument("sync must be none, fdatasync or fsync");
+
+      w = beacon_writer_open(path.c_str(), &opts);
+      if (!w) throw std::runtime_error("Could not open " + path);
+    }
+
+    ~Writer() { close(); }
+
+    int close()
+    {
+      int ret = 0;
+      if (w)
+      {
+        py::gil_scoped_release nogil;
+        ret = beacon_writer_close(w);
+      }
+      w = nullptr;
+      return ret;
+    }
+
+    void write_event(const beacon_event_t & ev)
+    {
+      check();
+      py::gil_scoped_release nogil;
+      if (beacon_event_sinkwrite(beacon_writer_sink(w), &ev)) throw_dropped();
+    }
+
+    /* every record in a structured array (e.g. from Reader.read_headers()) */
+    template <typename T, int (*sinkwrite)(const beacon_sink_t *, const T *)>
+    void write(py::array_t<T, py::array::c_style> a)
+    {
+      const T * recs = a.data();
+      py::ssize_t i, n = a.size(), dropped = 0;
+      check();
+      {
+        py::gil_scoped_release nogil;
+        for (i = 0; i < n; i++) dropped += sinkwrite(beacon_writer_sink(w), &recs[i]) != 0;
+      }
+      if (dropped) throw_dropped();
+    }
+
+    void flush()
+    {
+      int ret;
+      check();
+      {
+        py::gil_scoped_release nogil;
+        ret = beacon_writer_flush(w);
+      }
+      if (ret) throw std::runtime_error("Write error");
+    }
+
+    py::dict stats()
+    {
+      beacon_writer_stats_t s;
+      py::dict d;
+      check();
+      beacon_writer_get_stats(w, &s);
+      d["records_in"] = s.records_in;
+      d["records_written"] = s.records_written;
+      d["records_dropped"] = s.records_dropped;
+      d["bytes_written"] = s.bytes_written;
+      d["files"] = s.files;
+      d["errors"] = s.errors;
+      d["queue_records"] = s.queue_records;
+      d["queue_bytes"] = s.queue_bytes;
+      d["max_queue_bytes"] = s.max_queue_bytes;
+      d["stall_time"] = s.stall_time;
+      d["write_p50"] = s.write_p50;
+      d["write_p99"] = s.write_p99;
+      d["write_p999"] = s.write_p999;
+      d["write_max"] = s.write_max;
+      d["sync_p50"] = s.sync_p50;
+      d["sync_p99"] = s.sync_p99;
+      d["sync_max"] = s.sync_max;
+      return d;
+    }
+
+  private:
+    void check()
+    {
+      if (!w) throw std::runtime_error("Writer is closed");
+    }
+
+    // fine to throw without the GIL, it's taken back on the way out
+    static void throw_dropped()
+    {
+      throw std::runtime_error("Record dropped (queue full or write error)");
+    }
+
+    beacon_writer_t * w;
+};
+
+
+#ifdef BEACON_PY_DAQ
+class Device
+{
+  public:
+    Device(const std::string & master, const std::string & slave, int power_gpio, bool thread_safe)
+    {
+      d = beacon_open(master.c_str(), slave.empty() ? nullptr : slave.c_str(), power_gpio, thread_safe);
+      if (!d) throw std::runtime_error("Could not open " + master);
+    }
+
+    ~Device() { close(); }
+
+    void close()
+    {
+      if (d)
+      {
+        py::gil_scoped_release nogil;
+        beacon_close(d);
+      }
+      d = nullptr;
+    }
+
+    /* the mask of buffers ready to be read, 0 if timed out or cancelled */
+    int wait(float timeout, beacon_which_board_t which)
+    {
+      beacon_buffer_mask_t ready = 0;
+      check();
+      {
+        py::gil_scoped_release nogil;
+        beacon_wait(d, &ready, timeout, which);
+      }
+      return ready;
+    }
+
+    /* may be called from another thread while wait() is blocked */
+    void cancel_wait()
+    {
+      check();
+      beacon_cancel_wait(d);
+    }
+
+    /* waits for and reads whatever is ready: (headers, events) */
+    py::tuple read_events()
+    {
+      py::array_t<beacon_header_t> headers(BN_NUM_BUFFER);
+      py::array_t<beacon_event_t> events(BN_NUM_BUFFER);
+      int n;
+      check();
+      {
+        py::gil_scoped_release nogil;
+        n = beacon_wait_for_and_read_multiple_events(d, (beacon_header_t (*)[BN_NUM_BUFFER]) headers.mutable_data(),
+                                                     (beacon_event_t (*)[BN_NUM_BUFFER]) events.mutable_data());
+      }
+      if (n < 0) throw std::runtime_error("Readout failed");
+      return py::make_tuple(shrink(headers, n), shrink(events, n));
+    }
+
+    /* reads one buffer (without checking that it's ready): (header, event) */
+    py::tuple read_single(uint8_t buffer)
+    {
+      py::array_t<beacon_header_t> header(1);
+      std::unique_ptr<beacon_event_t> ev(new beacon_event_t());
+      int ret;
+      check();
+      {
+        py::gil_scoped_release nogil;
+        ret = beacon_read_single(d, buffer, header.mutable_data(), ev.get());
+      }
+      if (ret) throw std::runtime_error("Readout failed");
+      return py::make_tuple(header[py::int_(0)], py::cast(std::move(ev)));
+    }
+
+    py::object read_status(beacon_which_board_t which)
+    {
+      py::array_t<beacon_status_t> st(1);
+      int ret;
+      check();
+      {
+        py::gil_scoped_release nogil;
+        ret = beacon_read_status(d, st.mutable_data(), which);
+      }
+      if (ret) throw std::runtime_error("Reading status failed");
+      return st[py::int_(0)];
+    }
+
+    void sw_trigger()
+    {
+      check();
+      py::gil_scoped_release nogil;
+      beacon_sw_trigger(d);
+    }
+
+    void set_buffer_length(uint16_t length) { check(); beacon_set_buffer_length(d, length); }
+    uint16_t get_buffer_length() { check(); return beacon_get_buffer_length(d); }
+
+  private:
+    void check()
+    {
+      if (!d) throw std::runtime_error("Device is closed");
+    }
+
+    beacon_dev_t * d;
+};
+#endif
+
+
+PYBIND11_MODULE(beacon, m)
+{
+  m.doc() = "Reading and writing BEACON data (see beacon.h)";
+
+  m.attr("NUM_CHAN") = BN_NUM_CHAN;
+  m.attr("MAX_BOARDS") = BN_MAX_BOARDS;
+  m.attr("MAX_WAVEFORM_LENGTH") = BN_MAX_WAVEFORM_LENGTH;
+  m.attr("header_dtype") = py::dtype::of<beacon_header_t>();
+  m.attr("status_dtype") = py::dtype::of<beacon_status_t>();
+  m.attr("hk_dtype") = py::dtype::of<beacon_hk_t>();
+  m.attr("event_dtype") = py::dtype::of<beacon_event_t>();
+
+  py::class_<beacon_event_t>(m, "Event", "One event. data is a (boards, channels, buffer_length) view of the samples.")
+    .def(py::init([]() { return std::unique_ptr<beacon_event_t>(new beacon_event_t()); }))
+    .def_readwrite("event_number", &beacon_event_t::event_number)
+    .def_readwrite("buffer_length", &beacon_event_t::buffer_length)
+    .def_property_readonly("board_id", &event_board_id)
+    .def_property_readonly("data", &event_data)
+    .def("__repr__", [](const beacon_event_t & ev)
+         { return "<beacon.Event " + std::to_string(ev.event_number) + ", " + std::to_string(ev.buffer_length) + " samples>"; });
+
+  py::class_<Reader>(m, "Reader", "Reads a file of records (gzipped or not, or - for stdin). Iterating gives Events.")
+    .def(py::init<const std::string &>(), py::arg("path"))
+    .def("read_event", &Reader::read_event, "The next Event, or None at the end")
+    .def("read_header", &Reader::read_one<beacon_header_t, beacon_header_read_many>, "The next header, or None at the end")
+    .def("read_status", &Reader::read_one<beacon_status_t, beacon_status_read_many>, "The next status, or None at the end")
+    .def("read_hk", &Reader::read_one<beacon_hk_t, beacon_hk_read_many>, "The next hk, or None at the end")
+    .def("read_events", &Reader::read<beacon_event_t, beacon_event_read_many>, py::arg("n"),
+         "Up to n events as an array of event_dtype")
+    .def("read_headers", &Reader::read<beacon_header_t, beacon_header_read_many>, py::arg("n"),
+         "Up to n headers as an array of header_dtype")
+    .def("read_statuses", &Reader::read<beacon_status_t, beacon_status_read_many>, py::arg("n"),
+         "Up to n status records as an array of status_dtype")
+    .def("read_hks", &Reader::read<beacon_hk_t, beacon_hk_read_many>, py::arg("n"),
+         "Up to n hk records as an array of hk_dtype")
+    .def("seek_event", &Reader::seek_event, py::arg("event_number"))
+    .def("tell", &Reader::tell)
+    .def("close", &Reader::close)
+    .def("__iter__", [](py::object self) { return self; })
+    .def("__next__", &Reader::next_event)
+    .def("__enter__", [](py::object self) { return self; })
+    .def("__exit__", [](Reader & r, py::args) { r.close(); });
+
+  py::class_<Writer>(m, "Writer", "Writes records on a background thread, see beaconwriter.h")
+    .def(py::init<const std::string &, int, uint64_t, uint64_t, double, const std::string &, size_t, bool>(),
+         py::arg("path"), py::arg("level") = 0, py::arg("rotate_records") = 0, py::arg("rotate_bytes") = 0,
+         py::arg("rotate_seconds") = 0., py::arg("sync") = "none", py::arg("queue_bytes") = 0, py::arg("drop_when_full") = false)
+    .def("write_event", &Writer::write_event, py::arg("event"))
+    .def("write_events", &Writer::write<beacon_event_t, beacon_event_sinkwrite>, py::arg("events"))
+    .def("write_headers", &Writer::write<beacon_header_t, beacon_header_sinkwrite>, py::arg("headers"))
+    .def("write_statuses", &Writer::write<beacon_status_t, beacon_status_sinkwrite>, py::arg("statuses"))
+    .def("write_hks", &Writer::write<beacon_hk_t, beacon_hk_sinkwrite>, py::arg("hks"))
+    .def("flush", &Writer::flush)
+    .def("stats", &Writer::stats)
+    .def("close", &Writer::close)
+    .def("__enter__", [](py::object self) { return self; })
+    .def("__exit__", [](Writer & w, py::args) { w.close(); });
+
+#ifdef BEACON_PY_DAQ
+  py::enum_<beacon_which_board_t>(m, "Board")
+    .value("MASTER", MASTER)
+    .value("SLAVE", SLAVE);
+
+  py::class_<Device>(m, "Device", "The boards, see beacondaq.h")
+    .def(py::init<const std::string &, const std::string &, int, bool>(),
+         py::arg("master") = "/dev/spidev2.0", py::arg("slave") = "", py::arg("power_gpio") = 0, py::arg("thread_safe") = true)
+    .def("wait", &Device::wait, py::arg("timeout") = 1.f, py::arg("which") = MASTER)
+    .def("cancel_wait", &Device::cancel_wait)
+    .def("read_events", &Device::read_events, "Wait for and read what's ready: (headers, events) arrays")
+    .def("read_single", &Device::read_single, py::arg("buffer"))
+    .def("read_status", &Device::read_status, py::arg("which") = MASTER)
+    .def("sw_trigger", &Device::sw_trigger)
+    .def_property("buffer_length", &Device::get_buffer_length, &Device::set_buffer_length)
+    .def("close", &Device::close);
+#endif
+}
@@ -1,5 +1,5 @@
 #! /bin/sh
 
-# ./viewer.sh hdfile.dat evfile.dat iev 
+# ./viewer.sh hdfile.dat evfile.dat event_number 
 
 root.exe viewer.C"(\"$1\", \"$2\", $3)" 